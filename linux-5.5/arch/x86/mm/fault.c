@@ -32,6 +32,8 @@
 
 // [Canvas] profile page fault latency
 #include <linux/swap_stats.h>
+#include <linux/memcontrol.h>
+#include <trace/events/canvas.h>
 
 #define CREATE_TRACE_POINTS
 #include <asm/trace/exceptions.h>
@@ -1766,9 +1768,14 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code, unsigned long addr
 	pf_ts_end = get_cycles_end();
 
 	if (swap_major & ADC_PROFILE_SWAP_BIT) {
+		trace_canvas_swap_fault(address,
+					swap_major & ADC_PROFILE_MAJOR_BIT,
+					pf_ts_end - pf_ts_stt);
 		if (swap_major & ADC_PROFILE_MAJOR_BIT) {
 			accum_adc_time_stat(ADC_SWAP_MAJOR_LATENCY,
 					    pf_ts_end - pf_ts_stt);
+			mem_cgroup_account_swapin_latency(current->mm,
+							  pf_ts_end - pf_ts_stt);
 		} else {
 			accum_adc_time_stat(ADC_SWAP_MINOR_LATENCY,
 					    pf_ts_end - pf_ts_stt);
@@ -32,6 +32,10 @@
 /* [Canvas] */
 #include <linux/swap.h>
 #include <linux/swap_global_struct_mem_layer.h>
+#include <linux/pagemap.h>
+#include <linux/memcontrol.h>
+#include <linux/wait_bit.h>
+#include <linux/swap_stats.h>
 /* [Canvas] end */
 
 int sysctl_unprivileged_userfaultfd __read_mostly = 1;
@@ -83,8 +87,27 @@ struct userfaultfd_ctx {
 	bool mmap_changing;
 	/* mm with one ore more vmas attached to this userfaultfd_ctx */
 	struct mm_struct *mm;
+	/* [Canvas] async swap faults, see handle_userfault_swapin() */
+	spinlock_t swapin_lock;
+	/* swap-ins done, read as UFFD_EVENT_SWAPIN */
+	struct list_head swapin_done;
+	/* swap-ins started and not read yet, under swapin_lock */
+	unsigned int nr_swapin;
+	/* swap-ins still reading, their callbacks use the ctx */
+	atomic_t swapin_pending;
 };
 
+/* [Canvas] a swap-in started by an async swap fault */
+struct userfaultfd_swapin {
+	struct page_unlock_callback cb;
+	struct userfaultfd_ctx *ctx;
+	unsigned long address;
+	struct list_head list;
+};
+
+/* [Canvas] beyond it, async swap faults wait for the page */
+#define UFFD_SWAPIN_MAX 4096
+
 struct userfaultfd_fork_ctx {
 	struct userfaultfd_ctx *orig;
 	struct userfaultfd_ctx *new;
@@ -163,7 +186,15 @@ static void userfaultfd_ctx_get(struct userfaultfd_ctx *ctx)
  */
 static void userfaultfd_ctx_put(struct userfaultfd_ctx *ctx)
 {
+	struct userfaultfd_swapin *swapin, *next;
+
 	if (refcount_dec_and_test(&ctx->refcount)) {
+		/* [Canvas] the swap-ins reading still call back on ctx */
+		wait_var_event(&ctx->swapin_pending,
+			       !atomic_read(&ctx->swapin_pending));
+		list_for_each_entry_safe(swapin, next, &ctx->swapin_done, list)
+			kfree(swapin);
+		INIT_LIST_HEAD(&ctx->swapin_done);
 		VM_BUG_ON(spin_is_locked(&ctx->fault_pending_wqh.lock));
 		VM_BUG_ON(waitqueue_active(&ctx->fault_pending_wqh));
 		VM_BUG_ON(spin_is_locked(&ctx->fault_wqh.lock));
@@ -1034,6 +1065,99 @@ out:
 	return ret;
 }
 
+/* [Canvas] runs when the page is unlocked, often in irq */
+static void userfaultfd_swapin_done(struct page_unlock_callback *cb)
+{
+	struct userfaultfd_swapin *swapin =
+		container_of(cb, struct userfaultfd_swapin, cb);
+	struct userfaultfd_ctx *ctx = swapin->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->swapin_lock, flags);
+	list_add_tail(&swapin->list, &ctx->swapin_done);
+	spin_unlock_irqrestore(&ctx->swapin_lock, flags);
+	wake_up_poll(&ctx->fd_wqh, EPOLLIN);
+
+	/* the last access to ctx, see userfaultfd_ctx_put() */
+	if (atomic_dec_and_test(&ctx->swapin_pending))
+		wake_up_var(&ctx->swapin_pending);
+}
+
+/**
+ * [Canvas] Async swap fault, see UFFD_FEATURE_SWAP_ASYNC. Called on a swap
+ * cache miss.
+ *
+ * Returns VM_FAULT_SIGBUS once the swap-in is started, with its completion
+ * to be read from the uffd. Else 0 and the caller waits for the page as
+ * usual, *pagep is the page in the swap cache if we got that far.
+ */
+vm_fault_t handle_userfault_swapin(struct vm_fault *vmf, swp_entry_t entry,
+				   struct page **pagep)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct userfaultfd_ctx *ctx = vma->vm_userfaultfd_ctx.ctx;
+	struct userfaultfd_swapin *swapin;
+	struct page *page;
+	bool allocated;
+
+	*pagep = NULL;
+	if (!ctx || !(ctx->features & UFFD_FEATURE_SWAP_ASYNC) ||
+	    !(vma->vm_flags & VM_UFFD_WP))
+		return 0;
+	/* only user space can take the SIGBUS and come back */
+	if (!(vmf->flags & FAULT_FLAG_USER) ||
+	    (current->flags & (PF_EXITING | PF_DUMPCORE)) ||
+	    READ_ONCE(ctx->released))
+		return 0;
+
+	spin_lock_irq(&ctx->swapin_lock);
+	if (ctx->nr_swapin >= UFFD_SWAPIN_MAX) {
+		spin_unlock_irq(&ctx->swapin_lock);
+		return 0;
+	}
+	ctx->nr_swapin++;
+	spin_unlock_irq(&ctx->swapin_lock);
+
+	swapin = kmalloc(sizeof(*swapin), GFP_KERNEL);
+	if (!swapin)
+		goto out_unaccount;
+	page = __read_swap_cache_async(entry, GFP_HIGHUSER_MOVABLE, vma,
+				       vmf->address, &allocated);
+	if (!page)
+		goto out_free;
+	/* read by someone else, wait for it like any swap cache hit */
+	if (!allocated) {
+		*pagep = page;
+		goto out_free;
+	}
+
+	swap_readpage_async(page);
+	adc_profile_counter_inc(ADC_ONDEMAND_SWAPIN);
+	count_memcg_event_mm(vma->vm_mm, ONDEMAND_SWAPIN);
+
+	swapin->ctx = ctx;
+	swapin->address = vmf->address & PAGE_MASK;
+	swapin->cb.func = userfaultfd_swapin_done;
+	atomic_inc(&ctx->swapin_pending);
+	if (!add_page_unlock_callback(page, &swapin->cb)) {
+		/* in already, e.g. a synchronous device */
+		if (atomic_dec_and_test(&ctx->swapin_pending))
+			wake_up_var(&ctx->swapin_pending);
+		*pagep = page;
+		goto out_free;
+	}
+	put_page(page);
+	return VM_FAULT_SIGBUS;
+
+out_free:
+	kfree(swapin);
+out_unaccount:
+	spin_lock_irq(&ctx->swapin_lock);
+	ctx->nr_swapin--;
+	spin_unlock_irq(&ctx->swapin_lock);
+	return 0;
+}
+
 static void userfaultfd_event_wait_completion(struct userfaultfd_ctx *ctx,
 					      struct userfaultfd_wait_queue *ewq)
 {
@@ -1156,6 +1280,7 @@ int dup_userfaultfd(struct vm_area_struct *vma, struct list_head *fcs)
 		ctx->features = octx->features;
 		ctx->released = false;
 		ctx->mmap_changing = false;
+		ctx->nr_swapin = 0;
 		ctx->mm = vma->vm_mm;
 		mmgrab(ctx->mm);
 
@@ -1459,6 +1584,8 @@ static __poll_t userfaultfd_poll(struct file *file, poll_table *wait)
 			ret = EPOLLIN;
 		else if (waitqueue_active(&ctx->event_wqh))
 			ret = EPOLLIN;
+		else if (!list_empty_careful(&ctx->swapin_done))
+			ret = EPOLLIN;
 
 		return ret;
 	default:
@@ -1491,6 +1618,7 @@ static ssize_t userfaultfd_ctx_read(struct userfaultfd_ctx *ctx, int no_wait,
 	ssize_t ret;
 	DECLARE_WAITQUEUE(wait, current);
 	struct userfaultfd_wait_queue *uwq;
+	struct userfaultfd_swapin *swapin;
 	// [Canvas] put ctx here for direct delivered userfault
 	bool should_put_ctx = false;
 	/*
@@ -1593,6 +1721,25 @@ static ssize_t userfaultfd_ctx_read(struct userfaultfd_ctx *ctx, int no_wait,
 		}
 		spin_unlock(&ctx->event_wqh.lock);
 
+		/* [Canvas] swap-ins of async swap faults */
+		spin_lock(&ctx->swapin_lock);
+		swapin = list_first_entry_or_null(&ctx->swapin_done,
+						  struct userfaultfd_swapin,
+						  list);
+		if (swapin) {
+			list_del(&swapin->list);
+			ctx->nr_swapin--;
+		}
+		spin_unlock(&ctx->swapin_lock);
+		if (swapin) {
+			msg_init(msg);
+			msg->event = UFFD_EVENT_SWAPIN;
+			msg->arg.pagefault.address = swapin->address;
+			kfree(swapin);
+			ret = 0;
+			break;
+		}
+
 		if (signal_pending(current)) {
 			ret = -ERESTARTSYS;
 			break;
@@ -2478,6 +2625,9 @@ static void init_once_userfaultfd_ctx(void *mem)
 	init_waitqueue_head(&ctx->event_wqh);
 	init_waitqueue_head(&ctx->fd_wqh);
 	seqcount_init(&ctx->refile_seq);
+	spin_lock_init(&ctx->swapin_lock);
+	INIT_LIST_HEAD(&ctx->swapin_done);
+	atomic_set(&ctx->swapin_pending, 0);
 }
 
 /* [Canvas] do nothing */
@@ -2510,6 +2660,7 @@ SYSCALL_DEFINE1(userfaultfd, int, flags)
 	ctx->state = UFFD_STATE_WAIT_API;
 	ctx->released = false;
 	ctx->mmap_changing = false;
+	ctx->nr_swapin = 0;
 	ctx->mm = current->mm;
 	/* prevent the mm struct to be freed */
 	mmgrab(ctx->mm);
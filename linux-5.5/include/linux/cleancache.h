@@ -39,6 +39,8 @@ struct cleancache_ops {
 };
 
 extern int cleancache_register_ops(const struct cleancache_ops *ops);
+// [Canvas]
+extern void cleancache_deregister_ops(void);
 extern void __cleancache_init_fs(struct super_block *);
 extern void __cleancache_init_shared_fs(struct super_block *);
 extern int  __cleancache_get_page(struct page *);
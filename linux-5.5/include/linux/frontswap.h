@@ -31,6 +31,11 @@ extern struct frontswap_ops *frontswap_ops;
 
 extern void frontswap_register_ops(struct frontswap_ops *ops);
 extern void frontswap_deregister_ops(void);
+/* [Canvas] keep the pages of a backend across its reload */
+extern void frontswap_park_ops(void *state);
+extern bool frontswap_parked(void);
+extern void *frontswap_parked_state(void);
+extern void frontswap_unpark_ops(struct frontswap_ops *ops);
 extern void frontswap_shrink(unsigned long);
 extern unsigned long frontswap_curr_pages(void);
 extern void frontswap_writethrough(bool);
@@ -195,6 +195,28 @@ struct memcg_cgwb_frn {
 	struct wb_completion done;	/* tracks in-flight foreign writebacks */
 };
 
+/* [Canvas] per-tenant state of the local memory balancer, mm/memcg_balance.c */
+struct memcg_balance {
+	int priority;			/* 0: limit not managed by the balancer */
+	u64 slo_cycles;			/* swap-in latency target, 0: none */
+	unsigned long min_pages;	/* never shrink the limit below this */
+
+	atomic64_t lat_accum;		/* accumulated swap-in latency (cycles) */
+	atomic_long_t lat_cnt;		/* # swap-ins accumulated in lat_accum */
+	atomic_long_t slo_miss;		/* # swap-ins slower than slo_cycles */
+
+	/* snapshot taken by the previous balancing period */
+	unsigned long last_swapins;
+	u64 last_lat_accum;
+	unsigned long last_lat_cnt;
+	unsigned long last_slo_miss;
+	/* results of the previous balancing period, for canvas_balance_stat */
+	unsigned long swapin_rate;	/* swap-ins per second */
+	u64 avg_lat_cycles;
+	unsigned int slo_attained;	/* permille of swap-ins within the SLO */
+	u64 score;
+};
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -323,6 +345,13 @@ struct mem_cgroup {
 	struct deferred_split deferred_split_queue;
 #endif
 
+	/* [Canvas] local memory balancing across co-located tenants */
+	struct memcg_balance balance;
+
+	/* [Canvas] remote memory of the frontswap pages, mm/memcg_remote.c */
+	struct page_counter remote;
+	int remote_policy;		/* 1: give back over 70% of remote.max */
+
 	struct mem_cgroup_per_node *nodeinfo[0];
 	/* WARNING: nodeinfo must be the last member here */
 };
@@ -804,6 +833,41 @@ static inline void memcg_memory_event_mm(struct mm_struct *mm,
 	rcu_read_unlock();
 }
 
+/* [Canvas] profile per-tenant swap-in latency for the local memory balancer */
+static inline void mem_cgroup_account_swapin_latency(struct mm_struct *mm,
+						     u64 cycles)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled() || !mm)
+		return;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (likely(memcg)) {
+		atomic64_add(cycles, &memcg->balance.lat_accum);
+		atomic_long_inc(&memcg->balance.lat_cnt);
+		if (memcg->balance.slo_cycles &&
+		    cycles > memcg->balance.slo_cycles)
+			atomic_long_inc(&memcg->balance.slo_miss);
+	}
+	rcu_read_unlock();
+}
+
+/* [Canvas] helpers for mm/memcg_balance.c */
+unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg, int event);
+unsigned long mem_cgroup_local_max(struct mem_cgroup *memcg);
+int mem_cgroup_resize_local_max(struct mem_cgroup *memcg, unsigned long max);
+
+/* [Canvas] per-tenant quota of the remote memory, mm/memcg_remote.c */
+struct mem_cgroup *mem_cgroup_id_get_remote(struct mem_cgroup *memcg);
+void mem_cgroup_id_put_remote(struct mem_cgroup *memcg);
+int mem_cgroup_remote_swapon(int type, unsigned long max_pages);
+void mem_cgroup_remote_swapoff(int type);
+int mem_cgroup_charge_remote(struct page *page, int type, pgoff_t offset);
+void mem_cgroup_uncharge_remote(int type, pgoff_t offset);
+bool mem_cgroup_remote_full(struct page *page);
+
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 void mem_cgroup_split_huge_fixup(struct page *head);
 #endif
@@ -1136,6 +1200,35 @@ static inline void mem_cgroup_split_huge_fixup(struct page *head)
 {
 }
 
+static inline void mem_cgroup_account_swapin_latency(struct mm_struct *mm,
+						     u64 cycles)
+{
+}
+
+static inline int mem_cgroup_remote_swapon(int type, unsigned long max_pages)
+{
+	return 0;
+}
+
+static inline void mem_cgroup_remote_swapoff(int type)
+{
+}
+
+static inline int mem_cgroup_charge_remote(struct page *page, int type,
+					   pgoff_t offset)
+{
+	return 0;
+}
+
+static inline void mem_cgroup_uncharge_remote(int type, pgoff_t offset)
+{
+}
+
+static inline bool mem_cgroup_remote_full(struct page *page)
+{
+	return false;
+}
+
 static inline void count_memcg_events(struct mem_cgroup *memcg,
 				      enum vm_event_item idx,
 				      unsigned long count)
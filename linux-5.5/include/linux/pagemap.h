@@ -547,6 +547,16 @@ void page_endio(struct page *page, bool is_write, int err);
  */
 extern void add_page_wait_queue(struct page *page, wait_queue_entry_t *waiter);
 
+/* [Canvas] a callback run when a page locked for I/O gets unlocked */
+struct page_unlock_callback {
+	wait_queue_entry_t wait;
+	struct page *page;
+	void (*func)(struct page_unlock_callback *cb);
+};
+
+extern bool add_page_unlock_callback(struct page *page,
+				     struct page_unlock_callback *cb);
+
 /*
  * Fault everything in given userspace address range in.
  */
@@ -670,10 +670,7 @@ static inline int split_swap_cluster(swp_entry_t entry)
 #ifdef CONFIG_MEMCG
 static inline int mem_cgroup_swappiness(struct mem_cgroup *memcg)
 {
-	/* Cgroup2 doesn't have per-cgroup swappiness */
-	if (cgroup_subsys_on_dfl(memory_cgrp_subsys))
-		return vm_swappiness;
-
+	/* [Canvas] cgroup2 has per-cgroup swappiness too, memory.swappiness */
 	/* root ? */
 	if (mem_cgroup_disabled() || mem_cgroup_is_root(memcg))
 		return vm_swappiness;
@@ -726,7 +723,8 @@ static inline long mem_cgroup_get_nr_swap_pages(struct mem_cgroup *memcg)
 
 static inline bool mem_cgroup_swap_full(struct page *page)
 {
-	return vm_swap_full();
+	/* [Canvas] give back the remote memory over the quota */
+	return vm_swap_full() || mem_cgroup_remote_full(page);
 }
 #endif
 
@@ -58,13 +58,14 @@ static inline swp_entry_t get_reserved_swp_entry(struct page *page)
 	return __canvas_page_entries[page_to_pfn(page)];
 }
 
+/* hands the reserved entry out once, even to concurrent callers */
 static inline swp_entry_t alloc_reserved_swp_entry(struct page *page)
 {
 	swp_entry_t entry;
 	if (!__canvas_page_entries)
 		return invalid_swp_entry();
-	entry = __canvas_page_entries[page_to_pfn(page)];
-	__canvas_page_entries[page_to_pfn(page)] = invalid_swp_entry();
+	entry.val = xchg(&__canvas_page_entries[page_to_pfn(page)].val,
+			 invalid_swp_entry().val);
 	return entry;
 }
 
@@ -47,6 +47,10 @@ extern void deliver_userfault_post(struct vm_fault *vmf,
 				   int delivered);
 /* [Canvas] deliver swap fault to user via UFFD */
 extern vm_fault_t deliver_userfault(struct vm_fault *vmf, unsigned long reason);
+/* [Canvas] async swap fault, see UFFD_FEATURE_SWAP_ASYNC */
+extern vm_fault_t handle_userfault_swapin(struct vm_fault *vmf,
+					  swp_entry_t entry,
+					  struct page **pagep);
 
 extern ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
 			    unsigned long src_start, unsigned long len,
@@ -119,6 +123,14 @@ static inline vm_fault_t deliver_userfault(struct vm_fault *vmf,
 {
 	return VM_FAULT_SIGBUS;
 }
+
+static inline vm_fault_t handle_userfault_swapin(struct vm_fault *vmf,
+						 swp_entry_t entry,
+						 struct page **pagep)
+{
+	*pagep = NULL;
+	return 0;
+}
 /* [Canvas] end */
 
 static inline bool is_mergeable_vm_userfaultfd_ctx(struct vm_area_struct *vma,
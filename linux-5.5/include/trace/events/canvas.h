@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * [Canvas] swap events of the tenants, recorded by tools/swapbench/swaptrace
+ * and replayed by swapreplay.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM canvas
+
+#if !defined(_TRACE_CANVAS_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CANVAS_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/mm.h>
+#include <linux/memcontrol.h>
+#include <linux/swap_global_macro.h>
+
+#ifndef _TRACE_CANVAS_HELPERS
+#define _TRACE_CANVAS_HELPERS
+/* The events carry the memory cgroup, the tools filter on the tenant's. */
+static inline unsigned long canvas_task_cgroup_ino(void)
+{
+	unsigned long ino = 0;
+#ifdef CONFIG_MEMCG
+	struct mem_cgroup *memcg;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(current);
+	if (memcg)
+		ino = cgroup_ino(memcg->css.cgroup);
+	rcu_read_unlock();
+#endif
+	return ino;
+}
+
+#ifdef CONFIG_MEMCG
+#define canvas_page_cgroup_ino(page) page_cgroup_ino(page)
+#else
+#define canvas_page_cgroup_ino(page) 0
+#endif
+#endif /* _TRACE_CANVAS_HELPERS */
+
+#define CANVAS_SWAPIN_MISS 0
+#define CANVAS_SWAPIN_HIT 1 /* in the swap cache */
+#define CANVAS_SWAPIN_HIT_PREFETCH 2 /* first hit on a prefetched page */
+
+/* A fault on a swapped out page, before it is read. */
+TRACE_EVENT(canvas_swapin,
+
+	TP_PROTO(unsigned long address, swp_entry_t entry, int hit),
+
+	TP_ARGS(address, entry, hit),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	address)
+		__field(	unsigned long,	entry)
+		__field(	int,		hit)
+		__field(	unsigned long,	ino)
+	),
+
+	TP_fast_assign(
+		__entry->address = address;
+		__entry->entry = entry.val;
+		__entry->hit = hit;
+		__entry->ino = canvas_task_cgroup_ino();
+	),
+
+	TP_printk("addr=0x%lx entry=0x%lx hit=%d ino=%lu",
+		__entry->address, __entry->entry, __entry->hit, __entry->ino)
+);
+
+/* The whole fault on a swapped out page, @cycles long. */
+TRACE_EVENT(canvas_swap_fault,
+
+	TP_PROTO(unsigned long address, bool major, u64 cycles),
+
+	TP_ARGS(address, major, cycles),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	address)
+		__field(	bool,		major)
+		__field(	u64,		lat_ns)
+		__field(	unsigned long,	ino)
+	),
+
+	TP_fast_assign(
+		__entry->address = address;
+		__entry->major = major;
+		/* ADC_CPU_FREQ is in MHz */
+		__entry->lat_ns = div_u64(cycles * 1000, ADC_CPU_FREQ);
+		__entry->ino = canvas_task_cgroup_ino();
+	),
+
+	TP_printk("addr=0x%lx major=%d lat_ns=%llu ino=%lu",
+		__entry->address, __entry->major, __entry->lat_ns,
+		__entry->ino)
+);
+
+/* A swapped out page read ahead of the faults. */
+TRACE_EVENT(canvas_swap_prefetch,
+
+	TP_PROTO(swp_entry_t entry),
+
+	TP_ARGS(entry),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	entry)
+		__field(	unsigned long,	ino)
+	),
+
+	TP_fast_assign(
+		__entry->entry = entry.val;
+		__entry->ino = canvas_task_cgroup_ino();
+	),
+
+	TP_printk("entry=0x%lx ino=%lu", __entry->entry, __entry->ino)
+);
+
+/*
+ * A page written to swap, by the tenant or by kswapd, so it carries the
+ * cgroup of the page.
+ */
+TRACE_EVENT(canvas_swapout,
+
+	TP_PROTO(struct page *page, bool frontswap),
+
+	TP_ARGS(page, frontswap),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	entry)
+		__field(	unsigned long,	ino)
+		__field(	bool,		frontswap)
+	),
+
+	TP_fast_assign(
+		__entry->entry = page_private(page);
+		__entry->ino = canvas_page_cgroup_ino(page);
+		__entry->frontswap = frontswap;
+	),
+
+	TP_printk("entry=0x%lx ino=%lu frontswap=%d",
+		__entry->entry, __entry->ino, __entry->frontswap)
+);
+
+#endif /* _TRACE_CANVAS_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -26,7 +26,8 @@
 			   UFFD_FEATURE_MISSING_HUGETLBFS |	\
 			   UFFD_FEATURE_MISSING_SHMEM |		\
 			   UFFD_FEATURE_SIGBUS |		\
-			   UFFD_FEATURE_THREAD_ID)
+			   UFFD_FEATURE_THREAD_ID |		\
+			   UFFD_FEATURE_SWAP_ASYNC)
 #define UFFD_API_IOCTLS				\
 	((__u64)1 << _UFFDIO_REGISTER |		\
 	 (__u64)1 << _UFFDIO_UNREGISTER |	\
@@ -127,6 +128,8 @@ struct uffd_msg {
 #define UFFD_EVENT_REMAP	0x14
 #define UFFD_EVENT_REMOVE	0x15
 #define UFFD_EVENT_UNMAP	0x16
+/* [Canvas] a swap-in started by an async swap fault is done */
+#define UFFD_EVENT_SWAPIN	0x17
 
 /* flags for UFFD_EVENT_PAGEFAULT */
 #define UFFD_PAGEFAULT_FLAG_WRITE	(1<<0)	/* If this was a write fault */
@@ -175,6 +178,16 @@ struct uffdio_api {
 	 *
 	 * UFFD_FEATURE_THREAD_ID pid of the page faulted task_struct will
 	 * be returned, if feature is not requested 0 will be returned.
+	 *
+	 * [Canvas] UFFD_FEATURE_SWAP_ASYNC makes a user-mode fault on a
+	 * swapped out page of a range registered with
+	 * UFFDIO_REGISTER_MODE_WP return at once instead of waiting for the
+	 * swap-in: the read is started and the thread gets a SIGBUS at the
+	 * address. A user-level scheduler switches to another task then.
+	 * An UFFD_EVENT_SWAPIN message with the page address in
+	 * arg.pagefault.address is read from the uffd when the page is
+	 * in, touching it then is a minor fault. Faults from the kernel,
+	 * e.g. in copy_from_user(), still wait for the page.
 	 */
 #define UFFD_FEATURE_PAGEFAULT_FLAG_WP		(1<<0)
 #define UFFD_FEATURE_EVENT_FORK			(1<<1)
@@ -185,6 +198,7 @@ struct uffdio_api {
 #define UFFD_FEATURE_EVENT_UNMAP		(1<<6)
 #define UFFD_FEATURE_SIGBUS			(1<<7)
 #define UFFD_FEATURE_THREAD_ID			(1<<8)
+#define UFFD_FEATURE_SWAP_ASYNC			(1<<9)
 	__u64 features;
 
 	__u64 ioctls;
@@ -0,0 +1,671 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * [Canvas] KUnit tests and microbenchmarks of the swap data structures: the
+ * swap fault trend of find_trend(), the swap cache list of add_to_sc_list()
+ * and the swap entries reserved for the pages.
+ *
+ * The canvas_swap suite checks them, also with all the CPUs at them at once.
+ * The canvas_swap_bench suite prints their ns/op with 1, 2, 4, ... CPUs
+ * sharing one structure, as the threads of a process share its trend and
+ * swap cache list.
+ */
+
+#include <kunit/test.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap_global_macro.h>
+#include <linux/swap_stats.h>
+#include <linux/swapops.h>
+
+#define CANVAS_TEST_ITERS (1 << 16)
+
+/*
+ * Run fn(arg, thread id) on nr_threads kthreads, one per online CPU, started
+ * together. Returns the longest run in ns, or 0 if they could not start.
+ */
+struct canvas_test_thread {
+	struct task_struct *task;
+	struct completion done;
+	int id;
+	void (*fn)(void *arg, int id);
+	void *arg;
+	atomic_t *start;
+	u64 ns;
+};
+
+static int canvas_test_thread_fn(void *data)
+{
+	struct canvas_test_thread *thd = data;
+	u64 start;
+
+	atomic_dec(thd->start);
+	while (atomic_read(thd->start) > 0)
+		cond_resched();
+	start = ktime_get_ns();
+	thd->fn(thd->arg, thd->id);
+	thd->ns = ktime_get_ns() - start;
+	complete(&thd->done);
+	return 0;
+}
+
+static u64 canvas_test_run_threads(struct kunit *test, int nr_threads,
+				   void (*fn)(void *arg, int id), void *arg)
+{
+	struct canvas_test_thread *thds;
+	atomic_t start;
+	u64 ns = 0;
+	int i, cpu;
+
+	thds = kunit_kzalloc(test, nr_threads * sizeof(*thds), GFP_KERNEL);
+	if (!thds)
+		return 0;
+	atomic_set(&start, nr_threads);
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nr_threads; i++) {
+		thds[i].id = i;
+		thds[i].fn = fn;
+		thds[i].arg = arg;
+		thds[i].start = &start;
+		init_completion(&thds[i].done);
+		thds[i].task = kthread_create(canvas_test_thread_fn, &thds[i],
+					      "canvas_test/%d", i);
+		if (IS_ERR(thds[i].task)) {
+			// none of them has started yet
+			while (--i >= 0)
+				kthread_stop(thds[i].task);
+			return 0;
+		}
+		kthread_bind(thds[i].task, cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+	for (i = 0; i < nr_threads; i++)
+		wake_up_process(thds[i].task);
+	for (i = 0; i < nr_threads; i++) {
+		wait_for_completion(&thds[i].done);
+		ns = max(ns, thds[i].ns);
+	}
+	return ns;
+}
+
+/* swap fault trend */
+
+// the oldest first, as log_swap_trend() would have written them
+static void set_trend_deltas(struct swap_trend *s_trend, const long *deltas,
+			     int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		s_trend->history[i % SWAP_TREND_SIZE].delta = deltas[i];
+		s_trend->history[i % SWAP_TREND_SIZE].entry = i;
+	}
+	atomic_set(&s_trend->head, n % SWAP_TREND_SIZE);
+	atomic_set(&s_trend->size, min(n, SWAP_TREND_SIZE));
+}
+
+static void log_strides(struct swap_trend *s_trend, unsigned long entry,
+			long stride, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		log_swap_trend(s_trend, entry + i * stride);
+}
+
+static void canvas_trend_test_log(struct kunit *test)
+{
+	struct swap_trend *s_trend;
+	int newest;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	log_swap_trend(s_trend, 10);
+	log_swap_trend(s_trend, 13);
+	log_swap_trend(s_trend, 11);
+	KUNIT_EXPECT_EQ(test, 3, atomic_read(&s_trend->head));
+	KUNIT_EXPECT_EQ(test, 3, atomic_read(&s_trend->size));
+	KUNIT_EXPECT_EQ(test, 0L, s_trend->history[0].delta);
+	KUNIT_EXPECT_EQ(test, 3L, s_trend->history[1].delta);
+	KUNIT_EXPECT_EQ(test, -2L, s_trend->history[2].delta);
+
+	// the ring wraps around, the size stops at its length
+	log_strides(s_trend, 100, 1, 3 * SWAP_TREND_SIZE);
+	KUNIT_EXPECT_EQ(test, (3 + 3 * SWAP_TREND_SIZE) % SWAP_TREND_SIZE,
+			atomic_read(&s_trend->head));
+	KUNIT_EXPECT_EQ(test, SWAP_TREND_SIZE, atomic_read(&s_trend->size));
+	newest = trend_prev_idx(atomic_read(&s_trend->head));
+	KUNIT_EXPECT_EQ(test, 100UL + 3 * SWAP_TREND_SIZE - 1,
+			s_trend->history[newest].entry);
+	KUNIT_EXPECT_EQ(test, 1L, s_trend->history[newest].delta);
+}
+
+static void canvas_trend_test_region(struct kunit *test)
+{
+	static const long majority[] = { 1, 1, 1, 1, 1, 7, 7, 7 };
+	static const long half[] = { 1, 1, 1, 1, 7, 7, 7, 7 };
+	static const long none[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	struct swap_trend *s_trend;
+	long delta;
+	int count;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	set_trend_deltas(s_trend, majority, ARRAY_SIZE(majority));
+	KUNIT_EXPECT_TRUE(test, find_trend_in_region(s_trend, 8, &delta,
+						     &count));
+	KUNIT_EXPECT_EQ(test, 1L, delta);
+	KUNIT_EXPECT_EQ(test, 5, count);
+
+	// a half is not a majority
+	set_trend_deltas(s_trend, half, ARRAY_SIZE(half));
+	KUNIT_EXPECT_FALSE(test, find_trend_in_region(s_trend, 8, &delta,
+						      &count));
+	KUNIT_EXPECT_EQ(test, 4, count);
+
+	set_trend_deltas(s_trend, none, ARRAY_SIZE(none));
+	KUNIT_EXPECT_FALSE(test, find_trend_in_region(s_trend, 8, &delta,
+						      &count));
+	KUNIT_EXPECT_EQ(test, 1, count);
+
+	// only the newest entries of the region count
+	KUNIT_EXPECT_TRUE(test, find_trend_in_region(s_trend, 1, &delta,
+						     &count));
+	KUNIT_EXPECT_EQ(test, 8L, delta);
+}
+
+// the region spans the end and the start of the ring
+static void canvas_trend_test_region_wrap(struct kunit *test)
+{
+	long deltas[SWAP_TREND_SIZE + 4];
+	struct swap_trend *s_trend;
+	long delta;
+	int i, count;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	for (i = 0; i < ARRAY_SIZE(deltas); i++)
+		deltas[i] = i < ARRAY_SIZE(deltas) - 8 ? 9 : 2;
+	set_trend_deltas(s_trend, deltas, ARRAY_SIZE(deltas));
+	KUNIT_EXPECT_EQ(test, 4, atomic_read(&s_trend->head));
+	KUNIT_EXPECT_TRUE(test, find_trend_in_region(s_trend, 8, &delta,
+						     &count));
+	KUNIT_EXPECT_EQ(test, 2L, delta);
+	KUNIT_EXPECT_EQ(test, 8, count);
+	KUNIT_EXPECT_TRUE(test, find_trend_in_region(s_trend, SWAP_TREND_SIZE,
+						     &delta, &count));
+	KUNIT_EXPECT_EQ(test, 9L, delta);
+	KUNIT_EXPECT_EQ(test, SWAP_TREND_SIZE - 8, count);
+}
+
+static void canvas_trend_test_strides(struct kunit *test)
+{
+	static const long valid[] = { 1, -1, 2, 4, 15, -15 };
+	static const long invalid[] = { 0, 16, -16, 512 };
+	struct swap_trend *s_trend;
+	int i, depth, count;
+	long delta;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	for (i = 0; i < ARRAY_SIZE(valid); i++) {
+		memset(s_trend, 0, sizeof(*s_trend));
+		log_strides(s_trend, 1 << 20, valid[i], 2 * SWAP_TREND_SIZE);
+		KUNIT_EXPECT_TRUE(test, find_trend(s_trend, &depth, &delta,
+						   &count));
+		KUNIT_EXPECT_EQ(test, valid[i], delta);
+	}
+	// no stride, or one of 64KB and more, is left to the default readahead
+	for (i = 0; i < ARRAY_SIZE(invalid); i++) {
+		memset(s_trend, 0, sizeof(*s_trend));
+		log_strides(s_trend, 1 << 20, invalid[i], 2 * SWAP_TREND_SIZE);
+		KUNIT_EXPECT_FALSE(test, find_trend(s_trend, &depth, &delta,
+						    &count));
+		KUNIT_EXPECT_EQ(test, invalid[i], delta);
+	}
+}
+
+// a trend behind a few random faults is found in a larger window
+static void canvas_trend_test_window(struct kunit *test)
+{
+	struct swap_trend *s_trend;
+	unsigned long entry = 1 << 20;
+	int i, depth, count;
+	long delta;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	for (i = 0; i < SWAP_TREND_SIZE; i++, entry += 2)
+		log_swap_trend(s_trend, entry);
+	for (i = 0; i < 6; i++, entry += 1000 * (i + 1))
+		log_swap_trend(s_trend, entry);
+	KUNIT_EXPECT_FALSE(test, find_trend_in_region(s_trend, 8, &delta,
+						      &count));
+	KUNIT_EXPECT_TRUE(test, find_trend(s_trend, &depth, &delta, &count));
+	KUNIT_EXPECT_EQ(test, 2L, delta);
+
+	// faults with distinct deltas have no trend at all
+	memset(s_trend, 0, sizeof(*s_trend));
+	for (i = 0; i < 2 * SWAP_TREND_SIZE; i++)
+		log_swap_trend(s_trend, (unsigned long)i * i);
+	KUNIT_EXPECT_FALSE(test, find_trend(s_trend, &depth, &delta, &count));
+}
+
+struct trend_test_ctx {
+	struct swap_trend s_trend;
+	int nr_loggers;
+	atomic_t loggers_done;
+	atomic_t errors;
+};
+
+// the threads of a process fault and look for the trend concurrently
+static void trend_test_concurrent_fn(void *arg, int id)
+{
+	struct trend_test_ctx *ctx = arg;
+	int depth, count, head, size;
+	long delta;
+
+	if (id < ctx->nr_loggers) {
+		log_strides(&ctx->s_trend, (unsigned long)id << 32, 1,
+			    CANVAS_TEST_ITERS);
+		atomic_inc(&ctx->loggers_done);
+		return;
+	}
+	while (atomic_read(&ctx->loggers_done) < ctx->nr_loggers) {
+		find_trend(&ctx->s_trend, &depth, &delta, &count);
+		head = atomic_read(&ctx->s_trend.head);
+		size = atomic_read(&ctx->s_trend.size);
+		if (count < 0 || count > SWAP_TREND_SIZE || head < 0 ||
+		    head >= SWAP_TREND_SIZE || size < 0 ||
+		    size > SWAP_TREND_SIZE)
+			atomic_inc(&ctx->errors);
+		cond_resched();
+	}
+}
+
+static void canvas_trend_test_concurrent(struct kunit *test)
+{
+	int nr_threads = max(2U, num_online_cpus());
+	struct trend_test_ctx *ctx;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->nr_loggers = nr_threads - 1;
+
+	KUNIT_ASSERT_NE(test, 0ULL,
+			canvas_test_run_threads(test, nr_threads,
+						trend_test_concurrent_fn, ctx));
+	KUNIT_EXPECT_EQ(test, 0, atomic_read(&ctx->errors));
+	KUNIT_EXPECT_EQ(test, SWAP_TREND_SIZE,
+			atomic_read(&ctx->s_trend.size));
+	KUNIT_EXPECT_LT(test, atomic_read(&ctx->s_trend.head),
+			SWAP_TREND_SIZE);
+}
+
+/* swap cache list */
+
+/*
+ * The pages are not in the swap cache, so add_to_sc_list() evicts them
+ * from the full list without touching them.
+ */
+static struct page **alloc_test_pages(struct kunit *test, int nr)
+{
+	struct page **pages;
+	int i;
+
+	pages = kunit_kzalloc(test, nr * sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return NULL;
+	for (i = 0; i < nr; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			while (--i >= 0)
+				__free_page(pages[i]);
+			return NULL;
+		}
+	}
+	return pages;
+}
+
+static void free_test_pages(struct page **pages, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		__free_page(pages[i]);
+}
+
+static void canvas_sc_list_test_fill_evict(struct kunit *test)
+{
+	struct swapcache_list sc_list;
+	struct page **pages;
+	int i;
+
+	pages = alloc_test_pages(test, 11);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, pages);
+	init_swapcache_list(&sc_list, 8);
+
+	for (i = 0; i < 5; i++)
+		add_to_sc_list(&sc_list, swp_entry(0, i), pages[i]);
+	KUNIT_EXPECT_EQ(test, 5, sc_list.size);
+	KUNIT_EXPECT_EQ(test, 5, sc_list.head);
+	for (i = 0; i < 5; i++) {
+		KUNIT_EXPECT_PTR_EQ(test, pages[i], sc_list.pages[i]);
+		KUNIT_EXPECT_EQ(test, swp_entry(0, i).val, sc_list.entries[i]);
+	}
+
+	// the oldest ones make room once it is full
+	for (i = 5; i < 11; i++)
+		add_to_sc_list(&sc_list, swp_entry(0, i), pages[i]);
+	KUNIT_EXPECT_EQ(test, 8, sc_list.size);
+	KUNIT_EXPECT_EQ(test, 3, sc_list.head);
+	for (i = 0; i < 3; i++)
+		KUNIT_EXPECT_PTR_EQ(test, pages[8 + i], sc_list.pages[i]);
+	for (i = 3; i < 8; i++)
+		KUNIT_EXPECT_PTR_EQ(test, pages[i], sc_list.pages[i]);
+
+	destroy_swapcache_list(&sc_list);
+	free_test_pages(pages, 11);
+}
+
+#define SC_TEST_CAPACITY 64
+#define SC_TEST_PAGES_PER_THREAD 256
+
+struct sc_test_ctx {
+	struct swapcache_list sc_list;
+	struct page **pages;
+	int nr_pages;
+	unsigned long iters;
+};
+
+static void sc_list_test_fn(void *arg, int id)
+{
+	struct sc_test_ctx *ctx = arg;
+	int base = id * SC_TEST_PAGES_PER_THREAD;
+	unsigned long i;
+	int idx;
+
+	for (i = 0; i < ctx->iters; i++) {
+		idx = base + i % SC_TEST_PAGES_PER_THREAD;
+		add_to_sc_list(&ctx->sc_list, swp_entry(0, idx),
+			       ctx->pages[idx]);
+	}
+}
+
+static void canvas_sc_list_test_concurrent(struct kunit *test)
+{
+	int nr_threads = max(2U, num_online_cpus());
+	struct sc_test_ctx *ctx;
+	int i, j, dups = 0;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->nr_pages = nr_threads * SC_TEST_PAGES_PER_THREAD;
+	ctx->pages = alloc_test_pages(test, ctx->nr_pages);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->pages);
+	ctx->iters = SC_TEST_PAGES_PER_THREAD;
+	init_swapcache_list(&ctx->sc_list, SC_TEST_CAPACITY);
+
+	KUNIT_EXPECT_NE(test, 0ULL,
+			canvas_test_run_threads(test, nr_threads,
+						sc_list_test_fn, ctx));
+	KUNIT_EXPECT_EQ(test, SC_TEST_CAPACITY, ctx->sc_list.size);
+	for (i = 0; i < SC_TEST_CAPACITY; i++) {
+		struct page *page = ctx->sc_list.pages[i];
+
+		KUNIT_EXPECT_PTR_NE(test, (struct page *)NULL, page);
+		for (j = 0; j < i; j++)
+			dups += ctx->sc_list.pages[j] == page;
+	}
+	// every page is added once, so it is in at most one slot
+	KUNIT_EXPECT_EQ(test, 0, dups);
+
+	destroy_swapcache_list(&ctx->sc_list);
+	free_test_pages(ctx->pages, ctx->nr_pages);
+}
+
+/* reserved swap entries */
+
+#define RESERVE_TEST_ORDER 8
+#define RESERVE_TEST_PAGES (1 << RESERVE_TEST_ORDER)
+
+static struct page *alloc_reserve_test_pages(struct kunit *test)
+{
+	struct page *pages;
+
+	if (!__canvas_page_entries)
+		return NULL;
+	pages = alloc_pages(GFP_KERNEL, RESERVE_TEST_ORDER);
+	if (!pages)
+		return NULL;
+	if (page_to_pfn(pages) + RESERVE_TEST_PAGES >
+	    CANVAS_MAX_MEM / PAGE_SIZE) {
+		// beyond the memory the entries cover
+		__free_pages(pages, RESERVE_TEST_ORDER);
+		return NULL;
+	}
+	return pages;
+}
+
+static void canvas_reserve_test_alloc(struct kunit *test)
+{
+	struct page *page = alloc_reserve_test_pages(test);
+	swp_entry_t entry = swp_entry(0, 42);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, page);
+	KUNIT_EXPECT_FALSE(test,
+			   is_valid_swp_entry(get_reserved_swp_entry(page)));
+
+	set_reserved_swp_entry(page, entry);
+	KUNIT_EXPECT_EQ(test, entry.val, get_reserved_swp_entry(page).val);
+	// taken once, then gone
+	KUNIT_EXPECT_EQ(test, entry.val, alloc_reserved_swp_entry(page).val);
+	KUNIT_EXPECT_FALSE(test,
+			   is_valid_swp_entry(get_reserved_swp_entry(page)));
+	KUNIT_EXPECT_FALSE(test,
+			   is_valid_swp_entry(alloc_reserved_swp_entry(page)));
+
+	__free_pages(page, RESERVE_TEST_ORDER);
+}
+
+struct reserve_test_ctx {
+	struct page *pages;
+	atomic_t taken;
+	atomic_long_t sum;
+};
+
+// everyone tries to take the entry of every page
+static void reserve_test_fn(void *arg, int id)
+{
+	struct reserve_test_ctx *ctx = arg;
+	swp_entry_t entry;
+	int i;
+
+	for (i = 0; i < RESERVE_TEST_PAGES; i++) {
+		entry = alloc_reserved_swp_entry(ctx->pages + i);
+		if (is_valid_swp_entry(entry)) {
+			atomic_inc(&ctx->taken);
+			atomic_long_add(swp_offset(entry), &ctx->sum);
+		}
+	}
+}
+
+static void canvas_reserve_test_concurrent(struct kunit *test)
+{
+	int nr_threads = max(2U, num_online_cpus());
+	struct reserve_test_ctx *ctx;
+	int round, i;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->pages = alloc_reserve_test_pages(test);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->pages);
+
+	for (round = 0; round < 16; round++) {
+		atomic_set(&ctx->taken, 0);
+		atomic_long_set(&ctx->sum, 0);
+		for (i = 0; i < RESERVE_TEST_PAGES; i++)
+			set_reserved_swp_entry(ctx->pages + i,
+					       swp_entry(0, i + 1));
+		KUNIT_EXPECT_NE(test, 0ULL,
+				canvas_test_run_threads(test, nr_threads,
+							reserve_test_fn, ctx));
+		KUNIT_EXPECT_EQ(test, RESERVE_TEST_PAGES,
+				atomic_read(&ctx->taken));
+		KUNIT_EXPECT_EQ(test,
+				(long)RESERVE_TEST_PAGES *
+					(RESERVE_TEST_PAGES + 1) / 2,
+				atomic_long_read(&ctx->sum));
+	}
+	__free_pages(ctx->pages, RESERVE_TEST_ORDER);
+}
+
+static struct kunit_case canvas_swap_test_cases[] = {
+	KUNIT_CASE(canvas_trend_test_log),
+	KUNIT_CASE(canvas_trend_test_region),
+	KUNIT_CASE(canvas_trend_test_region_wrap),
+	KUNIT_CASE(canvas_trend_test_strides),
+	KUNIT_CASE(canvas_trend_test_window),
+	KUNIT_CASE(canvas_trend_test_concurrent),
+	KUNIT_CASE(canvas_sc_list_test_fill_evict),
+	KUNIT_CASE(canvas_sc_list_test_concurrent),
+	KUNIT_CASE(canvas_reserve_test_alloc),
+	KUNIT_CASE(canvas_reserve_test_concurrent),
+	{}
+};
+
+static struct kunit_suite canvas_swap_test_suite = {
+	.name = "canvas_swap",
+	.test_cases = canvas_swap_test_cases,
+};
+
+kunit_test_suite(canvas_swap_test_suite);
+
+/* microbenchmarks */
+
+/*
+ * Print the ns/op of fn, which does iters ops on thread id, with 1, 2, 4,
+ * ... up to all the online CPUs.
+ */
+static void canvas_bench(struct kunit *test, const char *name,
+			 void (*fn)(void *arg, int id), void *arg,
+			 unsigned long iters)
+{
+	unsigned int cpus = num_online_cpus();
+	unsigned int n;
+	u64 ns;
+
+	for (n = 1;; n = min(n * 2, cpus)) {
+		ns = canvas_test_run_threads(test, n, fn, arg);
+		KUNIT_ASSERT_NE(test, 0ULL, ns);
+		kunit_info(test, "%s: %u cpus: %llu ns/op\n", name, n,
+			   div_u64(ns, iters));
+		if (n == cpus)
+			break;
+	}
+}
+
+static void bench_log_trend_fn(void *arg, int id)
+{
+	log_strides(arg, (unsigned long)id << 32, 1, CANVAS_TEST_ITERS);
+}
+
+static void bench_find_trend_fn(void *arg, int id)
+{
+	int i, depth, count;
+	long delta;
+
+	for (i = 0; i < CANVAS_TEST_ITERS; i++)
+		find_trend(arg, &depth, &delta, &count);
+}
+
+static void canvas_bench_trend(struct kunit *test)
+{
+	struct swap_trend *s_trend;
+	long deltas[SWAP_TREND_SIZE];
+	int i;
+
+	s_trend = kunit_kzalloc(test, sizeof(*s_trend), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s_trend);
+
+	canvas_bench(test, "log_swap_trend", bench_log_trend_fn, s_trend,
+		     CANVAS_TEST_ITERS);
+
+	// the best case finds the trend in the first window
+	log_strides(s_trend, 0, 1, SWAP_TREND_SIZE);
+	canvas_bench(test, "find_trend, stride", bench_find_trend_fn, s_trend,
+		     CANVAS_TEST_ITERS);
+	// the worst case tries all the windows
+	for (i = 0; i < SWAP_TREND_SIZE; i++)
+		deltas[i] = i;
+	set_trend_deltas(s_trend, deltas, SWAP_TREND_SIZE);
+	canvas_bench(test, "find_trend, no trend", bench_find_trend_fn,
+		     s_trend, CANVAS_TEST_ITERS);
+}
+
+static void canvas_bench_sc_list(struct kunit *test)
+{
+	int nr_threads = num_online_cpus();
+	struct sc_test_ctx *ctx;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->nr_pages = nr_threads * SC_TEST_PAGES_PER_THREAD;
+	ctx->pages = alloc_test_pages(test, ctx->nr_pages);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->pages);
+	ctx->iters = CANVAS_TEST_ITERS;
+	init_swapcache_list(&ctx->sc_list, SC_TEST_CAPACITY);
+
+	canvas_bench(test, "add_to_sc_list", sc_list_test_fn, ctx,
+		     CANVAS_TEST_ITERS);
+
+	destroy_swapcache_list(&ctx->sc_list);
+	free_test_pages(ctx->pages, ctx->nr_pages);
+}
+
+// set and take the reserved entry of a page of its own
+static void bench_reserve_fn(void *arg, int id)
+{
+	struct page *page = (struct page *)arg + id % RESERVE_TEST_PAGES;
+	int i;
+
+	for (i = 0; i < CANVAS_TEST_ITERS; i++) {
+		set_reserved_swp_entry(page, swp_entry(0, i));
+		alloc_reserved_swp_entry(page);
+	}
+}
+
+static void canvas_bench_reserve(struct kunit *test)
+{
+	struct page *pages = alloc_reserve_test_pages(test);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, pages);
+	canvas_bench(test, "set+alloc_reserved_swp_entry", bench_reserve_fn,
+		     pages, CANVAS_TEST_ITERS);
+	__free_pages(pages, RESERVE_TEST_ORDER);
+}
+
+static struct kunit_case canvas_swap_bench_cases[] = {
+	KUNIT_CASE(canvas_bench_trend),
+	KUNIT_CASE(canvas_bench_sc_list),
+	KUNIT_CASE(canvas_bench_reserve),
+	{}
+};
+
+static struct kunit_suite canvas_swap_bench_suite = {
+	.name = "canvas_swap_bench",
+	.test_cases = canvas_swap_bench_cases,
+};
+
+kunit_test_suite(canvas_swap_bench_suite);
@@ -16,6 +16,7 @@
 #include <linux/mm.h>
 #include <linux/debugfs.h>
 #include <linux/cleancache.h>
+#include <linux/srcu.h>
 
 /*
  * cleancache_ops is set by cleancache_register_ops to contain the pointers
@@ -23,6 +24,9 @@
  */
 static const struct cleancache_ops *cleancache_ops __read_mostly;
 
+/* [Canvas] the hooks run in it, cleancache_deregister_ops() waits for them */
+DEFINE_STATIC_SRCU(cleancache_srcu);
+
 /*
  * Counters available via /sys/kernel/debug/cleancache (if debugfs is
  * properly configured.  These are for information only so are not protected
@@ -109,31 +113,63 @@ int cleancache_register_ops(const struct cleancache_ops *ops)
 }
 EXPORT_SYMBOL(cleancache_register_ops);
 
+static void cleancache_deregister_ops_sb(struct super_block *sb, void *unused)
+{
+	if (sb->cleancache_poolid >= 0)
+		sb->cleancache_poolid = CLEANCACHE_NO_BACKEND;
+}
+
+/*
+ * [Canvas] Unregister the cleancache backend, so that its module can go.
+ * The pools of the mounted filesystems are dropped, and get a new one from
+ * the next backend registered. The hooks read cleancache_ops once within
+ * cleancache_srcu, so after this none of them runs in the old backend.
+ */
+void cleancache_deregister_ops(void)
+{
+	xchg(&cleancache_ops, NULL);
+	iterate_supers(cleancache_deregister_ops_sb, NULL);
+	synchronize_srcu(&cleancache_srcu);
+}
+EXPORT_SYMBOL(cleancache_deregister_ops);
+
 /* Called by a cleancache-enabled filesystem at time of mount */
 void __cleancache_init_fs(struct super_block *sb)
 {
+	const struct cleancache_ops *ops;
 	int pool_id = CLEANCACHE_NO_BACKEND;
+	int idx;
+
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
 
-	if (cleancache_ops) {
-		pool_id = cleancache_ops->init_fs(PAGE_SIZE);
+	if (ops) {
+		pool_id = ops->init_fs(PAGE_SIZE);
 		if (pool_id < 0)
 			pool_id = CLEANCACHE_NO_POOL;
 	}
 	sb->cleancache_poolid = pool_id;
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_init_fs);
 
 /* Called by a cleancache-enabled clustered filesystem at time of mount */
 void __cleancache_init_shared_fs(struct super_block *sb)
 {
+	const struct cleancache_ops *ops;
 	int pool_id = CLEANCACHE_NO_BACKEND_SHARED;
+	int idx;
 
-	if (cleancache_ops) {
-		pool_id = cleancache_ops->init_shared_fs(&sb->s_uuid, PAGE_SIZE);
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+
+	if (ops) {
+		pool_id = ops->init_shared_fs(&sb->s_uuid, PAGE_SIZE);
 		if (pool_id < 0)
 			pool_id = CLEANCACHE_NO_POOL;
 	}
 	sb->cleancache_poolid = pool_id;
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_init_shared_fs);
 
@@ -175,11 +211,14 @@ static int cleancache_get_key(struct inode *inode,
  */
 int __cleancache_get_page(struct page *page)
 {
+	const struct cleancache_ops *ops;
 	int ret = -1;
-	int pool_id;
+	int pool_id, idx;
 	struct cleancache_filekey key = { .u.key = { 0 } };
 
-	if (!cleancache_ops) {
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+	if (!ops) {
 		cleancache_failed_gets++;
 		goto out;
 	}
@@ -192,12 +231,13 @@ int __cleancache_get_page(struct page *page)
 	if (cleancache_get_key(page->mapping->host, &key) < 0)
 		goto out;
 
-	ret = cleancache_ops->get_page(pool_id, key, page->index, page);
+	ret = ops->get_page(pool_id, key, page->index, page);
 	if (ret == 0)
 		cleancache_succ_gets++;
 	else
 		cleancache_failed_gets++;
 out:
+	srcu_read_unlock(&cleancache_srcu, idx);
 	return ret;
 }
 EXPORT_SYMBOL(__cleancache_get_page);
@@ -214,21 +254,26 @@ EXPORT_SYMBOL(__cleancache_get_page);
  */
 void __cleancache_put_page(struct page *page)
 {
-	int pool_id;
+	const struct cleancache_ops *ops;
+	int pool_id, idx;
 	struct cleancache_filekey key = { .u.key = { 0 } };
 
-	if (!cleancache_ops) {
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+	if (!ops) {
 		cleancache_puts++;
-		return;
+		goto out;
 	}
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	pool_id = page->mapping->host->i_sb->cleancache_poolid;
 	if (pool_id >= 0 &&
 		cleancache_get_key(page->mapping->host, &key) >= 0) {
-		cleancache_ops->put_page(pool_id, key, page->index, page);
+		ops->put_page(pool_id, key, page->index, page);
 		cleancache_puts++;
 	}
+out:
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_put_page);
 
@@ -243,21 +288,23 @@ EXPORT_SYMBOL(__cleancache_put_page);
 void __cleancache_invalidate_page(struct address_space *mapping,
 					struct page *page)
 {
+	const struct cleancache_ops *ops;
 	/* careful... page->mapping is NULL sometimes when this is called */
 	int pool_id = mapping->host->i_sb->cleancache_poolid;
 	struct cleancache_filekey key = { .u.key = { 0 } };
+	int idx;
 
-	if (!cleancache_ops)
-		return;
-
-	if (pool_id >= 0) {
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+	if (ops && pool_id >= 0) {
 		VM_BUG_ON_PAGE(!PageLocked(page), page);
 		if (cleancache_get_key(mapping->host, &key) >= 0) {
-			cleancache_ops->invalidate_page(pool_id,
+			ops->invalidate_page(pool_id,
 					key, page->index);
 			cleancache_invalidates++;
 		}
 	}
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_invalidate_page);
 
@@ -272,14 +319,17 @@ EXPORT_SYMBOL(__cleancache_invalidate_page);
  */
 void __cleancache_invalidate_inode(struct address_space *mapping)
 {
+	const struct cleancache_ops *ops;
 	int pool_id = mapping->host->i_sb->cleancache_poolid;
 	struct cleancache_filekey key = { .u.key = { 0 } };
+	int idx;
 
-	if (!cleancache_ops)
-		return;
-
-	if (pool_id >= 0 && cleancache_get_key(mapping->host, &key) >= 0)
-		cleancache_ops->invalidate_inode(pool_id, key);
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+	if (ops && pool_id >= 0 &&
+	    cleancache_get_key(mapping->host, &key) >= 0)
+		ops->invalidate_inode(pool_id, key);
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_invalidate_inode);
 
@@ -290,13 +340,17 @@ EXPORT_SYMBOL(__cleancache_invalidate_inode);
  */
 void __cleancache_invalidate_fs(struct super_block *sb)
 {
-	int pool_id;
+	const struct cleancache_ops *ops;
+	int pool_id, idx;
 
 	pool_id = sb->cleancache_poolid;
 	sb->cleancache_poolid = CLEANCACHE_NO_POOL;
 
-	if (cleancache_ops && pool_id >= 0)
-		cleancache_ops->invalidate_fs(pool_id);
+	idx = srcu_read_lock(&cleancache_srcu);
+	ops = READ_ONCE(cleancache_ops);
+	if (ops && pool_id >= 0)
+		ops->invalidate_fs(pool_id);
+	srcu_read_unlock(&cleancache_srcu, idx);
 }
 EXPORT_SYMBOL(__cleancache_invalidate_fs);
 
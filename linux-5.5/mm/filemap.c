@@ -1270,6 +1270,59 @@ void add_page_wait_queue(struct page *page, wait_queue_entry_t *waiter)
 }
 EXPORT_SYMBOL_GPL(add_page_wait_queue);
 
+/* [Canvas] see add_page_unlock_callback() */
+static int page_unlock_wake_function(wait_queue_entry_t *wait, unsigned mode,
+				     int sync, void *arg)
+{
+	struct wait_page_key *key = arg;
+	struct page_unlock_callback *cb =
+		container_of(wait, struct page_unlock_callback, wait);
+
+	if (cb->page != key->page)
+		return 0;
+	key->page_match = 1;
+	/* locked again already, wait for the next unlock */
+	if (key->bit_nr != PG_locked || test_bit(PG_locked, &key->page->flags))
+		return 0;
+
+	list_del_init(&wait->entry);
+	cb->func(cb);
+	return 1;
+}
+
+/**
+ * add_page_unlock_callback - [Canvas] Call back once a page is unlocked
+ * @page: The page, locked for I/O
+ * @cb: The callback, its func set by the caller
+ *
+ * Have @cb->func called once @page is unlocked, from the context that
+ * unlocks it, often an irq, so it must not sleep. @cb stays on the wait
+ * queue of the page until then.
+ *
+ * Returns false, with @cb not queued, if @page is not locked (anymore).
+ */
+bool add_page_unlock_callback(struct page *page,
+			      struct page_unlock_callback *cb)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	unsigned long flags;
+	bool queued = false;
+
+	cb->page = page;
+	init_waitqueue_func_entry(&cb->wait, page_unlock_wake_function);
+
+	spin_lock_irqsave(&q->lock, flags);
+	SetPageWaiters(page);
+	/* pairs with clear_bit_unlock_is_negative_byte() in unlock_page() */
+	smp_mb__after_atomic();
+	if (PageLocked(page)) {
+		__add_wait_queue_entry_tail(q, &cb->wait);
+		queued = true;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+	return queued;
+}
+
 #ifndef clear_bit_unlock_is_negative_byte
 
 /*
@@ -18,6 +18,7 @@
 #include <linux/debugfs.h>
 #include <linux/frontswap.h>
 #include <linux/swapfile.h>
+#include <linux/srcu.h>
 
 DEFINE_STATIC_KEY_FALSE(frontswap_enabled_key);
 EXPORT_SYMBOL(frontswap_enabled_key);
@@ -34,6 +35,12 @@ EXPORT_SYMBOL(frontswap_ops);
 #define for_each_frontswap_ops(ops)		\
 	for ((ops) = frontswap_ops; (ops); (ops) = (ops)->next)
 
+/*
+ * [Canvas] The backends are called in it, so that parking or deregistering
+ * them waits for the calls still running in their module.
+ */
+DEFINE_STATIC_SRCU(frontswap_srcu);
+
 /*
  * If enabled, frontswap_store will return failure even on success.  As
  * a result, the swap subsystem will always write the page to swap, in
@@ -196,9 +203,132 @@ void frontswap_deregister_ops(void)
 			//kfree(cur_ops);
 		}
 	}
-
+	synchronize_srcu(&frontswap_srcu);
 }
 EXPORT_SYMBOL(frontswap_deregister_ops);
+
+/*
+ * [Canvas] Park frontswap while its backend module is reloaded. The pages
+ * already in the backend stay set in the frontswap_map of their swap
+ * device. Their loads wait for the next backend instead of reading the
+ * stale swap slot, while stores fail over to the swap device.
+ * The backend leaves a state to its successor, e.g. where its pages are.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(frontswap_park_wait);
+static bool frontswap_is_parked;
+static void *frontswap_park_state;
+
+static void frontswap_park_init(unsigned type)
+{
+}
+
+static int frontswap_park_store(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	return -1;
+}
+
+static int frontswap_park_load(unsigned type, pgoff_t offset,
+			       struct page *page)
+{
+	wait_event(frontswap_park_wait, !READ_ONCE(frontswap_is_parked));
+	return frontswap_ops->load(type, offset, page);
+}
+
+static int frontswap_park_load_async(unsigned type, pgoff_t offset,
+				     struct page *page)
+{
+	wait_event(frontswap_park_wait, !READ_ONCE(frontswap_is_parked));
+	return frontswap_ops->load_async(type, offset, page);
+}
+
+static int frontswap_park_poll_load(int cpu)
+{
+	return 0;
+}
+
+static void frontswap_park_invalidate_page(unsigned type, pgoff_t offset)
+{
+}
+
+static void frontswap_park_invalidate_area(unsigned type)
+{
+}
+
+static struct frontswap_ops frontswap_park_ops = {
+	.init = frontswap_park_init,
+	.store = frontswap_park_store,
+	.load = frontswap_park_load,
+	.load_async = frontswap_park_load_async,
+	.poll_load = frontswap_park_poll_load,
+	.invalidate_page = frontswap_park_invalidate_page,
+	.invalidate_area = frontswap_park_invalidate_area,
+};
+
+/*
+ * Replace all the registered frontswap_ops with the parking ones, @state is
+ * kept for the next backend. Returns once no call runs in the old ones.
+ */
+void frontswap_park_ops(void *state)
+{
+	struct frontswap_ops *ops;
+
+	frontswap_park_state = state;
+	WRITE_ONCE(frontswap_is_parked, true);
+
+	frontswap_park_ops.next = NULL;
+	ops = xchg(&frontswap_ops, &frontswap_park_ops);
+	if (!ops)
+		static_branch_inc(&frontswap_enabled_key);
+	/* frontswap_enabled_key counts the parking ops only */
+	for (ops = ops ? ops->next : NULL; ops; ops = ops->next)
+		static_branch_dec(&frontswap_enabled_key);
+	synchronize_srcu(&frontswap_srcu);
+}
+EXPORT_SYMBOL(frontswap_park_ops);
+
+bool frontswap_parked(void)
+{
+	return READ_ONCE(frontswap_is_parked);
+}
+EXPORT_SYMBOL(frontswap_parked);
+
+/* The state left by the parked backend, NULL if none */
+void *frontswap_parked_state(void)
+{
+	return frontswap_parked() ? frontswap_park_state : NULL;
+}
+EXPORT_SYMBOL(frontswap_parked_state);
+
+/*
+ * Install @ops in place of the parking ones and let the parked loads go to
+ * it. The caller owns the parked state from now on.
+ */
+void frontswap_unpark_ops(struct frontswap_ops *ops)
+{
+	DECLARE_BITMAP(a, MAX_SWAPFILES);
+	struct swap_info_struct *si;
+	unsigned int i;
+
+	bitmap_zero(a, MAX_SWAPFILES);
+	spin_lock(&swap_lock);
+	plist_for_each_entry(si, &swap_active_head, list) {
+		if (si->frontswap_map)
+			set_bit(si->type, a);
+	}
+	spin_unlock(&swap_lock);
+
+	for_each_set_bit(i, a, MAX_SWAPFILES)
+		ops->init(i);
+
+	ops->next = NULL;
+	xchg(&frontswap_ops, ops);
+
+	frontswap_park_state = NULL;
+	WRITE_ONCE(frontswap_is_parked, false);
+	wake_up_all(&frontswap_park_wait);
+}
+EXPORT_SYMBOL(frontswap_unpark_ops);
 /* [Canvas] end */
 
 /*
@@ -226,6 +356,7 @@ void __frontswap_init(unsigned type, unsigned long *map)
 {
 	struct swap_info_struct *sis = swap_info[type];
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(sis == NULL);
 
@@ -242,8 +373,10 @@ void __frontswap_init(unsigned type, unsigned long *map)
 	 */
 	frontswap_map_set(sis, map);
 
+	idx = srcu_read_lock(&frontswap_srcu);
 	for_each_frontswap_ops(ops)
 		ops->init(type);
+	srcu_read_unlock(&frontswap_srcu, idx);
 }
 EXPORT_SYMBOL(__frontswap_init);
 
@@ -268,6 +401,8 @@ static inline void __frontswap_clear(struct swap_info_struct *sis,
 {
 	clear_bit(offset, sis->frontswap_map);
 	atomic_dec(&sis->frontswap_pages);
+	/* [Canvas] */
+	mem_cgroup_uncharge_remote(sis->type, offset);
 }
 
 /*
@@ -285,11 +420,13 @@ int __frontswap_store(struct page *page)
 	struct swap_info_struct *sis = swap_info[type];
 	pgoff_t offset = swp_offset(entry);
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(!frontswap_ops);
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(sis == NULL);
 
+	idx = srcu_read_lock(&frontswap_srcu);
 	/*
 	 * If a dup, we must remove the old page first; we can't leave the
 	 * old page no matter if the store of the new page succeeds or fails,
@@ -302,6 +439,16 @@ int __frontswap_store(struct page *page)
 			ops->invalidate_page(type, offset);
 	}
 
+	/*
+	 * [Canvas] a page over the remote memory quota of its memcg goes to
+	 * the swap device, see mm/memcg_remote.c.
+	 */
+	if (mem_cgroup_charge_remote(page, type, offset)) {
+		inc_frontswap_failed_stores();
+		ret = -1;
+		goto out;
+	}
+
 	/* Try to store in each implementation, until one succeeds. */
 	for_each_frontswap_ops(ops) {
 		ret = ops->store(type, offset, page);
@@ -312,11 +459,14 @@ int __frontswap_store(struct page *page)
 		__frontswap_set(sis, offset);
 		inc_frontswap_succ_stores();
 	} else {
+		mem_cgroup_uncharge_remote(type, offset); /* [Canvas] */
 		inc_frontswap_failed_stores();
 	}
 	if (frontswap_writethrough_enabled)
 		/* report failure so swap also writes to swap device */
 		ret = -1;
+out:
+	srcu_read_unlock(&frontswap_srcu, idx);
 	return ret;
 }
 EXPORT_SYMBOL(__frontswap_store);
@@ -334,6 +484,7 @@ int __frontswap_load(struct page *page)
 	struct swap_info_struct *sis = swap_info[type];
 	pgoff_t offset = swp_offset(entry);
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(!frontswap_ops);
 	VM_BUG_ON(!PageLocked(page));
@@ -343,11 +494,13 @@ int __frontswap_load(struct page *page)
 		return -1;
 
 	/* Try loading from each implementation, until one succeeds. */
+	idx = srcu_read_lock(&frontswap_srcu);
 	for_each_frontswap_ops(ops) {
 		ret = ops->load(type, offset, page);
 		if (!ret) /* successful load */
 			break;
 	}
+	srcu_read_unlock(&frontswap_srcu, idx);
 	if (ret == 0) {
 		inc_frontswap_loads();
 		if (frontswap_tmem_exclusive_gets_enabled) {
@@ -368,6 +521,7 @@ int __frontswap_load_async(struct page *page)
 	struct swap_info_struct *sis = swap_info[type];
 	pgoff_t offset = swp_offset(entry);
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(!frontswap_ops);
 	VM_BUG_ON(!PageLocked(page));
@@ -377,11 +531,13 @@ int __frontswap_load_async(struct page *page)
 		return -1;
 
 	/* Try loading from each implementation, until one succeeds. */
+	idx = srcu_read_lock(&frontswap_srcu);
 	for_each_frontswap_ops(ops) {
 		ret = ops->load_async(type, offset, page);
 		if (!ret) /* successful load */
 			break;
 	}
+	srcu_read_unlock(&frontswap_srcu, idx);
 	if (ret == 0) {
 		inc_frontswap_loads();
 		if (frontswap_tmem_exclusive_gets_enabled) {
@@ -397,15 +553,17 @@ EXPORT_SYMBOL(__frontswap_load_async);
 int __frontswap_poll_load(int cpu)
 {
 	struct frontswap_ops *ops;
+	int idx, ret;
 
 	VM_BUG_ON(!frontswap_ops);
 
-	/* Try loading from each implementation, until one succeeds. */
-	for_each_frontswap_ops(ops)
-		return ops->poll_load(cpu);
-
-	BUG();
-	return -1;
+	/* The first implementation polls. */
+	idx = srcu_read_lock(&frontswap_srcu);
+	ops = frontswap_ops;
+	BUG_ON(!ops);
+	ret = ops->poll_load(cpu);
+	srcu_read_unlock(&frontswap_srcu, idx);
+	return ret;
 }
 EXPORT_SYMBOL(__frontswap_poll_load);
 
@@ -417,6 +575,7 @@ void __frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
 	struct swap_info_struct *sis = swap_info[type];
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(!frontswap_ops);
 	VM_BUG_ON(sis == NULL);
@@ -424,8 +583,10 @@ void __frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	if (!__frontswap_test(sis, offset))
 		return;
 
+	idx = srcu_read_lock(&frontswap_srcu);
 	for_each_frontswap_ops(ops)
 		ops->invalidate_page(type, offset);
+	srcu_read_unlock(&frontswap_srcu, idx);
 	__frontswap_clear(sis, offset);
 	inc_frontswap_invalidates();
 }
@@ -439,6 +600,7 @@ void __frontswap_invalidate_area(unsigned type)
 {
 	struct swap_info_struct *sis = swap_info[type];
 	struct frontswap_ops *ops;
+	int idx;
 
 	VM_BUG_ON(!frontswap_ops);
 	VM_BUG_ON(sis == NULL);
@@ -446,8 +608,10 @@ void __frontswap_invalidate_area(unsigned type)
 	if (sis->frontswap_map == NULL)
 		return;
 
+	idx = srcu_read_lock(&frontswap_srcu);
 	for_each_frontswap_ops(ops)
 		ops->invalidate_area(type);
+	srcu_read_unlock(&frontswap_srcu, idx);
 	atomic_set(&sis->frontswap_pages, 0);
 	bitmap_zero(sis->frontswap_map, sis->max);
 }
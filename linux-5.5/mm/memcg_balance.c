@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * [Canvas] memcg_balance.c - rebalance local memory across co-located tenants
+ *
+ * Canvas isolates the remote swap path of each tenant, but the local DRAM
+ * limit of each memcg is still static. The balancer periodically moves the
+ * local limit between the memcgs that opted in (memory.canvas_priority > 0),
+ * keeping the sum of their limits within a host-wide budget set on the root
+ * memcg (memory.canvas_balance_budget_in_bytes). The local limit is
+ * memory.limit_in_bytes on cgroup v1 and memory.high on cgroup v2, see
+ * mem_cgroup_resize_local_max().
+ *
+ * Each period every tenant gets a score,
+ *
+ *   score = priority * swap-in rate * (1 + SLO_MISS_WEIGHT * SLO miss ratio)
+ *
+ * i.e. the value of the swap-ins that more local memory would avoid. One step
+ * of memory moves from the lowest score tenant to the highest score tenant
+ * when the gap exceeds the hysteresis. Tenants leaving part of their limit
+ * unused are preferred as donors since shrinking them costs nothing.
+ *
+ * Tenants are expected to be siblings: the swap-in events are hierarchical,
+ * so a managed tenant nested in another one is counted twice.
+ */
+#include <linux/memcontrol.h>
+#include <linux/page_counter.h>
+#include <linux/workqueue.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/swap_global_macro.h>
+
+#define BALANCE_MAX_TENANTS 64
+#define BALANCE_MIN_STEP ((16UL << 20) >> PAGE_SHIFT) /* 16MB */
+#define BALANCE_STEP_SHIFT 5 /* move budget/32 per period */
+#define BALANCE_HYSTERESIS 25 /* percent */
+#define BALANCE_SLO_MISS_WEIGHT 4
+#define BALANCE_MAX_PRIORITY 100
+
+struct balance_tenant {
+	struct mem_cgroup *memcg;
+	unsigned long max;
+	unsigned long usage;
+};
+
+static unsigned long balance_budget; /* pages, 0 disables the balancer */
+static unsigned int balance_interval_ms = 1000;
+
+/* serializes balancing periods against the knobs below */
+static DEFINE_MUTEX(balance_mutex);
+static struct balance_tenant balance_tenants[BALANCE_MAX_TENANTS];
+
+static void balance_workfn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(balance_work, balance_workfn);
+
+static void balance_snapshot(struct mem_cgroup *memcg)
+{
+	struct memcg_balance *b = &memcg->balance;
+
+	b->last_swapins = mem_cgroup_read_events(memcg, ONDEMAND_SWAPIN);
+	b->last_lat_accum = atomic64_read(&b->lat_accum);
+	b->last_lat_cnt = atomic_long_read(&b->lat_cnt);
+	b->last_slo_miss = atomic_long_read(&b->slo_miss);
+}
+
+static void balance_update_stats(struct mem_cgroup *memcg)
+{
+	struct memcg_balance *b = &memcg->balance;
+	unsigned long swapins, cnt, miss;
+	u64 lat, miss_weight;
+
+	swapins = mem_cgroup_read_events(memcg, ONDEMAND_SWAPIN);
+	/* the swap-in counters were reset through memory.stat */
+	if (swapins < b->last_swapins)
+		b->last_swapins = 0;
+	swapins -= b->last_swapins;
+	lat = atomic64_read(&b->lat_accum) - b->last_lat_accum;
+	cnt = atomic_long_read(&b->lat_cnt) - b->last_lat_cnt;
+	miss = atomic_long_read(&b->slo_miss) - b->last_slo_miss;
+	balance_snapshot(memcg);
+
+	b->swapin_rate = swapins * MSEC_PER_SEC / balance_interval_ms;
+	b->avg_lat_cycles = cnt ? div64_u64(lat, cnt) : 0;
+	b->slo_attained = cnt ? 1000 - min(miss, cnt) * 1000 / cnt : 1000;
+
+	/* a swap-in of a tenant missing its SLO is worth more to avoid */
+	miss_weight = 1000 + (u64)(1000 - b->slo_attained) *
+				     BALANCE_SLO_MISS_WEIGHT;
+	b->score = div_u64((u64)b->priority * b->swapin_rate * miss_weight,
+			   1000);
+}
+
+static int balance_collect(struct balance_tenant *tenants)
+{
+	struct mem_cgroup *memcg;
+	int nr = 0;
+
+	for (memcg = mem_cgroup_iter(NULL, NULL, NULL); memcg;
+	     memcg = mem_cgroup_iter(NULL, memcg, NULL)) {
+		if (mem_cgroup_is_root(memcg) || !memcg->balance.priority)
+			continue;
+		if (nr == BALANCE_MAX_TENANTS) {
+			pr_warn_once("%s, more than %d tenants, ignore the rest\n",
+				     __func__, BALANCE_MAX_TENANTS);
+			mem_cgroup_iter_break(NULL, memcg);
+			break;
+		}
+
+		css_get(&memcg->css);
+		balance_update_stats(memcg);
+		tenants[nr].memcg = memcg;
+		tenants[nr].max = mem_cgroup_local_max(memcg);
+		tenants[nr].usage = page_counter_read(&memcg->memory);
+		nr++;
+	}
+	return nr;
+}
+
+static int balance_set_max(struct balance_tenant *t, unsigned long max)
+{
+	int ret;
+
+	ret = mem_cgroup_resize_local_max(t->memcg, max);
+	if (ret) {
+		pr_debug("%s, resize memcg %p to %lu pages failed, %d\n",
+			 __func__, t->memcg, max, ret);
+		return ret;
+	}
+	t->max = max;
+	return 0;
+}
+
+static inline u64 tenant_score(struct balance_tenant *t)
+{
+	return t->memcg->balance.score;
+}
+
+/* The tenant losing the least by giving up @step pages, or -1. */
+static int balance_pick_donor(struct balance_tenant *tenants, int nr,
+			      int exclude, unsigned long step)
+{
+	int i, donor = -1, slack_donor = -1;
+
+	for (i = 0; i < nr; i++) {
+		struct balance_tenant *t = &tenants[i];
+
+		if (i == exclude || t->max < t->memcg->balance.min_pages + step)
+			continue;
+		if (t->max >= t->usage + step &&
+		    (slack_donor < 0 ||
+		     tenant_score(t) < tenant_score(&tenants[slack_donor])))
+			slack_donor = i;
+		if (donor < 0 || tenant_score(t) < tenant_score(&tenants[donor]))
+			donor = i;
+	}
+	return slack_donor >= 0 ? slack_donor : donor;
+}
+
+/* The tenant gaining the most from @step more pages, or -1. */
+static int balance_pick_receiver(struct balance_tenant *tenants, int nr)
+{
+	int i, recv = -1;
+
+	for (i = 0; i < nr; i++) {
+		if (!tenants[i].memcg->balance.swapin_rate)
+			continue;
+		if (recv < 0 ||
+		    tenant_score(&tenants[i]) > tenant_score(&tenants[recv]))
+			recv = i;
+	}
+	return recv;
+}
+
+static void balance_tenants_once(struct balance_tenant *tenants, int nr)
+{
+	unsigned long total = 0, step, sum_prio = 0;
+	int i, recv, donor;
+
+	step = max(balance_budget >> BALANCE_STEP_SHIFT, BALANCE_MIN_STEP);
+
+	for (i = 0; i < nr; i++)
+		sum_prio += tenants[i].memcg->balance.priority;
+
+	/* tenants joining the balancer start from their priority share */
+	for (i = 0; i < nr; i++) {
+		struct balance_tenant *t = &tenants[i];
+		unsigned long share;
+
+		if (t->max <= balance_budget)
+			continue;
+		share = balance_budget * t->memcg->balance.priority / sum_prio;
+		balance_set_max(t, max(share, t->memcg->balance.min_pages));
+	}
+
+	for (i = 0; i < nr; i++)
+		total += tenants[i].max;
+
+	if (total > balance_budget) {
+		/* the budget shrank, give memory back */
+		donor = balance_pick_donor(tenants, nr, -1, step);
+		if (donor >= 0)
+			balance_set_max(&tenants[donor],
+					tenants[donor].max -
+						min(step, total - balance_budget));
+		return;
+	}
+
+	recv = balance_pick_receiver(tenants, nr);
+	if (recv < 0)
+		return;
+
+	if (total < balance_budget) {
+		/* hand out the unassigned budget first */
+		balance_set_max(&tenants[recv],
+				tenants[recv].max +
+					min(step, balance_budget - total));
+		return;
+	}
+
+	donor = balance_pick_donor(tenants, nr, recv, step);
+	if (donor < 0)
+		return;
+
+	/* moving memory stalls the donor, only do it for a clear gain */
+	if (tenant_score(&tenants[recv]) * 100 <=
+	    tenant_score(&tenants[donor]) * (100 + BALANCE_HYSTERESIS))
+		return;
+
+	if (balance_set_max(&tenants[donor], tenants[donor].max - step))
+		return;
+	if (balance_set_max(&tenants[recv], tenants[recv].max + step))
+		balance_set_max(&tenants[donor], tenants[donor].max + step);
+}
+
+static void balance_workfn(struct work_struct *work)
+{
+	int nr, i;
+
+	mutex_lock(&balance_mutex);
+	if (!balance_budget)
+		goto out;
+
+	nr = balance_collect(balance_tenants);
+	if (nr)
+		balance_tenants_once(balance_tenants, nr);
+	for (i = 0; i < nr; i++)
+		css_put(&balance_tenants[i].memcg->css);
+
+	queue_delayed_work(system_unbound_wq, &balance_work,
+			   msecs_to_jiffies(balance_interval_ms));
+out:
+	mutex_unlock(&balance_mutex);
+}
+
+/*
+ * cgroup interface files
+ */
+
+static u64 canvas_priority_read(struct cgroup_subsys_state *css,
+				struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->balance.priority;
+}
+
+static int canvas_priority_write(struct cgroup_subsys_state *css,
+				 struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	if (val > BALANCE_MAX_PRIORITY)
+		return -EINVAL;
+
+	mutex_lock(&balance_mutex);
+	if (!memcg->balance.priority)
+		balance_snapshot(memcg);
+	memcg->balance.priority = val;
+	mutex_unlock(&balance_mutex);
+	return 0;
+}
+
+static u64 canvas_latency_slo_read(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return div_u64(mem_cgroup_from_css(css)->balance.slo_cycles,
+		       ADC_CPU_FREQ);
+}
+
+static int canvas_latency_slo_write(struct cgroup_subsys_state *css,
+				    struct cftype *cft, u64 val)
+{
+	/* ADC_CPU_FREQ is in MHz, i.e. cycles per us */
+	mem_cgroup_from_css(css)->balance.slo_cycles = val * ADC_CPU_FREQ;
+	return 0;
+}
+
+static u64 canvas_min_limit_read(struct cgroup_subsys_state *css,
+				 struct cftype *cft)
+{
+	return (u64)mem_cgroup_from_css(css)->balance.min_pages * PAGE_SIZE;
+}
+
+static ssize_t canvas_min_limit_write(struct kernfs_open_file *of, char *buf,
+				      size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long min_pages;
+	int ret;
+
+	buf = strstrip(buf);
+	ret = page_counter_memparse(buf, "max", &min_pages);
+	if (ret)
+		return ret;
+
+	mutex_lock(&balance_mutex);
+	memcg->balance.min_pages = min_pages;
+	mutex_unlock(&balance_mutex);
+	return nbytes;
+}
+
+static int canvas_balance_stat_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	struct memcg_balance *b = &memcg->balance;
+
+	seq_printf(m, "swapin_rate %lu\n", b->swapin_rate);
+	seq_printf(m, "avg_swapin_latency_ns %llu\n",
+		   div_u64(b->avg_lat_cycles * 1000, ADC_CPU_FREQ));
+	seq_printf(m, "slo_attained_permille %u\n", b->slo_attained);
+	seq_printf(m, "score %llu\n", b->score);
+	seq_printf(m, "limit_in_bytes %llu\n",
+		   (u64)mem_cgroup_local_max(memcg) * PAGE_SIZE);
+	return 0;
+}
+
+static u64 canvas_balance_budget_read(struct cgroup_subsys_state *css,
+				      struct cftype *cft)
+{
+	return (u64)balance_budget * PAGE_SIZE;
+}
+
+static ssize_t canvas_balance_budget_write(struct kernfs_open_file *of,
+					   char *buf, size_t nbytes, loff_t off)
+{
+	unsigned long budget;
+	int ret;
+
+	buf = strstrip(buf);
+	ret = page_counter_memparse(buf, "0", &budget);
+	if (ret)
+		return ret;
+
+	mutex_lock(&balance_mutex);
+	balance_budget = budget;
+	mutex_unlock(&balance_mutex);
+
+	if (budget) {
+		mod_delayed_work(system_unbound_wq, &balance_work, 0);
+		pr_info("Canvas local memory balancer: budget %lu pages, period %ums\n",
+			budget, balance_interval_ms);
+	} else {
+		cancel_delayed_work_sync(&balance_work);
+		pr_info("Canvas local memory balancer: disabled\n");
+	}
+	return nbytes;
+}
+
+static u64 canvas_balance_interval_read(struct cgroup_subsys_state *css,
+					struct cftype *cft)
+{
+	return balance_interval_ms;
+}
+
+static int canvas_balance_interval_write(struct cgroup_subsys_state *css,
+					 struct cftype *cft, u64 val)
+{
+	if (val < 100 || val > 60 * MSEC_PER_SEC)
+		return -EINVAL;
+
+	mutex_lock(&balance_mutex);
+	balance_interval_ms = val;
+	mutex_unlock(&balance_mutex);
+	return 0;
+}
+
+static struct cftype memcg_balance_legacy_files[] = {
+	{
+		.name = "canvas_priority",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_priority_read,
+		.write_u64 = canvas_priority_write,
+	},
+	{
+		.name = "canvas_latency_slo_us",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_latency_slo_read,
+		.write_u64 = canvas_latency_slo_write,
+	},
+	{
+		.name = "canvas_min_limit_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_min_limit_read,
+		.write = canvas_min_limit_write,
+	},
+	{
+		.name = "canvas_balance_stat",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = canvas_balance_stat_show,
+	},
+	{
+		.name = "canvas_balance_budget_in_bytes",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.read_u64 = canvas_balance_budget_read,
+		.write = canvas_balance_budget_write,
+	},
+	{
+		.name = "canvas_balance_interval_ms",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.read_u64 = canvas_balance_interval_read,
+		.write_u64 = canvas_balance_interval_write,
+	},
+	{ }	/* terminate */
+};
+
+static struct cftype memcg_balance_files[] = {
+	{
+		.name = "canvas_priority",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_priority_read,
+		.write_u64 = canvas_priority_write,
+	},
+	{
+		.name = "canvas_latency_slo_us",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_latency_slo_read,
+		.write_u64 = canvas_latency_slo_write,
+	},
+	{
+		.name = "canvas_min_limit",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = canvas_min_limit_read,
+		.write = canvas_min_limit_write,
+	},
+	{
+		.name = "canvas_balance_stat",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = canvas_balance_stat_show,
+	},
+	{
+		.name = "canvas_balance_budget",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.read_u64 = canvas_balance_budget_read,
+		.write = canvas_balance_budget_write,
+	},
+	{
+		.name = "canvas_balance_interval_ms",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.read_u64 = canvas_balance_interval_read,
+		.write_u64 = canvas_balance_interval_write,
+	},
+	{ }	/* terminate */
+};
+
+static int __init memcg_balance_init(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+
+	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
+				       memcg_balance_files));
+	WARN_ON(cgroup_add_legacy_cftypes(&memory_cgrp_subsys,
+					  memcg_balance_legacy_files));
+	return 0;
+}
+subsys_initcall(memcg_balance_init);
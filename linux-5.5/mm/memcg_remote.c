@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * [Canvas] memcg_remote.c - per-tenant quota of the remote memory
+ *
+ * The remote memory is shared by all the tenants of a CPU server, and
+ * nothing stops one of them from taking all of it. Each page frontswap
+ * takes is charged to the remote counter of the memcg of the page when it
+ * is stored, and uncharged when its swap entry is freed, or when the entry
+ * is stored again. The memcg is recorded by id per swap entry, like a swap
+ * charge, so the charge outlives the cgroup until the entry is freed.
+ *
+ * A store that would take a memcg over its memory.remote.max, or that of
+ * an ancestor, is refused and the page is written to the swap device
+ * instead. With memory.remote.policy = 1 (reclaim), the memcg also gives
+ * back the remote memory of the pages it faults in, while it uses 70% of
+ * its remote.max or more: their remote copies are freed instead of being
+ * kept for the next swap-out, see mem_cgroup_swap_full(). With 0 (fallback,
+ * the default), the pages over the quota just go to the swap device.
+ *
+ * The files are memory.remote.{current,max,policy,events} on cgroup v2 and
+ * memory.remote.{usage_in_bytes,limit_in_bytes,policy,failcnt} on v1.
+ */
+#include <linux/memcontrol.h>
+#include <linux/page_counter.h>
+#include <linux/seq_file.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+
+#define REMOTE_POLICY_FALLBACK 0
+#define REMOTE_POLICY_RECLAIM 1
+
+/* memcg id per swap entry in the remote memory, 0: none */
+static unsigned short *remote_ids[MAX_SWAPFILES];
+
+int mem_cgroup_remote_swapon(int type, unsigned long max_pages)
+{
+	unsigned short *ids;
+
+	if (mem_cgroup_disabled())
+		return 0;
+
+	ids = vzalloc(array_size(max_pages, sizeof(*ids)));
+	if (!ids)
+		return -ENOMEM;
+	WRITE_ONCE(remote_ids[type], ids);
+	return 0;
+}
+
+/* swapoff, all the entries are freed by now */
+void mem_cgroup_remote_swapoff(int type)
+{
+	unsigned short *ids = remote_ids[type];
+
+	WRITE_ONCE(remote_ids[type], NULL);
+	vfree(ids);
+}
+
+/*
+ * Charges the page stored by frontswap at @offset of swap @type to its
+ * memcg. Returns -ENOMEM if the memcg is over its quota.
+ */
+int mem_cgroup_charge_remote(struct page *page, int type, pgoff_t offset)
+{
+	unsigned short *ids = READ_ONCE(remote_ids[type]);
+	struct page_counter *counter;
+	struct mem_cgroup *memcg;
+
+	if (!ids)
+		return 0;
+	memcg = page->mem_cgroup;
+	if (!memcg || mem_cgroup_is_root(memcg))
+		return 0;
+
+	memcg = mem_cgroup_id_get_remote(memcg);
+	if (mem_cgroup_is_root(memcg)) {
+		mem_cgroup_id_put_remote(memcg);
+		return 0;
+	}
+	if (!page_counter_try_charge(&memcg->remote, 1, &counter)) {
+		mem_cgroup_id_put_remote(memcg);
+		return -ENOMEM;
+	}
+	ids[offset] = mem_cgroup_id(memcg);
+	return 0;
+}
+
+void mem_cgroup_uncharge_remote(int type, pgoff_t offset)
+{
+	unsigned short *ids = READ_ONCE(remote_ids[type]);
+	struct mem_cgroup *memcg;
+	unsigned short id;
+
+	if (!ids || !ids[offset])
+		return;
+	id = ids[offset];
+	ids[offset] = 0;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_id(id);
+	if (memcg) {
+		page_counter_uncharge(&memcg->remote, 1);
+		mem_cgroup_id_put_remote(memcg);
+	}
+	rcu_read_unlock();
+}
+
+/* The memcg of @page, or an ancestor, gives back its remote memory. */
+bool mem_cgroup_remote_full(struct page *page)
+{
+	struct mem_cgroup *memcg;
+
+	for (memcg = page->mem_cgroup; memcg && !mem_cgroup_is_root(memcg);
+	     memcg = parent_mem_cgroup(memcg)) {
+		if (READ_ONCE(memcg->remote_policy) == REMOTE_POLICY_RECLAIM &&
+		    page_counter_read(&memcg->remote) * 10 / 7 >=
+			    READ_ONCE(memcg->remote.max))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * cgroup interface files
+ */
+
+static u64 remote_current_read(struct cgroup_subsys_state *css,
+			       struct cftype *cft)
+{
+	return (u64)page_counter_read(&mem_cgroup_from_css(css)->remote) *
+	       PAGE_SIZE;
+}
+
+static u64 remote_limit_read(struct cgroup_subsys_state *css,
+			     struct cftype *cft)
+{
+	return (u64)READ_ONCE(mem_cgroup_from_css(css)->remote.max) *
+	       PAGE_SIZE;
+}
+
+static int remote_max_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	unsigned long max = READ_ONCE(memcg->remote.max);
+
+	if (max == PAGE_COUNTER_MAX)
+		seq_puts(m, "max\n");
+	else
+		seq_printf(m, "%llu\n", (u64)max * PAGE_SIZE);
+	return 0;
+}
+
+/*
+ * A memcg over a lowered quota keeps its remote memory, only its next
+ * stores go to the swap device.
+ */
+static ssize_t remote_max_write(struct kernfs_open_file *of, char *buf,
+				size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long max;
+	int ret;
+
+	buf = strstrip(buf);
+	ret = page_counter_memparse(buf,
+			cgroup_subsys_on_dfl(memory_cgrp_subsys) ? "max" : "-1",
+			&max);
+	if (ret)
+		return ret;
+
+	xchg(&memcg->remote.max, max);
+	return nbytes;
+}
+
+static u64 remote_policy_read(struct cgroup_subsys_state *css,
+			      struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->remote_policy;
+}
+
+static int remote_policy_write(struct cgroup_subsys_state *css,
+			       struct cftype *cft, u64 val)
+{
+	if (val > REMOTE_POLICY_RECLAIM)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->remote_policy, val);
+	return 0;
+}
+
+/* the stores refused because of this memcg's quota */
+static u64 remote_failcnt_read(struct cgroup_subsys_state *css,
+			       struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->remote.failcnt;
+}
+
+static int remote_events_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "max %lu\n",
+		   mem_cgroup_from_css(seq_css(m))->remote.failcnt);
+	return 0;
+}
+
+static struct cftype memcg_remote_legacy_files[] = {
+	{
+		.name = "remote.usage_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_current_read,
+	},
+	{
+		.name = "remote.limit_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_limit_read,
+		.write = remote_max_write,
+	},
+	{
+		.name = "remote.policy",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_policy_read,
+		.write_u64 = remote_policy_write,
+	},
+	{
+		.name = "remote.failcnt",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_failcnt_read,
+	},
+	{ }	/* terminate */
+};
+
+static struct cftype memcg_remote_files[] = {
+	{
+		.name = "remote.current",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_current_read,
+	},
+	{
+		.name = "remote.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = remote_max_show,
+		.write = remote_max_write,
+	},
+	{
+		.name = "remote.policy",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = remote_policy_read,
+		.write_u64 = remote_policy_write,
+	},
+	{
+		.name = "remote.events",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = remote_events_show,
+	},
+	{ }	/* terminate */
+};
+
+static int __init memcg_remote_init(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+
+	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
+				       memcg_remote_files));
+	WARN_ON(cgroup_add_legacy_cftypes(&memory_cgrp_subsys,
+					  memcg_remote_legacy_files));
+	return 0;
+}
+subsys_initcall(memcg_remote_init);
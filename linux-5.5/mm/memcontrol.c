@@ -1423,6 +1423,10 @@ static char *memory_stat_format(struct mem_cgroup *memcg)
 	seq_buf_printf(&s, "slab_unreclaimable %llu\n",
 		       (u64)memcg_page_state(memcg, NR_SLAB_UNRECLAIMABLE) *
 		       PAGE_SIZE);
+	/* [Canvas] swap cache size */
+	seq_buf_printf(&s, "swap_cache %llu\n",
+		       (u64)memcg_page_state(memcg, MEMCG_SWAP_CACHE) *
+		       PAGE_SIZE);
 
 	/* Accumulated memory events */
 
@@ -1430,6 +1434,15 @@ static char *memory_stat_format(struct mem_cgroup *memcg)
 		       memcg_events(memcg, PGFAULT));
 	seq_buf_printf(&s, "%s %lu\n", vm_event_name(PGMAJFAULT),
 		       memcg_events(memcg, PGMAJFAULT));
+#ifdef CONFIG_SWAP
+	/* [Canvas] Per-cgroup swap cache stats, reset by writing to the file */
+	seq_buf_printf(&s, "%s %lu\n", vm_event_name(ONDEMAND_SWAPIN),
+		       memcg_events(memcg, ONDEMAND_SWAPIN));
+	seq_buf_printf(&s, "%s %lu\n", vm_event_name(PREFETCH_SWAPIN),
+		       memcg_events(memcg, PREFETCH_SWAPIN));
+	seq_buf_printf(&s, "%s %lu\n", vm_event_name(HITON_SWAP_CACHE),
+		       memcg_events(memcg, HITON_SWAP_CACHE));
+#endif
 
 	seq_buf_printf(&s, "workingset_refault %lu\n",
 		       memcg_page_state(memcg, WORKINGSET_REFAULT));
@@ -3038,6 +3051,44 @@ static int mem_cgroup_resize_max(struct mem_cgroup *memcg,
 	return ret;
 }
 
+/*
+ * [Canvas] let the local memory balancer move the local limit between
+ * tenants. On the default hierarchy the balancer moves memory.high instead of
+ * memory.max: a shrunk tenant is reclaimed to remote memory and throttled,
+ * rather than OOM killed, and memory.max stays the hard cap set by the admin.
+ */
+unsigned long mem_cgroup_local_max(struct mem_cgroup *memcg)
+{
+	unsigned long max = READ_ONCE(memcg->memory.max);
+
+	if (cgroup_subsys_on_dfl(memory_cgrp_subsys))
+		return min(READ_ONCE(memcg->high), max);
+	return max;
+}
+
+int mem_cgroup_resize_local_max(struct mem_cgroup *memcg, unsigned long max)
+{
+	unsigned long nr_pages;
+
+	if (!cgroup_subsys_on_dfl(memory_cgrp_subsys))
+		return mem_cgroup_resize_max(memcg, max, false);
+
+	if (max > READ_ONCE(memcg->memory.max))
+		return -EINVAL;
+
+	WRITE_ONCE(memcg->high, max);
+	nr_pages = page_counter_read(&memcg->memory);
+	if (nr_pages > max)
+		try_to_free_mem_cgroup_pages(memcg, nr_pages - max,
+					     GFP_KERNEL, true);
+	return 0;
+}
+
+unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg, int event)
+{
+	return memcg_events(memcg, event);
+}
+
 unsigned long mem_cgroup_soft_limit_reclaim(pg_data_t *pgdat, int order,
 					    gfp_t gfp_mask,
 					    unsigned long *total_scanned)
@@ -3821,9 +3872,13 @@ static int memcg_adc_stat_reset(struct cgroup_subsys_state *css,
 	for (event = ONDEMAND_SWAPIN; event <= HITON_SWAP_CACHE; event++) {
 		int cpu;
 		atomic_long_set(&memcg->vmevents[event], 0);
-		for_each_possible_cpu(cpu)
+		for_each_possible_cpu(cpu) {
 			*per_cpu_ptr(&memcg->vmstats_local->events[event], cpu) =
 				0;
+			/* drop the not yet flushed batch as well */
+			*per_cpu_ptr(&memcg->vmstats_percpu->events[event], cpu) =
+				0;
+		}
 	}
 	return 0;
 }
@@ -4848,6 +4903,27 @@ struct mem_cgroup *mem_cgroup_from_id(unsigned short id)
 	return idr_find(&mem_cgroup_idr, id);
 }
 
+/*
+ * [Canvas] a remote memory charge pins the id of its memcg, or of the nearest
+ * online ancestor, like a swap charge, see mm/memcg_remote.c.
+ */
+struct mem_cgroup *mem_cgroup_id_get_remote(struct mem_cgroup *memcg)
+{
+	while (!refcount_inc_not_zero(&memcg->id.ref)) {
+		if (WARN_ON_ONCE(memcg == root_mem_cgroup))
+			break;
+		memcg = parent_mem_cgroup(memcg);
+		if (!memcg)
+			memcg = root_mem_cgroup;
+	}
+	return memcg;
+}
+
+void mem_cgroup_id_put_remote(struct mem_cgroup *memcg)
+{
+	mem_cgroup_id_put(memcg);
+}
+
 static int alloc_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
 {
 	struct mem_cgroup_per_node *pn;
@@ -5012,12 +5088,14 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 		page_counter_init(&memcg->memsw, &parent->memsw);
 		page_counter_init(&memcg->kmem, &parent->kmem);
 		page_counter_init(&memcg->tcpmem, &parent->tcpmem);
+		page_counter_init(&memcg->remote, &parent->remote); /* [Canvas] */
 	} else {
 		page_counter_init(&memcg->memory, NULL);
 		page_counter_init(&memcg->swap, NULL);
 		page_counter_init(&memcg->memsw, NULL);
 		page_counter_init(&memcg->kmem, NULL);
 		page_counter_init(&memcg->tcpmem, NULL);
+		page_counter_init(&memcg->remote, NULL); /* [Canvas] */
 		/*
 		 * Deeper hierachy with use_hierarchy == false doesn't make
 		 * much sense so let cgroup subsystem know about this
@@ -6183,6 +6261,14 @@ static struct cftype memory_files[] = {
 		.name = "stat",
 		.flags = CFTYPE_NOT_ON_ROOT,
 		.seq_show = memory_stat_show,
+		.write_u64 = memcg_adc_stat_reset,
+	},
+	{
+		/* [Canvas] per-tenant swappiness, also on the default hierarchy */
+		.name = "swappiness",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_swappiness_read,
+		.write_u64 = mem_cgroup_swappiness_write,
 	},
 	{
 		.name = "oom.group",
@@ -7056,6 +7142,9 @@ bool mem_cgroup_swap_full(struct page *page)
 
 	if (vm_swap_full())
 		return true;
+	/* [Canvas] give back the remote memory over the quota */
+	if (mem_cgroup_remote_full(page))
+		return true;
 	if (!do_swap_account || !cgroup_subsys_on_dfl(memory_cgrp_subsys))
 		return false;
 
@@ -89,6 +89,7 @@
 /* [Canvas] profile swap stats. */
 #include <linux/swap_stats.h>
 #include <linux/page_idle.h>
+#include <trace/events/canvas.h>
 
 #if defined(LAST_CPUPID_NOT_IN_PAGE_FLAGS) && !defined(CONFIG_COMPILE_TEST)
 #warning Unfortunate NUMA and NUMA Balancing config, growing page-frame for last_cpupid.
@@ -2903,6 +2904,7 @@ vm_fault_t do_swap_page_profiling(struct vm_fault *vmf, int *swap_major)
 	pte_t pte;
 	int locked;
 	int exclusive = 0;
+	bool on_device;
 	vm_fault_t ret = 0;
 
 	if (!pte_unmap_same(vma->vm_mm, vmf->pmd, vmf->pte, vmf->orig_pte))
@@ -2936,7 +2938,24 @@ vm_fault_t do_swap_page_profiling(struct vm_fault *vmf, int *swap_major)
 			// Hit on swap cache (only prefetched pages)
 			adc_profile_counter_inc(ADC_HIT_ON_PREFETCH);
 			count_memcg_event_mm(vma->vm_mm, HITON_SWAP_CACHE);
+			trace_canvas_swapin(vmf->address, entry,
+					    CANVAS_SWAPIN_HIT_PREFETCH);
+		} else {
+			trace_canvas_swapin(vmf->address, entry,
+					    CANVAS_SWAPIN_HIT);
+		}
+	} else {
+		trace_canvas_swapin(vmf->address, entry, CANVAS_SWAPIN_MISS);
+	}
+
+	// [Canvas] async swap fault: start the swap-in and return to user
+	if (!page && userfaultfd_armed(vma)) {
+		ret = handle_userfault_swapin(vmf, entry, &page);
+		if (ret) {
+			delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+			goto out;
 		}
+		swapcache = page;
 	}
 
 	if (!page) {
@@ -3108,12 +3127,18 @@ vm_fault_t do_swap_page_profiling(struct vm_fault *vmf, int *swap_major)
 		activate_page(page);
 	}
 
+	/* [Canvas] a page frontswap did not take, e.g. past the remote
+	 * memory, was read from the swap device. It gets a new entry at its
+	 * next swap-out, in the remote memory if a slot is free by then. */
+	on_device = frontswap_enabled() &&
+		    !frontswap_test(swp_swap_info(entry), swp_offset(entry));
+
 	/* [Canvas] adaptive entry allocation & reservation */
-	if (reserve_swp_entry_enabled())
+	if (reserve_swp_entry_enabled() && !on_device)
 		swap_reserve(page, entry);
 	else
 		swap_free(entry);
-	if (mem_cgroup_swap_full(page) ||
+	if (mem_cgroup_swap_full(page) || on_device ||
 	    (vma->vm_flags & VM_LOCKED) || PageMlocked(page))
 		try_to_free_swap(page);
 	unlock_page(page);
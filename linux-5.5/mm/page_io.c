@@ -31,6 +31,7 @@
 /* [Canvas] profile swap out latency */
 #include <linux/swap_stats.h>
 #include <linux/swap_global_struct_mem_layer.h>
+#include <trace/events/canvas.h>
 
 #include "internal.h"
 /* [Canvas] end */
@@ -263,6 +264,7 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 	}
 	pf_ts_stt = get_cycles_start();
 	if (frontswap_store(page) == 0) {
+		trace_canvas_swapout(page, true);
 		set_page_writeback(page);
 		unlock_page(page);
 		end_page_writeback(page);
@@ -271,6 +273,7 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 		accum_adc_time_stat(ADC_SWAPOUT_LATENCY, pf_ts_end - pf_ts_stt);
 		goto out;
 	}
+	trace_canvas_swapout(page, false);
 	ret = __swap_writepage(page, wbc, end_swap_bio_write);
 out:
 	return ret;
@@ -30,6 +30,7 @@
 // [Canvas] profile swap stats.
 #include <linux/swap_stats.h>
 #include <linux/page_idle.h>
+#include <trace/events/canvas.h>
 
 // for uffd
 #include <linux/swap_global_struct_mem_layer.h>
@@ -676,6 +677,7 @@ struct page *swap_cluster_readahead_profiling(swp_entry_t entry, gfp_t gfp_mask,
 			count_vm_event(SWAP_RA);
 
 			set_page_prefetch(page);
+			trace_canvas_swap_prefetch(offset_entry);
 			adc_profile_counter_inc(ADC_PREFETCH_SWAPIN);
 			if (vma->vm_mm)
 				count_memcg_event_mm(vma->vm_mm,
@@ -1043,6 +1045,7 @@ static struct page *swap_vma_readahead_profiling(swp_entry_t fentry,
 			count_vm_event(SWAP_RA);
 
 			set_page_prefetch(page);
+			trace_canvas_swap_prefetch(entry);
 			adc_profile_counter_inc(ADC_PREFETCH_SWAPIN);
 			if (vma->vm_mm)
 				count_memcg_event_mm(vma->vm_mm,
@@ -1162,6 +1165,7 @@ static inline bool swap_vma_prefetch(swp_entry_t fentry, gfp_t gfp_mask,
 			count_vm_event(SWAP_RA);
 
 			set_page_prefetch(page);
+			trace_canvas_swap_prefetch(entry);
 			adc_profile_counter_inc(ADC_PREFETCH_SWAPIN);
 			if (vma->vm_mm)
 				count_memcg_event_mm(vma->vm_mm,
@@ -1253,6 +1257,7 @@ static inline bool swap_cluster_prefetch(swp_entry_t entry, gfp_t gfp_mask,
 			count_vm_event(SWAP_RA);
 
 			set_page_prefetch(page);
+			trace_canvas_swap_prefetch(offset_entry);
 			adc_profile_counter_inc(ADC_PREFETCH_SWAPIN);
 			if (vma->vm_mm)
 				count_memcg_event_mm(vma->vm_mm,
@@ -1422,6 +1427,7 @@ static void swap_vma_readahead_prefetch(gfp_t gfp_mask,
 			count_vm_event(SWAP_RA);
 
 			set_page_prefetch(page);
+			trace_canvas_swap_prefetch(entry);
 			adc_profile_counter_inc(ADC_PREFETCH_SWAPIN);
 			if (vma->vm_mm)
 				count_memcg_event_mm(vma->vm_mm,
@@ -5,6 +5,9 @@
 // [Canvas]
 #include <linux/swap_global_macro.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/canvas.h>
+
 /* swap isolation */
 bool __swap_isolated = true;
 EXPORT_SYMBOL(__swap_isolated);
@@ -131,9 +134,11 @@ void add_to_sc_list(struct swapcache_list *sc_list, swp_entry_t entry,
 			sc_list->entries[head] = entry.val;
 			inc_sc_list_head(sc_list);
 			sc_list->size++;
+			spin_unlock_irq(&sc_list->lock);
+			return;
 		}
+		// filled up by others meanwhile, evict one for the page instead
 		spin_unlock_irq(&sc_list->lock);
-		return;
 	}
 	while (!find && trails < sc_list->capacity) {
 		struct page *victim_page = NULL;
@@ -2873,6 +2873,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	kvfree(frontswap_map);
 	/* Destroy swap account information */
 	swap_cgroup_swapoff(p->type);
+	mem_cgroup_remote_swapoff(p->type); /* [Canvas] */
 	exit_swap_address_space(p->type);
 
 	inode = mapping->host;
@@ -3463,6 +3464,12 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (IS_ENABLED(CONFIG_FRONTSWAP))
 		frontswap_map = kvcalloc(BITS_TO_LONGS(maxpages), sizeof(long),
 					 GFP_KERNEL);
+	/* [Canvas] and the memcg charged for each page in frontswap */
+	if (frontswap_map) {
+		error = mem_cgroup_remote_swapon(p->type, maxpages);
+		if (error)
+			goto bad_swap;
+	}
 
 	if (p->bdev && (swap_flags & SWAP_FLAG_DISCARD) &&
 	    swap_discardable(p)) {
@@ -3542,6 +3549,7 @@ bad_swap:
 	}
 	destroy_swap_extents(p);
 	swap_cgroup_swapoff(p->type);
+	mem_cgroup_remote_swapoff(p->type); /* [Canvas] */
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
 	p->flags = 0;
@@ -3997,6 +4005,13 @@ void mem_cgroup_throttle_swaprate(struct mem_cgroup *memcg, int node,
 	plist_for_each_entry_safe (si, next, &swap_avail_heads[node],
 				   avail_lists[node]) {
 		if (si->bdev) {
+			/*
+			 * [Canvas] swap-ins of a frontswap backed device are
+			 * served by remote memory, the congestion of the block
+			 * device says nothing about them.
+			 */
+			if (frontswap_enabled() && frontswap_map_get(si))
+				break;
 			blkcg_schedule_throttle(bdev_get_queue(si->bdev), true);
 			break;
 		}
@@ -4057,9 +4072,7 @@ void swap_reserve(struct page *page, swp_entry_t entry)
 
 void free_reserved_swp_entry(struct page *page)
 {
-	swp_entry_t entry = get_reserved_swp_entry(page);
-	if (is_valid_swp_entry(entry)) {
-		set_reserved_swp_entry(page, invalid_swp_entry());
+	swp_entry_t entry = alloc_reserved_swp_entry(page);
+	if (is_valid_swp_entry(entry))
 		free_swap_slot_try_lock(entry);
-	}
 }
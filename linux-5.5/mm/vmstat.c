@@ -1179,10 +1179,6 @@ const char * const vmstat_text[] = {
 	"pgpgout",
 	"pswpin",
 	"pswpout",
-	/* [Canvas] Per-cgroup swap cache stats */
-	"ondemand_swapin",
-	"prefetch_swapin",
-	"hiton_swap_cache",
 
 	TEXTS_FOR_ZONES("pgalloc")
 	TEXTS_FOR_ZONES("allocstall")
@@ -0,0 +1,377 @@
+#include "rswap_rdma.h"
+
+/*
+ * One-sided chunk allocation, see the alloc map in constants.h. The client
+ * claims and returns its chunks with RDMA atomics on the alloc map of the
+ * memory server, the server CPU only hands out the map and a client slot.
+ * Everything here runs at connect and disconnect time on rdma queue 0, and
+ * waits for each operation.
+ */
+
+int rswap_one_sided;
+MODULE_PARM_DESC(one_sided,
+		 "Claim remote chunks with RDMA atomics, fall back to messages if the memory server can't");
+module_param_named(one_sided, rswap_one_sided, int, 0444);
+
+struct rswap_alloc_req {
+	struct ib_cqe cqe;
+	struct completion done;
+	struct rswap_rdma_queue *rdma_queue;
+	enum ib_wc_status status;
+};
+
+static void rswap_alloc_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_alloc_req *req =
+		container_of(wc->wr_cqe, struct rswap_alloc_req, cqe);
+
+	req->status = wc->status;
+	atomic_dec(&req->rdma_queue->rdma_post_counter);
+	complete(&req->done);
+}
+
+// Post @wr landing in @buf of @len bytes and wait for it.
+static int rswap_alloc_post(struct rdma_session_context *rdma_session,
+			    struct ib_send_wr *wr, void *buf, size_t len)
+{
+	struct rswap_rdma_queue *rdma_queue = &(rdma_session->rdma_queues[0]);
+	struct ib_device *dev = rdma_session->rdma_dev->dev;
+	const struct ib_send_wr *bad_wr;
+	struct rswap_alloc_req req;
+	struct ib_sge sge;
+	u64 dma_addr;
+	int ret;
+
+	dma_addr = ib_dma_map_single(dev, buf, len, DMA_FROM_DEVICE);
+	if (unlikely(ib_dma_mapping_error(dev, dma_addr))) {
+		pr_err("%s, map rdma buffer failed.\n", __func__);
+		return -ENOMEM;
+	}
+	sge.addr = dma_addr;
+	sge.length = len;
+	sge.lkey = dev->local_dma_lkey;
+
+	req.cqe.done = rswap_alloc_done;
+	req.rdma_queue = rdma_queue;
+	req.status = IB_WC_SUCCESS;
+	init_completion(&req.done);
+
+	wr->wr_cqe = &req.cqe;
+	wr->sg_list = &sge;
+	wr->num_sge = 1;
+	wr->send_flags = IB_SEND_SIGNALED;
+
+	atomic_inc(&rdma_queue->rdma_post_counter);
+	ret = ib_post_send(rdma_queue->qp, wr, &bad_wr);
+	if (unlikely(ret)) {
+		pr_err("%s, post rdma wr error %d\n", __func__, ret);
+		atomic_dec(&rdma_queue->rdma_post_counter);
+		goto out;
+	}
+
+	drain_rdma_queue(rdma_queue);
+	wait_for_completion(&req.done);
+	if (unlikely(req.status != IB_WC_SUCCESS)) {
+		pr_err("%s, rdma wr failed, %s\n", __func__,
+		       rdma_wc_status_name(req.status));
+		ret = -EIO;
+	}
+out:
+	ib_dma_unmap_single(dev, dma_addr, len, DMA_FROM_DEVICE);
+	return ret;
+}
+
+// @buf may be anywhere, the rdma read lands in a kmalloc'ed bounce buffer.
+static int rswap_alloc_read(struct rdma_session_context *rdma_session,
+			    uint64_t off, void *buf, size_t len)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	struct ib_rdma_wr wr;
+	void *bounce;
+	int ret;
+
+	bounce = kmalloc(len, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr.opcode = IB_WR_RDMA_READ;
+	wr.remote_addr = map->remote_addr + off;
+	wr.rkey = map->rkey;
+	ret = rswap_alloc_post(rdma_session, &wr.wr, bounce, len);
+	if (!ret)
+		memcpy(buf, bounce, len);
+	kfree(bounce);
+	return ret;
+}
+
+// Atomics return the old value of the remote word in *@old.
+static int rswap_alloc_atomic(struct rdma_session_context *rdma_session,
+			      enum ib_wr_opcode opcode, uint64_t off,
+			      uint64_t compare_add, uint64_t swap,
+			      uint64_t *old)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	struct ib_atomic_wr wr;
+	int ret;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr.opcode = opcode;
+	wr.remote_addr = map->remote_addr + off;
+	wr.rkey = map->rkey;
+	wr.compare_add = compare_add;
+	wr.swap = swap;
+	ret = rswap_alloc_post(rdma_session, &wr.wr, map->atomic_buf,
+			       sizeof(uint64_t));
+	*old = *map->atomic_buf;
+	return ret;
+}
+
+static inline uint64_t rswap_alloc_owner_off(struct rswap_alloc_map *map,
+					     uint32_t idx)
+{
+	return map->header.owner_off + idx * sizeof(uint64_t);
+}
+
+static inline uint64_t rswap_alloc_used_off(struct rswap_alloc_map *map)
+{
+	return map->header.client_off +
+	       map->slot * sizeof(struct rswap_alloc_client) +
+	       offsetof(struct rswap_alloc_client, used);
+}
+
+// Claim a free chunk of the alloc map within the quota, its index in *@idx.
+static int rswap_alloc_claim(struct rdma_session_context *rdma_session,
+			     uint32_t *idx)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	uint64_t owner = map->slot + 1;
+	uint64_t old, start;
+	uint32_t i, n;
+	int ret;
+
+	ret = rswap_alloc_atomic(rdma_session, IB_WR_ATOMIC_FETCH_AND_ADD,
+				 rswap_alloc_used_off(map), 1, 0, &old);
+	if (ret)
+		return ret;
+	if (map->quota && old >= map->quota) {
+		ret = -ENOSPC;
+		goto undo;
+	}
+
+	ret = rswap_alloc_atomic(rdma_session, IB_WR_ATOMIC_FETCH_AND_ADD,
+				 offsetof(struct rswap_alloc_header, cursor), 1,
+				 0, &start);
+	if (ret)
+		goto undo;
+
+	for (n = 0; n < map->header.nr_chunks; n++) {
+		i = (start + n) % map->header.nr_chunks;
+		ret = rswap_alloc_atomic(rdma_session,
+					 IB_WR_ATOMIC_CMP_AND_SWP,
+					 rswap_alloc_owner_off(map, i), 0,
+					 owner, &old);
+		if (ret)
+			goto undo;
+		if (old == 0) {
+			*idx = i;
+			return 0;
+		}
+	}
+	ret = -ENOSPC;
+undo:
+	rswap_alloc_atomic(rdma_session, IB_WR_ATOMIC_FETCH_AND_ADD,
+			   rswap_alloc_used_off(map), (uint64_t)-1, 0, &old);
+	return ret;
+}
+
+static int rswap_alloc_unclaim(struct rdma_session_context *rdma_session,
+			       uint32_t idx)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	uint64_t owner = map->slot + 1;
+	uint64_t old;
+	int ret;
+
+	ret = rswap_alloc_atomic(rdma_session, IB_WR_ATOMIC_CMP_AND_SWP,
+				 rswap_alloc_owner_off(map, idx), owner, 0,
+				 &old);
+	if (ret)
+		return ret;
+	// taken back by the server already
+	if (old != owner)
+		return 0;
+	return rswap_alloc_atomic(rdma_session, IB_WR_ATOMIC_FETCH_AND_ADD,
+				  rswap_alloc_used_off(map), (uint64_t)-1, 0,
+				  &old);
+}
+
+// Get the alloc map and a client slot in it from the memory server.
+int rswap_query_alloc_map(struct rdma_session_context *rdma_session)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	struct rswap_rdma_queue *rdma_queue = &(rdma_session->rdma_queues[0]);
+	struct rswap_alloc_client client;
+	size_t len;
+	int ret;
+
+	ret = send_message_to_remote(rdma_session, 0, QUERY_ALLOC_MAP, 0);
+	if (ret) {
+		pr_err("%s, Post 2-sided message to remote server failed.\n",
+		       __func__);
+		return ret;
+	}
+	drain_rdma_queue(rdma_queue);
+	wait_event_interruptible(rdma_queue->sem,
+				 rdma_queue->state == ALLOC_MAP_RECV);
+	// let the 2-sided path query again if we fall back to it
+	rdma_queue->state = MEMORY_SERVER_AVAILABLE;
+	if (map->slot < 0)
+		return -ENODEV;
+
+	map->atomic_buf = kzalloc(sizeof(uint64_t), GFP_KERNEL);
+	if (!map->atomic_buf)
+		return -ENOMEM;
+
+	ret = rswap_alloc_read(rdma_session, 0, &map->header,
+			       sizeof(map->header));
+	if (ret)
+		return ret;
+	if (map->header.magic != RSWAP_ALLOC_MAGIC ||
+	    map->header.chunk_shift != CHUNK_SHIFT) {
+		pr_err("%s, bad alloc map, magic 0x%x chunk_shift %u\n",
+		       __func__, map->header.magic, map->header.chunk_shift);
+		return -EINVAL;
+	}
+
+	len = map->header.nr_chunks * sizeof(struct rswap_extent);
+	map->extents = kzalloc(len, GFP_KERNEL);
+	if (!map->extents)
+		return -ENOMEM;
+	ret = rswap_alloc_read(rdma_session, map->header.extent_off,
+			       map->extents, len);
+	if (ret)
+		return ret;
+
+	ret = rswap_alloc_read(rdma_session,
+			       map->header.client_off +
+				       map->slot * sizeof(client),
+			       &client, sizeof(client));
+	if (ret)
+		return ret;
+	map->quota = client.quota;
+
+	pr_info("%s, alloc map of %u chunks, slot %d, quota %llu chunks\n",
+		__func__, map->header.nr_chunks, map->slot, map->quota);
+	return 0;
+}
+
+/*
+ * Claim the chunks of rmsize, or as many as the alloc map gives, with RDMA
+ * atomics. Returns an error if the caller should get its chunks with
+ * messages instead.
+ */
+int rswap_alloc_remote_chunks(struct rdma_session_context *rdma_session)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct rswap_rdma_queue *rdma_queue;
+	uint32_t wanted, idx;
+	int ret;
+
+	if (rdma_session->rdma_dev->dev->attrs.atomic_cap == IB_ATOMIC_NONE) {
+		pr_warn("%s, rdma device has no atomics.\n", __func__);
+		return -EOPNOTSUPP;
+	}
+
+	rdma_queue = &(rdma_session->rdma_queues[num_queues - 1]);
+	wait_event_interruptible(rdma_queue->sem,
+				 rdma_queue->state == MEMORY_SERVER_AVAILABLE);
+
+	ret = rswap_query_alloc_map(rdma_session);
+	if (ret)
+		goto err;
+
+	wanted = rswap_wanted_chunks(rdma_session);
+	if (!wanted)
+		wanted = map->header.nr_chunks;
+	wanted = min_t(uint32_t, wanted, MAX_REGION_NUM);
+
+	pool->chunk_num = wanted;
+	ret = init_remote_chunk_list(rdma_session);
+	if (ret)
+		goto err;
+
+	for (pool->chunk_num = 0; pool->chunk_num < wanted;
+	     pool->chunk_num++) {
+		struct remote_chunk *chunk = &pool->chunks[pool->chunk_num];
+
+		ret = rswap_alloc_claim(rdma_session, &idx);
+		if (ret)
+			break;
+		chunk->remote_addr = map->extents[idx].addr;
+		chunk->remote_rkey = map->extents[idx].rkey;
+		chunk->mapped_size = (uint64_t)1 << CHUNK_SHIFT;
+		chunk->alloc_idx = idx;
+		chunk->chunk_state = MAPPED;
+		pr_info("Claimed chunk[%u] : alloc map entry %u, remote_addr : 0x%llx, remote_rkey: 0x%x \n",
+			pool->chunk_num, idx, chunk->remote_addr,
+			chunk->remote_rkey);
+	}
+	if (!pool->chunk_num) {
+		pr_warn("%s, no chunk left in the alloc map.\n", __func__);
+		kfree(pool->chunks);
+		pool->chunks = NULL;
+		ret = -ENOSPC;
+		goto err;
+	}
+	if (pool->chunk_num < wanted)
+		pr_warn("%s, asked for %u chunks, the rest is out of the quota or the alloc map.\n",
+			__func__, wanted);
+	pr_info("%s, claimed %u chunks with rdma atomics.\n", __func__,
+		pool->chunk_num);
+	return 0;
+
+err:
+	pr_warn("%s, one-sided allocation failed %d, fall back to messages.\n",
+		__func__, ret);
+	rswap_free_alloc_map(rdma_session);
+	return ret;
+}
+
+// Return the chunks claimed with rswap_alloc_remote_chunks().
+int rswap_alloc_release_chunks(struct rdma_session_context *rdma_session)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	int nr = 0;
+	int ret = 0;
+	uint32_t i;
+
+	for (i = 0; i < pool->chunk_num; i++) {
+		struct remote_chunk *chunk = &pool->chunks[i];
+
+		if (chunk->chunk_state != MAPPED || chunk->alloc_idx < 0)
+			continue;
+		ret = rswap_alloc_unclaim(rdma_session, chunk->alloc_idx);
+		if (ret) {
+			pr_warn("%s, leave the rest of the chunks to the memory server.\n",
+				__func__);
+			break;
+		}
+		chunk->chunk_state = EMPTY;
+		nr++;
+	}
+	pr_info("%s, released %d chunks with rdma atomics.\n", __func__, nr);
+	return ret;
+}
+
+void rswap_free_alloc_map(struct rdma_session_context *rdma_session)
+{
+	struct rswap_alloc_map *map = &rdma_session->alloc_map;
+
+	kfree(map->extents);
+	map->extents = NULL;
+	kfree(map->atomic_buf);
+	map->atomic_buf = NULL;
+	map->slot = -1;
+}
@@ -0,0 +1,459 @@
+#include <linux/cleancache.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/xarray.h>
+#include <linux/swap_stats.h>
+
+#include "constants.h"
+#include "rswap_cleancache.h"
+#include "rswap_ops.h"
+
+/*
+ * Cleancache on remote memory. The clean file pages evicted from the page
+ * cache are written to the slots of the top cc_size GB of the remote memory,
+ * and a read of such a page takes it back with one remote read instead of
+ * going to the disk. Gets are exclusive, the page is back in the page cache.
+ *
+ * The index is local: every pool (a mounted filesystem) has a hash table of
+ * its files, every file an xarray of page index -> slot. Free slots are on a
+ * stack, when there are none the oldest put is evicted. A single lock guards
+ * all of it, irq-safe as the puts come under the i_pages lock with irqs off,
+ * and is never held across a transfer: a slot being written has an odd seq,
+ * a get checks after its read that the seq of the slot did not move, i.e.,
+ * that the slot was not reused under it.
+ */
+
+#if defined(CONFIG_CLEANCACHE) && defined(RSWAP_KERNEL_SUPPORT)
+
+#define RSWAP_CC_MAX_POOLS 32
+#define RSWAP_CC_INODE_HASH_BITS 10
+#define RSWAP_CC_EVICT_TRIES 64
+
+struct rswap_cc_inode {
+	struct hlist_node node;
+	struct cleancache_filekey key;
+	struct xarray pages; // index -> xa_mk_value(slot)
+	unsigned long nr_pages;
+};
+
+struct rswap_cc_pool {
+	bool used;
+	DECLARE_HASHTABLE(inodes, RSWAP_CC_INODE_HASH_BITS);
+};
+
+struct rswap_cc_slot {
+	struct rswap_cc_inode *inode; // NULL if free, or dropped while written
+	pgoff_t index;
+	unsigned int seq; // odd while the slot is written
+};
+
+static struct {
+	spinlock_t lock;
+	struct rswap_cc_pool pools[RSWAP_CC_MAX_POOLS];
+	struct rswap_cc_slot *slots;
+	u32 *free; // stack of the free slots
+	u32 nr_free;
+	u32 nr_slots;
+	u32 hand; // the next slot to evict
+	size_t base; // remote address of slot 0
+
+	bool enabled;
+	atomic64_t puts, hits, misses, evictions, dropped;
+} rswap_cc;
+
+static inline bool rswap_cc_key_eq(const struct cleancache_filekey *a,
+				   const struct cleancache_filekey *b)
+{
+	return !memcmp(a, b, sizeof(*a));
+}
+
+static inline u32 rswap_cc_key_hash(const struct cleancache_filekey *key)
+{
+	return jhash2(key->u.key, CLEANCACHE_KEY_MAX, 0);
+}
+
+static struct rswap_cc_pool *rswap_cc_get_pool(int pool_id)
+{
+	if (pool_id < 0 || pool_id >= RSWAP_CC_MAX_POOLS ||
+	    !rswap_cc.pools[pool_id].used)
+		return NULL;
+	return &rswap_cc.pools[pool_id];
+}
+
+static struct rswap_cc_inode *
+rswap_cc_find_inode(struct rswap_cc_pool *pool,
+		    const struct cleancache_filekey *key)
+{
+	struct rswap_cc_inode *inode;
+
+	hash_for_each_possible(pool->inodes, inode, node,
+			       rswap_cc_key_hash(key))
+		if (rswap_cc_key_eq(&inode->key, key))
+			return inode;
+	return NULL;
+}
+
+static void rswap_cc_free_inode(struct rswap_cc_inode *inode)
+{
+	hash_del(&inode->node);
+	xa_destroy(&inode->pages);
+	kfree(inode);
+}
+
+// Drop a slot from its file. One being written is freed by its writer.
+static void rswap_cc_drop_slot(u32 slot)
+{
+	struct rswap_cc_slot *s = &rswap_cc.slots[slot];
+	struct rswap_cc_inode *inode = s->inode;
+
+	xa_erase(&inode->pages, s->index);
+	s->inode = NULL;
+	if (!(s->seq & 1))
+		rswap_cc.free[rswap_cc.nr_free++] = slot;
+	if (!--inode->nr_pages)
+		rswap_cc_free_inode(inode);
+}
+
+static void rswap_cc_drop_inode(struct rswap_cc_inode *inode)
+{
+	unsigned long index;
+	void *entry;
+
+	inode->nr_pages++; // held until all its slots are dropped
+	xa_for_each (&inode->pages, index, entry)
+		rswap_cc_drop_slot(xa_to_value(entry));
+	if (!--inode->nr_pages)
+		rswap_cc_free_inode(inode);
+}
+
+// A free slot, or the oldest one that is not being written. -1 if none.
+static long rswap_cc_alloc_slot(void)
+{
+	struct rswap_cc_slot *s;
+	int tries;
+	u32 slot;
+
+	if (rswap_cc.nr_free)
+		return rswap_cc.free[--rswap_cc.nr_free];
+	for (tries = 0; tries < RSWAP_CC_EVICT_TRIES; tries++) {
+		slot = rswap_cc.hand;
+		rswap_cc.hand = (slot + 1) % rswap_cc.nr_slots;
+		s = &rswap_cc.slots[slot];
+		if (!s->inode || (s->seq & 1))
+			continue;
+		rswap_cc_drop_slot(slot);
+		atomic64_inc(&rswap_cc.evictions);
+		return rswap_cc.free[--rswap_cc.nr_free];
+	}
+	return -1;
+}
+
+static int rswap_cc_init_fs(size_t pagesize)
+{
+	unsigned long flags;
+	int i;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	for (i = 0; i < RSWAP_CC_MAX_POOLS; i++) {
+		if (!rswap_cc.pools[i].used) {
+			rswap_cc.pools[i].used = true;
+			hash_init(rswap_cc.pools[i].inodes);
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+	return i < RSWAP_CC_MAX_POOLS ? i : -1;
+}
+
+// The pages of clustered filesystems are shared by the nodes, keep off.
+static int rswap_cc_init_shared_fs(uuid_t *uuid, size_t pagesize)
+{
+	return -1;
+}
+
+static void rswap_cc_put_page(int pool_id, struct cleancache_filekey key,
+			      pgoff_t index, struct page *page)
+{
+	struct rswap_cc_inode *inode;
+	struct rswap_cc_pool *pool;
+	struct rswap_cc_slot *s;
+	unsigned long flags;
+	void *old;
+	long slot;
+	int ret;
+
+	if (!READ_ONCE(rswap_cc.enabled))
+		return;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	pool = rswap_cc_get_pool(pool_id);
+	if (!pool)
+		goto out_unlock;
+	inode = rswap_cc_find_inode(pool, &key);
+	if (!inode) {
+		inode = kmalloc(sizeof(*inode), GFP_ATOMIC | __GFP_NOWARN);
+		if (!inode)
+			goto out_drop;
+		inode->key = key;
+		inode->nr_pages = 0;
+		xa_init(&inode->pages);
+		hash_add(pool->inodes, &inode->node, rswap_cc_key_hash(&key));
+	}
+	// counts the new page, and holds the inode meanwhile
+	inode->nr_pages++;
+	// an older copy of the page goes
+	old = xa_load(&inode->pages, index);
+	if (old)
+		rswap_cc_drop_slot(xa_to_value(old));
+
+	slot = rswap_cc_alloc_slot();
+	if (slot < 0)
+		goto out_free_inode;
+	if (xa_is_err(xa_store(&inode->pages, index, xa_mk_value(slot),
+			       GFP_ATOMIC | __GFP_NOWARN))) {
+		rswap_cc.free[rswap_cc.nr_free++] = slot;
+		goto out_free_inode;
+	}
+	s = &rswap_cc.slots[slot];
+	s->inode = inode;
+	s->index = index;
+	s->seq++;
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+
+	ret = rswap_cc_write_page(rswap_cc.base + ((size_t)slot << PAGE_SHIFT),
+				  page);
+
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	s->seq++;
+	if (unlikely(ret) && s->inode) {
+		pr_err("%s, write to slot %ld failed, %d\n", __func__, slot,
+		       ret);
+		rswap_cc_drop_slot(slot);
+	} else if (!s->inode) {
+		// invalidated or evicted while written
+		rswap_cc.free[rswap_cc.nr_free++] = slot;
+	}
+	atomic64_inc(&rswap_cc.puts);
+	goto out_unlock;
+
+out_free_inode:
+	if (!--inode->nr_pages)
+		rswap_cc_free_inode(inode);
+out_drop:
+	atomic64_inc(&rswap_cc.dropped);
+out_unlock:
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+}
+
+static int rswap_cc_get_page(int pool_id, struct cleancache_filekey key,
+			     pgoff_t index, struct page *page)
+{
+	struct rswap_cc_inode *inode;
+	struct rswap_cc_pool *pool;
+	unsigned long flags;
+	unsigned int seq;
+	void *entry = NULL;
+	u32 slot;
+	int ret = -1;
+
+	if (!READ_ONCE(rswap_cc.enabled))
+		return -1;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	pool = rswap_cc_get_pool(pool_id);
+	inode = pool ? rswap_cc_find_inode(pool, &key) : NULL;
+	if (inode)
+		entry = xa_load(&inode->pages, index);
+	if (!entry) {
+		spin_unlock_irqrestore(&rswap_cc.lock, flags);
+		goto out;
+	}
+	slot = xa_to_value(entry);
+	seq = rswap_cc.slots[slot].seq;
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+	if (seq & 1)
+		goto out;
+
+	if (rswap_cc_read_page(rswap_cc.base + ((size_t)slot << PAGE_SHIFT),
+			       page))
+		goto out;
+
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	if (rswap_cc.slots[slot].seq == seq && rswap_cc.slots[slot].inode) {
+		rswap_cc_drop_slot(slot);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+out:
+	atomic64_inc(ret ? &rswap_cc.misses : &rswap_cc.hits);
+	return ret;
+}
+
+static void rswap_cc_invalidate_page(int pool_id, struct cleancache_filekey key,
+				     pgoff_t index)
+{
+	struct rswap_cc_inode *inode;
+	struct rswap_cc_pool *pool;
+	unsigned long flags;
+	void *entry;
+
+	if (!READ_ONCE(rswap_cc.enabled))
+		return;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	pool = rswap_cc_get_pool(pool_id);
+	inode = pool ? rswap_cc_find_inode(pool, &key) : NULL;
+	entry = inode ? xa_load(&inode->pages, index) : NULL;
+	if (entry)
+		rswap_cc_drop_slot(xa_to_value(entry));
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+}
+
+static void rswap_cc_invalidate_inode(int pool_id,
+				      struct cleancache_filekey key)
+{
+	struct rswap_cc_inode *inode;
+	struct rswap_cc_pool *pool;
+	unsigned long flags;
+
+	if (!READ_ONCE(rswap_cc.enabled))
+		return;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	pool = rswap_cc_get_pool(pool_id);
+	inode = pool ? rswap_cc_find_inode(pool, &key) : NULL;
+	if (inode)
+		rswap_cc_drop_inode(inode);
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+}
+
+static void rswap_cc_invalidate_fs(int pool_id)
+{
+	struct rswap_cc_inode *inode;
+	struct rswap_cc_pool *pool;
+	struct hlist_node *tmp;
+	unsigned long flags;
+	int bkt;
+
+	if (!READ_ONCE(rswap_cc.enabled))
+		return;
+	spin_lock_irqsave(&rswap_cc.lock, flags);
+	pool = rswap_cc_get_pool(pool_id);
+	if (pool) {
+		hash_for_each_safe (pool->inodes, bkt, tmp, inode, node)
+			rswap_cc_drop_inode(inode);
+		pool->used = false;
+	}
+	spin_unlock_irqrestore(&rswap_cc.lock, flags);
+}
+
+static const struct cleancache_ops rswap_cleancache_ops = {
+	.init_fs = rswap_cc_init_fs,
+	.init_shared_fs = rswap_cc_init_shared_fs,
+	.get_page = rswap_cc_get_page,
+	.put_page = rswap_cc_put_page,
+	.invalidate_page = rswap_cc_invalidate_page,
+	.invalidate_inode = rswap_cc_invalidate_inode,
+	.invalidate_fs = rswap_cc_invalidate_fs,
+};
+
+int rswap_cleancache_init(int mem_size, int cc_size)
+{
+	u32 i;
+	int ret;
+
+	if (!cc_size)
+		return 0;
+	if (cc_size < 0 || cc_size >= mem_size) {
+		pr_err("%s, ccsize %dGB must be less than rmsize %dGB\n",
+		       __func__, cc_size, mem_size);
+		return -EINVAL;
+	}
+	// the slots are read and written at their remote address as is
+	if (mem_size > rswap_granted_size()) {
+		pr_err("%s, ccsize %dGB up to %dGB is past the %dGB of remote memory granted\n",
+		       __func__, cc_size, mem_size, rswap_granted_size());
+		return -ENOSPC;
+	}
+
+	spin_lock_init(&rswap_cc.lock);
+	rswap_cc.nr_slots = ((u64)cc_size * ONE_GB) >> PAGE_SHIFT;
+	rswap_cc.base = (size_t)(mem_size - cc_size) * ONE_GB;
+	rswap_cc.slots = vzalloc(array_size(rswap_cc.nr_slots,
+					    sizeof(*rswap_cc.slots)));
+	rswap_cc.free = vmalloc(array_size(rswap_cc.nr_slots,
+					   sizeof(*rswap_cc.free)));
+	if (!rswap_cc.slots || !rswap_cc.free) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	// the low slots go first
+	for (i = 0; i < rswap_cc.nr_slots; i++)
+		rswap_cc.free[i] = rswap_cc.nr_slots - 1 - i;
+	rswap_cc.nr_free = rswap_cc.nr_slots;
+	rswap_cc.hand = 0;
+	WRITE_ONCE(rswap_cc.enabled, true);
+
+	ret = cleancache_register_ops(&rswap_cleancache_ops);
+	if (ret) {
+		pr_err("%s, another cleancache backend is registered\n",
+		       __func__);
+		goto err;
+	}
+	pr_info("%s, %dGB of cleancache at remote 0x%zx, %u slots\n", __func__,
+		cc_size, rswap_cc.base, rswap_cc.nr_slots);
+	return 0;
+
+err:
+	rswap_cc.enabled = false;
+	vfree(rswap_cc.free);
+	vfree(rswap_cc.slots);
+	rswap_cc.slots = NULL;
+	return ret;
+}
+
+void rswap_cleancache_exit(void)
+{
+	struct rswap_cc_inode *inode;
+	struct hlist_node *tmp;
+	int i, bkt;
+
+	if (!rswap_cc.slots)
+		return;
+	WRITE_ONCE(rswap_cc.enabled, false);
+	// waits for the ops running
+	cleancache_deregister_ops();
+
+	for (i = 0; i < RSWAP_CC_MAX_POOLS; i++) {
+		if (!rswap_cc.pools[i].used)
+			continue;
+		hash_for_each_safe (rswap_cc.pools[i].inodes, bkt, tmp, inode,
+				    node)
+			rswap_cc_free_inode(inode);
+		rswap_cc.pools[i].used = false;
+	}
+	pr_info("%s, puts %lld, hits %lld, misses %lld, evictions %lld, dropped %lld\n",
+		__func__, atomic64_read(&rswap_cc.puts),
+		atomic64_read(&rswap_cc.hits), atomic64_read(&rswap_cc.misses),
+		atomic64_read(&rswap_cc.evictions),
+		atomic64_read(&rswap_cc.dropped));
+	vfree(rswap_cc.free);
+	vfree(rswap_cc.slots);
+	rswap_cc.slots = NULL;
+}
+
+#else
+
+int rswap_cleancache_init(int mem_size, int cc_size)
+{
+	if (!cc_size)
+		return 0;
+	pr_err("%s, the kernel has no cleancache\n", __func__);
+	return -EOPNOTSUPP;
+}
+
+void rswap_cleancache_exit(void)
+{
+}
+
+#endif
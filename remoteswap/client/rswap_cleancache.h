@@ -0,0 +1,15 @@
+#ifndef __RSWAP_CLEANCACHE_H
+#define __RSWAP_CLEANCACHE_H
+
+#include <linux/mm.h>
+#include <linux/types.h>
+
+/*
+ * Transfers of the cleancache, implemented by the backend. Both wait for
+ * the page, and the write may be called with irqs off. The read leaves the
+ * page to the caller: it is neither marked up to date nor unlocked.
+ */
+int rswap_cc_write_page(size_t roffset, struct page *page);
+int rswap_cc_read_page(size_t roffset, struct page *page);
+
+#endif // __RSWAP_CLEANCACHE_H
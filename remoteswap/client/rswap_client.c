@@ -11,6 +11,7 @@
 #ifdef LIMIT_SWAP_CACHE_SIZE
 #include <linux/swap_stats.h>
 #endif
+#include "rswap_heat.h"
 #include "rswap_ops.h"
 #include "utils.h"
 
@@ -22,6 +23,8 @@ MODULE_VERSION("1.0");
 static char server_ip[INET_ADDRSTRLEN];
 static int server_port;
 static int remote_mem_size;
+static int cleancache_size;
+static int dev_size;
 
 MODULE_PARM_DESC(sip, "Remote memory server ip address");
 MODULE_PARM_DESC(sport, "Remote memory server port");
@@ -29,24 +32,53 @@ MODULE_PARM_DESC(rmsize, "Remote memory size in GB");
 module_param_string(sip, server_ip, INET_ADDRSTRLEN, 0644);
 module_param_named(sport, server_port, int, 0644);
 module_param_named(rmsize, remote_mem_size, int, 0644);
+MODULE_PARM_DESC(ccsize,
+		 "Remote memory in GB for the cleancache of clean file pages, taken from the top of rmsize");
+module_param_named(ccsize, cleancache_size, int, 0444);
+MODULE_PARM_DESC(devsize,
+		 "Remote memory in GB for /dev/rswap, taken right below the cleancache");
+module_param_named(devsize, dev_size, int, 0444);
 
 int __init rswap_cpu_init(void)
 {
 	int ret = 0;
 
+	// counts from the first transfer, swap works without it
+	if (rswap_heat_init(remote_mem_size))
+		pr_warn("%s, heat map disabled.\n", __func__);
 	ret = rswap_client_init(server_ip, server_port, remote_mem_size);
 	if (unlikely(ret)) {
 		pr_err("%s, rswap_rdma_client_init failed. \n", __func__);
-		goto out;
+		goto out_heat;
 	}
 
+	rswap_swap_limit_init(remote_mem_size, cleancache_size, dev_size);
+
+	// a warm reload takes the pages the previous module left
+	if (frontswap_parked()) {
+		ret = rswap_unpark_frontswap();
+		if (unlikely(ret))
+			goto out_client;
+		goto out_cleancache;
+	}
+
+	// swap works without it, stored in place
+	if (rswap_log_init(remote_mem_size, cleancache_size, dev_size))
+		pr_warn("%s, swap log disabled.\n", __func__);
+	if (rswap_ec_init(remote_mem_size, cleancache_size, dev_size))
+		pr_warn("%s, erasure coding disabled.\n", __func__);
+	if (rswap_migrate_init(remote_mem_size, cleancache_size, dev_size))
+		pr_warn("%s, chunk migration disabled.\n", __func__);
+	if (rswap_tier_init(remote_mem_size, cleancache_size, dev_size))
+		pr_warn("%s, far server disabled.\n", __func__);
+
 #ifdef RSWAP_KERNEL_SUPPORT
 	if (!frontswap_enabled()) {
 		ret = rswap_register_frontswap();
 		if (unlikely(ret)) {
 			pr_err("%s, Enable frontswap path failed. \n",
 			       __func__);
-			goto out;
+			goto out_client;
 		}
 	} else {
 		rswap_replace_frontswap();
@@ -55,18 +87,54 @@ int __init rswap_cpu_init(void)
 	ret = rswap_register_frontswap();
 	if (unlikely(ret)) {
 		pr_err("%s, Enable frontswap path failed. \n", __func__);
-		goto out;
+		goto out_client;
 	}
 #endif
 
-out:
+out_cleancache:
+	// swap works without it
+	if (rswap_cleancache_init(remote_mem_size, cleancache_size))
+		pr_warn("%s, cleancache disabled.\n", __func__);
+	if (rswap_dev_init(remote_mem_size, cleancache_size, dev_size))
+		pr_warn("%s, /dev/rswap disabled.\n", __func__);
+	return 0;
+
+out_client:
+	rswap_tier_exit();
+	rswap_migrate_exit();
+	rswap_ec_exit();
+	rswap_log_exit();
+	rswap_client_exit();
+out_heat:
+	// its decay work and debugfs files must not outlive the module
+	rswap_heat_exit();
 	return ret;
 }
 
 void __exit rswap_cpu_exit(void)
 {
+	void *warm_state;
+
 	pr_info("Prepare to remove the CPU Server module.\n");
+	rswap_dev_exit();
+	// a cache, nothing to keep for a warm reload
+	rswap_cleancache_exit();
+	warm_state = rswap_client_park();
+	if (warm_state) {
+		// loads wait for the next load of the module meanwhile
+		pr_info("park frontswap, keep the remote pages for the reload.\n");
+		frontswap_park_ops(warm_state);
+	}
+	rswap_tier_exit();
+	rswap_migrate_exit();
+	rswap_ec_exit();
+	rswap_log_exit();
 	rswap_client_exit();
+	rswap_heat_exit();
+	if (warm_state) {
+		pr_info("Remove CPU Server module DONE, frontswap parked. \n");
+		return;
+	}
 
 	pr_info("unloading frontswap module\n");
 	pr_info("1) decrease frontswap_enabled_key to 0. \n");
@@ -0,0 +1,615 @@
+#include <linux/fs.h>
+#include <linux/genalloc.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/xarray.h>
+
+#include "rswap_dev.h"
+#include "rswap_ops.h"
+#include "rswap_rdma.h"
+
+/*
+ * /dev/rswap, see rswap_dev.h for the interface. The regions are carved out
+ * of the dev_size GB right below the cleancache of the remote memory, and
+ * the transfers go on the async load queue of the submitting cpu, whose
+ * completions come in softirq. A transfer is split into one work request
+ * per page of the buffer, and at the remote chunk boundaries, as the queues
+ * take a single sge.
+ *
+ * Every context has sq_entries requests, and at most cq_entries minus the
+ * completions not reaped yet are in flight, so the completion ring never
+ * overflows. A submission that finds no room stops there, the rest of the
+ * sq waits for the next RSWAP_IOC_ENTER.
+ */
+
+#define RSWAP_DEV_MAX_PIECES (RSWAP_DEV_MAX_LEN / PAGE_SIZE + 2)
+#define RSWAP_DEV_MAX_BUF (1ULL << 30)
+#define RSWAP_DEV_POOL_BASE PAGE_SIZE // genalloc takes 0 for a failure
+
+struct rswap_dev_req;
+
+struct rswap_dev_piece {
+	struct ib_cqe cqe;
+	struct ib_rdma_wr wr;
+	struct ib_sge sge;
+	struct rswap_dev_req *req;
+	struct rswap_rdma_queue *rdma_queue;
+};
+
+struct rswap_dev_req {
+	struct rswap_dev_ctx *ctx;
+	u64 user_data;
+	u32 len;
+	bool write;
+	int status;
+	atomic_t pending; // pieces in flight
+	struct rswap_dev_piece pieces[RSWAP_DEV_MAX_PIECES];
+};
+
+struct rswap_dev_region {
+	u64 start; // in the dev area
+	u64 size;
+};
+
+struct rswap_dev_ctx {
+	struct mutex lock; // setup, regions and submission
+	struct rswap_dev_rings *rings; // vmalloc_user, mapped by the process
+	size_t rings_size;
+	struct rswap_dev_sqe *sqes;
+	struct rswap_dev_cqe *cqes;
+	u32 sq_entries, cq_entries;
+	u32 sq_head; // the copies of the kernel, the process may scribble
+	u32 cq_tail;
+
+	struct page **buf_pages;
+	dma_addr_t *buf_dma;
+	u32 nr_buf_pages;
+
+	struct xarray regions; // id -> struct rswap_dev_region
+
+	struct rswap_dev_req *reqs;
+	u32 *free_reqs;
+	u32 nr_free;
+	spinlock_t cq_lock; // the cq ring and the free requests
+	atomic_t inflight;
+	wait_queue_head_t wait;
+};
+
+static struct {
+	struct gen_pool *pool;
+	u64 base; // remote address of the dev area
+	u64 size;
+	bool registered;
+} rswap_dev;
+
+static inline struct ib_device *rswap_dev_ibdev(void)
+{
+	return rdma_session_global.rdma_dev->dev;
+}
+
+// Completions in the cq not reaped by the process yet.
+static u32 rswap_dev_cq_ready(struct rswap_dev_ctx *ctx)
+{
+	u32 ready = ctx->cq_tail - READ_ONCE(ctx->rings->cq_head);
+
+	return min(ready, ctx->cq_entries);
+}
+
+// A free request, if the cq has room for its completion.
+static struct rswap_dev_req *rswap_dev_get_req(struct rswap_dev_ctx *ctx)
+{
+	struct rswap_dev_req *req = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->cq_lock, flags);
+	if (ctx->nr_free && rswap_dev_cq_ready(ctx) +
+					    atomic_read(&ctx->inflight) <
+				    ctx->cq_entries) {
+		req = &ctx->reqs[ctx->free_reqs[--ctx->nr_free]];
+		atomic_inc(&ctx->inflight);
+	}
+	spin_unlock_irqrestore(&ctx->cq_lock, flags);
+	return req;
+}
+
+static void rswap_dev_end_req(struct rswap_dev_req *req)
+{
+	struct rswap_dev_ctx *ctx = req->ctx;
+	struct rswap_dev_cqe *cqe;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->cq_lock, flags);
+	cqe = &ctx->cqes[ctx->cq_tail & (ctx->cq_entries - 1)];
+	cqe->user_data = req->user_data;
+	cqe->res = req->status ? req->status : req->len;
+	cqe->pad = 0;
+	ctx->cq_tail++;
+	smp_store_release(&ctx->rings->cq_tail, ctx->cq_tail);
+	ctx->free_reqs[ctx->nr_free++] = req - ctx->reqs;
+	atomic_dec(&ctx->inflight);
+	spin_unlock_irqrestore(&ctx->cq_lock, flags);
+	wake_up(&ctx->wait);
+}
+
+static void rswap_dev_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_dev_piece *piece =
+		container_of(wc->wr_cqe, struct rswap_dev_piece, cqe);
+	struct rswap_dev_req *req = piece->req;
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		pr_err("%s, status %s\n", __func__,
+		       rdma_wc_status_name(wc->status));
+		req->status = -EIO;
+	} else if (!req->write) {
+		ib_dma_sync_single_for_cpu(rswap_dev_ibdev(), piece->sge.addr,
+					   piece->sge.length, DMA_FROM_DEVICE);
+	}
+	atomic_dec(&piece->rdma_queue->rdma_post_counter);
+	if (atomic_dec_and_test(&req->pending))
+		rswap_dev_end_req(req);
+}
+
+static bool rswap_dev_check(struct rswap_dev_ctx *ctx,
+			    const struct rswap_dev_sqe *sqe,
+			    struct rswap_dev_region **region)
+{
+	if (sqe->opcode != RSWAP_DEV_READ && sqe->opcode != RSWAP_DEV_WRITE)
+		return false;
+	if (!sqe->len || sqe->len > RSWAP_DEV_MAX_LEN ||
+	    !IS_ALIGNED(sqe->len | sqe->offset | sqe->buf_offset,
+			RSWAP_DEV_ALIGN))
+		return false;
+	if (sqe->buf_offset >= (u64)ctx->nr_buf_pages << PAGE_SHIFT ||
+	    sqe->len > ((u64)ctx->nr_buf_pages << PAGE_SHIFT) - sqe->buf_offset)
+		return false;
+	*region = xa_load(&ctx->regions, sqe->region);
+	return *region && sqe->offset < (*region)->size &&
+	       sqe->len <= (*region)->size - sqe->offset;
+}
+
+/*
+ * Post the transfer of one sq entry, or complete it with an error right
+ * away. -EBUSY if there is no room for it now, in the cq or the send queue.
+ */
+static int rswap_dev_submit(struct rswap_dev_ctx *ctx,
+			    const struct rswap_dev_sqe *sqe)
+{
+	struct ib_device *dev = rswap_dev_ibdev();
+	struct rswap_rdma_queue *rdma_queue;
+	struct rswap_dev_region *region;
+	struct rswap_dev_piece *piece;
+	struct remote_chunk *chunk;
+	const struct ib_send_wr *bad_wr;
+	struct rswap_dev_req *req;
+	u64 buf_off, raddr;
+	u32 left, len;
+	int i, nr, ret;
+
+	req = rswap_dev_get_req(ctx);
+	if (!req)
+		return -EBUSY;
+	req->user_data = sqe->user_data;
+	req->len = sqe->len;
+	req->write = sqe->opcode == RSWAP_DEV_WRITE;
+	req->status = 0;
+	if (!rswap_dev_check(ctx, sqe, &region)) {
+		req->status = -EINVAL;
+		rswap_dev_end_req(req);
+		return 0;
+	}
+
+	buf_off = sqe->buf_offset;
+	raddr = rswap_dev.base + region->start + sqe->offset;
+	for (nr = 0, left = sqe->len; left; nr++) {
+		len = min_t(u64, left, PAGE_SIZE - offset_in_page(buf_off));
+		len = min_t(u64, len, CHUNK_MASK + 1 - (raddr & CHUNK_MASK));
+		chunk = &rdma_session_global.remote_mem_pool
+				 .chunks[raddr >> CHUNK_SHIFT];
+
+		piece = &req->pieces[nr];
+		piece->req = req;
+		piece->cqe.done = rswap_dev_done;
+		piece->sge.addr = ctx->buf_dma[buf_off >> PAGE_SHIFT] +
+				  offset_in_page(buf_off);
+		piece->sge.length = len;
+		piece->sge.lkey = rdma_session_global.rdma_dev->pd->local_dma_lkey;
+		piece->wr.wr.next = NULL;
+		piece->wr.wr.wr_cqe = &piece->cqe;
+		piece->wr.wr.sg_list = &piece->sge;
+		piece->wr.wr.num_sge = 1;
+		piece->wr.wr.opcode =
+			req->write ? IB_WR_RDMA_WRITE : IB_WR_RDMA_READ;
+		piece->wr.wr.send_flags = IB_SEND_SIGNALED;
+		piece->wr.remote_addr = chunk->remote_addr + (raddr & CHUNK_MASK);
+		piece->wr.rkey = chunk->remote_rkey;
+		if (req->write)
+			ib_dma_sync_single_for_device(dev, piece->sge.addr, len,
+						      DMA_TO_DEVICE);
+
+		buf_off += len;
+		raddr += len;
+		left -= len;
+	}
+
+	rdma_queue = get_rdma_queue(&rdma_session_global, get_cpu(),
+				    QP_LOAD_ASYNC);
+	if (atomic_add_return(nr, &rdma_queue->rdma_post_counter) >
+	    RDMA_SEND_QUEUE_DEPTH - 16) {
+		atomic_sub(nr, &rdma_queue->rdma_post_counter);
+		put_cpu();
+		// not submitted, back to the free ones without a completion
+		spin_lock_irq(&ctx->cq_lock);
+		ctx->free_reqs[ctx->nr_free++] = req - ctx->reqs;
+		atomic_dec(&ctx->inflight);
+		spin_unlock_irq(&ctx->cq_lock);
+		return -EBUSY;
+	}
+	atomic_set(&req->pending, nr + 1); // held until all are posted
+	for (i = 0; i < nr; i++) {
+		req->pieces[i].rdma_queue = rdma_queue;
+		ret = ib_post_send(rdma_queue->qp, &req->pieces[i].wr.wr,
+				   &bad_wr);
+		if (unlikely(ret)) {
+			pr_err("%s, post rdma wr failed, %d\n", __func__, ret);
+			atomic_sub(nr - i, &rdma_queue->rdma_post_counter);
+			atomic_sub(nr - i, &req->pending);
+			req->status = -EIO;
+			break;
+		}
+	}
+	put_cpu();
+	if (atomic_dec_and_test(&req->pending))
+		rswap_dev_end_req(req);
+	return 0;
+}
+
+static int rswap_dev_enter(struct rswap_dev_ctx *ctx,
+			   struct rswap_dev_enter *e)
+{
+	struct rswap_dev_sqe sqe;
+	u32 tail, n;
+	int ret = 0;
+
+	mutex_lock(&ctx->lock);
+	if (!ctx->rings) {
+		mutex_unlock(&ctx->lock);
+		return -EINVAL;
+	}
+	tail = smp_load_acquire(&ctx->rings->sq_tail);
+	n = min3(e->to_submit, tail - ctx->sq_head, ctx->sq_entries);
+	for (e->submitted = 0; e->submitted < n; e->submitted++) {
+		// a copy, the process may change it meanwhile
+		memcpy(&sqe, &ctx->sqes[ctx->sq_head & (ctx->sq_entries - 1)],
+		       sizeof(sqe));
+		if (rswap_dev_submit(ctx, &sqe))
+			break;
+		ctx->sq_head++;
+	}
+	smp_store_release(&ctx->rings->sq_head, ctx->sq_head);
+	mutex_unlock(&ctx->lock);
+
+	if (e->min_complete)
+		ret = wait_event_interruptible(
+			ctx->wait,
+			rswap_dev_cq_ready(ctx) >=
+					min(e->min_complete, ctx->cq_entries) ||
+				!atomic_read(&ctx->inflight));
+	return ret;
+}
+
+static void rswap_dev_free_buf(struct rswap_dev_ctx *ctx)
+{
+	u32 i;
+
+	for (i = 0; i < ctx->nr_buf_pages; i++) {
+		if (!ctx->buf_pages[i])
+			break;
+		if (!ib_dma_mapping_error(rswap_dev_ibdev(), ctx->buf_dma[i]))
+			ib_dma_unmap_page(rswap_dev_ibdev(), ctx->buf_dma[i],
+					  PAGE_SIZE, DMA_BIDIRECTIONAL);
+		__free_page(ctx->buf_pages[i]);
+	}
+	kvfree(ctx->buf_dma);
+	kvfree(ctx->buf_pages);
+}
+
+static int rswap_dev_setup(struct rswap_dev_ctx *ctx,
+			   struct rswap_dev_setup *s)
+{
+	size_t sq_off, cq_off;
+	u32 i;
+
+	if (!s->sq_entries || s->sq_entries > RSWAP_DEV_MAX_ENTRIES ||
+	    !s->buf_size || s->buf_size > RSWAP_DEV_MAX_BUF)
+		return -EINVAL;
+	if (ctx->rings)
+		return -EBUSY;
+
+	ctx->sq_entries = roundup_pow_of_two(s->sq_entries);
+	ctx->cq_entries = 2 * ctx->sq_entries;
+	sq_off = ALIGN(sizeof(struct rswap_dev_rings), RSWAP_DEV_ALIGN);
+	cq_off = ALIGN(sq_off + ctx->sq_entries * sizeof(struct rswap_dev_sqe),
+		       RSWAP_DEV_ALIGN);
+	ctx->rings_size = PAGE_ALIGN(cq_off + ctx->cq_entries *
+						      sizeof(struct rswap_dev_cqe));
+	ctx->nr_buf_pages = PAGE_ALIGN(s->buf_size) >> PAGE_SHIFT;
+
+	ctx->reqs = kvcalloc(ctx->sq_entries, sizeof(*ctx->reqs), GFP_KERNEL);
+	ctx->free_reqs = kvcalloc(ctx->sq_entries, sizeof(u32), GFP_KERNEL);
+	ctx->buf_pages = kvcalloc(ctx->nr_buf_pages, sizeof(struct page *),
+				  GFP_KERNEL);
+	ctx->buf_dma = kvcalloc(ctx->nr_buf_pages, sizeof(dma_addr_t),
+				GFP_KERNEL);
+	ctx->rings = vmalloc_user(ctx->rings_size);
+	if (!ctx->reqs || !ctx->free_reqs || !ctx->buf_pages || !ctx->buf_dma ||
+	    !ctx->rings)
+		goto err;
+	for (i = 0; i < ctx->nr_buf_pages; i++) {
+		ctx->buf_pages[i] = alloc_page(GFP_KERNEL_ACCOUNT | __GFP_ZERO);
+		if (!ctx->buf_pages[i])
+			goto err;
+		// mapped for the lifetime of the context
+		ctx->buf_dma[i] = ib_dma_map_page(rswap_dev_ibdev(),
+						  ctx->buf_pages[i], 0,
+						  PAGE_SIZE, DMA_BIDIRECTIONAL);
+		if (ib_dma_mapping_error(rswap_dev_ibdev(), ctx->buf_dma[i])) {
+			__free_page(ctx->buf_pages[i]);
+			ctx->buf_pages[i] = NULL;
+			goto err;
+		}
+	}
+	for (i = 0; i < ctx->sq_entries; i++) {
+		ctx->reqs[i].ctx = ctx;
+		ctx->free_reqs[i] = i;
+	}
+	ctx->nr_free = ctx->sq_entries;
+
+	ctx->sqes = (void *)ctx->rings + sq_off;
+	ctx->cqes = (void *)ctx->rings + cq_off;
+	ctx->rings->sq_entries = ctx->sq_entries;
+	ctx->rings->cq_entries = ctx->cq_entries;
+	ctx->rings->sq_off = sq_off;
+	ctx->rings->cq_off = cq_off;
+	s->sq_entries = ctx->sq_entries;
+	s->cq_entries = ctx->cq_entries;
+	s->buf_size = (u64)ctx->nr_buf_pages << PAGE_SHIFT;
+	s->rings_size = ctx->rings_size;
+	return 0;
+
+err:
+	rswap_dev_free_buf(ctx);
+	vfree(ctx->rings);
+	kvfree(ctx->free_reqs);
+	kvfree(ctx->reqs);
+	ctx->rings = NULL;
+	ctx->buf_pages = NULL;
+	ctx->buf_dma = NULL;
+	ctx->nr_buf_pages = 0;
+	return -ENOMEM;
+}
+
+static int rswap_dev_alloc(struct rswap_dev_ctx *ctx,
+			   struct rswap_dev_alloc *a)
+{
+	struct rswap_dev_region *region;
+	unsigned long addr;
+	int ret;
+
+	if (!a->size || a->size > rswap_dev.size)
+		return -EINVAL;
+	region = kzalloc(sizeof(*region), GFP_KERNEL);
+	if (!region)
+		return -ENOMEM;
+	region->size = PAGE_ALIGN(a->size);
+	addr = gen_pool_alloc(rswap_dev.pool, region->size);
+	if (!addr) {
+		kfree(region);
+		return -ENOSPC;
+	}
+	region->start = addr - RSWAP_DEV_POOL_BASE;
+	ret = xa_alloc(&ctx->regions, &a->region, region, xa_limit_32b,
+		       GFP_KERNEL);
+	if (ret) {
+		gen_pool_free(rswap_dev.pool, addr, region->size);
+		kfree(region);
+	}
+	return ret;
+}
+
+static void rswap_dev_put_region(struct rswap_dev_region *region)
+{
+	gen_pool_free(rswap_dev.pool, region->start + RSWAP_DEV_POOL_BASE,
+		      region->size);
+	kfree(region);
+}
+
+static int rswap_dev_free(struct rswap_dev_ctx *ctx, u32 id)
+{
+	struct rswap_dev_region *region;
+
+	region = xa_erase(&ctx->regions, id);
+	if (!region)
+		return -EINVAL;
+	// its remote memory may go to another process next
+	wait_event(ctx->wait, !atomic_read(&ctx->inflight));
+	rswap_dev_put_region(region);
+	return 0;
+}
+
+static long rswap_dev_ioctl(struct file *file, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct rswap_dev_ctx *ctx = file->private_data;
+	void __user *uarg = (void __user *)arg;
+	union {
+		struct rswap_dev_setup setup;
+		struct rswap_dev_alloc alloc;
+		struct rswap_dev_enter enter;
+		u32 region;
+	} a;
+	long ret;
+
+	if (_IOC_SIZE(cmd) > sizeof(a))
+		return -ENOTTY;
+	if (copy_from_user(&a, uarg, _IOC_SIZE(cmd)))
+		return -EFAULT;
+
+	switch (cmd) {
+	case RSWAP_IOC_SETUP:
+		mutex_lock(&ctx->lock);
+		ret = rswap_dev_setup(ctx, &a.setup);
+		mutex_unlock(&ctx->lock);
+		break;
+	case RSWAP_IOC_ALLOC:
+		mutex_lock(&ctx->lock);
+		ret = rswap_dev_alloc(ctx, &a.alloc);
+		mutex_unlock(&ctx->lock);
+		break;
+	case RSWAP_IOC_FREE:
+		mutex_lock(&ctx->lock);
+		ret = rswap_dev_free(ctx, a.region);
+		mutex_unlock(&ctx->lock);
+		break;
+	case RSWAP_IOC_ENTER:
+		ret = rswap_dev_enter(ctx, &a.enter);
+		break;
+	default:
+		return -ENOTTY;
+	}
+	if (ret == 0 && (_IOC_DIR(cmd) & _IOC_READ) &&
+	    copy_to_user(uarg, &a, _IOC_SIZE(cmd)))
+		ret = -EFAULT;
+	return ret;
+}
+
+static int rswap_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct rswap_dev_ctx *ctx = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start, addr;
+	u64 off = (u64)vma->vm_pgoff << PAGE_SHIFT;
+	u32 i;
+	int ret = -EINVAL;
+
+	mutex_lock(&ctx->lock);
+	if (!ctx->rings)
+		goto out;
+	if (off == 0) {
+		ret = remap_vmalloc_range(vma, ctx->rings, 0);
+	} else if (off == RSWAP_DEV_BUF_OFF &&
+		   size <= (u64)ctx->nr_buf_pages << PAGE_SHIFT) {
+		for (i = 0, addr = vma->vm_start; addr < vma->vm_end;
+		     i++, addr += PAGE_SIZE) {
+			ret = vm_insert_page(vma, addr, ctx->buf_pages[i]);
+			if (ret)
+				break;
+		}
+	}
+out:
+	mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+static int rswap_dev_open(struct inode *inode, struct file *file)
+{
+	struct rswap_dev_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	mutex_init(&ctx->lock);
+	spin_lock_init(&ctx->cq_lock);
+	init_waitqueue_head(&ctx->wait);
+	xa_init_flags(&ctx->regions, XA_FLAGS_ALLOC);
+	file->private_data = ctx;
+	return 0;
+}
+
+static int rswap_dev_release(struct inode *inode, struct file *file)
+{
+	struct rswap_dev_ctx *ctx = file->private_data;
+	struct rswap_dev_region *region;
+	unsigned long id;
+
+	wait_event(ctx->wait, !atomic_read(&ctx->inflight));
+	xa_for_each (&ctx->regions, id, region)
+		rswap_dev_put_region(region);
+	xa_destroy(&ctx->regions);
+	if (ctx->rings) {
+		rswap_dev_free_buf(ctx);
+		vfree(ctx->rings);
+		kvfree(ctx->free_reqs);
+		kvfree(ctx->reqs);
+	}
+	kfree(ctx);
+	return 0;
+}
+
+static const struct file_operations rswap_dev_fops = {
+	.owner = THIS_MODULE,
+	.open = rswap_dev_open,
+	.release = rswap_dev_release,
+	.unlocked_ioctl = rswap_dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = rswap_dev_mmap,
+};
+
+static struct miscdevice rswap_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = RSWAP_DEV_NAME,
+	.fops = &rswap_dev_fops,
+};
+
+int rswap_dev_init(int mem_size, int cc_size, int dev_size)
+{
+	int ret;
+
+	if (!dev_size)
+		return 0;
+	if (dev_size < 0 || cc_size + dev_size >= mem_size) {
+		pr_err("%s, devsize %dGB and ccsize %dGB must be less than rmsize %dGB\n",
+		       __func__, dev_size, cc_size, mem_size);
+		return -EINVAL;
+	}
+	// its requests are posted to the chunk of their address as is
+	if (mem_size - cc_size > rswap_granted_size()) {
+		pr_err("%s, devsize %dGB up to %dGB is past the %dGB of remote memory granted\n",
+		       __func__, dev_size, mem_size - cc_size, rswap_granted_size());
+		return -ENOSPC;
+	}
+
+	rswap_dev.base = (u64)(mem_size - cc_size - dev_size) * ONE_GB;
+	rswap_dev.size = (u64)dev_size * ONE_GB;
+	rswap_dev.pool = gen_pool_create(PAGE_SHIFT, NUMA_NO_NODE);
+	if (!rswap_dev.pool)
+		return -ENOMEM;
+	ret = gen_pool_add(rswap_dev.pool, RSWAP_DEV_POOL_BASE, rswap_dev.size,
+			   NUMA_NO_NODE);
+	if (ret)
+		goto err;
+	ret = misc_register(&rswap_miscdev);
+	if (ret)
+		goto err;
+	rswap_dev.registered = true;
+	pr_info("%s, /dev/%s on %dGB at remote 0x%llx\n", __func__,
+		RSWAP_DEV_NAME, dev_size, rswap_dev.base);
+	return 0;
+
+err:
+	gen_pool_destroy(rswap_dev.pool);
+	rswap_dev.pool = NULL;
+	return ret;
+}
+
+// The open files hold the module, none is left here.
+void rswap_dev_exit(void)
+{
+	if (!rswap_dev.registered)
+		return;
+	misc_deregister(&rswap_miscdev);
+	gen_pool_destroy(rswap_dev.pool);
+	rswap_dev.registered = false;
+}
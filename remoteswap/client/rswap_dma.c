@@ -0,0 +1,73 @@
+#include <linux/dma-mapping.h>
+#include <linux/nodemask.h>
+#include <linux/vmalloc.h>
+
+#include "rswap_dma.h"
+
+#define SECTION_BYTES (PAGES_PER_SECTION << PAGE_SHIFT)
+
+static u64 rswap_dma_map_seg(struct rswap_dma_map *map, unsigned long pfn)
+{
+	dma_addr_t dma;
+
+	if (!map->dev)
+		return PFN_PHYS(pfn);
+	dma = dma_map_page_attrs(map->dev, pfn_to_page(pfn), 0, SECTION_BYTES,
+				 DMA_BIDIRECTIONAL, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(map->dev, dma))
+		return RSWAP_DMA_NONE;
+	return dma;
+}
+
+int rswap_dma_map_init(struct rswap_dma_map *map, struct device *dev)
+{
+	unsigned long seg, end_pfn = 0;
+	int nid;
+
+	for_each_online_node (nid)
+		end_pfn = max(end_pfn, node_end_pfn(nid));
+
+	map->dev = dev;
+	map->nr_mapped = 0;
+	map->nr_segs = DIV_ROUND_UP(end_pfn, PAGES_PER_SECTION);
+	map->seg_dma = vmalloc(array_size(map->nr_segs, sizeof(u64)));
+	if (!map->seg_dma) {
+		map->nr_segs = 0;
+		return -ENOMEM;
+	}
+
+	for (seg = 0; seg < map->nr_segs; seg++) {
+		unsigned long pfn = seg << PFN_SECTION_SHIFT;
+
+		// holes, and sections only partly backed by the node's memory
+		if (!pfn_valid(pfn) || !pfn_valid(pfn + PAGES_PER_SECTION - 1)) {
+			map->seg_dma[seg] = RSWAP_DMA_NONE;
+			continue;
+		}
+		map->seg_dma[seg] = rswap_dma_map_seg(map, pfn);
+		if (map->seg_dma[seg] != RSWAP_DMA_NONE)
+			map->nr_mapped++;
+		cond_resched();
+	}
+	pr_info("%s, %lu of %lu sections of %luMB mapped%s\n", __func__,
+		map->nr_mapped, map->nr_segs, SECTION_BYTES >> 20,
+		dev ? "" : ", emulated");
+	return 0;
+}
+
+void rswap_dma_map_exit(struct rswap_dma_map *map)
+{
+	unsigned long seg;
+
+	if (!map->seg_dma)
+		return;
+	for (seg = 0; map->dev && seg < map->nr_segs; seg++) {
+		if (map->seg_dma[seg] != RSWAP_DMA_NONE)
+			dma_unmap_page_attrs(map->dev, map->seg_dma[seg],
+					     SECTION_BYTES, DMA_BIDIRECTIONAL,
+					     DMA_ATTR_SKIP_CPU_SYNC);
+	}
+	vfree(map->seg_dma);
+	map->seg_dma = NULL;
+	map->nr_segs = 0;
+}
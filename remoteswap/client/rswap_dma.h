@@ -0,0 +1,47 @@
+#ifndef __RSWAP_DMA_H
+#define __RSWAP_DMA_H
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/types.h>
+
+/*
+ * Persistent DMA mapping of the physical memory, so a swap page is not
+ * mapped and unmapped, one IOTLB map and invalidation with an IOMMU, for
+ * each transfer. Memory is mapped once per section, bidirectionally, and
+ * the DMA address of a page is computed from its section's. A page of a
+ * section that could not be mapped, or hot-added later, has no address and
+ * the transfer maps it as before.
+ *
+ * Without a device, the map emulates one without an IOMMU (the DMA address
+ * is the physical one), for the tests.
+ */
+
+#define RSWAP_DMA_NONE (~0ULL)
+
+struct rswap_dma_map {
+	struct device *dev; // NULL to emulate
+	u64 *seg_dma; // of each section, RSWAP_DMA_NONE if not mapped
+	unsigned long nr_segs;
+	unsigned long nr_mapped;
+};
+
+int rswap_dma_map_init(struct rswap_dma_map *map, struct device *dev);
+void rswap_dma_map_exit(struct rswap_dma_map *map);
+
+static inline u64 rswap_dma_page_addr(struct rswap_dma_map *map,
+				      struct page *page)
+{
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long seg = pfn >> PFN_SECTION_SHIFT;
+	u64 dma;
+
+	if (seg >= map->nr_segs)
+		return RSWAP_DMA_NONE;
+	dma = map->seg_dma[seg];
+	if (dma == RSWAP_DMA_NONE)
+		return dma;
+	return dma + ((u64)(pfn & (PAGES_PER_SECTION - 1)) << PAGE_SHIFT);
+}
+
+#endif // __RSWAP_DMA_H
@@ -0,0 +1,266 @@
+/*
+ * Self-tests and microbenchmarks of the persistent DMA mapping of rswap,
+ * built by make TEST=1. No RDMA device is needed.
+ *
+ * The tests check the DMA address of pages across the physical memory, in
+ * the emulated map (the physical address), and, with pci=<bdf> of any PCI
+ * device, in a real one against the IOMMU translation if it is on. The
+ * benchmark prints ns/op and Kops/s of mapping and unmapping a page per
+ * transfer against the lookup in the persistent map, for that device. Boot
+ * with iommu.strict=1, iommu.strict=0 or iommu=off (intel_iommu=off) to
+ * compare the IOMMU modes.
+ *
+ * Loading fails with -EINVAL if any test fails, the results are in dmesg.
+ */
+#include <linux/dma-mapping.h>
+#include <linux/iommu.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/pci.h>
+#include <linux/random.h>
+
+#include "rswap_dma.h"
+
+MODULE_AUTHOR("Chenxi Wang, Yifan Qiao, Yulong Zhang");
+MODULE_DESCRIPTION("RSWAP, persistent DMA mapping self-tests and microbenchmarks");
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_VERSION("1.0");
+
+static char *pci_dev_name;
+static int nr_pages = 1 << 16;
+static int bench_iters = 1 << 16;
+static bool bench = true;
+
+MODULE_PARM_DESC(pci, "PCI device (domain:bus:slot.fn) for the real mapping and the benchmark, none by default");
+MODULE_PARM_DESC(nr_pages, "Random pages checked per map");
+MODULE_PARM_DESC(bench_iters, "Pages mapped by each benchmark");
+MODULE_PARM_DESC(bench, "Run the benchmark after the tests");
+module_param_named(pci, pci_dev_name, charp, 0444);
+module_param(nr_pages, int, 0444);
+module_param(bench_iters, int, 0444);
+module_param(bench, bool, 0444);
+
+static int nr_failed_checks;
+static struct pci_dev *pdev;
+
+#define DMA_CHECK(cond)                                                        \
+	do {                                                                   \
+		if (!(cond)) {                                                 \
+			pr_err("%s:%d check failed: %s\n", __func__, __LINE__, \
+			       #cond);                                         \
+			nr_failed_checks++;                                    \
+		}                                                              \
+	} while (0)
+
+// a random valid pfn, 0 if none found
+static unsigned long dma_random_pfn(struct rswap_dma_map *map)
+{
+	unsigned long pfn;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		pfn = prandom_u32_max(map->nr_segs) << PFN_SECTION_SHIFT |
+		      prandom_u32_max(PAGES_PER_SECTION);
+		if (pfn_valid(pfn))
+			return pfn;
+	}
+	return 0;
+}
+
+// the address where the device reaches the page, 0 if unknown
+static phys_addr_t dma_to_phys(struct rswap_dma_map *map, u64 dma)
+{
+	struct iommu_domain *domain;
+
+	if (!map->dev)
+		return dma;
+	domain = iommu_get_domain_for_dev(map->dev);
+	if (!domain)
+		return dma; // no translation
+	return iommu_iova_to_phys(domain, dma);
+}
+
+static void dma_check_map(struct rswap_dma_map *map)
+{
+	unsigned long pfn, seg;
+	u64 dma;
+	int i;
+
+	DMA_CHECK(map->nr_mapped > 0);
+	for (seg = 0; seg < map->nr_segs; seg++) {
+		if (map->seg_dma[seg] != RSWAP_DMA_NONE)
+			DMA_CHECK(IS_ALIGNED(map->seg_dma[seg], PAGE_SIZE));
+	}
+	for (i = 0; i < nr_pages; i++) {
+		pfn = dma_random_pfn(map);
+		if (!pfn)
+			continue;
+		dma = rswap_dma_page_addr(map, pfn_to_page(pfn));
+		if (dma == RSWAP_DMA_NONE) {
+			// only in a section left out
+			DMA_CHECK(map->seg_dma[pfn >> PFN_SECTION_SHIFT] ==
+				  RSWAP_DMA_NONE);
+			continue;
+		}
+		DMA_CHECK(dma_to_phys(map, dma) == PFN_PHYS(pfn));
+	}
+}
+
+/* single thread tests */
+
+static void dma_test_emulated(void)
+{
+	struct rswap_dma_map map;
+	struct page *page = alloc_page(GFP_KERNEL);
+
+	if (!page)
+		return;
+	DMA_CHECK(rswap_dma_map_init(&map, NULL) == 0);
+	dma_check_map(&map);
+	DMA_CHECK(rswap_dma_page_addr(&map, page) == page_to_phys(page));
+	rswap_dma_map_exit(&map);
+	DMA_CHECK(map.nr_segs == 0);
+	__free_page(page);
+}
+
+// past the end of the memory, or after the map is gone
+static void dma_test_unmapped(void)
+{
+	struct rswap_dma_map map;
+	struct page *page = alloc_page(GFP_KERNEL);
+
+	if (!page)
+		return;
+	DMA_CHECK(rswap_dma_map_init(&map, NULL) == 0);
+	map.nr_segs = page_to_pfn(page) >> PFN_SECTION_SHIFT;
+	DMA_CHECK(rswap_dma_page_addr(&map, page) == RSWAP_DMA_NONE);
+	map.nr_segs++;
+	DMA_CHECK(rswap_dma_page_addr(&map, page) != RSWAP_DMA_NONE);
+	rswap_dma_map_exit(&map);
+	DMA_CHECK(rswap_dma_page_addr(&map, page) == RSWAP_DMA_NONE);
+	__free_page(page);
+}
+
+static void dma_test_device(void)
+{
+	struct rswap_dma_map map;
+
+	if (!pdev)
+		return;
+	DMA_CHECK(rswap_dma_map_init(&map, &pdev->dev) == 0);
+	dma_check_map(&map);
+	rswap_dma_map_exit(&map);
+}
+
+/* benchmarks */
+
+static void dma_bench(void)
+{
+	struct rswap_dma_map map;
+	struct page **pages;
+	u64 start, ns, sum = 0;
+	dma_addr_t dma;
+	int i, n = 0;
+
+	if (!pdev)
+		return;
+	pages = kvmalloc_array(bench_iters, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return;
+	// the swap pages are scattered over the memory
+	for (i = 0; i < bench_iters; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i])
+			break;
+		n++;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		dma = dma_map_page(&pdev->dev, pages[i], 0, PAGE_SIZE,
+				   DMA_FROM_DEVICE);
+		if (dma_mapping_error(&pdev->dev, dma))
+			continue;
+		dma_unmap_page(&pdev->dev, dma, PAGE_SIZE, DMA_FROM_DEVICE);
+	}
+	ns = ktime_get_ns() - start;
+	pr_info("rswap_dma bench: map+unmap per page: %llu ns/op, %llu Kops/s\n",
+		ns / max(n, 1), (u64)n * 1000000 / max(ns, 1ULL));
+
+	if (!rswap_dma_map_init(&map, &pdev->dev)) {
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			sum += rswap_dma_page_addr(&map, pages[i]);
+			dma_sync_single_for_cpu(&pdev->dev,
+						rswap_dma_page_addr(&map, pages[i]),
+						PAGE_SIZE, DMA_FROM_DEVICE);
+		}
+		ns = ktime_get_ns() - start;
+		pr_info("rswap_dma bench: persistent map lookup+sync: %llu ns/op, %llu Kops/s (%llx)\n",
+			ns / max(n, 1), (u64)n * 1000000 / max(ns, 1ULL), sum);
+		rswap_dma_map_exit(&map);
+	}
+
+	for (i = 0; i < n; i++)
+		__free_page(pages[i]);
+	kvfree(pages);
+}
+
+struct dma_test_case {
+	const char *name;
+	void (*run)(void);
+};
+
+static const struct dma_test_case dma_tests[] = {
+	{ "emulated", dma_test_emulated },
+	{ "unmapped", dma_test_unmapped },
+	{ "device", dma_test_device },
+};
+
+static int __init rswap_dma_test_init(void)
+{
+	unsigned int domain, bus, slot, fn;
+	int i, failed, nr_failed = 0;
+
+	if (pci_dev_name) {
+		if (sscanf(pci_dev_name, "%x:%x:%x.%x", &domain, &bus, &slot,
+			   &fn) != 4)
+			return -EINVAL;
+		pdev = pci_get_domain_bus_and_slot(domain, bus,
+						   PCI_DEVFN(slot, fn));
+		if (!pdev)
+			return -ENODEV;
+	}
+
+	// TAP, as KUnit prints it
+	pr_info("TAP version 14\n");
+	pr_info("1..%zu\n", ARRAY_SIZE(dma_tests));
+	for (i = 0; i < ARRAY_SIZE(dma_tests); i++) {
+		failed = nr_failed_checks;
+		dma_tests[i].run();
+		failed = nr_failed_checks != failed;
+		nr_failed += failed;
+		pr_info("%s %d - rswap_dma_%s%s\n", failed ? "not ok" : "ok",
+			i + 1, dma_tests[i].name,
+			dma_tests[i].run == dma_test_device && !pdev ?
+				" # SKIP no pci device" :
+				"");
+	}
+	if (nr_failed) {
+		pci_dev_put(pdev);
+		return -EINVAL;
+	}
+
+	if (bench)
+		dma_bench();
+	return 0;
+}
+
+static void __exit rswap_dma_test_exit(void)
+{
+	pci_dev_put(pdev);
+}
+
+module_init(rswap_dma_test_init);
+module_exit(rswap_dma_test_exit);
@@ -1,4 +1,5 @@
 #include "rswap_dram.h"
+#include "rswap_heat.h"
 #include "constants.h"
 
 static void *local_dram; // a buffer created via vzalloc
@@ -8,6 +9,7 @@ int rswap_dram_write(struct page *page, size_t roffset)
 {
 	void *page_vaddr;
 
+	rswap_heat_add(roffset, true);
 	page_vaddr = kmap_atomic(page);
 	copy_page((void *)(local_dram + roffset), page_vaddr);
 	kunmap_atomic(page_vaddr);
@@ -22,6 +24,7 @@ int rswap_dram_read(struct page *page, size_t roffset)
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(PageUptodate(page), page);
 
+	rswap_heat_add(roffset, false);
 	page_vaddr = kmap_atomic(page);
 	copy_page(page_vaddr, (void *)(local_dram + roffset));
 	kunmap_atomic(page_vaddr);
@@ -31,6 +34,18 @@ int rswap_dram_read(struct page *page, size_t roffset)
 	return 0;
 }
 
+// The cleancache read, the page stays locked and is not marked up to date.
+int rswap_dram_copy_to_page(struct page *page, size_t roffset)
+{
+	void *page_vaddr;
+
+	rswap_heat_add(roffset, false);
+	page_vaddr = kmap_atomic(page);
+	copy_page(page_vaddr, (void *)(local_dram + roffset));
+	kunmap_atomic(page_vaddr);
+	return 0;
+}
+
 int rswap_init_local_dram(int _mem_size)
 {
 	local_mem_size = (uint64_t)_mem_size * ONE_GB;
@@ -1,3 +1,4 @@
+#include "rswap_cleancache.h"
 #include "rswap_dram.h"
 #include "rswap_ops.h"
 #include "utils.h"
@@ -5,11 +6,35 @@
 #include "rswap_scheduler.h"
 #include <linux/swap_stats.h>
 
+// of the dram, the swap device takes the pages past it
+static pgoff_t rswap_swap_pages;
+// GB of the dram, all of the rmsize
+static int rswap_dram_size;
+
+int rswap_granted_size(void)
+{
+	return rswap_dram_size;
+}
+
+void rswap_swap_limit_init(int mem_size, int cc_size, int dev_size)
+{
+	rswap_swap_pages = (pgoff_t)max(mem_size - cc_size - dev_size, 0)
+			   << (30 - PAGE_SHIFT);
+	pr_info("%s, %lu swap pages in the dram\n", __func__,
+		rswap_swap_pages);
+}
+
 int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset,
 			  struct page *page)
 {
 	int ret = 0;
 
+	// the store fails, the kernel writes the page to the swap device
+	if (unlikely(swap_entry_offset >= rswap_swap_pages)) {
+		pr_warn_once("%s, the swap partition is larger than the dram, the pages past %lu go to the swap device\n",
+			     __func__, rswap_swap_pages);
+		return -ENOSPC;
+	}
 	ret = rswap_dram_write(page, swap_entry_offset << PAGE_SHIFT);
 	if (unlikely(ret)) {
 		pr_err("could not read page remotely\n");
@@ -54,6 +79,16 @@ int rswap_frontswap_poll_load(int cpu)
 	return 0;
 }
 
+int rswap_cc_write_page(size_t roffset, struct page *page)
+{
+	return rswap_dram_write(page, roffset);
+}
+
+int rswap_cc_read_page(size_t roffset, struct page *page)
+{
+	return rswap_dram_copy_to_page(page, roffset);
+}
+
 static void rswap_invalidate_page(unsigned type, pgoff_t offset)
 {
 #ifdef DEBUG_MODE_DETAIL
@@ -111,12 +146,79 @@ int rswap_replace_frontswap(void)
 	return 0;
 }
 
+void *rswap_client_park(void)
+{
+	// the local DRAM goes with the module
+	return NULL;
+}
+
+int rswap_unpark_frontswap(void)
+{
+	// the local DRAM of the parked module is gone
+	pr_err("%s, cannot take the pages of the parked module, frontswap stays parked.\n",
+	       __func__);
+	return -EOPNOTSUPP;
+}
+
 int rswap_client_init(char *server_ip, int server_port, int mem_size)
 {
+	rswap_dram_size = mem_size;
 	return rswap_init_local_dram(mem_size);
 }
 
 void rswap_client_exit(void)
 {
 	rswap_remove_local_dram();
-}
\ No newline at end of file
+}
+// No rdma to take the transfers from user space to.
+int rswap_dev_init(int mem_size, int cc_size, int dev_size)
+{
+	if (!dev_size)
+		return 0;
+	pr_err("%s, no /dev/rswap on the dram backend\n", __func__);
+	return -EOPNOTSUPP;
+}
+
+void rswap_dev_exit(void)
+{
+}
+
+// log_store is a parameter of the rdma backend
+int rswap_log_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_log_exit(void)
+{
+}
+
+// ecip is a parameter of the rdma backend
+int rswap_ec_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_ec_exit(void)
+{
+}
+
+// mgip is a parameter of the rdma backend
+int rswap_migrate_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_migrate_exit(void)
+{
+}
+
+// farip is a parameter of the rdma backend
+int rswap_tier_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_tier_exit(void)
+{
+}
@@ -0,0 +1,673 @@
+#include <linux/inet.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+
+#include "rswap_ec.h"
+#include "rswap_rdma.h"
+#include "rswap_ops.h"
+
+/*
+ * Erasure-coded swap across RSWAP_EC_N memory servers, RS(4,2), see
+ * rswap_ec.h: the primary server is fragment server 0, ecip gives the
+ * others. Each server holds one fragment of a stripe, so the remote memory
+ * is 1.5x the swapped out pages instead of 2x with a replica, and any two
+ * servers may fail.
+ *
+ * A load reads its page from the server of its data fragment, as without
+ * coding. If that server is dead or the read fails, the stripe is read from
+ * the other servers and decoded, in a work item. Loads only unlock their
+ * page, the fault waits for it.
+ *
+ * A store is copied into the pending stripe of its core, and the stripe is
+ * written once all its members are stored, the data pages and the parity
+ * in one batch of writes. A partial stripe, when the core goes on to
+ * another stripe or after ec_flush_ms, reads the members not stored from
+ * the servers to compute the parity. The servers thus always hold
+ * consistent stripes, written under the stripe's lock against the decoding
+ * reads. A server is dead after its first failed transfer, until the
+ * module is reloaded.
+ *
+ * A pending stripe whose write fails stays pending and is retried, the
+ * stores that would replace it fail meanwhile. Once more than RSWAP_EC_M
+ * servers are dead it can never be written, its members are marked lost and
+ * their loads fail instead of reading the old stripe.
+ */
+
+static char ec_servers[RSWAP_EC_N * 24];
+static int ec_flush_ms = 10;
+
+MODULE_PARM_DESC(ecip,
+		 "Erasure-code the swap across the primary and 5 more memory servers, ip:port,ip:port,..., none by default");
+MODULE_PARM_DESC(ec_flush_ms, "Write a partly stored stripe after that many ms");
+module_param_string(ecip, ec_servers, sizeof(ec_servers), 0444);
+module_param_named(ec_flush_ms, ec_flush_ms, int, 0644);
+
+#define RSWAP_EC_NONE U64_MAX
+#define RSWAP_EC_LOCKS 64 // stripe locks, hashed
+
+struct rswap_ec_pend {
+	spinlock_t lock;
+	u64 stripe; // RSWAP_EC_NONE if none
+	unsigned int members; // stored since the last write
+	bool indexed; // in the pending xarray
+	unsigned long stamp; // jiffies of the first store
+	struct page *pages[RSWAP_EC_N]; // the stripe, parity computed at the write
+	struct page *scratch[RSWAP_EC_N]; // read from the servers
+};
+
+struct rswap_ec_io {
+	struct ib_cqe cqe;
+	struct page *page;
+	u64 dma_addr;
+	enum dma_data_direction dir;
+	unsigned int srv;
+	struct rswap_rdma_queue *rdma_queue;
+	enum ib_wc_status status;
+};
+
+struct rswap_ec_read {
+	struct rswap_ec_io io;
+	struct work_struct work;
+	struct page *page; // locked until read or decoded
+	pgoff_t offset;
+};
+
+static struct {
+	bool on;
+	struct rdma_session_context *sessions[RSWAP_EC_N]; // 0 is the primary
+	unsigned long dead; // servers
+	u64 nr_stripes;
+
+	struct rswap_ec_pend *pends; // of each cpu
+	struct xarray pending; // stripe -> pend
+	spinlock_t locks[RSWAP_EC_LOCKS];
+	struct delayed_work flush_work;
+
+	u8 *lost; // members of each stripe dropped unwritten
+	struct workqueue_struct *wq; // ordered, the decoding reads
+	struct page *scratch[RSWAP_EC_N]; // of the decoding reads
+	atomic_t inflight; // loads
+
+	atomic64_t full_writes, partial_writes, degraded_reads, decoded;
+} rswap_ec;
+
+bool rswap_ec_on(void)
+{
+	return rswap_ec.on;
+}
+
+static spinlock_t *rswap_ec_lock(u64 stripe)
+{
+	return &rswap_ec.locks[stripe % RSWAP_EC_LOCKS];
+}
+
+static bool rswap_ec_dead(unsigned int srv)
+{
+	return test_bit(srv, &rswap_ec.dead);
+}
+
+// no stripe can be written any more
+static bool rswap_ec_broken(void)
+{
+	return hweight_long(READ_ONCE(rswap_ec.dead)) > RSWAP_EC_M;
+}
+
+static void rswap_ec_kill(unsigned int srv, const char *why)
+{
+	if (!test_and_set_bit(srv, &rswap_ec.dead))
+		pr_err("%s, memory server %u is dead, %s, %u of %u left\n", __func__, srv, why,
+		       RSWAP_EC_N - hweight_long(READ_ONCE(rswap_ec.dead)), RSWAP_EC_N);
+}
+
+// the fragments of a stripe on the dead servers
+static unsigned int rswap_ec_lost(u64 stripe)
+{
+	unsigned int frag, lost = 0;
+
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if (rswap_ec_dead(rswap_ec_server(stripe, frag)))
+			lost |= 1U << frag;
+	}
+	return lost;
+}
+
+static void rswap_ec_io_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_ec_io *io = container_of(wc->wr_cqe, struct rswap_ec_io, cqe);
+
+	ib_dma_unmap_page(io->rdma_queue->rdma_session->rdma_dev->dev, io->dma_addr, PAGE_SIZE, io->dir);
+	atomic_dec(&io->rdma_queue->rdma_post_counter);
+	io->status = wc->status;
+	if (unlikely(wc->status != IB_WC_SUCCESS))
+		rswap_ec_kill(io->srv, rdma_wc_status_name(wc->status));
+}
+
+// Posts the transfer of a fragment, preemption disabled. The async loads
+// do not wait for credits.
+static int rswap_ec_post(struct rswap_ec_io *io, u64 stripe, unsigned int frag, struct page *page,
+			 enum rdma_queue_type type)
+{
+	unsigned int srv = rswap_ec_server(stripe, frag);
+	struct rdma_session_context *rdma_session = rswap_ec.sessions[srv];
+	size_t addr = pgoff2addr(stripe);
+	struct remote_chunk *chunk = &rdma_session->remote_mem_pool.chunks[addr >> CHUNK_SHIFT];
+	struct ib_device *dev = rdma_session->rdma_dev->dev;
+	struct ib_sge sge;
+	struct ib_rdma_wr wr = {
+		.wr.wr_cqe = &io->cqe,
+		.wr.sg_list = &sge,
+		.wr.num_sge = 1,
+		.wr.opcode = type == QP_STORE ? IB_WR_RDMA_WRITE : IB_WR_RDMA_READ,
+		.wr.send_flags = IB_SEND_SIGNALED,
+		.remote_addr = chunk->remote_addr + (addr & CHUNK_MASK),
+		.rkey = chunk->remote_rkey,
+	};
+	const struct ib_send_wr *bad_wr;
+	int ret;
+
+	if (rswap_ec_dead(srv))
+		return -EIO;
+	if (!io->cqe.done)
+		io->cqe.done = rswap_ec_io_done;
+	io->page = page;
+	io->srv = srv;
+	io->dir = type == QP_STORE ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	io->status = IB_WC_SUCCESS;
+	io->dma_addr = ib_dma_map_page(dev, page, 0, PAGE_SIZE, io->dir);
+	if (unlikely(ib_dma_mapping_error(dev, io->dma_addr)))
+		return -ENOMEM;
+	sge.addr = io->dma_addr;
+	sge.length = PAGE_SIZE;
+	sge.lkey = rdma_session->rdma_dev->pd->local_dma_lkey;
+
+	io->rdma_queue = get_rdma_queue(rdma_session, smp_processor_id(), type);
+	while (atomic_inc_return(&io->rdma_queue->rdma_post_counter) >= RDMA_SEND_QUEUE_DEPTH - 16) {
+		atomic_dec(&io->rdma_queue->rdma_post_counter);
+		if (type == QP_LOAD_ASYNC) {
+			ret = -EBUSY;
+			goto err;
+		}
+		drain_rdma_queue(io->rdma_queue);
+	}
+	ret = ib_post_send(io->rdma_queue->qp, &wr.wr, &bad_wr);
+	if (unlikely(ret)) {
+		atomic_dec(&io->rdma_queue->rdma_post_counter);
+		rswap_ec_kill(srv, "post failed");
+		goto err;
+	}
+	return 0;
+
+err:
+	ib_dma_unmap_page(dev, io->dma_addr, PAGE_SIZE, io->dir);
+	return ret;
+}
+
+// Transfers the fragments of a stripe in the mask, all posted before
+// waiting. Returns the fragments done.
+static unsigned int rswap_ec_rw(u64 stripe, struct page **frags, unsigned int mask, bool write)
+{
+	struct rswap_ec_io ios[RSWAP_EC_N] = {};
+	unsigned int frag, posted = 0, done = 0;
+
+	get_cpu();
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if ((mask & (1U << frag)) &&
+		    !rswap_ec_post(&ios[frag], stripe, frag, frags[frag], write ? QP_STORE : QP_LOAD_SYNC))
+			posted |= 1U << frag;
+	}
+	// a queue per server
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if (!(posted & (1U << frag)))
+			continue;
+		drain_rdma_queue(ios[frag].rdma_queue);
+		if (ios[frag].status == IB_WC_SUCCESS)
+			done |= 1U << frag;
+	}
+	put_cpu();
+	return done;
+}
+
+/*
+ * Reads the fragments of a stripe in the mask, decoded from all the others
+ * if some are on dead servers or their reads fail. Under the stripe's lock.
+ */
+static int rswap_ec_read_stripe(u64 stripe, struct page **frags, unsigned int want)
+{
+	unsigned int lost = rswap_ec_lost(stripe), done = 0, frag;
+	u8 *ptrs[RSWAP_EC_N];
+
+	if (want & lost)
+		want = RSWAP_EC_ALL;
+	for (;;) {
+		done |= rswap_ec_rw(stripe, frags, want & ~done, false);
+		if (!(want & ~done) || want == RSWAP_EC_ALL)
+			break;
+		want = RSWAP_EC_ALL;
+	}
+	lost = want & ~done;
+	if (!lost)
+		return 0;
+
+	for (frag = 0; frag < RSWAP_EC_N; frag++)
+		ptrs[frag] = page_address(frags[frag]);
+	if (rswap_ec_decode(ptrs, PAGE_SIZE, lost)) {
+		pr_err("%s, stripe 0x%llx lost, fragments 0x%x unavailable\n", __func__, stripe, lost);
+		return -EIO;
+	}
+	atomic64_inc(&rswap_ec.decoded);
+	return 0;
+}
+
+/* stores */
+
+// Writes the pending stripe, under the stripe's lock.
+static int rswap_ec_flush(struct rswap_ec_pend *pend)
+{
+	u64 stripe = pend->stripe;
+	unsigned int missing = RSWAP_EC_DATA & ~pend->members, want, done, frag;
+	spinlock_t *lock = rswap_ec_lock(stripe);
+	u8 *ptrs[RSWAP_EC_N];
+	int ret = 0;
+
+	spin_lock(lock);
+	if (missing) {
+		// the old stripe, the new members are still consistent with it
+		ret = rswap_ec_read_stripe(stripe, pend->scratch, missing);
+		if (ret)
+			goto out;
+		for (frag = 0; frag < RSWAP_EC_K; frag++) {
+			if (missing & (1U << frag))
+				copy_highpage(pend->pages[frag], pend->scratch[frag]);
+		}
+	}
+	for (frag = 0; frag < RSWAP_EC_N; frag++)
+		ptrs[frag] = page_address(pend->pages[frag]);
+	rswap_ec_encode(ptrs, PAGE_SIZE);
+
+	// the members not stored are already there
+	want = pend->members | 1U << RSWAP_EC_P | 1U << RSWAP_EC_Q;
+	done = rswap_ec_rw(stripe, pend->pages, want, true);
+	if (rswap_ec_broken()) {
+		pr_err("%s, stripe 0x%llx lost, fragments 0x%x of 0x%x written\n", __func__, stripe, done, want);
+		ret = -EIO;
+		goto out;
+	}
+	if (missing)
+		atomic64_inc(&rswap_ec.partial_writes);
+	else
+		atomic64_inc(&rswap_ec.full_writes);
+	rswap_ec.lost[stripe] &= ~pend->members;
+out:
+	spin_unlock(lock);
+	return ret;
+}
+
+// The pending stripe is empty after.
+static void rswap_ec_reset(struct rswap_ec_pend *pend)
+{
+	if (pend->indexed)
+		xa_erase(&rswap_ec.pending, pend->stripe);
+	pend->stripe = RSWAP_EC_NONE;
+	pend->members = 0;
+	pend->indexed = false;
+}
+
+/*
+ * Writes the pending stripe, emptied once written. On a failure it stays
+ * pending to be retried, unless it can never be written: its members are
+ * marked lost then.
+ */
+static int rswap_ec_write(struct rswap_ec_pend *pend)
+{
+	spinlock_t *lock = rswap_ec_lock(pend->stripe);
+	int ret;
+
+	ret = rswap_ec_flush(pend);
+	if (ret && !rswap_ec_broken())
+		return ret;
+	if (ret) {
+		spin_lock(lock);
+		rswap_ec.lost[pend->stripe] |= pend->members;
+		spin_unlock(lock);
+		pr_err_ratelimited("%s, stripe 0x%llx lost, members 0x%x\n", __func__, pend->stripe,
+				   pend->members);
+	}
+	rswap_ec_reset(pend);
+	return ret;
+}
+
+static int rswap_ec_add(struct rswap_ec_pend *pend, unsigned int member, struct page *page)
+{
+	copy_highpage(pend->pages[member], page);
+	pend->members |= 1U << member;
+	// the page is stored as long as the stripe is pending
+	if (pend->members == RSWAP_EC_DATA && rswap_ec_write(pend) && pend->stripe == RSWAP_EC_NONE)
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Returns 0 once the page is stored, or in the pending stripe, an error if
+ * it could not be, 1 if the swap is not erasure-coded.
+ */
+int rswap_ec_store_page(pgoff_t offset, struct page *page)
+{
+	u64 stripe = rswap_ec_stripe(offset);
+	unsigned int member = rswap_ec_member(offset);
+	struct rswap_ec_pend *pend;
+	int ret;
+
+	if (!rswap_ec.on)
+		return 1;
+	if (stripe >= rswap_ec.nr_stripes)
+		return -ENOSPC;
+
+retry:
+	// another core's stripe
+	pend = xa_load(&rswap_ec.pending, stripe);
+	if (pend) {
+		spin_lock(&pend->lock);
+		if (pend->stripe != stripe) {
+			spin_unlock(&pend->lock);
+			goto retry;
+		}
+		ret = rswap_ec_add(pend, member, page);
+		spin_unlock(&pend->lock);
+		return ret;
+	}
+
+	pend = &rswap_ec.pends[raw_smp_processor_id()];
+	spin_lock(&pend->lock);
+	// the page goes to the swap device while the stripe is retried
+	if (pend->stripe != RSWAP_EC_NONE && rswap_ec_write(pend) && pend->stripe != RSWAP_EC_NONE) {
+		spin_unlock(&pend->lock);
+		return -EBUSY;
+	}
+	pend->stripe = stripe;
+	pend->stamp = jiffies;
+	ret = xa_insert(&rswap_ec.pending, stripe, pend, GFP_ATOMIC);
+	if (ret == -EBUSY) {
+		pend->stripe = RSWAP_EC_NONE;
+		spin_unlock(&pend->lock);
+		goto retry;
+	}
+	// written at once then
+	pend->indexed = !ret;
+	ret = rswap_ec_add(pend, member, page);
+	if (!ret && !pend->indexed) {
+		// only this page, it goes to the swap device on a failure
+		ret = rswap_ec_flush(pend);
+		rswap_ec_reset(pend);
+	}
+	spin_unlock(&pend->lock);
+	return ret;
+}
+
+static void rswap_ec_flush_work(struct work_struct *work)
+{
+	unsigned long age = msecs_to_jiffies(max(READ_ONCE(ec_flush_ms), 1));
+	struct rswap_ec_pend *pend;
+	unsigned int cpu;
+
+	for_each_possible_cpu (cpu) {
+		pend = &rswap_ec.pends[cpu];
+		spin_lock(&pend->lock);
+		if (pend->stripe != RSWAP_EC_NONE && time_after_eq(jiffies, pend->stamp + age))
+			rswap_ec_write(pend);
+		spin_unlock(&pend->lock);
+	}
+	if (rswap_ec.on)
+		queue_delayed_work(system_unbound_wq, &rswap_ec.flush_work, age);
+}
+
+/* loads */
+
+// the page from the other fragments of its stripe, a fragment at a time
+static void rswap_ec_degraded_read(struct work_struct *work)
+{
+	struct rswap_ec_read *read = container_of(work, struct rswap_ec_read, work);
+	u64 stripe = rswap_ec_stripe(read->offset);
+	unsigned int member = rswap_ec_member(read->offset);
+	spinlock_t *lock = rswap_ec_lock(stripe);
+	int ret;
+
+	spin_lock(lock);
+	ret = rswap_ec_read_stripe(stripe, rswap_ec.scratch, 1U << member);
+	spin_unlock(lock);
+	if (!ret) {
+		copy_highpage(read->page, rswap_ec.scratch[member]);
+		SetPageUptodate(read->page);
+	}
+	// else the fault gets a SIGBUS
+	unlock_page(read->page);
+	atomic64_inc(&rswap_ec.degraded_reads);
+	kfree(read);
+	atomic_dec(&rswap_ec.inflight);
+}
+
+static void rswap_ec_read_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_ec_read *read = container_of(wc->wr_cqe, struct rswap_ec_read, io.cqe);
+
+	rswap_ec_io_done(cq, wc);
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		queue_work(rswap_ec.wq, &read->work);
+		return;
+	}
+	SetPageUptodate(read->page);
+	unlock_page(read->page);
+	kfree(read);
+	atomic_dec(&rswap_ec.inflight);
+}
+
+/*
+ * Returns 0 once the read of the page is posted, the page is unlocked when
+ * done, an error if it could not be, 1 if the swap is not erasure-coded.
+ */
+int rswap_ec_load_page(pgoff_t offset, struct page *page)
+{
+	u64 stripe = rswap_ec_stripe(offset);
+	unsigned int member = rswap_ec_member(offset);
+	struct rswap_ec_pend *pend;
+	struct rswap_ec_read *read;
+	int ret;
+
+	if (!rswap_ec.on)
+		return 1;
+	if (stripe >= rswap_ec.nr_stripes)
+		return -EINVAL;
+
+	pend = xa_load(&rswap_ec.pending, stripe);
+	if (pend) {
+		spin_lock(&pend->lock);
+		if (pend->stripe == stripe && (pend->members & (1U << member))) {
+			copy_highpage(page, pend->pages[member]);
+			spin_unlock(&pend->lock);
+			SetPageUptodate(page);
+			unlock_page(page);
+			return 0;
+		}
+		spin_unlock(&pend->lock);
+	}
+	// the fault gets SIGBUS instead of the old page
+	if (unlikely(READ_ONCE(rswap_ec.lost[stripe]) & (1U << member))) {
+		SetPageError(page);
+		unlock_page(page);
+		return 0;
+	}
+
+	read = kmalloc(sizeof(*read), GFP_ATOMIC);
+	if (!read)
+		return -ENOMEM;
+	read->io.cqe.done = rswap_ec_read_done;
+	read->page = page;
+	read->offset = offset;
+	INIT_WORK(&read->work, rswap_ec_degraded_read);
+	atomic_inc(&rswap_ec.inflight);
+	get_cpu();
+	ret = rswap_ec_post(&read->io, stripe, member, page, QP_LOAD_ASYNC);
+	put_cpu();
+	if (ret)
+		queue_work(rswap_ec.wq, &read->work);
+	return 0;
+}
+
+/* setup */
+
+// ip:port of the servers 1.. in ecip
+static int rswap_ec_connect(void)
+{
+	char *servers = ec_servers, *server, *port;
+	struct rdma_session_context *rdma_session;
+	u64 chunks = DIV_ROUND_UP(pgoff2addr(rswap_ec.nr_stripes), (u64)REGION_SIZE_GB * ONE_GB);
+	unsigned int srv = 1;
+	int ret, nr;
+
+	while ((server = strsep(&servers, ",")) != NULL) {
+		port = strrchr(server, ':');
+		if (srv == RSWAP_EC_N || !port || kstrtoint(port + 1, 10, &nr))
+			goto err_param;
+		*port = '\0';
+
+		rdma_session = kzalloc(sizeof(*rdma_session), GFP_KERNEL);
+		if (!rdma_session)
+			return -ENOMEM;
+		rswap_ec.sessions[srv++] = rdma_session;
+		rdma_session->secondary = true;
+		rdma_session->remote_mem_pool.remote_mem_size = chunks * REGION_SIZE_GB;
+		rdma_session->remote_mem_pool.chunk_num = chunks;
+		if (init_rdma_sessions(rdma_session, server, nr) != 1)
+			return -EINVAL;
+		ret = rdma_session_connect(rdma_session);
+		if (ret) {
+			pr_err("%s, connect to memory server %s:%d failed\n", __func__, server, nr);
+			return ret;
+		}
+		if (rdma_session->remote_mem_pool.chunk_num < chunks) {
+			pr_err("%s, %u of %llu chunks on %s:%d\n", __func__, rdma_session->remote_mem_pool.chunk_num,
+			       chunks, server, nr);
+			return -ENOMEM;
+		}
+	}
+	if (srv == RSWAP_EC_N)
+		return 0;
+
+err_param:
+	pr_err("%s, ecip takes %d ip:port of memory servers\n", __func__, RSWAP_EC_N - 1);
+	return -EINVAL;
+}
+
+static void rswap_ec_free(void)
+{
+	unsigned int cpu, frag, srv;
+
+	for (srv = 1; srv < RSWAP_EC_N; srv++) {
+		if (!rswap_ec.sessions[srv])
+			continue;
+		if (rswap_ec.sessions[srv]->rdma_dev)
+			rswap_disconnect_and_collect_resource(rswap_ec.sessions[srv]);
+		kfree(rswap_ec.sessions[srv]);
+		rswap_ec.sessions[srv] = NULL;
+	}
+	for (cpu = 0; rswap_ec.pends && cpu < nr_cpu_ids; cpu++) {
+		for (frag = 0; frag < RSWAP_EC_N; frag++) {
+			if (rswap_ec.pends[cpu].pages[frag])
+				__free_page(rswap_ec.pends[cpu].pages[frag]);
+			if (rswap_ec.pends[cpu].scratch[frag])
+				__free_page(rswap_ec.pends[cpu].scratch[frag]);
+		}
+	}
+	kfree(rswap_ec.pends);
+	rswap_ec.pends = NULL;
+	vfree(rswap_ec.lost);
+	rswap_ec.lost = NULL;
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if (rswap_ec.scratch[frag])
+			__free_page(rswap_ec.scratch[frag]);
+		rswap_ec.scratch[frag] = NULL;
+	}
+	if (rswap_ec.wq)
+		destroy_workqueue(rswap_ec.wq);
+	rswap_ec.wq = NULL;
+	xa_destroy(&rswap_ec.pending);
+}
+
+static int rswap_ec_alloc_pages(struct page **pages)
+{
+	unsigned int frag;
+
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		pages[frag] = alloc_page(GFP_KERNEL);
+		if (!pages[frag])
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+int rswap_ec_init(int mem_size, int cc_size, int dev_size)
+{
+	unsigned int cpu, i;
+	int ret = -ENOMEM;
+
+	if (!ec_servers[0])
+		return 0;
+	if (rswap_log_on() || rdma_session_replica.replica) {
+		pr_err("%s, the stripes are placed in place, no erasure coding with log_store or rsip\n",
+		       __func__);
+		return -EINVAL;
+	}
+
+	// the primary server holds a fragment of each stripe too
+	rswap_ec.nr_stripes = ((((u64)(mem_size - cc_size - dev_size) * ONE_GB) >> PAGE_SHIFT) / RSWAP_EC_K);
+	rswap_ec.sessions[0] = &rdma_session_global;
+	rswap_ec.dead = 0;
+	xa_init(&rswap_ec.pending);
+	for (i = 0; i < RSWAP_EC_LOCKS; i++)
+		spin_lock_init(&rswap_ec.locks[i]);
+	INIT_DELAYED_WORK(&rswap_ec.flush_work, rswap_ec_flush_work);
+	atomic_set(&rswap_ec.inflight, 0);
+
+	rswap_ec.wq = alloc_ordered_workqueue("rswap_ec", WQ_MEM_RECLAIM | WQ_HIGHPRI);
+	rswap_ec.pends = kcalloc(nr_cpu_ids, sizeof(*rswap_ec.pends), GFP_KERNEL);
+	rswap_ec.lost = vzalloc(rswap_ec.nr_stripes);
+	if (!rswap_ec.wq || !rswap_ec.pends || !rswap_ec.lost || rswap_ec_alloc_pages(rswap_ec.scratch))
+		goto err;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		spin_lock_init(&rswap_ec.pends[cpu].lock);
+		rswap_ec.pends[cpu].stripe = RSWAP_EC_NONE;
+		if (cpu_possible(cpu) && (rswap_ec_alloc_pages(rswap_ec.pends[cpu].pages) ||
+					  rswap_ec_alloc_pages(rswap_ec.pends[cpu].scratch)))
+			goto err;
+	}
+
+	ret = rswap_ec_connect();
+	if (ret)
+		goto err;
+
+	rswap_ec_gf_init();
+	rswap_ec.on = true;
+	queue_delayed_work(system_unbound_wq, &rswap_ec.flush_work, msecs_to_jiffies(max(ec_flush_ms, 1)));
+	pr_info("%s, RS(%d,%d) over %d memory servers, %llu stripes\n", __func__, RSWAP_EC_K, RSWAP_EC_M,
+		RSWAP_EC_N, rswap_ec.nr_stripes);
+	return 0;
+
+err:
+	rswap_ec_free();
+	return ret;
+}
+
+// After the stores and loads, nothing pending is kept.
+void rswap_ec_exit(void)
+{
+	if (!rswap_ec.on)
+		return;
+	rswap_ec.on = false;
+	cancel_delayed_work_sync(&rswap_ec.flush_work);
+	while (atomic_read(&rswap_ec.inflight))
+		msleep(1);
+
+	pr_info("%s, %lld full and %lld partial stripe writes, %lld degraded reads, %lld stripes decoded, dead servers 0x%lx\n",
+		__func__, atomic64_read(&rswap_ec.full_writes), atomic64_read(&rswap_ec.partial_writes),
+		atomic64_read(&rswap_ec.degraded_reads), atomic64_read(&rswap_ec.decoded), rswap_ec.dead);
+	rswap_ec_free();
+}
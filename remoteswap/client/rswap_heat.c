@@ -0,0 +1,148 @@
+#include <linux/debugfs.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "constants.h"
+#include "rswap_heat.h"
+
+/*
+ * Every heat_decay_ms, the counts of each MB since the last time are added
+ * to its heat, after halving it, so the heat of a MB is its reads (writes)
+ * of the last period, plus half those of the one before, and so on. Shown
+ * in /sys/kernel/debug/rswap:
+ *
+ *   chunks   the heat of each remote chunk of REGION_SIZE_GB
+ *   regions  the heat of each MB with any, by its offset in MB
+ */
+
+static bool heat_map = true;
+static int heat_decay_ms = 1000;
+
+MODULE_PARM_DESC(heat_map, "Count the reads and writes of each MB of the remote memory, on by default");
+MODULE_PARM_DESC(heat_decay_ms, "The heat of the remote memory is halved that often");
+module_param_named(heat_map, heat_map, bool, 0444);
+module_param_named(heat_decay_ms, heat_decay_ms, int, 0644);
+
+#define RSWAP_HEAT_CHUNK_REGIONS ((unsigned long)REGION_SIZE_GB << (30 - RSWAP_HEAT_SHIFT))
+
+struct rswap_heat_map rswap_heat;
+
+static struct {
+	u32 *heat[2]; // reads, writes, decayed
+	struct mutex lock; // heat, against the readers
+	struct delayed_work decay;
+	struct dentry *dir;
+} rswap_heat_priv;
+
+static void rswap_heat_decay(struct work_struct *work)
+{
+	unsigned long region;
+	int rw;
+
+	mutex_lock(&rswap_heat_priv.lock);
+	for (region = 0; region < rswap_heat.nr_regions; region++) {
+		for (rw = 0; rw < 2; rw++) {
+			u32 *heat = &rswap_heat_priv.heat[rw][region];
+
+			*heat = *heat / 2 + xchg(&rswap_heat.counts[rw][region], 0);
+		}
+		if (!(region & 0xfff))
+			cond_resched();
+	}
+	mutex_unlock(&rswap_heat_priv.lock);
+	queue_delayed_work(system_unbound_wq, &rswap_heat_priv.decay, msecs_to_jiffies(max(heat_decay_ms, 10)));
+}
+
+static int rswap_heat_chunks_show(struct seq_file *m, void *v)
+{
+	unsigned long chunk, region;
+	u64 heat[2];
+	int rw;
+
+	seq_puts(m, "chunk reads writes\n");
+	mutex_lock(&rswap_heat_priv.lock);
+	for (chunk = 0; chunk < rswap_heat.nr_regions / RSWAP_HEAT_CHUNK_REGIONS; chunk++) {
+		heat[0] = heat[1] = 0;
+		for (region = chunk * RSWAP_HEAT_CHUNK_REGIONS; region < (chunk + 1) * RSWAP_HEAT_CHUNK_REGIONS;
+		     region++) {
+			for (rw = 0; rw < 2; rw++)
+				heat[rw] += rswap_heat_priv.heat[rw][region];
+		}
+		seq_printf(m, "%lu %llu %llu\n", chunk, heat[0], heat[1]);
+	}
+	mutex_unlock(&rswap_heat_priv.lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rswap_heat_chunks);
+
+static int rswap_heat_regions_show(struct seq_file *m, void *v)
+{
+	unsigned long region;
+
+	seq_puts(m, "mb reads writes\n");
+	mutex_lock(&rswap_heat_priv.lock);
+	for (region = 0; region < rswap_heat.nr_regions; region++) {
+		if (!rswap_heat_priv.heat[0][region] && !rswap_heat_priv.heat[1][region])
+			continue;
+		seq_printf(m, "%lu %u %u\n", region, rswap_heat_priv.heat[0][region],
+			   rswap_heat_priv.heat[1][region]);
+	}
+	mutex_unlock(&rswap_heat_priv.lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rswap_heat_regions);
+
+// Before the first transfer.
+int rswap_heat_init(int mem_size)
+{
+	int rw;
+
+	if (!heat_map || mem_size <= 0)
+		return 0;
+	rswap_heat.nr_regions = (unsigned long)mem_size << (30 - RSWAP_HEAT_SHIFT);
+	for (rw = 0; rw < 2; rw++) {
+		rswap_heat.counts[rw] = vzalloc(rswap_heat.nr_regions * sizeof(u32));
+		rswap_heat_priv.heat[rw] = vzalloc(rswap_heat.nr_regions * sizeof(u32));
+		if (!rswap_heat.counts[rw] || !rswap_heat_priv.heat[rw])
+			goto err;
+	}
+
+	mutex_init(&rswap_heat_priv.lock);
+	INIT_DELAYED_WORK(&rswap_heat_priv.decay, rswap_heat_decay);
+	rswap_heat_priv.dir = debugfs_create_dir("rswap", NULL);
+	debugfs_create_file("chunks", 0444, rswap_heat_priv.dir, NULL, &rswap_heat_chunks_fops);
+	debugfs_create_file("regions", 0444, rswap_heat_priv.dir, NULL, &rswap_heat_regions_fops);
+	queue_delayed_work(system_unbound_wq, &rswap_heat_priv.decay, msecs_to_jiffies(max(heat_decay_ms, 10)));
+	rswap_heat.on = true;
+	return 0;
+
+err:
+	for (rw = 0; rw < 2; rw++) {
+		vfree(rswap_heat.counts[rw]);
+		rswap_heat.counts[rw] = NULL;
+		vfree(rswap_heat_priv.heat[rw]);
+		rswap_heat_priv.heat[rw] = NULL;
+	}
+	return -ENOMEM;
+}
+
+// After the last transfer.
+void rswap_heat_exit(void)
+{
+	int rw;
+
+	if (!rswap_heat.on)
+		return;
+	rswap_heat.on = false;
+	debugfs_remove_recursive(rswap_heat_priv.dir);
+	cancel_delayed_work_sync(&rswap_heat_priv.decay);
+	for (rw = 0; rw < 2; rw++) {
+		vfree(rswap_heat.counts[rw]);
+		rswap_heat.counts[rw] = NULL;
+		vfree(rswap_heat_priv.heat[rw]);
+		rswap_heat_priv.heat[rw] = NULL;
+	}
+}
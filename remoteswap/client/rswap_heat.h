@@ -0,0 +1,37 @@
+#ifndef __RSWAP_HEAT_H
+#define __RSWAP_HEAT_H
+
+#include <linux/compiler.h>
+#include <linux/types.h>
+
+/*
+ * Heat map of the remote memory: the reads and writes of each MB, counted
+ * by the backend on each transfer, decayed and shown per chunk and per MB in
+ * debugfs, see rswap_heat.c.
+ */
+#define RSWAP_HEAT_SHIFT 20
+
+struct rswap_heat_map {
+	bool on;
+	unsigned long nr_regions; // of 1MB
+	u32 *counts[2]; // reads, writes, since the last decay
+};
+
+extern struct rswap_heat_map rswap_heat;
+
+// Racy, a count lost to another cpu does not matter for a heat map.
+static inline void rswap_heat_add(size_t roffset, bool write)
+{
+	unsigned long region = roffset >> RSWAP_HEAT_SHIFT;
+	u32 *count;
+
+	if (!rswap_heat.on || unlikely(region >= rswap_heat.nr_regions))
+		return;
+	count = &rswap_heat.counts[write][region];
+	WRITE_ONCE(*count, READ_ONCE(*count) + 1);
+}
+
+int rswap_heat_init(int mem_size);
+void rswap_heat_exit(void);
+
+#endif // __RSWAP_HEAT_H
@@ -0,0 +1,684 @@
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#include "rswap_rdma.h"
+#include "rswap_ops.h"
+
+/*
+ * Log-structured swap on the remote memory. Without it, a swap offset has a
+ * fixed remote page, and scattered swap-outs are scattered 4KB writes. With
+ * log_store=1, a store is copied to the staging buffer of its core, which
+ * is written with one RDMA write of a whole segment (LOG_SEG_PAGES) once
+ * full, anywhere in the swap part of the remote memory. The map gives the
+ * current log position of each swap offset.
+ *
+ * A rewritten or invalidated page leaves a dead page in its segment. The
+ * free segments are kept above gc_low by compaction in the background, or
+ * by the store that found none: the segment with the fewest live pages is
+ * read at once, its live pages are copied into the segment being compacted
+ * into, written, and moved in the map only then, and the segment is freed
+ * by a later compaction once the reads started before are done. Loads of
+ * the pages still staged are served from the staging buffer.
+ *
+ * A full staging buffer is swapped with the spare one of its core and
+ * written from there with the stager's lock dropped, the loads of its pages
+ * are served from the spare buffer until it is written.
+ *
+ * The map is lost with the module, so there is no warm reload. Size the
+ * swap partition below the swap part of the remote memory, the log needs
+ * some free segments.
+ */
+
+static int log_store;
+MODULE_PARM_DESC(log_store,
+		 "Append the swapped out pages to per-core logs on the remote memory, with large writes");
+module_param(log_store, int, 0444);
+
+#define LOG_SEG_ORDER 6
+#define LOG_SEG_PAGES (1U << LOG_SEG_ORDER) // 256KB
+#define LOG_SEG_BYTES ((size_t)LOG_SEG_PAGES << PAGE_SHIFT)
+#define LOG_GC_RESERVE 1 // free segments only compaction takes
+
+// owner of a segment, a staging buffer, or
+enum {
+	LOG_FREE = -1,
+	LOG_SEALED = -2, // written
+	LOG_VICTIM = -3, // being compacted
+	LOG_GC_DEST = -4, // compacted into
+	LOG_DRAINING = -5, // compacted, freed once no read is left
+};
+
+struct rswap_log_buf {
+	struct page *pages; // LOG_SEG_PAGES, contiguous
+	u64 dma_addr;
+	enum dma_data_direction dir;
+};
+
+struct rswap_log_stager {
+	spinlock_t lock;
+	struct rswap_log_buf buf;
+	u32 seg; // staged in buf, RSWAP_LOG_NONE if none
+	unsigned int fill;
+	struct rswap_log_buf spare;
+	u32 sealing; // full in spare, RSWAP_LOG_NONE if none
+	bool writing; // spare, with the lock dropped
+};
+
+struct rswap_log_move {
+	u32 offset;
+	u32 pos; // in the victim
+};
+
+static struct {
+	bool on;
+	u32 *map; // swap offset -> log position, seg << LOG_SEG_ORDER | slot
+	u32 *rmap; // log position -> swap offset of its last store
+	unsigned long nr_pages; // of both
+	u32 nr_segs;
+	atomic_t *live; // pages of each segment still in the map
+	atomic_t *readers; // reads in flight of each segment
+	int *owner;
+
+	spinlock_t lock; // free segments
+	unsigned long *free;
+	u32 nr_free;
+	u32 hint;
+	u32 gc_low;
+
+	struct rswap_log_stager *stagers; // of each cpu
+
+	struct mutex gc_mutex; // the rest
+	struct work_struct gc_work;
+	struct rswap_log_buf gc_victim;
+	struct rswap_log_buf gc_buf;
+	struct rswap_log_move gc_moves[LOG_SEG_PAGES];
+	u32 gc_seg;
+	unsigned int gc_fill, gc_flushed;
+
+	atomic64_t stored, staged_loads, writes, written_pages, gc_segs,
+		gc_moved;
+} rswap_log;
+
+static inline u32 log_seg(u32 pos)
+{
+	return pos >> LOG_SEG_ORDER;
+}
+
+static inline size_t log_seg_addr(u32 seg)
+{
+	return (size_t)seg * LOG_SEG_BYTES;
+}
+
+bool rswap_log_on(void)
+{
+	return rswap_log.on;
+}
+
+struct rswap_log_io {
+	struct ib_cqe cqe;
+	enum ib_wc_status status;
+};
+
+static void rswap_log_io_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_log_io *io = container_of(wc->wr_cqe, struct rswap_log_io, cqe);
+	struct rswap_rdma_queue *rdma_queue = cq->cq_context;
+
+	io->status = wc->status;
+	atomic_dec(&rdma_queue->rdma_post_counter);
+}
+
+// One transfer of a log buffer, waits for it as rswap_rdma_rw_sync does.
+static int rswap_log_rw(u64 dma_addr, size_t len, size_t raddr, bool write)
+{
+	struct rdma_session_context *rdma_session = &rdma_session_global;
+	struct remote_chunk *chunk = &rdma_session->remote_mem_pool.chunks[raddr >> CHUNK_SHIFT];
+	struct rswap_log_io io = { .cqe.done = rswap_log_io_done, .status = IB_WC_SUCCESS };
+	struct ib_sge sge = {
+		.addr = dma_addr,
+		.length = len,
+		.lkey = rdma_session->rdma_dev->pd->local_dma_lkey,
+	};
+	struct ib_rdma_wr wr = {
+		.wr.wr_cqe = &io.cqe,
+		.wr.sg_list = &sge,
+		.wr.num_sge = 1,
+		.wr.opcode = write ? IB_WR_RDMA_WRITE : IB_WR_RDMA_READ,
+		.wr.send_flags = IB_SEND_SIGNALED,
+		.remote_addr = chunk->remote_addr + (raddr & CHUNK_MASK),
+		.rkey = chunk->remote_rkey,
+	};
+	const struct ib_send_wr *bad_wr;
+	struct rswap_rdma_queue *rdma_queue;
+	int ret;
+
+	rdma_queue = get_rdma_queue(rdma_session, get_cpu(), write ? QP_STORE : QP_LOAD_SYNC);
+	while (atomic_inc_return(&rdma_queue->rdma_post_counter) >= RDMA_SEND_QUEUE_DEPTH - 16) {
+		atomic_dec(&rdma_queue->rdma_post_counter);
+		drain_rdma_queue(rdma_queue);
+	}
+	ret = ib_post_send(rdma_queue->qp, &wr.wr, &bad_wr);
+	if (unlikely(ret)) {
+		atomic_dec(&rdma_queue->rdma_post_counter);
+		pr_err("%s, post rdma %s failed, %d\n", __func__, write ? "write" : "read", ret);
+		goto out;
+	}
+	drain_rdma_queue(rdma_queue);
+	if (unlikely(io.status != IB_WC_SUCCESS)) {
+		pr_err("%s, rdma %s of 0x%zx bytes at 0x%zx failed, %s\n", __func__, write ? "write" : "read", len,
+		       raddr, rdma_wc_status_name(io.status));
+		ret = -EIO;
+	}
+out:
+	put_cpu();
+	return ret;
+}
+
+// slots [from, to) of a buffer to their place in segment seg
+static int rswap_log_write(struct rswap_log_buf *buf, unsigned int from, unsigned int to, u32 seg)
+{
+	struct ib_device *dev = rdma_session_global.rdma_dev->dev;
+	u64 dma_addr = buf->dma_addr + ((u64)from << PAGE_SHIFT);
+	size_t len = (size_t)(to - from) << PAGE_SHIFT;
+	int ret;
+
+	ib_dma_sync_single_for_device(dev, dma_addr, len, DMA_TO_DEVICE);
+	ret = rswap_log_rw(dma_addr, len, log_seg_addr(seg) + ((size_t)from << PAGE_SHIFT), true);
+	if (!ret) {
+		atomic64_inc(&rswap_log.writes);
+		atomic64_add(to - from, &rswap_log.written_pages);
+	}
+	return ret;
+}
+
+static u32 rswap_log_alloc_seg(bool gc)
+{
+	u32 seg = RSWAP_LOG_NONE;
+
+	spin_lock(&rswap_log.lock);
+	if (rswap_log.nr_free <= (gc ? 0 : LOG_GC_RESERVE))
+		goto out;
+	seg = find_next_bit(rswap_log.free, rswap_log.nr_segs, rswap_log.hint);
+	if (seg >= rswap_log.nr_segs)
+		seg = find_first_bit(rswap_log.free, rswap_log.nr_segs);
+	__clear_bit(seg, rswap_log.free);
+	rswap_log.nr_free--;
+	rswap_log.hint = seg + 1;
+out:
+	spin_unlock(&rswap_log.lock);
+	return seg;
+}
+
+static void rswap_log_free_seg(u32 seg)
+{
+	WRITE_ONCE(rswap_log.owner[seg], LOG_FREE);
+	spin_lock(&rswap_log.lock);
+	__set_bit(seg, rswap_log.free);
+	rswap_log.nr_free++;
+	spin_unlock(&rswap_log.lock);
+}
+
+/* compaction */
+
+// the live pages compacted since the last flush are written, then moved
+static int rswap_log_gc_flush(void)
+{
+	u32 seg = rswap_log.gc_seg;
+	struct rswap_log_move *move;
+	unsigned int i;
+	int ret;
+
+	if (rswap_log.gc_flushed == rswap_log.gc_fill)
+		return 0;
+	ret = rswap_log_write(&rswap_log.gc_buf, rswap_log.gc_flushed, rswap_log.gc_fill, seg);
+	if (ret)
+		return ret;
+
+	for (i = rswap_log.gc_flushed; i < rswap_log.gc_fill; i++) {
+		move = &rswap_log.gc_moves[i];
+		atomic_inc(&rswap_log.live[seg]);
+		// rewritten or invalidated meanwhile, the copy is dead
+		if (cmpxchg(&rswap_log.map[move->offset], move->pos, seg << LOG_SEG_ORDER | i) == move->pos) {
+			atomic_dec(&rswap_log.live[log_seg(move->pos)]);
+			atomic64_inc(&rswap_log.gc_moved);
+		} else {
+			atomic_dec(&rswap_log.live[seg]);
+		}
+	}
+	rswap_log.gc_flushed = rswap_log.gc_fill;
+	if (rswap_log.gc_fill == LOG_SEG_PAGES) {
+		WRITE_ONCE(rswap_log.owner[seg], LOG_SEALED);
+		rswap_log.gc_seg = RSWAP_LOG_NONE;
+	}
+	return 0;
+}
+
+static int rswap_log_gc_one(void)
+{
+	struct ib_device *dev = rdma_session_global.rdma_dev->dev;
+	u32 seg, victim = RSWAP_LOG_NONE, pos, offset;
+	unsigned int slot, min_live = LOG_SEG_PAGES;
+	bool draining = false, freed = false;
+	int owner, ret;
+
+	for (seg = 0; seg < rswap_log.nr_segs; seg++) {
+		owner = READ_ONCE(rswap_log.owner[seg]);
+		if (owner == LOG_DRAINING) {
+			// the stores that replaced the pages dropped them from
+			// the count, and the loads that found them in the map
+			// are done
+			if (!atomic_read(&rswap_log.live[seg]) && !atomic_read(&rswap_log.readers[seg])) {
+				rswap_log_free_seg(seg);
+				atomic64_inc(&rswap_log.gc_segs);
+				freed = true;
+			} else {
+				draining = true;
+			}
+			continue;
+		}
+		if (owner == LOG_SEALED && atomic_read(&rswap_log.live[seg]) < min_live) {
+			victim = seg;
+			min_live = atomic_read(&rswap_log.live[seg]);
+		}
+	}
+	if (freed)
+		return 0;
+	if (victim == RSWAP_LOG_NONE)
+		return draining ? -EAGAIN : -ENOSPC; // all live
+
+	WRITE_ONCE(rswap_log.owner[victim], LOG_VICTIM);
+	if (!min_live)
+		goto drain; // nothing to move
+	ret = rswap_log_rw(rswap_log.gc_victim.dma_addr, LOG_SEG_BYTES, log_seg_addr(victim), false);
+	if (ret)
+		goto err;
+	ib_dma_sync_single_for_cpu(dev, rswap_log.gc_victim.dma_addr, LOG_SEG_BYTES, DMA_FROM_DEVICE);
+
+	for (slot = 0; slot < LOG_SEG_PAGES; slot++) {
+		pos = victim << LOG_SEG_ORDER | slot;
+		offset = rswap_log.rmap[pos];
+		if (offset == RSWAP_LOG_NONE || READ_ONCE(rswap_log.map[offset]) != pos)
+			continue;
+		if (rswap_log.gc_seg == RSWAP_LOG_NONE) {
+			// the reserve, the victim gives it back
+			rswap_log.gc_seg = rswap_log_alloc_seg(true);
+			if (WARN_ON_ONCE(rswap_log.gc_seg == RSWAP_LOG_NONE)) {
+				ret = -ENOSPC;
+				goto err;
+			}
+			WRITE_ONCE(rswap_log.owner[rswap_log.gc_seg], LOG_GC_DEST);
+			rswap_log.gc_fill = rswap_log.gc_flushed = 0;
+		}
+		copy_highpage(rswap_log.gc_buf.pages + rswap_log.gc_fill, rswap_log.gc_victim.pages + slot);
+		rswap_log.rmap[rswap_log.gc_seg << LOG_SEG_ORDER | rswap_log.gc_fill] = offset;
+		rswap_log.gc_moves[rswap_log.gc_fill].offset = offset;
+		rswap_log.gc_moves[rswap_log.gc_fill].pos = pos;
+		rswap_log.gc_fill++;
+		if (rswap_log.gc_fill == LOG_SEG_PAGES) {
+			ret = rswap_log_gc_flush();
+			if (ret)
+				goto err;
+		}
+	}
+	ret = rswap_log_gc_flush();
+	if (ret)
+		goto err;
+
+drain:
+	// freed by a later pass, the mutex is not held for its readers
+	WRITE_ONCE(rswap_log.owner[victim], LOG_DRAINING);
+	return 0;
+
+err:
+	// the pages not moved yet stay there
+	rswap_log.gc_fill = rswap_log.gc_flushed;
+	WRITE_ONCE(rswap_log.owner[victim], LOG_SEALED);
+	return ret;
+}
+
+// Compacts until above the reserve, or gc_low in the background.
+static int rswap_log_gc(u32 target)
+{
+	int ret = 0;
+
+	mutex_lock(&rswap_log.gc_mutex);
+	while (READ_ONCE(rswap_log.nr_free) < target && !ret) {
+		ret = rswap_log_gc_one();
+		if (ret == -EAGAIN) {
+			// only victims left to drain
+			mutex_unlock(&rswap_log.gc_mutex);
+			cond_resched();
+			mutex_lock(&rswap_log.gc_mutex);
+			ret = 0;
+		}
+	}
+	mutex_unlock(&rswap_log.gc_mutex);
+	return ret;
+}
+
+static void rswap_log_gc_work(struct work_struct *work)
+{
+	rswap_log_gc(rswap_log.gc_low);
+}
+
+/* swap path */
+
+// The full staging buffer becomes the spare one, to be written.
+static void rswap_log_swap_bufs(struct rswap_log_stager *stager)
+{
+	struct rswap_log_buf buf = stager->buf;
+
+	stager->buf = stager->spare;
+	stager->spare = buf;
+	stager->sealing = stager->seg;
+	stager->seg = RSWAP_LOG_NONE;
+	stager->fill = 0;
+}
+
+// Writes the spare buffer, under the stager's lock, dropped meanwhile.
+static int rswap_log_seal(struct rswap_log_stager *stager)
+{
+	u32 seg = stager->sealing;
+	int ret;
+
+	stager->writing = true;
+	spin_unlock(&stager->lock);
+	ret = rswap_log_write(&stager->spare, 0, LOG_SEG_PAGES, seg);
+	spin_lock(&stager->lock);
+	stager->writing = false;
+	if (ret)
+		return ret;
+	WRITE_ONCE(rswap_log.owner[seg], LOG_SEALED);
+	stager->sealing = RSWAP_LOG_NONE;
+	return 0;
+}
+
+/*
+ * Returns 0 once the page is staged, an error, or 1 without the log. The
+ * page is copied, the caller may reuse it at once.
+ */
+int rswap_log_store_page(pgoff_t offset, struct page *page)
+{
+	struct rswap_log_stager *stager;
+	unsigned int cpu;
+	u32 pos, old;
+	int ret;
+
+	if (!rswap_log.on)
+		return 1;
+	if (unlikely(offset >= rswap_log.nr_pages))
+		return -ENOSPC;
+
+	cpu = raw_smp_processor_id();
+	stager = &rswap_log.stagers[cpu];
+	spin_lock(&stager->lock);
+	// a full segment waits for the spare buffer, failed to be written or
+	// still being written
+	if (unlikely(stager->fill == LOG_SEG_PAGES)) {
+		ret = -EBUSY;
+		if (stager->writing)
+			goto out;
+		if (stager->sealing != RSWAP_LOG_NONE) {
+			ret = rswap_log_seal(stager);
+			if (ret)
+				goto out;
+		}
+		rswap_log_swap_bufs(stager);
+		ret = rswap_log_seal(stager);
+		if (ret)
+			goto out;
+	}
+	while (stager->seg == RSWAP_LOG_NONE) {
+		stager->seg = rswap_log_alloc_seg(false);
+		if (stager->seg != RSWAP_LOG_NONE) {
+			WRITE_ONCE(rswap_log.owner[stager->seg], cpu);
+			break;
+		}
+		spin_unlock(&stager->lock);
+		ret = rswap_log_gc(LOG_GC_RESERVE + 1);
+		if (ret)
+			return ret;
+		spin_lock(&stager->lock);
+	}
+
+	pos = stager->seg << LOG_SEG_ORDER | stager->fill;
+	copy_highpage(stager->buf.pages + stager->fill, page);
+	rswap_log.rmap[pos] = offset;
+	atomic_inc(&rswap_log.live[stager->seg]);
+	old = xchg(&rswap_log.map[offset], pos);
+	if (old != RSWAP_LOG_NONE)
+		atomic_dec(&rswap_log.live[log_seg(old)]);
+	stager->fill++;
+	atomic64_inc(&rswap_log.stored);
+	ret = 0;
+	// the page is staged anyway, the next store retries on failure
+	if (stager->fill == LOG_SEG_PAGES && stager->sealing == RSWAP_LOG_NONE) {
+		rswap_log_swap_bufs(stager);
+		rswap_log_seal(stager);
+	}
+out:
+	spin_unlock(&stager->lock);
+	if (READ_ONCE(rswap_log.nr_free) < rswap_log.gc_low)
+		queue_work(system_unbound_wq, &rswap_log.gc_work);
+	return ret;
+}
+
+/*
+ * Returns 0 once a page still staged is copied, up to date and unlocked,
+ * an error, or 1 if the page is to be read from the remote memory.
+ */
+int rswap_log_load_staged(pgoff_t offset, struct page *page)
+{
+	struct rswap_log_stager *stager;
+	int owner, ret = 1;
+	u32 pos;
+
+	if (!rswap_log.on)
+		return 1;
+	if (unlikely(offset >= rswap_log.nr_pages))
+		return -EINVAL;
+	pos = READ_ONCE(rswap_log.map[offset]);
+	if (unlikely(pos == RSWAP_LOG_NONE))
+		return -ENOENT;
+	owner = READ_ONCE(rswap_log.owner[log_seg(pos)]);
+	if (owner < 0)
+		return 1;
+
+	stager = &rswap_log.stagers[owner];
+	spin_lock(&stager->lock);
+	// or written meanwhile
+	if (stager->seg == log_seg(pos)) {
+		copy_highpage(page, stager->buf.pages + (pos & (LOG_SEG_PAGES - 1)));
+		ret = 0;
+	} else if (stager->sealing == log_seg(pos)) {
+		copy_highpage(page, stager->spare.pages + (pos & (LOG_SEG_PAGES - 1)));
+		ret = 0;
+	}
+	spin_unlock(&stager->lock);
+	if (!ret) {
+		SetPageUptodate(page);
+		unlock_page(page);
+		atomic64_inc(&rswap_log.staged_loads);
+	}
+	return ret;
+}
+
+/*
+ * The remote page to read for a swap offset, not staged. Its segment is not
+ * reused before rswap_log_unpin(*log_seg), when the read is done.
+ */
+int rswap_log_pin(pgoff_t *offset, u32 *log_seg_pinned)
+{
+	u32 pos;
+
+	*log_seg_pinned = RSWAP_LOG_NONE;
+	if (!rswap_log.on)
+		return 0;
+	if (unlikely(*offset >= rswap_log.nr_pages))
+		return -EINVAL;
+	for (;;) {
+		pos = READ_ONCE(rswap_log.map[*offset]);
+		if (unlikely(pos == RSWAP_LOG_NONE))
+			return -ENOENT;
+		atomic_inc(&rswap_log.readers[log_seg(pos)]);
+		smp_mb__after_atomic();
+		// not moved by a compaction meanwhile
+		if (READ_ONCE(rswap_log.map[*offset]) == pos)
+			break;
+		atomic_dec(&rswap_log.readers[log_seg(pos)]);
+	}
+	*offset = pos;
+	*log_seg_pinned = log_seg(pos);
+	return 0;
+}
+
+void rswap_log_unpin(u32 log_seg_pinned)
+{
+	smp_mb__before_atomic();
+	atomic_dec(&rswap_log.readers[log_seg_pinned]);
+}
+
+void rswap_log_invalidate(pgoff_t offset)
+{
+	u32 old;
+
+	if (!rswap_log.on || offset >= rswap_log.nr_pages)
+		return;
+	old = xchg(&rswap_log.map[offset], RSWAP_LOG_NONE);
+	if (old != RSWAP_LOG_NONE)
+		atomic_dec(&rswap_log.live[log_seg(old)]);
+}
+
+/* init and exit */
+
+static int rswap_log_buf_alloc(struct rswap_log_buf *buf, enum dma_data_direction dir)
+{
+	struct ib_device *dev = rdma_session_global.rdma_dev->dev;
+
+	buf->pages = alloc_pages(GFP_KERNEL, LOG_SEG_ORDER);
+	if (!buf->pages)
+		return -ENOMEM;
+	buf->dir = dir;
+	buf->dma_addr = ib_dma_map_page(dev, buf->pages, 0, LOG_SEG_BYTES, dir);
+	if (unlikely(ib_dma_mapping_error(dev, buf->dma_addr))) {
+		__free_pages(buf->pages, LOG_SEG_ORDER);
+		buf->pages = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void rswap_log_buf_free(struct rswap_log_buf *buf)
+{
+	if (!buf->pages)
+		return;
+	ib_dma_unmap_page(rdma_session_global.rdma_dev->dev, buf->dma_addr, LOG_SEG_BYTES, buf->dir);
+	__free_pages(buf->pages, LOG_SEG_ORDER);
+	buf->pages = NULL;
+}
+
+static void rswap_log_free(void)
+{
+	unsigned int cpu;
+
+	if (rswap_log.stagers) {
+		for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+			rswap_log_buf_free(&rswap_log.stagers[cpu].buf);
+			rswap_log_buf_free(&rswap_log.stagers[cpu].spare);
+		}
+		kfree(rswap_log.stagers);
+		rswap_log.stagers = NULL;
+	}
+	rswap_log_buf_free(&rswap_log.gc_victim);
+	rswap_log_buf_free(&rswap_log.gc_buf);
+	vfree(rswap_log.map);
+	vfree(rswap_log.rmap);
+	vfree(rswap_log.live);
+	vfree(rswap_log.readers);
+	vfree(rswap_log.owner);
+	vfree(rswap_log.free);
+}
+
+// The log on the swap part of the remote memory, below /dev/rswap.
+int rswap_log_init(int mem_size, int cc_size, int dev_size)
+{
+	unsigned int cpu;
+	u32 seg;
+	int ret = -ENOMEM;
+
+	if (!log_store)
+		return 0;
+	if (rdma_session_replica.replica) {
+		pr_err("%s, the replica reads the pages in place, no log with rsip\n", __func__);
+		return -EINVAL;
+	}
+
+	rswap_log.nr_pages = ((u64)(mem_size - cc_size - dev_size) * ONE_GB) >> PAGE_SHIFT;
+	rswap_log.nr_pages = min_t(unsigned long, rswap_log.nr_pages, RSWAP_LOG_NONE);
+	rswap_log.nr_segs = rswap_log.nr_pages >> LOG_SEG_ORDER;
+	if (rswap_log.nr_segs < 2 * (nr_cpu_ids + LOG_GC_RESERVE)) {
+		pr_err("%s, %lu remote pages for swap, too few for the log\n", __func__, rswap_log.nr_pages);
+		return -EINVAL;
+	}
+
+	rswap_log.map = vmalloc(array_size(rswap_log.nr_pages, sizeof(u32)));
+	rswap_log.rmap = vmalloc(array_size(rswap_log.nr_pages, sizeof(u32)));
+	rswap_log.live = vzalloc(array_size(rswap_log.nr_segs, sizeof(atomic_t)));
+	rswap_log.readers = vzalloc(array_size(rswap_log.nr_segs, sizeof(atomic_t)));
+	rswap_log.owner = vmalloc(array_size(rswap_log.nr_segs, sizeof(int)));
+	rswap_log.free = vmalloc(array_size(BITS_TO_LONGS(rswap_log.nr_segs), sizeof(unsigned long)));
+	rswap_log.stagers = kcalloc(nr_cpu_ids, sizeof(*rswap_log.stagers), GFP_KERNEL);
+	if (!rswap_log.map || !rswap_log.rmap || !rswap_log.live || !rswap_log.readers || !rswap_log.owner ||
+	    !rswap_log.free || !rswap_log.stagers)
+		goto err;
+	memset(rswap_log.map, 0xff, array_size(rswap_log.nr_pages, sizeof(u32)));
+	memset(rswap_log.rmap, 0xff, array_size(rswap_log.nr_pages, sizeof(u32)));
+	for (seg = 0; seg < rswap_log.nr_segs; seg++)
+		rswap_log.owner[seg] = LOG_FREE;
+	bitmap_fill(rswap_log.free, rswap_log.nr_segs);
+	rswap_log.nr_free = rswap_log.nr_segs;
+	rswap_log.hint = 0;
+	rswap_log.gc_low = min_t(u32, rswap_log.nr_segs / 4, 2 * nr_cpu_ids + LOG_GC_RESERVE);
+	spin_lock_init(&rswap_log.lock);
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		spin_lock_init(&rswap_log.stagers[cpu].lock);
+		rswap_log.stagers[cpu].seg = RSWAP_LOG_NONE;
+		rswap_log.stagers[cpu].sealing = RSWAP_LOG_NONE;
+		if (cpu_possible(cpu) && (rswap_log_buf_alloc(&rswap_log.stagers[cpu].buf, DMA_TO_DEVICE) ||
+					  rswap_log_buf_alloc(&rswap_log.stagers[cpu].spare, DMA_TO_DEVICE)))
+			goto err;
+	}
+	if (rswap_log_buf_alloc(&rswap_log.gc_victim, DMA_FROM_DEVICE) ||
+	    rswap_log_buf_alloc(&rswap_log.gc_buf, DMA_TO_DEVICE))
+		goto err;
+	mutex_init(&rswap_log.gc_mutex);
+	INIT_WORK(&rswap_log.gc_work, rswap_log_gc_work);
+	rswap_log.gc_seg = RSWAP_LOG_NONE;
+
+	rswap_log.on = true;
+	pr_info("%s, swap log of %u segments of %zuKB\n", __func__, rswap_log.nr_segs, LOG_SEG_BYTES >> 10);
+	return 0;
+
+err:
+	rswap_log_free();
+	return ret;
+}
+
+// After the stores and loads, nothing staged is kept.
+void rswap_log_exit(void)
+{
+	u64 writes;
+
+	if (!rswap_log.on)
+		return;
+	rswap_log.on = false;
+	cancel_work_sync(&rswap_log.gc_work);
+
+	writes = atomic64_read(&rswap_log.writes);
+	pr_info("%s, %lld pages stored, %lld loaded while staged, %lld writes of %lld pages on average, %lld segments compacted, %lld pages moved\n",
+		__func__, atomic64_read(&rswap_log.stored), atomic64_read(&rswap_log.staged_loads), writes,
+		writes ? atomic64_read(&rswap_log.written_pages) / writes : 0, atomic64_read(&rswap_log.gc_segs),
+		atomic64_read(&rswap_log.gc_moved));
+	rswap_log_free();
+}
@@ -0,0 +1,509 @@
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+
+#include "rswap_rdma.h"
+#include "rswap_ops.h"
+
+/*
+ * Migration of the swap chunks between the primary memory server and a
+ * second one (mgip), while swap goes on. A swap chunk is not bound to a
+ * remote chunk of the primary server anymore but to its current place in
+ * the directory, a server and a chunk of its pool, so a busy server can be
+ * drained, or the chunks rebalanced.
+ *
+ * Writing a chunk index to the migrate parameter moves it to the other
+ * server, "all" moves all the chunks still on the primary. A move copies
+ * the chunk with large RDMA transfers, while the stores to it go on and
+ * mark their pages dirty once done. The dirty pages are copied again until
+ * few are left, then the chunk is frozen: new transfers to it wait, the
+ * ones in flight are drained, the last dirty pages are copied and the
+ * directory entry is flipped to the copy. Each change of an entry bumps its
+ * generation, a transfer that took the entry while it changed takes it
+ * again. The chunk left behind is free for a move back, and is given back
+ * to its server with the others when the module is unloaded. A chunk
+ * stored to faster than it is copied is not frozen but left in place, its
+ * move can be requested again later.
+ */
+
+static char migrate_ip[INET_ADDRSTRLEN];
+static int migrate_port;
+static int migrate_size;
+
+MODULE_PARM_DESC(mgip, "Memory server to migrate the swap chunks to, none by default");
+MODULE_PARM_DESC(mgport, "Port of the migration memory server");
+MODULE_PARM_DESC(mgsize, "Remote memory on the migration server in GB");
+module_param_string(mgip, migrate_ip, INET_ADDRSTRLEN, 0444);
+module_param_named(mgport, migrate_port, int, 0444);
+module_param_named(mgsize, migrate_size, int, 0444);
+
+#define MIGRATE_BATCH_ORDER 6
+#define MIGRATE_BATCH_PAGES (1U << MIGRATE_BATCH_ORDER) // 256KB
+#define MIGRATE_BATCH_BYTES ((size_t)MIGRATE_BATCH_PAGES << PAGE_SHIFT)
+#define MIGRATE_CHUNK_PAGES (1UL << (CHUNK_SHIFT - PAGE_SHIFT))
+#define MIGRATE_FREEZE_PAGES 64 // dirty pages left to copy frozen
+#define MIGRATE_PASSES 8
+
+enum { CHUNK_STABLE, CHUNK_COPYING, CHUNK_FROZEN };
+
+struct rswap_mig_server {
+	struct rdma_session_context *rdma_session;
+	unsigned long used[BITS_TO_LONGS(MAX_REGION_NUM)]; // chunks of its pool
+};
+
+struct rswap_chunk_dir {
+	seqcount_t gen; // bumped around each change
+	int state;
+	struct rswap_mig_server *server;
+	u32 slot; // in the server's pool
+	atomic_t users; // transfers in flight
+};
+
+static struct rdma_session_context rdma_session_migrate;
+
+static struct {
+	bool on;
+	struct rswap_mig_server servers[2]; // 0 is the primary
+	struct rswap_chunk_dir dir[MAX_REGION_NUM];
+	u32 nr_chunks; // of the swap part
+
+	struct mutex mutex; // the moves
+	struct work_struct work;
+	unsigned long requested[BITS_TO_LONGS(MAX_REGION_NUM)];
+	spinlock_t lock; // requested
+	bool stop;
+	u32 chunk; // being moved
+	unsigned long *dirty; // its pages stored while copied
+	struct page *buf; // MIGRATE_BATCH_PAGES
+
+	atomic64_t moved, moved_bytes, recopied, retries;
+} rswap_migrate;
+
+bool rswap_migrate_on(void)
+{
+	return rswap_migrate.on;
+}
+
+/*
+ * The place of the chunk of a remote address. Unless ref->counted is
+ * false, rswap_chunk_put() once the transfer is done.
+ */
+void rswap_chunk_get(size_t roffset, struct rswap_chunk_ref *ref)
+{
+	u32 idx = roffset >> CHUNK_SHIFT;
+	struct rswap_chunk_dir *dir;
+	struct rswap_mig_server *server;
+	unsigned int gen;
+	u32 slot;
+
+	ref->counted = false;
+	if (!rswap_migrate.on || idx >= rswap_migrate.nr_chunks) {
+		ref->rdma_session = &rdma_session_global;
+		ref->chunk = &rdma_session_global.remote_mem_pool.chunks[idx];
+		return;
+	}
+
+	dir = &rswap_migrate.dir[idx];
+	for (;;) {
+		gen = read_seqcount_begin(&dir->gen);
+		if (READ_ONCE(dir->state) == CHUNK_FROZEN) {
+			cpu_relax();
+			continue;
+		}
+		server = dir->server;
+		slot = dir->slot;
+		atomic_inc(&dir->users);
+		smp_mb__after_atomic();
+		if (!read_seqcount_retry(&dir->gen, gen))
+			break;
+		// raced a change of the entry, take it again
+		atomic_dec(&dir->users);
+		atomic64_inc(&rswap_migrate.retries);
+	}
+	ref->rdma_session = server->rdma_session;
+	ref->chunk = &server->rdma_session->remote_mem_pool.chunks[slot];
+	ref->counted = true;
+}
+
+void rswap_chunk_put(size_t roffset, bool write)
+{
+	struct rswap_chunk_dir *dir = &rswap_migrate.dir[roffset >> CHUNK_SHIFT];
+
+	// only the chunk being moved is not stable
+	if (write && READ_ONCE(dir->state) != CHUNK_STABLE)
+		set_bit((roffset & CHUNK_MASK) >> PAGE_SHIFT, rswap_migrate.dirty);
+	smp_mb__before_atomic();
+	atomic_dec(&dir->users);
+}
+
+// The transfers to the migration server are polled with the primary's.
+void rswap_migrate_drain(int cpu, enum rdma_queue_type type)
+{
+	if (rswap_migrate.on)
+		drain_rdma_queue(get_rdma_queue(&rdma_session_migrate, cpu, type));
+}
+
+static void rswap_chunk_set(struct rswap_chunk_dir *dir, int state, struct rswap_mig_server *server, u32 slot)
+{
+	preempt_disable();
+	write_seqcount_begin(&dir->gen);
+	dir->state = state;
+	dir->server = server;
+	dir->slot = slot;
+	write_seqcount_end(&dir->gen);
+	preempt_enable();
+	smp_mb();
+}
+
+// for the transfers that took the entry before its change
+static void rswap_chunk_wait_users(struct rswap_chunk_dir *dir)
+{
+	while (atomic_read(&dir->users))
+		cpu_relax();
+}
+
+/* copy */
+
+struct rswap_migrate_io {
+	struct ib_cqe cqe;
+	enum ib_wc_status status;
+};
+
+static void rswap_migrate_io_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_migrate_io *io = container_of(wc->wr_cqe, struct rswap_migrate_io, cqe);
+	struct rswap_rdma_queue *rdma_queue = cq->cq_context;
+
+	io->status = wc->status;
+	atomic_dec(&rdma_queue->rdma_post_counter);
+}
+
+// One transfer of the buffer to or from a chunk, waits for it.
+static int rswap_migrate_rw(struct rswap_mig_server *server, u32 slot, size_t off, size_t len, bool write)
+{
+	struct rdma_session_context *rdma_session = server->rdma_session;
+	struct remote_chunk *chunk = &rdma_session->remote_mem_pool.chunks[slot];
+	struct ib_device *dev = rdma_session->rdma_dev->dev;
+	enum dma_data_direction dir = write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	struct rswap_migrate_io io = { .cqe.done = rswap_migrate_io_done, .status = IB_WC_SUCCESS };
+	struct ib_sge sge = {
+		.length = len,
+		.lkey = rdma_session->rdma_dev->pd->local_dma_lkey,
+	};
+	struct ib_rdma_wr wr = {
+		.wr.wr_cqe = &io.cqe,
+		.wr.sg_list = &sge,
+		.wr.num_sge = 1,
+		.wr.opcode = write ? IB_WR_RDMA_WRITE : IB_WR_RDMA_READ,
+		.wr.send_flags = IB_SEND_SIGNALED,
+		.remote_addr = chunk->remote_addr + off,
+		.rkey = chunk->remote_rkey,
+	};
+	const struct ib_send_wr *bad_wr;
+	struct rswap_rdma_queue *rdma_queue;
+	int ret;
+
+	sge.addr = ib_dma_map_page(dev, rswap_migrate.buf, 0, len, dir);
+	if (unlikely(ib_dma_mapping_error(dev, sge.addr)))
+		return -ENOMEM;
+
+	rdma_queue = get_rdma_queue(rdma_session, get_cpu(), write ? QP_STORE : QP_LOAD_SYNC);
+	while (atomic_inc_return(&rdma_queue->rdma_post_counter) >= RDMA_SEND_QUEUE_DEPTH - 16) {
+		atomic_dec(&rdma_queue->rdma_post_counter);
+		drain_rdma_queue(rdma_queue);
+	}
+	ret = ib_post_send(rdma_queue->qp, &wr.wr, &bad_wr);
+	if (unlikely(ret)) {
+		atomic_dec(&rdma_queue->rdma_post_counter);
+		pr_err("%s, post rdma %s failed, %d\n", __func__, write ? "write" : "read", ret);
+		goto out;
+	}
+	drain_rdma_queue(rdma_queue);
+	if (unlikely(io.status != IB_WC_SUCCESS)) {
+		pr_err("%s, rdma %s of 0x%zx bytes at 0x%zx failed, %s\n", __func__, write ? "write" : "read", len,
+		       off, rdma_wc_status_name(io.status));
+		ret = -EIO;
+	}
+out:
+	put_cpu();
+	ib_dma_unmap_page(dev, sge.addr, len, dir);
+	return ret;
+}
+
+static int rswap_migrate_copy(struct rswap_mig_server *from, u32 from_slot, struct rswap_mig_server *to, u32 to_slot,
+			      unsigned long page, unsigned long nr)
+{
+	size_t off = page << PAGE_SHIFT, len = nr << PAGE_SHIFT;
+	int ret;
+
+	ret = rswap_migrate_rw(from, from_slot, off, len, false);
+	if (!ret)
+		ret = rswap_migrate_rw(to, to_slot, off, len, true);
+	return ret;
+}
+
+// the dirty pages, in runs of up to a batch; returns how many
+static long rswap_migrate_copy_dirty(struct rswap_mig_server *from, u32 from_slot, struct rswap_mig_server *to,
+				     u32 to_slot, bool frozen)
+{
+	unsigned long page = 0, end;
+	long copied = 0;
+	int ret;
+
+	for (;;) {
+		page = find_next_bit(rswap_migrate.dirty, MIGRATE_CHUNK_PAGES, page);
+		if (page >= MIGRATE_CHUNK_PAGES)
+			break;
+		for (end = page; end < MIGRATE_CHUNK_PAGES && end - page < MIGRATE_BATCH_PAGES; end++) {
+			if (!test_and_clear_bit(end, rswap_migrate.dirty))
+				break;
+		}
+		ret = rswap_migrate_copy(from, from_slot, to, to_slot, page, end - page);
+		if (ret)
+			return ret;
+		copied += end - page;
+		page = end;
+		if (!frozen)
+			cond_resched();
+	}
+	atomic64_add(copied, &rswap_migrate.recopied);
+	return copied;
+}
+
+static u32 rswap_migrate_alloc_slot(struct rswap_mig_server *server)
+{
+	u32 slot = find_first_zero_bit(server->used, server->rdma_session->remote_mem_pool.chunk_num);
+
+	if (slot < server->rdma_session->remote_mem_pool.chunk_num)
+		__set_bit(slot, server->used);
+	return slot;
+}
+
+// Moves a swap chunk to the other server, under the mutex.
+static int rswap_migrate_chunk(u32 idx)
+{
+	struct rswap_chunk_dir *dir = &rswap_migrate.dir[idx];
+	struct rswap_mig_server *from = dir->server;
+	struct rswap_mig_server *to = &rswap_migrate.servers[from == rswap_migrate.servers];
+	u32 from_slot = dir->slot, to_slot;
+	u64 start = ktime_get_ns(), frozen, ns;
+	unsigned long page;
+	long copied = 0;
+	int pass, ret = 0;
+
+	to_slot = rswap_migrate_alloc_slot(to);
+	if (to_slot >= to->rdma_session->remote_mem_pool.chunk_num) {
+		pr_err("%s, no free chunk on the other server for chunk %u\n", __func__, idx);
+		return -ENOSPC;
+	}
+	bitmap_zero(rswap_migrate.dirty, MIGRATE_CHUNK_PAGES);
+	rswap_migrate.chunk = idx;
+	rswap_chunk_set(dir, CHUNK_COPYING, from, from_slot);
+	// the stores from before are not marked
+	rswap_chunk_wait_users(dir);
+
+	for (page = 0; page < MIGRATE_CHUNK_PAGES && !ret; page += MIGRATE_BATCH_PAGES) {
+		if (READ_ONCE(rswap_migrate.stop))
+			ret = -EINTR;
+		else
+			ret = rswap_migrate_copy(from, from_slot, to, to_slot, page, MIGRATE_BATCH_PAGES);
+		cond_resched();
+	}
+	for (pass = 0; !ret && pass < MIGRATE_PASSES; pass++) {
+		if (bitmap_weight(rswap_migrate.dirty, MIGRATE_CHUNK_PAGES) <= MIGRATE_FREEZE_PAGES)
+			break;
+		copied = rswap_migrate_copy_dirty(from, from_slot, to, to_slot, false);
+		ret = copied < 0 ? copied : 0;
+	}
+	// too many pages to copy with the transfers to it spinning
+	if (!ret && bitmap_weight(rswap_migrate.dirty, MIGRATE_CHUNK_PAGES) > MIGRATE_FREEZE_PAGES)
+		ret = -EBUSY;
+	if (ret)
+		goto err;
+
+	// the transfers to the chunk spin with the preemption off until it is
+	// stable again, so this one can't be preempted by them
+	preempt_disable();
+	frozen = ktime_get_ns();
+	rswap_chunk_set(dir, CHUNK_FROZEN, from, from_slot);
+	rswap_chunk_wait_users(dir);
+	copied = rswap_migrate_copy_dirty(from, from_slot, to, to_slot, true);
+	if (copied < 0) {
+		ret = copied;
+		rswap_chunk_set(dir, CHUNK_STABLE, from, from_slot);
+		preempt_enable();
+		goto err;
+	}
+	rswap_chunk_set(dir, CHUNK_STABLE, to, to_slot);
+	preempt_enable();
+	__clear_bit(from_slot, from->used);
+	ns = ktime_get_ns() - start;
+
+	atomic64_inc(&rswap_migrate.moved);
+	atomic64_add(CHUNK_MASK + 1, &rswap_migrate.moved_bytes);
+	pr_info("%s, chunk %u moved to server %d in %llu ms, %llu MB/s, frozen %llu us for %ld pages\n", __func__, idx,
+		(int)(to - rswap_migrate.servers), ns / NSEC_PER_MSEC, ((CHUNK_MASK + 1) >> 20) * NSEC_PER_SEC / ns,
+		(ktime_get_ns() - frozen) / NSEC_PER_USEC, copied);
+	return 0;
+
+err:
+	rswap_chunk_set(dir, CHUNK_STABLE, from, from_slot);
+	__clear_bit(to_slot, to->used);
+	pr_err("%s, chunk %u stays on server %d, %d\n", __func__, idx, (int)(from - rswap_migrate.servers), ret);
+	return ret;
+}
+
+static void rswap_migrate_work(struct work_struct *work)
+{
+	u32 idx;
+
+	mutex_lock(&rswap_migrate.mutex);
+	for (;;) {
+		spin_lock(&rswap_migrate.lock);
+		idx = find_first_bit(rswap_migrate.requested, MAX_REGION_NUM);
+		if (idx < MAX_REGION_NUM)
+			__clear_bit(idx, rswap_migrate.requested);
+		spin_unlock(&rswap_migrate.lock);
+		if (idx >= MAX_REGION_NUM || READ_ONCE(rswap_migrate.stop))
+			break;
+		rswap_migrate_chunk(idx);
+	}
+	mutex_unlock(&rswap_migrate.mutex);
+}
+
+static int rswap_migrate_param_set(const char *val, const struct kernel_param *kp)
+{
+	u32 idx;
+
+	if (!rswap_migrate.on)
+		return -ENODEV;
+	spin_lock(&rswap_migrate.lock);
+	if (sysfs_streq(val, "all")) {
+		for (idx = 0; idx < rswap_migrate.nr_chunks; idx++) {
+			if (rswap_migrate.dir[idx].server == rswap_migrate.servers)
+				__set_bit(idx, rswap_migrate.requested);
+		}
+	} else if (!kstrtou32(val, 0, &idx) && idx < rswap_migrate.nr_chunks) {
+		__set_bit(idx, rswap_migrate.requested);
+	} else {
+		spin_unlock(&rswap_migrate.lock);
+		return -EINVAL;
+	}
+	spin_unlock(&rswap_migrate.lock);
+	queue_work(system_unbound_wq, &rswap_migrate.work);
+	return 0;
+}
+
+// the server of each swap chunk
+static int rswap_migrate_param_get(char *buf, const struct kernel_param *kp)
+{
+	int len = 0;
+	u32 idx;
+
+	for (idx = 0; rswap_migrate.on && idx < rswap_migrate.nr_chunks; idx++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d",
+				 (int)(READ_ONCE(rswap_migrate.dir[idx].server) - rswap_migrate.servers));
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static const struct kernel_param_ops rswap_migrate_param_ops = {
+	.set = rswap_migrate_param_set,
+	.get = rswap_migrate_param_get,
+};
+
+MODULE_PARM_DESC(migrate,
+		 "Write a swap chunk index to move it to the other server, or all to drain the primary; reads the server of each chunk");
+module_param_cb(migrate, &rswap_migrate_param_ops, NULL, 0644);
+
+/* setup */
+
+int rswap_migrate_init(int mem_size, int cc_size, int dev_size)
+{
+	struct rswap_mig_server *primary = &rswap_migrate.servers[0];
+	u32 idx;
+	int ret;
+
+	if (!migrate_ip[0])
+		return 0;
+	if (rswap_log_on() || rswap_ec_on() || rdma_session_replica.replica) {
+		pr_err("%s, the swap chunks have a fixed place with log_store, ecip or rsip\n", __func__);
+		return -EINVAL;
+	}
+	if (migrate_size < REGION_SIZE_GB) {
+		pr_err("%s, mgsize %dGB, at least %dGB for a chunk\n", __func__, migrate_size, REGION_SIZE_GB);
+		return -EINVAL;
+	}
+
+	// the chunks of the cleancache and /dev/rswap stay
+	rswap_migrate.nr_chunks = min_t(u32, (mem_size - cc_size - dev_size) / REGION_SIZE_GB,
+					rdma_session_global.remote_mem_pool.chunk_num);
+	if (!rswap_migrate.nr_chunks)
+		return -EINVAL;
+	rswap_migrate.dirty = vzalloc(BITS_TO_LONGS(MIGRATE_CHUNK_PAGES) * sizeof(unsigned long));
+	rswap_migrate.buf = alloc_pages(GFP_KERNEL, MIGRATE_BATCH_ORDER);
+	if (!rswap_migrate.dirty || !rswap_migrate.buf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	rdma_session_migrate.remote_mem_pool.remote_mem_size = migrate_size;
+	rdma_session_migrate.remote_mem_pool.chunk_num = migrate_size / REGION_SIZE_GB;
+	rdma_session_migrate.secondary = true;
+	ret = init_rdma_sessions(&rdma_session_migrate, migrate_ip, migrate_port);
+	if (ret != 1) {
+		ret = -EINVAL;
+		goto err;
+	}
+	ret = rdma_session_connect(&rdma_session_migrate);
+	if (ret) {
+		pr_err("%s, connect to %s:%d failed\n", __func__, migrate_ip, migrate_port);
+		goto err;
+	}
+
+	primary->rdma_session = &rdma_session_global;
+	rswap_migrate.servers[1].rdma_session = &rdma_session_migrate;
+	bitmap_set(primary->used, 0, rdma_session_global.remote_mem_pool.chunk_num);
+	for (idx = 0; idx < MAX_REGION_NUM; idx++) {
+		seqcount_init(&rswap_migrate.dir[idx].gen);
+		rswap_migrate.dir[idx].state = CHUNK_STABLE;
+		rswap_migrate.dir[idx].server = primary;
+		rswap_migrate.dir[idx].slot = idx;
+		atomic_set(&rswap_migrate.dir[idx].users, 0);
+	}
+	mutex_init(&rswap_migrate.mutex);
+	spin_lock_init(&rswap_migrate.lock);
+	INIT_WORK(&rswap_migrate.work, rswap_migrate_work);
+	rswap_migrate.stop = false;
+	rswap_migrate.on = true;
+	pr_info("%s, %u swap chunks can move to %s:%d, %u chunks there\n", __func__, rswap_migrate.nr_chunks,
+		migrate_ip, migrate_port, rdma_session_migrate.remote_mem_pool.chunk_num);
+	return 0;
+
+err:
+	if (rswap_migrate.buf)
+		__free_pages(rswap_migrate.buf, MIGRATE_BATCH_ORDER);
+	rswap_migrate.buf = NULL;
+	vfree(rswap_migrate.dirty);
+	rswap_migrate.dirty = NULL;
+	return ret;
+}
+
+// After the stores and loads, the swap chunks are gone with both servers.
+void rswap_migrate_exit(void)
+{
+	if (!rswap_migrate.on)
+		return;
+	WRITE_ONCE(rswap_migrate.stop, true);
+	cancel_work_sync(&rswap_migrate.work);
+	rswap_migrate.on = false;
+
+	pr_info("%s, %lld chunks moved, %lld MB, %lld dirty pages copied again, %lld transfers retried\n", __func__,
+		atomic64_read(&rswap_migrate.moved), atomic64_read(&rswap_migrate.moved_bytes) >> 20,
+		atomic64_read(&rswap_migrate.recopied), atomic64_read(&rswap_migrate.retries));
+	rswap_disconnect_and_collect_resource(&rdma_session_migrate);
+	__free_pages(rswap_migrate.buf, MIGRATE_BATCH_ORDER);
+	rswap_migrate.buf = NULL;
+	vfree(rswap_migrate.dirty);
+	rswap_migrate.dirty = NULL;
+}
@@ -4,7 +4,48 @@
 int rswap_client_init(char *server_ip, int server_port, int mem_size);
 void rswap_client_exit(void);
 
+// The swap part of the remote memory: below /dev/rswap and the cleancache,
+// and held on the memory server. Stores past it fail, so the kernel writes
+// the page to the swap device. After rswap_client_init().
+void rswap_swap_limit_init(int mem_size, int cc_size, int dev_size);
+// GB of the remote memory held on the memory server, in whole chunks.
+// After rswap_client_init().
+int rswap_granted_size(void);
+
 int rswap_register_frontswap(void);
 int rswap_replace_frontswap(void);
 
+// Warm reload, see frontswap_park_ops(). NULL if the pages are not kept.
+// Unparking fails, with frontswap left parked, if the pages are not taken.
+void *rswap_client_park(void);
+int rswap_unpark_frontswap(void);
+
+// Cleancache on the top cc_size GB of the remote memory, 0 for none.
+int rswap_cleancache_init(int mem_size, int cc_size);
+void rswap_cleancache_exit(void);
+
+// /dev/rswap on the dev_size GB below the cleancache, 0 for none.
+int rswap_dev_init(int mem_size, int cc_size, int dev_size);
+void rswap_dev_exit(void);
+
+// Log-structured swap, if log_store is set, on the swap part of the remote
+// memory. Before the first store.
+int rswap_log_init(int mem_size, int cc_size, int dev_size);
+void rswap_log_exit(void);
+
+// Erasure coding, if ecip is set, of the swap part of the remote memory
+// across the memory servers. Before the first store.
+int rswap_ec_init(int mem_size, int cc_size, int dev_size);
+void rswap_ec_exit(void);
+
+// Migration of the swap chunks, if mgip is set, to and from another memory
+// server. Before the first store.
+int rswap_migrate_init(int mem_size, int cc_size, int dev_size);
+void rswap_migrate_exit(void);
+
+// Placement of the cold swap pages, if farip is set, on a far memory
+// server. Before the first store.
+int rswap_tier_init(int mem_size, int cc_size, int dev_size);
+void rswap_tier_exit(void);
+
 #endif // __RSWAP_OPS_H
@@ -7,6 +7,11 @@ int num_queues; // Total #(queues)
 char *server_ip; // the memory server ip
 uint16_t server_port; // the memory server port
 
+int rswap_warm_reload;
+MODULE_PARM_DESC(warm,
+		 "Keep the remote pages on unload for the next load of the module, no swapoff needed");
+module_param_named(warm, rswap_warm_reload, int, 0644);
+
 u64 rmda_ops_count = 0;
 u64 cq_notify_count = 0;
 u64 cq_get_count = 0;
@@ -79,8 +84,14 @@ int handle_recv_wr(struct rswap_rdma_queue *rdma_queue, struct ib_wc *wc)
 			__func__,
 			rdma_session->rdma_recv_req.recv_buf->mapped_chunk);
 
+		// the memory server is shared, only ask for rmsize
 		rdma_session->remote_mem_pool.chunk_num =
 			rdma_session->rdma_recv_req.recv_buf->mapped_chunk;
+		if (rswap_wanted_chunks(rdma_session) &&
+		    rswap_wanted_chunks(rdma_session) <
+			    rdma_session->remote_mem_pool.chunk_num)
+			rdma_session->remote_mem_pool.chunk_num =
+				rswap_wanted_chunks(rdma_session);
 		rdma_queue->state = FREE_MEM_RECV;
 
 		ret = init_remote_chunk_list(rdma_session);
@@ -99,6 +110,27 @@ int handle_recv_wr(struct rswap_rdma_queue *rdma_queue, struct ib_wc *wc)
 		rdma_queue->state = RECEIVED_CHUNKS;
 		wake_up_interruptible(&rdma_queue->sem);
 
+		break;
+	case ALLOC_MAP:
+		rdma_session->alloc_map.slot =
+			rdma_session->rdma_recv_req.recv_buf->mapped_chunk;
+		rdma_session->alloc_map.remote_addr =
+			rdma_session->rdma_recv_req.recv_buf->buf[0];
+		rdma_session->alloc_map.rkey =
+			rdma_session->rdma_recv_req.recv_buf->rkey[0];
+		pr_info("%s, Received ALLOC_MAP, slot %d, remote_addr 0x%llx, %llu bytes\n",
+			__func__, rdma_session->alloc_map.slot,
+			rdma_session->alloc_map.remote_addr,
+			rdma_session->rdma_recv_req.recv_buf->mapped_size[0]);
+
+		rdma_queue->state = ALLOC_MAP_RECV;
+		wake_up_interruptible(&rdma_queue->sem);
+		break;
+	case DONE:
+		pr_info("%s, released %d chunks to remote memory.\n", __func__,
+			rdma_session->rdma_recv_req.recv_buf->mapped_chunk);
+		rdma_queue->state = RELEASED_CHUNKS;
+		wake_up_interruptible(&rdma_queue->sem);
 		break;
 	default:
 		pr_err("%s, Recieved WRONG RDMA message %d \n", __func__,
@@ -240,10 +272,188 @@ int rswap_request_for_chunk(struct rdma_session_context *rdma_session)
 				 rdma_queue->state == RECEIVED_CHUNKS);
 
 	pr_info("%s, Got %d chunks from memory server.\n", __func__, chunk_num);
+	if (chunk_num < rswap_wanted_chunks(rdma_session))
+		pr_warn("%s, asked for %u chunks, the rest is out of the quota or the free memory of memory server.\n",
+			__func__, rswap_wanted_chunks(rdma_session));
 err:
 	return ret;
 }
 
+/*
+ * Give the remote chunks back to the memory server, which shares them with
+ * other clients. The server also reclaims them when the last queue of the
+ * client disconnects, so don't wait for a dead server too long.
+ */
+int rswap_release_remote_chunks(struct rdma_session_context *rdma_session)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct rswap_rdma_queue *rdma_queue = &(rdma_session->rdma_queues[0]);
+	struct message *msg = rdma_session->rdma_send_req.send_buf;
+	int nr = 0;
+	int ret;
+	uint32_t i;
+
+	if (rdma_session->warm_exit)
+		return 0;
+	if (rdma_session->alloc_map.slot >= 0)
+		return rswap_alloc_release_chunks(rdma_session);
+
+	for (i = 0; i < pool->chunk_num && nr < MAX_REGION_NUM; i++) {
+		if (pool->chunks[i].chunk_state != MAPPED)
+			continue;
+		msg->buf[nr++] = pool->chunks[i].remote_addr;
+	}
+	if (!nr)
+		return 0;
+
+	ret = send_message_to_remote(rdma_session, 0, RELEASE_CHUNKS, nr);
+	if (ret) {
+		pr_err("%s, Post 2-sided message to remote server failed.\n",
+		       __func__);
+		return ret;
+	}
+
+	drain_rdma_queue(rdma_queue);
+	ret = wait_event_interruptible_timeout(
+		rdma_queue->sem, rdma_queue->state == RELEASED_CHUNKS,
+		RSWAP_RELEASE_TIMEOUT);
+	if (ret <= 0) {
+		pr_warn("%s, memory server does not answer, leave the chunks to it.\n",
+			__func__);
+		return ret ? ret : -ETIMEDOUT;
+	}
+
+	for (i = 0; i < pool->chunk_num; i++)
+		pool->chunks[i].chunk_state = EMPTY;
+	return 0;
+}
+
+/*
+ * Remember the chunks for the next load of the module and keep them from
+ * being released on disconnect. The memory server keeps them for its lease.
+ */
+struct rswap_warm_state *
+rswap_save_warm_state(struct rdma_session_context *rdma_session)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct rswap_warm_state *warm;
+
+	warm = kzalloc(struct_size(warm, chunks, pool->chunk_num), GFP_KERNEL);
+	if (!warm)
+		return NULL;
+	warm->magic = RSWAP_WARM_MAGIC;
+	warm->chunk_shift = CHUNK_SHIFT;
+	memcpy(warm->addr, rdma_session->addr, sizeof(warm->addr));
+	warm->port = rdma_session->port;
+	warm->one_sided = rdma_session->alloc_map.slot >= 0;
+	warm->chunk_num = pool->chunk_num;
+	memcpy(warm->chunks, pool->chunks,
+	       pool->chunk_num * sizeof(struct remote_chunk));
+
+	rdma_session->warm_exit = true;
+	pr_info("%s, keep %u chunks for the next load of the module.\n",
+		__func__, warm->chunk_num);
+	return warm;
+}
+
+/*
+ * Ask the memory server back for the chunks left by the previous module, in
+ * the same order. The pages swapped out to a chunk it lost are gone, they are
+ * marked so that their loads fail instead of reading whatever is there now.
+ */
+int rswap_reattach_remote_chunks(struct rdma_session_context *rdma_session,
+				 struct rswap_warm_state *warm)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct message *msg = rdma_session->rdma_send_req.send_buf;
+	struct rswap_rdma_queue *rdma_queue;
+	uint32_t i, lost = 0;
+	int ret;
+
+	if (warm->magic != RSWAP_WARM_MAGIC ||
+	    warm->chunk_shift != CHUNK_SHIFT ||
+	    memcmp(warm->addr, rdma_session->addr, sizeof(warm->addr)) ||
+	    warm->port != rdma_session->port ||
+	    warm->chunk_num > MAX_REGION_NUM) {
+		pr_err("%s, the previous module used another memory server or chunk size.\n",
+		       __func__);
+		return -EINVAL;
+	}
+
+	rdma_queue = &(rdma_session->rdma_queues[num_queues - 1]);
+	wait_event_interruptible(rdma_queue->sem,
+				 rdma_queue->state == MEMORY_SERVER_AVAILABLE);
+
+	pool->chunk_num = warm->chunk_num;
+	ret = init_remote_chunk_list(rdma_session);
+	if (ret)
+		return ret;
+	for (i = 0; i < warm->chunk_num; i++)
+		msg->buf[i] = warm->chunks[i].chunk_state == MAPPED ?
+				      warm->chunks[i].remote_addr :
+				      0;
+
+	rdma_queue = &(rdma_session->rdma_queues[0]);
+	ret = send_message_to_remote(rdma_session, 0, REATTACH_CHUNKS,
+				     warm->chunk_num);
+	if (ret) {
+		pr_err("%s, Post 2-sided message to remote server failed.\n",
+		       __func__);
+		return ret;
+	}
+	drain_rdma_queue(rdma_queue);
+	wait_event_interruptible(rdma_queue->sem,
+				 rdma_queue->state == RECEIVED_CHUNKS);
+
+	for (i = 0; i < warm->chunk_num; i++) {
+		if (warm->chunks[i].chunk_state != MAPPED)
+			continue;
+		if (pool->chunks[i].chunk_state != MAPPED ||
+		    pool->chunks[i].remote_rkey !=
+			    warm->chunks[i].remote_rkey) {
+			pool->chunks[i].lost = vmalloc(array_size(
+				BITS_TO_LONGS(CHUNK_PAGES), sizeof(unsigned long)));
+			if (!pool->chunks[i].lost)
+				return -ENOMEM;
+			bitmap_fill(pool->chunks[i].lost, CHUNK_PAGES);
+			lost++;
+			continue;
+		}
+		pool->chunks[i].alloc_idx = warm->chunks[i].alloc_idx;
+	}
+	rdma_session->lost_chunks = lost;
+	if (lost)
+		pr_err("%s, the memory server lost %u of %u chunks, the pages swapped out to them are gone.\n",
+		       __func__, lost, warm->chunk_num);
+
+	if (warm->one_sided) {
+		ret = rswap_query_alloc_map(rdma_session);
+		if (ret)
+			pr_warn("%s, no alloc map, one-sided chunks are left to the lease.\n",
+				__func__);
+	}
+	pr_info("%s, reattached %u chunks.\n", __func__,
+		warm->chunk_num - lost);
+	return 0;
+}
+
+/*
+ * The memory server rejects a queue whose chunk size differs from its own,
+ * and tells its chunk size in the private data of the reject.
+ */
+static void rswap_check_server_param(struct rdma_cm_event *event)
+{
+	const struct rswap_conn_param *param = event->param.conn.private_data;
+
+	if (event->param.conn.private_data_len < sizeof(*param) ||
+	    param->magic != RSWAP_CONN_MAGIC)
+		return;
+
+	if (param->chunk_shift != CHUNK_SHIFT)
+		pr_err("%s, memory server chunk size 0x%llx != client chunk size 0x%llx, rebuild with the same REGION_SIZE_GB\n",
+		       __func__, 1ULL << param->chunk_shift, 1ULL << CHUNK_SHIFT);
+}
+
 int rswap_rdma_cm_event_handler(struct rdma_cm_id *cma_id,
 				struct rdma_cm_event *event)
 {
@@ -282,11 +492,13 @@ int rswap_rdma_cm_event_handler(struct rdma_cm_id *cma_id,
 		rdma_queue->state = CONNECTED;
 		wake_up_interruptible(&rdma_queue->sem);
 		break;
+	case RDMA_CM_EVENT_REJECTED:
+		rswap_check_server_param(event);
+		/* fall through */
 	case RDMA_CM_EVENT_ADDR_ERROR:
 	case RDMA_CM_EVENT_ROUTE_ERROR:
 	case RDMA_CM_EVENT_CONNECT_ERROR:
 	case RDMA_CM_EVENT_UNREACHABLE:
-	case RDMA_CM_EVENT_REJECTED:
 		pr_err("%s, cma event %d, event name %s, error code %d \n",
 		       __func__, event->event,
 		       rdma_cm_message_print(event->event), event->status);
@@ -518,6 +730,7 @@ int rswap_connect_remote_memory_server(
 	struct rdma_session_context *rdma_session, int rdma_queue_inx)
 {
 	struct rdma_conn_param conn_param;
+	struct rswap_conn_param param;
 	int ret;
 	struct rswap_rdma_queue *rdma_queue;
 	const struct ib_recv_wr *bad_wr;
@@ -528,6 +741,14 @@ int rswap_connect_remote_memory_server(
 	conn_param.initiator_depth = 1;
 	conn_param.retry_count = 10;
 
+	// negotiate #(queues) and chunk size with the memory server
+	param.magic = RSWAP_CONN_MAGIC;
+	param.num_queues = num_queues;
+	param.q_index = rdma_queue_inx;
+	param.chunk_shift = CHUNK_SHIFT;
+	conn_param.private_data = &param;
+	conn_param.private_data_len = sizeof(param);
+
 	atomic_inc(&rdma_queue->rdma_post_counter);
 	ret = ib_post_recv(rdma_queue->qp, &rdma_session->rdma_recv_req.rq_wr,
 			   &bad_wr);
@@ -566,17 +787,19 @@ int init_remote_chunk_list(struct rdma_session_context *rdma_session)
 {
 	int ret = 0;
 	uint32_t i;
+	// slots of the chunks not granted stay EMPTY
+	uint32_t nr_slots = max(rdma_session->remote_mem_pool.chunk_num,
+				rswap_wanted_chunks(rdma_session));
 
 	rdma_session->remote_mem_pool.chunks = (struct remote_chunk *)kzalloc(
-		sizeof(struct remote_chunk) *
-			rdma_session->remote_mem_pool.chunk_num,
-		GFP_KERNEL);
+		sizeof(struct remote_chunk) * nr_slots, GFP_KERNEL);
 
-	for (i = 0; i < rdma_session->remote_mem_pool.chunk_num; i++) {
+	for (i = 0; i < nr_slots; i++) {
 		rdma_session->remote_mem_pool.chunks[i].chunk_state = EMPTY;
 		rdma_session->remote_mem_pool.chunks[i].remote_addr = 0x0;
 		rdma_session->remote_mem_pool.chunks[i].mapped_size = 0x0;
 		rdma_session->remote_mem_pool.chunks[i].remote_rkey = 0x0;
+		rdma_session->remote_mem_pool.chunks[i].alloc_idx = -1;
 	}
 
 	return ret;
@@ -612,7 +835,8 @@ void bind_remote_memory_chunks(struct rdma_session_context *rdma_session)
 	}
 }
 
-int init_rdma_sessions(struct rdma_session_context *rdma_session)
+int init_rdma_sessions(struct rdma_session_context *rdma_session, char *ip,
+		       int port)
 {
 	int ret = 0;
 
@@ -621,15 +845,15 @@ int init_rdma_sessions(struct rdma_session_context *rdma_session)
 	rdma_session->send_queue_depth = RDMA_SEND_QUEUE_DEPTH + 1;
 	rdma_session->recv_queue_depth = RDMA_RECV_QUEUE_DEPTH + 1;
 
-	rdma_session->port = htons(server_port);
-	ret = in4_pton(server_ip, strlen(server_ip), rdma_session->addr, -1,
-		       NULL);
+	rdma_session->port = htons(port);
+	ret = in4_pton(ip, strlen(ip), rdma_session->addr, -1, NULL);
 	if (ret == 0) {
 		pr_err("Assign ip %s to  rdma_session->addr : %s failed.\n",
-		       server_ip, rdma_session->addr);
+		       ip, rdma_session->addr);
 		goto err;
 	}
 	rdma_session->addr_type = AF_INET;
+	rdma_session->alloc_map.slot = -1;
 
 err:
 	return ret;
@@ -727,6 +951,28 @@ int rdma_session_connect(struct rdma_session_context *rdma_session)
 		pr_info("%s, RDMA queue[%d] Connect to remote server successfully \n",
 			__func__, i);
 	}
+	// the replica is a cache, a reload starts it empty, as the other
+	// servers of the erasure coding and of the migration. The parked pages
+	// are only in the chunks of the previous module, no fresh chunks in
+	// their place: on a failure frontswap stays parked, with the state and
+	// the chunks kept for another try.
+	if (!rdma_session->secondary && frontswap_parked()) {
+		struct rswap_warm_state *warm = frontswap_parked_state();
+
+		ret = warm ? rswap_reattach_remote_chunks(rdma_session, warm) :
+			     -EINVAL;
+		if (!ret)
+			goto out;
+		pr_err("%s, reattach failed, frontswap stays parked.\n",
+		       __func__);
+		rdma_session->warm_exit = true;
+		rswap_disconnect_and_collect_resource(rdma_session);
+		goto err;
+	}
+	if (!rdma_session->secondary && rswap_one_sided &&
+	    !rswap_alloc_remote_chunks(rdma_session))
+		goto out;
+
 	ret = rswap_query_available_memory(rdma_session);
 	if (unlikely(ret)) {
 		pr_info("%s, request for chunk failed.\n", __func__);
@@ -738,6 +984,7 @@ int rdma_session_connect(struct rdma_session_context *rdma_session)
 		pr_info("%s, request for chunk failed.\n", __func__);
 		goto err;
 	}
+out:
 	pr_info("%s,Exit the main() function with built RDMA conenction rdma_session_context:0x%llx .\n",
 		__func__, (uint64_t)rdma_session);
 
@@ -750,6 +997,8 @@ err:
 
 void rswap_free_buffers(struct rdma_session_context *rdma_session)
 {
+	uint32_t i;
+
 	if (rdma_session == NULL)
 		return;
 
@@ -758,8 +1007,12 @@ void rswap_free_buffers(struct rdma_session_context *rdma_session)
 	if (rdma_session->rdma_send_req.send_buf != NULL)
 		kfree(rdma_session->rdma_send_req.send_buf);
 
-	if (rdma_session->remote_mem_pool.chunks != NULL)
+	if (rdma_session->remote_mem_pool.chunks != NULL) {
+		for (i = 0; i < rdma_session->remote_mem_pool.chunk_num; i++)
+			vfree(rdma_session->remote_mem_pool.chunks[i].lost);
 		kfree(rdma_session->remote_mem_pool.chunks);
+	}
+	rswap_free_alloc_map(rdma_session);
 
 	pr_debug("%s, Free RDMA buffers done. \n", __func__);
 }
@@ -805,6 +1058,8 @@ int rswap_disconnect_and_collect_resource(
 	int i;
 	struct rswap_rdma_queue *rdma_queue;
 
+	rswap_release_remote_chunks(rdma_session);
+
 	for (i = 0; i < num_queues; i++) {
 		rdma_queue = &(rdma_session->rdma_queues[i]);
 		if (unlikely(rdma_queue->freed != 0)) {
@@ -890,7 +1145,7 @@ char *rdma_wc_status_name(int wc_status_id)
 char *rdma_message_print(int message_id)
 {
 	char *message_type_name;
-	char *type2str[12] = {
+	char *type2str[16] = {
 		"DONE",
 		"GOT_CHUNKS",
 		"GOT_SINGLE_CHUNK",
@@ -902,6 +1157,10 @@ char *rdma_message_print(int message_id)
 		"REQUEST_SINGLE_CHUNK",
 		"QUERY",
 		"AVAILABLE_TO_QUERY",
+		"RELEASE_CHUNKS",
+		"QUERY_ALLOC_MAP",
+		"ALLOC_MAP",
+		"REATTACH_CHUNKS",
 		"ERROR Message Type",
 	};
 
@@ -909,7 +1168,7 @@ char *rdma_message_print(int message_id)
 	message_id -= 1;
 
 	message_type_name = (char *)kzalloc(32, GFP_KERNEL); // 32 bytes
-	strcpy(message_type_name, type2str[message_id < 11 ? message_id : 11]);
+	strcpy(message_type_name, type2str[message_id < 15 ? message_id : 15]);
 	return message_type_name;
 }
 
@@ -917,13 +1176,16 @@ char *rdma_session_context_state_print(int id)
 {
 	char *rdma_seesion_state_name;
 
-	char *state2str[20] = { "IDLE",
+	char *state2str[23] = { "IDLE",
 				"CONNECT_REQUEST",
 				"ADDR_RESOLVED",
 				"ROUTE_RESOLVED",
 				"CONNECTED",
+				"MEMORY_SERVER_AVAILABLE",
 				"FREE_MEM_RECV",
 				"RECEIVED_CHUNKS",
+				"RELEASED_CHUNKS",
+				"ALLOC_MAP_RECV",
 				"RDMA_BUF_ADV",
 				"WAIT_OPS",
 				"RECV_STOP",
@@ -941,7 +1203,7 @@ char *rdma_session_context_state_print(int id)
 	// message id starts from 1
 	id -= 1;
 	rdma_seesion_state_name = (char *)kzalloc(32, GFP_KERNEL); // 32 bytes.
-	strcpy(rdma_seesion_state_name, state2str[id < 19 ? id : 19]);
+	strcpy(rdma_seesion_state_name, state2str[id < 22 ? id : 22]);
 	return rdma_seesion_state_name;
 }
 
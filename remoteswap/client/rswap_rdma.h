@@ -34,6 +34,7 @@
 #include <linux/smp.h>
 
 #include "constants.h"
+#include "rswap_dma.h"
 #include "utils.h"
 
 #define RDMA_SEND_QUEUE_DEPTH 128
@@ -41,6 +42,9 @@
 #define GB_SHIFT 30
 #define CHUNK_SHIFT (u64)(GB_SHIFT + ilog2(REGION_SIZE_GB))
 #define CHUNK_MASK (u64)(((u64)1 << CHUNK_SHIFT) - 1)
+#define CHUNK_PAGE_SHIFT (CHUNK_SHIFT - PAGE_SHIFT)
+#define CHUNK_PAGES ((u64)1 << CHUNK_PAGE_SHIFT)
+#define RSWAP_RELEASE_TIMEOUT (5 * HZ)
 
 enum rdma_queue_state {
 	IDLE = 1,
@@ -53,6 +57,8 @@ enum rdma_queue_state {
 
 	FREE_MEM_RECV,
 	RECEIVED_CHUNKS,
+	RELEASED_CHUNKS,
+	ALLOC_MAP_RECV,
 	RDMA_BUF_ADV,
 	WAIT_OPS,
 	RECV_STOP,
@@ -80,6 +86,8 @@ struct remote_chunk {
 	uint64_t remote_addr;
 	uint64_t mapped_size;
 	enum chunk_mapping_state chunk_state;
+	int alloc_idx; // entry in the alloc map, -1 if got by message
+	unsigned long *lost; // pages of the previous module the server lost
 };
 
 struct chunk_list {
@@ -92,12 +100,17 @@ struct fs_rdma_req {
 	struct ib_cqe cqe;
 	struct page *page;
 	u64 dma_addr;
+	bool dma_mapped; // by the request, not in the session's dma_map
+	u32 log_seg; // pinned until the read is done, see rswap_log.c
+	bool chunk_ref; // held until done, see rswap_migrate.c
+	size_t roffset; // of the page in the remote memory
 	struct ib_sge sge;
 	struct ib_rdma_wr rdma_wr;
 
 	struct completion done;
 	struct rswap_rdma_queue *rdma_queue;
 	int no_wait_pkts;
+	enum ib_wc_status status; // of the cleancache transfers
 #ifdef LATENCY_THRESHOLD
 	uint64_t sent_time_start;
 #endif
@@ -148,6 +161,36 @@ struct rswap_rdma_dev {
 	struct ib_pd *pd;
 };
 
+// The alloc map of the memory server, see constants.h and rswap_alloc.c.
+struct rswap_alloc_map {
+	uint64_t remote_addr;
+	uint32_t rkey;
+	int slot; // our client slot in it, -1: chunks are got by message
+	uint64_t quota; // in chunks, 0: no limit
+
+	struct rswap_alloc_header header;
+	struct rswap_extent *extents;
+	uint64_t *atomic_buf; // old value returned by the rdma atomics
+};
+
+/*
+ * What a warm unload leaves to the next load of the module, see
+ * frontswap_park_ops(). The remote address of a swapped out page only
+ * depends on the index of its chunk, so the chunks in the same order are
+ * enough to find the pages again.
+ */
+#define RSWAP_WARM_MAGIC 0x5257524d // "RWRM"
+
+struct rswap_warm_state {
+	uint32_t magic;
+	uint32_t chunk_shift;
+	u8 addr[16];
+	uint16_t port;
+	int one_sided;
+	uint32_t chunk_num;
+	struct remote_chunk chunks[];
+};
+
 struct rdma_session_context {
 	struct rswap_rdma_dev *rdma_dev;
 	struct rswap_rdma_queue *rdma_queues;
@@ -162,6 +205,12 @@ struct rdma_session_context {
 	struct two_sided_rdma_send rdma_send_req;
 
 	struct chunk_list remote_mem_pool;
+	struct rswap_alloc_map alloc_map;
+	bool warm_exit; // leave the chunks to the next load of the module
+	uint32_t lost_chunks; // lost by the memory server on a warm reload
+	bool replica; // holds copies of hot pages, see rswap_replica.c
+	bool secondary; // not the primary server, no warm state or alloc map
+	struct rswap_dma_map dma_map; // empty unless dma_persist
 };
 
 static inline size_t pgoff2addr(pgoff_t offset)
@@ -169,6 +218,53 @@ static inline size_t pgoff2addr(pgoff_t offset)
 	return offset << PAGE_SHIFT;
 }
 
+/*
+ * The page at @offset was swapped out by the previous module to a chunk the
+ * memory server lost on the warm reload, it must not be read.
+ */
+static inline bool rswap_page_lost(struct rdma_session_context *rdma_session,
+				   pgoff_t offset)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct remote_chunk *chunk;
+
+	if (likely(!rdma_session->lost_chunks) ||
+	    (offset >> CHUNK_PAGE_SHIFT) >= pool->chunk_num)
+		return false;
+	chunk = &pool->chunks[offset >> CHUNK_PAGE_SHIFT];
+	return chunk->lost && test_bit(offset & (CHUNK_PAGES - 1), chunk->lost);
+}
+
+/*
+ * A store to a lost chunk the memory server did not give back fails, one
+ * to a chunk it gave back anew replaces the lost page.
+ */
+static inline bool rswap_page_store_lost(struct rdma_session_context *rdma_session,
+					 pgoff_t offset)
+{
+	struct chunk_list *pool = &rdma_session->remote_mem_pool;
+	struct remote_chunk *chunk;
+
+	if (likely(!rdma_session->lost_chunks) ||
+	    (offset >> CHUNK_PAGE_SHIFT) >= pool->chunk_num)
+		return false;
+	chunk = &pool->chunks[offset >> CHUNK_PAGE_SHIFT];
+	if (!chunk->lost)
+		return false;
+	if (chunk->chunk_state != MAPPED)
+		return true;
+	clear_bit(offset & (CHUNK_PAGES - 1), chunk->lost);
+	return false;
+}
+
+// #(chunks) covering the rmsize the client is configured with, 0 if not set
+static inline uint32_t
+rswap_wanted_chunks(struct rdma_session_context *rdma_session)
+{
+	return DIV_ROUND_UP(rdma_session->remote_mem_pool.remote_mem_size,
+			    REGION_SIZE_GB);
+}
+
 enum rdma_queue_type get_qp_type(int idx);
 struct rswap_rdma_queue *
 get_rdma_queue(struct rdma_session_context *rdma_session, unsigned int cpu,
@@ -177,7 +273,8 @@ void get_rdma_queue_cpu_type(struct rdma_session_context *rdma_session,
 			     struct rswap_rdma_queue *rdma_queue,
 			     unsigned int *cpu, enum rdma_queue_type *type);
 
-int init_rdma_sessions(struct rdma_session_context *rdma_session);
+int init_rdma_sessions(struct rdma_session_context *rdma_session, char *ip,
+		       int port);
 int rdma_session_connect(struct rdma_session_context *rdma_session);
 int rswap_init_rdma_queue(struct rdma_session_context *rdma_session, int cpu);
 int rswap_create_rdma_queue(struct rdma_session_context *rdma_session,
@@ -190,6 +287,16 @@ int rswap_setup_buffers(struct rdma_session_context *rdma_session);
 
 int init_remote_chunk_list(struct rdma_session_context *rdma_session);
 void bind_remote_memory_chunks(struct rdma_session_context *rdma_session);
+int rswap_release_remote_chunks(struct rdma_session_context *rdma_session);
+struct rswap_warm_state *
+rswap_save_warm_state(struct rdma_session_context *rdma_session);
+int rswap_reattach_remote_chunks(struct rdma_session_context *rdma_session,
+				 struct rswap_warm_state *warm);
+
+int rswap_alloc_remote_chunks(struct rdma_session_context *rdma_session);
+int rswap_alloc_release_chunks(struct rdma_session_context *rdma_session);
+int rswap_query_alloc_map(struct rdma_session_context *rdma_session);
+void rswap_free_alloc_map(struct rdma_session_context *rdma_session);
 
 int rswap_disconnect_and_collect_resource(
 	struct rdma_session_context *rdma_session);
@@ -205,6 +312,46 @@ int rswap_rdma_send(int cpu, pgoff_t offset, struct page *page,
 		    enum rdma_queue_type type);
 int rswap_rdma_send_note(int cpu, pgoff_t offset, struct page *page,
 			 enum rdma_queue_type type, int no_wait_pkts);
+int rswap_rdma_rw_sync(struct rdma_session_context *rdma_session,
+		       size_t roffset, struct page *page,
+		       enum rdma_queue_type type);
+
+#define RSWAP_LOG_NONE U32_MAX
+bool rswap_log_on(void);
+int rswap_log_store_page(pgoff_t offset, struct page *page);
+int rswap_log_load_staged(pgoff_t offset, struct page *page);
+int rswap_log_pin(pgoff_t *offset, u32 *log_seg);
+void rswap_log_unpin(u32 log_seg);
+void rswap_log_invalidate(pgoff_t offset);
+
+// A swap chunk, where it is now, see rswap_migrate.c
+struct rswap_chunk_ref {
+	struct rdma_session_context *rdma_session;
+	struct remote_chunk *chunk;
+	bool counted; // rswap_chunk_put() once the transfer is done
+};
+
+bool rswap_migrate_on(void);
+void rswap_chunk_get(size_t roffset, struct rswap_chunk_ref *ref);
+void rswap_chunk_put(size_t roffset, bool write);
+void rswap_migrate_drain(int cpu, enum rdma_queue_type type);
+
+bool rswap_ec_on(void);
+int rswap_ec_store_page(pgoff_t offset, struct page *page);
+int rswap_ec_load_page(pgoff_t offset, struct page *page);
+
+bool rswap_tier_on(void);
+int rswap_tier_store(pgoff_t offset, struct page *page);
+int rswap_tier_load(pgoff_t offset, struct page *page, bool fault);
+void rswap_tier_invalidate(pgoff_t offset);
+void rswap_tier_invalidate_all(void);
+
+int rswap_replica_init(void);
+void rswap_replica_exit(void);
+void rswap_replica_store(pgoff_t offset, struct page *page);
+int rswap_replica_load(pgoff_t offset, struct page *page);
+void rswap_replica_invalidate(pgoff_t offset);
+void rswap_replica_invalidate_all(void);
 
 void drain_rdma_queue(struct rswap_rdma_queue *rdma_queue);
 void drain_rdma_queue_unblock(struct rswap_rdma_queue *rdma_queue);
@@ -220,7 +367,10 @@ void print_scatterlist_info(struct scatterlist *sl_ptr, int nents);
 void print_critical_macros(void);
 
 extern struct rdma_session_context rdma_session_global;
+extern struct rdma_session_context rdma_session_replica;
 
+extern int rswap_one_sided;
+extern int rswap_warm_reload;
 extern int online_cores;
 extern int num_queues;
 extern char *server_ip;
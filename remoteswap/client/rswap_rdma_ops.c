@@ -1,8 +1,16 @@
 #include <linux/swap_stats.h>
 
+#include "rswap_cleancache.h"
+#include "rswap_heat.h"
 #include "rswap_rdma.h"
 #include "rswap_scheduler.h"
 
+static int rswap_dma_persist;
+MODULE_PARM_DESC(dma_persist,
+		 "Map the physical memory for the RDMA device once at load, instead of each page per transfer. "
+		 "Saves the IOMMU work, but the device may access any memory");
+module_param_named(dma_persist, rswap_dma_persist, int, 0444);
+
 void drain_rdma_queue(struct rswap_rdma_queue *rdma_queue)
 {
 	unsigned long flags;
@@ -40,6 +48,15 @@ void drain_all_rdma_queues(int target_mem_server)
 	}
 }
 
+// a page in the persistent mapping only needs a sync
+static void fs_rdma_unmap(struct ib_device *ibdev, struct fs_rdma_req *rdma_req, enum dma_data_direction dir)
+{
+	if (rdma_req->dma_mapped)
+		ib_dma_unmap_page(ibdev, rdma_req->dma_addr, PAGE_SIZE, dir);
+	else if (dir == DMA_FROM_DEVICE)
+		ib_dma_sync_single_for_cpu(ibdev, rdma_req->dma_addr, PAGE_SIZE, dir);
+}
+
 void fs_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 {
 	struct fs_rdma_req *rdma_req = container_of(wc->wr_cqe, struct fs_rdma_req, cqe);
@@ -59,7 +76,9 @@ void fs_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 	if (unlikely(wc->status != IB_WC_SUCCESS)) {
 		pr_err("%s status is not success, it is=%d\n", __func__, wc->status);
 	}
-	ib_dma_unmap_page(ibdev, rdma_req->dma_addr, PAGE_SIZE, DMA_TO_DEVICE);
+	fs_rdma_unmap(ibdev, rdma_req, DMA_TO_DEVICE);
+	if (rdma_req->chunk_ref)
+		rswap_chunk_put(rdma_req->roffset, true);
 
 	atomic_dec(&rdma_queue->rdma_post_counter);
 	complete(&rdma_req->done);
@@ -76,7 +95,7 @@ void fs_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 	}
 #endif
 	if (!(rdma_req->no_wait_pkts)) {
-		get_rdma_queue_cpu_type(&rdma_session_global, rdma_queue, &cpu, &type);
+		get_rdma_queue_cpu_type(rdma_queue->rdma_session, rdma_queue, &cpu, &type);
 		proc = rswap_vqlist_get_triple(cpu)->proc;
 		rswap_proc_send_pkts_dec(proc, type);
 	}
@@ -103,10 +122,14 @@ void fs_rdma_read_done(struct ib_cq *cq, struct ib_wc *wc)
 	if (unlikely(wc->status != IB_WC_SUCCESS)) {
 		pr_err("%s status is not success, it is=%d\n", __func__, wc->status);
 	}
-	ib_dma_unmap_page(ibdev, rdma_req->dma_addr, PAGE_SIZE, DMA_FROM_DEVICE);
+	fs_rdma_unmap(ibdev, rdma_req, DMA_FROM_DEVICE);
+	if (rdma_req->chunk_ref)
+		rswap_chunk_put(rdma_req->roffset, false);
 
 	SetPageUptodate(rdma_req->page);
 	unlock_page(rdma_req->page);
+	if (rdma_req->log_seg != RSWAP_LOG_NONE)
+		rswap_log_unpin(rdma_req->log_seg);
 	atomic_dec(&rdma_queue->rdma_post_counter);
 	complete(&rdma_req->done);
 
@@ -122,7 +145,7 @@ void fs_rdma_read_done(struct ib_cq *cq, struct ib_wc *wc)
 	}
 #endif
 	if (!(rdma_req->no_wait_pkts)) {
-		get_rdma_queue_cpu_type(&rdma_session_global, rdma_queue, &cpu, &type);
+		get_rdma_queue_cpu_type(rdma_queue->rdma_session, rdma_queue, &cpu, &type);
 		proc = rswap_vqlist_get_triple(cpu)->proc;
 		rswap_proc_send_pkts_dec(proc, type);
 	}
@@ -171,10 +194,20 @@ int fs_build_rdma_wr(struct rdma_session_context *rdma_session, struct rswap_rdm
 	struct ib_device *dev = rdma_session->rdma_dev->dev;
 
 	rdma_req->page = page;
+	rdma_req->log_seg = RSWAP_LOG_NONE;
+	rdma_req->chunk_ref = false;
 	init_completion(&(rdma_req->done));
+	// the heat map is of the primary server's remote memory
+	if (!rdma_session->secondary)
+		rswap_heat_add((size_t)(remote_chunk_ptr - rdma_session->remote_mem_pool.chunks) << CHUNK_SHIFT |
+				       offset_within_chunk,
+			       type == QP_STORE);
 
 	dir = type == QP_STORE ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
-	rdma_req->dma_addr = ib_dma_map_page(dev, page, 0, PAGE_SIZE, dir);
+	rdma_req->dma_addr = rswap_dma_page_addr(&rdma_session->dma_map, page);
+	rdma_req->dma_mapped = rdma_req->dma_addr == RSWAP_DMA_NONE;
+	if (rdma_req->dma_mapped)
+		rdma_req->dma_addr = ib_dma_map_page(dev, page, 0, PAGE_SIZE, dir);
 	if (unlikely(ib_dma_mapping_error(dev, rdma_req->dma_addr))) {
 		pr_err("%s, ib_dma_mapping_error\n", __func__);
 		ret = -ENOMEM;
@@ -210,46 +243,147 @@ int rswap_rdma_send_note(int cpu, pgoff_t offset, struct page *page, enum rdma_q
 {
 	int ret = 0;
 	size_t page_addr;
-	size_t chunk_idx;
-	size_t offset_within_chunk;
 	struct rswap_rdma_queue *rdma_queue;
 	struct fs_rdma_req *rdma_req;
-	struct remote_chunk *remote_chunk_ptr;
-
+	struct rswap_chunk_ref ref;
+	u32 log_seg = RSWAP_LOG_NONE;
+
+	// the stores are appended to the log, see rswap_log.c
+	if (type != QP_STORE) {
+		ret = rswap_log_pin(&offset, &log_seg);
+		if (unlikely(ret))
+			goto out;
+	}
 	page_addr = pgoff2addr(offset);
-	chunk_idx = page_addr >> CHUNK_SHIFT;
-	offset_within_chunk = page_addr & CHUNK_MASK;
+	// the server the chunk is on now, see rswap_migrate.c
+	rswap_chunk_get(page_addr, &ref);
 
-	rdma_queue = get_rdma_queue(&rdma_session_global, cpu, type);
+	rdma_queue = get_rdma_queue(ref.rdma_session, cpu, type);
 	rdma_req = (struct fs_rdma_req *)kmem_cache_alloc(rdma_queue->fs_rdma_req_cache, GFP_ATOMIC);
 	if (!rdma_req) {
 		pr_err("%s, get reserved fs_rdma_req failed. \n", __func__);
-		goto out;
+		goto out_put;
 	}
 
-	remote_chunk_ptr = &(rdma_session_global.remote_mem_pool.chunks[chunk_idx]);
-
-	ret = fs_build_rdma_wr(&rdma_session_global, rdma_queue, rdma_req, remote_chunk_ptr, offset_within_chunk, page,
+	ret = fs_build_rdma_wr(ref.rdma_session, rdma_queue, rdma_req, ref.chunk, page_addr & CHUNK_MASK, page,
 			       type);
 	if (unlikely(ret)) {
 		pr_err("%s, build rdma_wr failed.\n", __func__);
-		goto out;
+		goto out_put;
 	}
 	rdma_req->no_wait_pkts = no_wait_pkts;
+	rdma_req->log_seg = log_seg;
+	rdma_req->chunk_ref = ref.counted;
+	rdma_req->roffset = page_addr;
 #ifdef LATENCY_THRESHOLD
 	rdma_req->sent_time_start = get_cycles_start();
 #endif
 
-	ret = fs_enqueue_send_wr(&rdma_session_global, rdma_queue, rdma_req);
+	ret = fs_enqueue_send_wr(ref.rdma_session, rdma_queue, rdma_req);
 	if (unlikely(ret)) {
 		pr_err("%s, enqueue rdma_wr failed.\n", __func__);
+		goto out_put;
+	}
+	return ret;
+
+out_put:
+	if (ref.counted)
+		rswap_chunk_put(page_addr, false);
+	if (log_seg != RSWAP_LOG_NONE)
+		rswap_log_unpin(log_seg);
+out:
+	return ret;
+}
+
+/*
+ * The cleancache and replica transfers bypass the scheduler and poll their
+ * own queue. The completion leaves the page and the request to the waiter.
+ */
+static void fs_rdma_sync_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct fs_rdma_req *rdma_req = container_of(wc->wr_cqe, struct fs_rdma_req, cqe);
+	struct rswap_rdma_queue *rdma_queue = cq->cq_context;
+	struct ib_device *ibdev = rdma_queue->rdma_session->rdma_dev->dev;
+
+	fs_rdma_unmap(ibdev, rdma_req,
+		      rdma_req->rdma_wr.wr.opcode == IB_WR_RDMA_WRITE ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	rdma_req->status = wc->status;
+	atomic_dec(&rdma_queue->rdma_post_counter);
+}
+
+int rswap_rdma_rw_sync(struct rdma_session_context *rdma_session, size_t roffset, struct page *page,
+		       enum rdma_queue_type type)
+{
+	struct rswap_rdma_queue *rdma_queue;
+	struct fs_rdma_req *rdma_req;
+	struct remote_chunk *remote_chunk_ptr;
+	int ret, cpu;
+
+	cpu = get_cpu();
+	rdma_queue = get_rdma_queue(rdma_session, cpu, type);
+	rdma_req = (struct fs_rdma_req *)kmem_cache_alloc(rdma_queue->fs_rdma_req_cache, GFP_ATOMIC);
+	if (!rdma_req) {
+		ret = -ENOMEM;
 		goto out;
 	}
 
+	remote_chunk_ptr = &(rdma_session->remote_mem_pool.chunks[roffset >> CHUNK_SHIFT]);
+	ret = fs_build_rdma_wr(rdma_session, rdma_queue, rdma_req, remote_chunk_ptr, roffset & CHUNK_MASK,
+			       page, type);
+	if (unlikely(ret))
+		goto out; // the request is freed
+	rdma_req->cqe.done = fs_rdma_sync_done;
+	rdma_req->status = IB_WC_SUCCESS;
+
+	ret = fs_enqueue_send_wr(rdma_session, rdma_queue, rdma_req);
+	if (unlikely(ret)) {
+		fs_rdma_unmap(rdma_session->rdma_dev->dev, rdma_req,
+			      type == QP_STORE ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+		goto out_free;
+	}
+	// returns once our completion, and the ones before it, are processed
+	drain_rdma_queue(rdma_queue);
+	if (unlikely(rdma_req->status != IB_WC_SUCCESS)) {
+		pr_err("%s, rdma %s at 0x%zx failed, %s\n", __func__, type == QP_STORE ? "write" : "read", roffset,
+		       rdma_wc_status_name(rdma_req->status));
+		ret = -EIO;
+	}
+out_free:
+	kmem_cache_free(rdma_queue->fs_rdma_req_cache, rdma_req);
 out:
+	put_cpu();
 	return ret;
 }
 
+int rswap_cc_write_page(size_t roffset, struct page *page)
+{
+	return rswap_rdma_rw_sync(&rdma_session_global, roffset, page, QP_STORE);
+}
+
+int rswap_cc_read_page(size_t roffset, struct page *page)
+{
+	return rswap_rdma_rw_sync(&rdma_session_global, roffset, page, QP_LOAD_SYNC);
+}
+
+// of the remote memory, the swap device takes the pages past it
+static pgoff_t rswap_swap_pages;
+
+int rswap_granted_size(void)
+{
+	return rdma_session_global.remote_mem_pool.chunk_num * REGION_SIZE_GB;
+}
+
+void rswap_swap_limit_init(int mem_size, int cc_size, int dev_size)
+{
+	u64 swap_size = max(mem_size - cc_size - dev_size, 0);
+	u64 granted = rswap_granted_size();
+
+	if (granted < (u64)mem_size)
+		pr_warn("%s, %lluGB of the %dGB of remote memory granted\n", __func__, granted, mem_size);
+	rswap_swap_pages = min(swap_size, granted) << (GB_SHIFT - PAGE_SHIFT);
+	pr_info("%s, %lu swap pages in the remote memory\n", __func__, rswap_swap_pages);
+}
+
 static inline pgoff_t local_to_remote_page_mapping(unsigned type, pgoff_t swap_entry_offset)
 {
 #ifndef RSWAP_KERNEL_SUPPORT
@@ -262,6 +396,35 @@ static inline pgoff_t local_to_remote_page_mapping(unsigned type, pgoff_t swap_e
 #endif
 }
 
+/*
+ * A swap offset past the remote memory, e.g. of a swap partition larger
+ * than it. The store fails and frontswap leaves the page to the swap
+ * device, its bit in the frontswap map stays clear so the page is read
+ * from there, and the kernel gives it a new swap entry when it is faulted
+ * in, backed by the remote memory if one is free by then.
+ */
+static inline bool rswap_swap_overflow(pgoff_t remote_page_offset)
+{
+	if (likely(remote_page_offset < rswap_swap_pages))
+		return false;
+	pr_warn_once("%s, the swap partition is larger than the remote memory, the pages past %lu go to the swap device\n",
+		     __func__, rswap_swap_pages);
+	return true;
+}
+
+/*
+ * A page the memory server lost on a warm reload fails to load, the fault
+ * gets SIGBUS instead of the data of another page.
+ */
+static inline bool rswap_load_lost(pgoff_t remote_page_offset, struct page *page)
+{
+	if (likely(!rswap_page_lost(&rdma_session_global, remote_page_offset)))
+		return false;
+	SetPageError(page);
+	unlock_page(page);
+	return true;
+}
+
 int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset, struct page *page)
 {
 	pgoff_t remote_page_offset = local_to_remote_page_mapping(type, swap_entry_offset);
@@ -274,6 +437,22 @@ int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset, struct page
 	struct rswap_vqueue *vqueue;
 	struct rswap_request vrequest = { remote_page_offset, page };
 
+	if (rswap_swap_overflow(remote_page_offset) ||
+	    rswap_page_store_lost(&rdma_session_global, remote_page_offset))
+		return -ENOSPC;
+	// staged for a large write, or stored in place
+	ret = rswap_log_store_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or erasure-coded across the servers
+	ret = rswap_ec_store_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or on the far server if cold
+	ret = rswap_tier_store(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+
 	cpu = get_cpu();
 	vqueue = rswap_vqlist_get(cpu, QP_STORE);
 
@@ -281,6 +460,9 @@ int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset, struct page
 		ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_STORE, 1);
 	} else {
 		ret = rswap_vqueue_enqueue(vqueue, &vrequest);
+		// the vqueue could not grow, bypass the scheduler
+		if (ret == -ENOMEM)
+			ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_STORE, 1);
 		sent_vqueue = 1;
 	}
 	atomic_inc(&global_rswap_scheduler->total_pkts);
@@ -296,11 +478,29 @@ int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset, struct page
 	}
 	rdma_queue = get_rdma_queue(&rdma_session_global, cpu, QP_STORE);
 	drain_rdma_queue(rdma_queue);
+	rswap_migrate_drain(cpu, QP_STORE);
+	rswap_replica_store(remote_page_offset, page);
 #else
 	int ret = 0;
 	int cpu;
 	struct rswap_rdma_queue *rdma_queue;
 
+	if (rswap_swap_overflow(remote_page_offset) ||
+	    rswap_page_store_lost(&rdma_session_global, remote_page_offset))
+		return -ENOSPC;
+	// staged for a large write, or stored in place
+	ret = rswap_log_store_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or erasure-coded across the servers
+	ret = rswap_ec_store_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or on the far server if cold
+	ret = rswap_tier_store(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+
 	cpu = get_cpu();
 	ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_STORE, 1);
 	put_cpu();
@@ -311,6 +511,8 @@ int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset, struct page
 
 	rdma_queue = get_rdma_queue(&rdma_session_global, cpu, QP_STORE);
 	drain_rdma_queue(rdma_queue);
+	rswap_migrate_drain(cpu, QP_STORE);
+	rswap_replica_store(remote_page_offset, page);
 	ret = 0;
 #endif
 
@@ -328,6 +530,24 @@ int rswap_frontswap_load(unsigned type, pgoff_t swap_entry_offset, struct page *
 	struct rswap_vqueue *vqueue;
 	struct rswap_request vrequest = { remote_page_offset, page };
 
+	if (rswap_load_lost(remote_page_offset, page))
+		return 0;
+	// still staged in the log
+	ret = rswap_log_load_staged(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// from the data server of its stripe, decoded if it failed
+	ret = rswap_ec_load_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or from the far server if it was cold
+	ret = rswap_tier_load(remote_page_offset, page, true);
+	if (ret <= 0)
+		goto out;
+	// hot pages are read from both servers
+	ret = rswap_replica_load(remote_page_offset, page);
+	if (!ret)
+		goto out;
 	cpu = smp_processor_id();
 
 	vqueue = rswap_vqlist_get(cpu, QP_LOAD_SYNC);
@@ -335,6 +555,8 @@ int rswap_frontswap_load(unsigned type, pgoff_t swap_entry_offset, struct page *
 		ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_SYNC, 1);
 	} else {
 		ret = rswap_vqueue_enqueue(vqueue, &vrequest);
+		if (ret == -ENOMEM)
+			ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_SYNC, 1);
 	}
 	atomic_inc(&global_rswap_scheduler->total_pkts);
 
@@ -346,6 +568,25 @@ int rswap_frontswap_load(unsigned type, pgoff_t swap_entry_offset, struct page *
 	int ret = 0;
 	int cpu;
 
+	if (rswap_load_lost(remote_page_offset, page))
+		return 0;
+	// still staged in the log
+	ret = rswap_log_load_staged(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// from the data server of its stripe, decoded if it failed
+	ret = rswap_ec_load_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or from the far server if it was cold
+	ret = rswap_tier_load(remote_page_offset, page, true);
+	if (ret <= 0)
+		goto out;
+	// hot pages are read from both servers
+	ret = rswap_replica_load(remote_page_offset, page);
+	if (!ret)
+		goto out;
+
 	cpu = smp_processor_id();
 
 	ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_SYNC, 1);
@@ -370,6 +611,21 @@ int rswap_frontswap_load_async(unsigned type, pgoff_t swap_entry_offset, struct
 	struct rswap_vqueue *vqueue;
 	struct rswap_request vrequest = { remote_page_offset, page };
 
+	if (rswap_load_lost(remote_page_offset, page))
+		return 0;
+	// still staged in the log
+	ret = rswap_log_load_staged(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// from the data server of its stripe, decoded if it failed
+	ret = rswap_ec_load_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or from the far server if it was cold
+	ret = rswap_tier_load(remote_page_offset, page, false);
+	if (ret <= 0)
+		goto out;
+
 	cpu = smp_processor_id();
 
 	vqueue = rswap_vqlist_get(cpu, QP_LOAD_ASYNC);
@@ -377,6 +633,8 @@ int rswap_frontswap_load_async(unsigned type, pgoff_t swap_entry_offset, struct
 		ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_ASYNC, 1);
 	} else {
 		ret = rswap_vqueue_enqueue(vqueue, &vrequest);
+		if (ret == -ENOMEM)
+			ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_ASYNC, 1);
 	}
 	atomic_inc(&global_rswap_scheduler->total_pkts);
 
@@ -389,6 +647,21 @@ int rswap_frontswap_load_async(unsigned type, pgoff_t swap_entry_offset, struct
 	int ret = 0;
 	int cpu = smp_processor_id();
 
+	if (rswap_load_lost(remote_page_offset, page))
+		return 0;
+	// still staged in the log
+	ret = rswap_log_load_staged(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// from the data server of its stripe, decoded if it failed
+	ret = rswap_ec_load_page(remote_page_offset, page);
+	if (ret <= 0)
+		goto out;
+	// or from the far server if it was cold
+	ret = rswap_tier_load(remote_page_offset, page, false);
+	if (ret <= 0)
+		goto out;
+
 	ret = rswap_rdma_send_note(cpu, remote_page_offset, page, QP_LOAD_ASYNC, 1);
 	if (unlikely(ret)) {
 		pr_err("%s, enqueuing rdma frontswap write failed.\n", __func__);
@@ -413,23 +686,30 @@ int rswap_frontswap_poll_load(int cpu)
 		rswap_vqueue_drain(cpu, QP_LOAD_SYNC);
 	rdma_queue = get_rdma_queue(&rdma_session_global, cpu, QP_LOAD_SYNC);
 	drain_rdma_queue(rdma_queue);
+	rswap_migrate_drain(cpu, QP_LOAD_SYNC);
 #else
 	struct rswap_rdma_queue *rdma_queue;
 
 	rdma_queue = get_rdma_queue(&rdma_session_global, cpu, QP_LOAD_SYNC);
 	drain_rdma_queue(rdma_queue);
+	rswap_migrate_drain(cpu, QP_LOAD_SYNC);
 #endif
 	return 0;
 }
 
 static void rswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	return;
+	pgoff_t remote_page_offset = local_to_remote_page_mapping(type, offset);
+
+	rswap_log_invalidate(remote_page_offset);
+	rswap_replica_invalidate(remote_page_offset);
+	rswap_tier_invalidate(remote_page_offset);
 }
 
 static void rswap_invalidate_area(unsigned type)
 {
-	return;
+	rswap_replica_invalidate_all();
+	rswap_tier_invalidate_all();
 }
 
 static void rswap_frontswap_init(unsigned type)
@@ -473,6 +753,30 @@ int rswap_replace_frontswap(void)
 	return 0;
 }
 
+void *rswap_client_park(void)
+{
+	// the log's map, the other servers of the erasure coding, the
+	// migrated chunks and the pages of the far server are not kept
+	if (!rswap_warm_reload || rswap_log_on() || rswap_ec_on() || rswap_migrate_on() || rswap_tier_on())
+		return NULL;
+	// the pages lost on the last reload are not kept track of
+	if (rdma_session_global.lost_chunks)
+		return NULL;
+	return rswap_save_warm_state(&rdma_session_global);
+}
+
+int rswap_unpark_frontswap(void)
+{
+	void *warm = frontswap_parked_state();
+
+	// the kernel drops the state before it is freed
+	frontswap_unpark_ops(&rswap_frontswap_ops);
+	kfree(warm);
+	pr_info("frontswap unparked, %u remote chunks reattached\n",
+		rdma_session_global.remote_mem_pool.chunk_num);
+	return 0;
+}
+
 int rswap_client_init(char *_server_ip, int _server_port, int _mem_size)
 {
 	int ret = 0;
@@ -483,11 +787,11 @@ int rswap_client_init(char *_server_ip, int _server_port, int _mem_size)
 	server_ip = _server_ip;
 	server_port = _server_port;
 	rdma_session_global.remote_mem_pool.remote_mem_size = _mem_size;
-	rdma_session_global.remote_mem_pool.chunk_num = _mem_size / REGION_SIZE_GB;
+	rdma_session_global.remote_mem_pool.chunk_num = DIV_ROUND_UP(_mem_size, REGION_SIZE_GB);
 
 	pr_info("%s, num_queues : %d (Can't exceed the slots on Memory server) \n", __func__, num_queues);
 
-	ret = init_rdma_sessions(&rdma_session_global);
+	ret = init_rdma_sessions(&rdma_session_global, server_ip, server_port);
 
 	ret = rdma_session_connect(&rdma_session_global);
 	if (unlikely(ret)) {
@@ -495,6 +799,15 @@ int rswap_client_init(char *_server_ip, int _server_port, int _mem_size)
 		goto out;
 	}
 
+	// the transfers map their pages without it
+	if (rswap_dma_persist &&
+	    rswap_dma_map_init(&rdma_session_global.dma_map, rdma_session_global.rdma_dev->dev->dma_device))
+		pr_warn("%s, persistent dma mapping disabled.\n", __func__);
+
+	// swap works without it
+	if (rswap_replica_init())
+		pr_warn("%s, replica disabled.\n", __func__);
+
 #ifdef ENABLE_VQUEUE
 	ret = rswap_scheduler_init();
 	if (ret) {
@@ -509,6 +822,8 @@ out:
 void rswap_client_exit(void)
 {
 	int ret;
+	rswap_replica_exit();
+	rswap_dma_map_exit(&rdma_session_global.dma_map);
 	ret = rswap_disconnect_and_collect_resource(&rdma_session_global);
 	if (unlikely(ret)) {
 		pr_err("%s,  failed.\n", __func__);
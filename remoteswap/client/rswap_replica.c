@@ -0,0 +1,425 @@
+#include <linux/hrtimer.h>
+#include <linux/xarray.h>
+
+#include "rswap_rdma.h"
+
+/*
+ * Hedged reads of hot pages from a replica memory server. A swapped out
+ * page that was on the active list before (PageWorkingset) is also written
+ * to a slot of the rrsize GB on the replica server, as long as there are
+ * free slots. A demand read of such a page goes to the primary server, and
+ * again to the replica if it is not done within the hedge_pct percentile of
+ * the recent primary latencies. The first one to complete fills the page.
+ *
+ * A read that loses may still land after the page is unlocked, so both go
+ * to bounce pages, copied by the winner. Both use the async load queues,
+ * completed in softirq, and the faulting thread spins until the page is
+ * unlocked as for any demand read. The hedge is posted by a softirq timer.
+ */
+
+struct rdma_session_context rdma_session_replica;
+
+static char replica_ip[INET_ADDRSTRLEN];
+static int replica_port;
+static int replica_size;
+static int hedge_pct = 95;
+static int hedge_min_us = 10;
+
+MODULE_PARM_DESC(rsip, "Replica memory server ip address, none by default");
+MODULE_PARM_DESC(rsport, "Replica memory server port");
+MODULE_PARM_DESC(rrsize, "Remote memory on the replica server in GB, for the hot pages");
+MODULE_PARM_DESC(hedge_pct,
+		 "Demand reads slower than this percentile of the primary server are also sent to the replica");
+MODULE_PARM_DESC(hedge_min_us, "Never hedge a demand read before that many us");
+module_param_string(rsip, replica_ip, INET_ADDRSTRLEN, 0444);
+module_param_named(rsport, replica_port, int, 0444);
+module_param_named(rrsize, replica_size, int, 0444);
+module_param_named(hedge_pct, hedge_pct, int, 0644);
+module_param_named(hedge_min_us, hedge_min_us, int, 0644);
+
+#define RSWAP_HEDGE_BUCKETS 256 // of 1us, the last one takes the rest
+#define RSWAP_HEDGE_WINDOW 4096 // samples per threshold update
+
+enum { HEDGE_PRIMARY, HEDGE_REPLICA, HEDGE_NR };
+
+struct rswap_hedge_req;
+
+struct rswap_hedge_read {
+	struct ib_cqe cqe;
+	struct ib_rdma_wr wr;
+	struct ib_sge sge;
+	struct page *bounce;
+	u64 dma_addr;
+	struct rswap_rdma_queue *rdma_queue;
+	struct rswap_hedge_req *req;
+};
+
+struct rswap_hedge_req {
+	struct page *page; // locked until the first read is done
+	pgoff_t offset; // on the primary server
+	unsigned long slot; // on the replica
+	u64 start; // ns
+	atomic_t done;
+	atomic_t refs; // the reads in flight and the timer
+	struct hrtimer timer;
+	struct rswap_hedge_read reads[HEDGE_NR];
+};
+
+static struct {
+	bool on;
+	struct xarray map; // primary page offset -> replica slot
+	unsigned long *slots; // in use
+	unsigned long nr_slots;
+	unsigned long hint;
+	spinlock_t lock; // slots
+	atomic_t inflight; // hedge requests
+
+	atomic_t hist[RSWAP_HEDGE_BUCKETS];
+	atomic_t nr_samples;
+	u64 threshold_ns;
+
+	atomic64_t replicated, hedged, replica_wins;
+} rswap_replica;
+
+static unsigned long rswap_replica_alloc_slot(void)
+{
+	unsigned long slot;
+
+	spin_lock(&rswap_replica.lock);
+	slot = find_next_zero_bit(rswap_replica.slots, rswap_replica.nr_slots,
+				  rswap_replica.hint);
+	if (slot >= rswap_replica.nr_slots)
+		slot = find_first_zero_bit(rswap_replica.slots,
+					   rswap_replica.nr_slots);
+	if (slot < rswap_replica.nr_slots) {
+		__set_bit(slot, rswap_replica.slots);
+		rswap_replica.hint = slot + 1;
+	}
+	spin_unlock(&rswap_replica.lock);
+	return slot;
+}
+
+static void rswap_replica_free_slot(unsigned long slot)
+{
+	spin_lock(&rswap_replica.lock);
+	__clear_bit(slot, rswap_replica.slots);
+	spin_unlock(&rswap_replica.lock);
+}
+
+void rswap_replica_invalidate(pgoff_t offset)
+{
+	void *entry;
+
+	if (!rswap_replica.on)
+		return;
+	entry = xa_erase(&rswap_replica.map, offset);
+	if (entry)
+		rswap_replica_free_slot(xa_to_value(entry));
+}
+
+// swapoff, rare enough to drop all the copies
+void rswap_replica_invalidate_all(void)
+{
+	unsigned long offset;
+	void *entry;
+
+	if (!rswap_replica.on)
+		return;
+	xa_for_each (&rswap_replica.map, offset, entry)
+		rswap_replica_invalidate(offset);
+}
+
+/*
+ * Called after the page is written to the primary server. No load of the
+ * same offset runs meanwhile.
+ */
+void rswap_replica_store(pgoff_t offset, struct page *page)
+{
+	unsigned long slot;
+	void *entry;
+
+	if (!rswap_replica.on)
+		return;
+	entry = xa_load(&rswap_replica.map, offset);
+	if (!PageWorkingset(page)) {
+		// an older copy of the offset is stale now
+		if (entry)
+			rswap_replica_invalidate(offset);
+		return;
+	}
+
+	slot = entry ? xa_to_value(entry) : rswap_replica_alloc_slot();
+	if (slot >= rswap_replica.nr_slots)
+		return; // full
+	if (rswap_rdma_rw_sync(&rdma_session_replica, slot << PAGE_SHIFT, page,
+			       QP_STORE)) {
+		if (entry)
+			rswap_replica_invalidate(offset);
+		else
+			rswap_replica_free_slot(slot);
+		return;
+	}
+	if (!entry && xa_err(xa_store(&rswap_replica.map, offset,
+				      xa_mk_value(slot), GFP_NOWAIT))) {
+		rswap_replica_free_slot(slot);
+		return;
+	}
+	atomic64_inc(&rswap_replica.replicated);
+}
+
+// Latency of the primary server, for the hedge threshold.
+static void rswap_hedge_sample(u64 ns)
+{
+	u64 us = min_t(u64, ns / NSEC_PER_USEC, RSWAP_HEDGE_BUCKETS - 1);
+	int target, sum = 0, i;
+
+	atomic_inc(&rswap_replica.hist[us]);
+	if (atomic_inc_return(&rswap_replica.nr_samples) != RSWAP_HEDGE_WINDOW)
+		return;
+
+	target = RSWAP_HEDGE_WINDOW * clamp(hedge_pct, 1, 100) / 100;
+	for (i = 0; i < RSWAP_HEDGE_BUCKETS - 1; i++) {
+		sum += atomic_read(&rswap_replica.hist[i]);
+		if (sum >= target)
+			break;
+	}
+	WRITE_ONCE(rswap_replica.threshold_ns,
+		   max(i + 1, hedge_min_us) * NSEC_PER_USEC);
+	for (i = 0; i < RSWAP_HEDGE_BUCKETS; i++)
+		atomic_set(&rswap_replica.hist[i], 0);
+	atomic_set(&rswap_replica.nr_samples, 0);
+}
+
+static void rswap_hedge_put(struct rswap_hedge_req *req)
+{
+	if (!atomic_dec_and_test(&req->refs))
+		return;
+	if (!atomic_read(&req->done)) {
+		// both failed, the fault gets a SIGBUS
+		pr_err("%s, read of page offset 0x%lx failed on both servers\n",
+		       __func__, req->offset);
+		unlock_page(req->page);
+	}
+	kfree(req);
+	atomic_dec(&rswap_replica.inflight);
+}
+
+static int rswap_hedge_post(struct rswap_hedge_req *req, int idx);
+
+static void rswap_hedge_read_done(struct ib_cq *cq, struct ib_wc *wc)
+{
+	struct rswap_hedge_read *read =
+		container_of(wc->wr_cqe, struct rswap_hedge_read, cqe);
+	struct rswap_hedge_req *req = read->req;
+	struct ib_device *ibdev = read->rdma_queue->rdma_session->rdma_dev->dev;
+	bool primary = read == &req->reads[HEDGE_PRIMARY];
+
+	ib_dma_unmap_page(ibdev, read->dma_addr, PAGE_SIZE, DMA_FROM_DEVICE);
+	atomic_dec(&read->rdma_queue->rdma_post_counter);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		pr_err("%s, %s read failed, %s\n", __func__,
+		       primary ? "primary" : "replica",
+		       rdma_wc_status_name(wc->status));
+		// hedge at once, the timer's reference goes to the read
+		if (primary && hrtimer_try_to_cancel(&req->timer) == 1 &&
+		    rswap_hedge_post(req, HEDGE_REPLICA))
+			rswap_hedge_put(req);
+	} else {
+		if (primary)
+			rswap_hedge_sample(ktime_get_ns() - req->start);
+		if (!atomic_xchg(&req->done, 1)) {
+			copy_highpage(req->page, read->bounce);
+			SetPageUptodate(req->page);
+			unlock_page(req->page);
+			if (!primary)
+				atomic64_inc(&rswap_replica.replica_wins);
+			if (hrtimer_try_to_cancel(&req->timer) == 1)
+				rswap_hedge_put(req);
+		}
+	}
+	__free_page(read->bounce);
+	rswap_hedge_put(req);
+}
+
+static int rswap_hedge_post(struct rswap_hedge_req *req, int idx)
+{
+	struct rswap_hedge_read *read = &req->reads[idx];
+	struct rdma_session_context *rdma_session =
+		idx == HEDGE_PRIMARY ? &rdma_session_global :
+				       &rdma_session_replica;
+	size_t addr = idx == HEDGE_PRIMARY ? pgoff2addr(req->offset) :
+					     pgoff2addr(req->slot);
+	struct remote_chunk *chunk =
+		&rdma_session->remote_mem_pool.chunks[addr >> CHUNK_SHIFT];
+	struct ib_device *dev = rdma_session->rdma_dev->dev;
+	const struct ib_send_wr *bad_wr;
+	int ret = -ENOMEM;
+
+	read->req = req;
+	read->bounce = alloc_page(GFP_ATOMIC);
+	if (!read->bounce)
+		return ret;
+	read->dma_addr =
+		ib_dma_map_page(dev, read->bounce, 0, PAGE_SIZE, DMA_FROM_DEVICE);
+	if (unlikely(ib_dma_mapping_error(dev, read->dma_addr)))
+		goto err_free;
+
+	// preemptible from the load path, any cpu's queue will do
+	read->rdma_queue = get_rdma_queue(rdma_session, raw_smp_processor_id(),
+					  QP_LOAD_ASYNC);
+	ret = -EBUSY;
+	if (atomic_inc_return(&read->rdma_queue->rdma_post_counter) >=
+	    RDMA_SEND_QUEUE_DEPTH - 16)
+		goto err_unmap;
+
+	read->cqe.done = rswap_hedge_read_done;
+	read->sge.addr = read->dma_addr;
+	read->sge.length = PAGE_SIZE;
+	read->sge.lkey = rdma_session->rdma_dev->pd->local_dma_lkey;
+	read->wr.wr.next = NULL;
+	read->wr.wr.wr_cqe = &read->cqe;
+	read->wr.wr.sg_list = &read->sge;
+	read->wr.wr.num_sge = 1;
+	read->wr.wr.opcode = IB_WR_RDMA_READ;
+	read->wr.wr.send_flags = IB_SEND_SIGNALED;
+	read->wr.remote_addr = chunk->remote_addr + (addr & CHUNK_MASK);
+	read->wr.rkey = chunk->remote_rkey;
+	ret = ib_post_send(read->rdma_queue->qp, &read->wr.wr, &bad_wr);
+	if (unlikely(ret)) {
+		pr_err("%s, post rdma read failed, %d\n", __func__, ret);
+		goto err_unmap;
+	}
+	return 0;
+
+err_unmap:
+	atomic_dec(&read->rdma_queue->rdma_post_counter);
+	ib_dma_unmap_page(dev, read->dma_addr, PAGE_SIZE, DMA_FROM_DEVICE);
+err_free:
+	__free_page(read->bounce);
+	return ret;
+}
+
+static enum hrtimer_restart rswap_hedge_fire(struct hrtimer *timer)
+{
+	struct rswap_hedge_req *req =
+		container_of(timer, struct rswap_hedge_req, timer);
+
+	// the timer's reference goes to the read
+	if (!atomic_read(&req->done) && !rswap_hedge_post(req, HEDGE_REPLICA))
+		atomic64_inc(&rswap_replica.hedged);
+	else
+		rswap_hedge_put(req);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Demand read of a page with a copy on the replica. Returns 0 once the page
+ * is unlocked, up to date unless both reads failed, or an error if the page
+ * has no copy or the read could not be posted, the caller reads it then.
+ */
+int rswap_replica_load(pgoff_t offset, struct page *page)
+{
+	struct rswap_hedge_req *req;
+	void *entry;
+	int ret;
+
+	if (!rswap_replica.on)
+		return -ENOENT;
+	entry = xa_load(&rswap_replica.map, offset);
+	if (!entry)
+		return -ENOENT;
+
+	req = kmalloc(sizeof(*req), GFP_ATOMIC);
+	if (!req)
+		return -ENOMEM;
+	req->page = page;
+	req->offset = offset;
+	req->slot = xa_to_value(entry);
+	req->start = ktime_get_ns();
+	atomic_set(&req->done, 0);
+	atomic_set(&req->refs, 2);
+	hrtimer_init(&req->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	req->timer.function = rswap_hedge_fire;
+
+	atomic_inc(&rswap_replica.inflight);
+	ret = rswap_hedge_post(req, HEDGE_PRIMARY);
+	if (ret) {
+		kfree(req);
+		atomic_dec(&rswap_replica.inflight);
+		return ret;
+	}
+	hrtimer_start(&req->timer,
+		      ns_to_ktime(READ_ONCE(rswap_replica.threshold_ns)),
+		      HRTIMER_MODE_REL_SOFT);
+
+	// the reads complete in softirq, as for any demand read the page is
+	// needed before we return
+	while (PageLocked(page))
+		cpu_relax();
+	return 0;
+}
+
+int rswap_replica_init(void)
+{
+	int ret;
+
+	if (!replica_ip[0])
+		return 0;
+	if (replica_size < REGION_SIZE_GB) {
+		pr_err("%s, rrsize %dGB, at least %dGB for a replica\n",
+		       __func__, replica_size, REGION_SIZE_GB);
+		return -EINVAL;
+	}
+
+	rdma_session_replica.replica = true;
+	rdma_session_replica.secondary = true;
+	rdma_session_replica.remote_mem_pool.remote_mem_size = replica_size;
+	rdma_session_replica.remote_mem_pool.chunk_num =
+		replica_size / REGION_SIZE_GB;
+	ret = init_rdma_sessions(&rdma_session_replica, replica_ip,
+				 replica_port);
+	if (ret != 1)
+		return -EINVAL;
+	ret = rdma_session_connect(&rdma_session_replica);
+	if (ret) {
+		pr_err("%s, connect to replica %s:%d failed\n", __func__,
+		       replica_ip, replica_port);
+		return ret;
+	}
+
+	rswap_replica.nr_slots = (unsigned long)rdma_session_replica
+					 .remote_mem_pool.chunk_num
+				 << (CHUNK_SHIFT - PAGE_SHIFT);
+	rswap_replica.slots = vzalloc(BITS_TO_LONGS(rswap_replica.nr_slots) *
+				      sizeof(unsigned long));
+	if (!rswap_replica.slots) {
+		rswap_disconnect_and_collect_resource(&rdma_session_replica);
+		return -ENOMEM;
+	}
+	xa_init(&rswap_replica.map);
+	spin_lock_init(&rswap_replica.lock);
+	rswap_replica.threshold_ns = (u64)hedge_min_us * NSEC_PER_USEC;
+	rswap_replica.on = true;
+	pr_info("%s, hot pages replicated on %s:%d, %lu pages\n", __func__,
+		replica_ip, replica_port, rswap_replica.nr_slots);
+	return 0;
+}
+
+void rswap_replica_exit(void)
+{
+	if (!rswap_replica.on)
+		return;
+	// the swap devices are gone or parked, only hedged reads may be left
+	rswap_replica.on = false;
+	while (atomic_read(&rswap_replica.inflight))
+		msleep(1);
+
+	pr_info("%s, %lld pages replicated, %lld reads hedged, %lld won by the replica\n",
+		__func__, atomic64_read(&rswap_replica.replicated),
+		atomic64_read(&rswap_replica.hedged),
+		atomic64_read(&rswap_replica.replica_wins));
+	xa_destroy(&rswap_replica.map);
+	vfree(rswap_replica.slots);
+	rswap_disconnect_and_collect_resource(&rdma_session_replica);
+}
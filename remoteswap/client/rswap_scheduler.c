@@ -48,109 +48,6 @@ inline bool is_bw_control_enabled(void)
 	return _bw_control_enabled;
 }
 
-int rswap_vqueue_init(struct rswap_vqueue *vqueue)
-{
-	if (!vqueue) {
-		return -EINVAL;
-	}
-
-	atomic_set(&vqueue->cnt, 0);
-	atomic_set(&vqueue->send_direct, 1);
-
-	vqueue->max_cnt = RSWAP_VQUEUE_MAX_SIZE;
-	vqueue->head = 0;
-	vqueue->tail = 0;
-
-	vqueue->reqs = (struct rswap_request *)vmalloc(sizeof(struct rswap_request) * vqueue->max_cnt);
-
-	spin_lock_init(&vqueue->lock);
-
-	return 0;
-}
-EXPORT_SYMBOL(rswap_vqueue_init);
-
-int rswap_vqueue_destroy(struct rswap_vqueue *vqueue)
-{
-	if (!vqueue) {
-		return -EINVAL;
-	}
-	vfree(vqueue->reqs);
-	memset(vqueue, 0, sizeof(struct rswap_vqueue));
-	return 0;
-}
-
-inline void rswap_vqueue_enlarge(struct rswap_vqueue *vqueue)
-{
-	unsigned long flags;
-	unsigned head_len;
-	unsigned tail_len;
-	struct rswap_request *old_buf;
-	spin_lock_irqsave(&vqueue->lock, flags);
-	if (vqueue->head < vqueue->tail) {
-		head_len = vqueue->tail - vqueue->head;
-		old_buf = vqueue->reqs;
-		vqueue->reqs = (struct rswap_request *)vmalloc(sizeof(struct rswap_request) * vqueue->max_cnt * 2);
-		memcpy(vqueue->reqs, old_buf + vqueue->head, sizeof(struct rswap_request) * head_len);
-	} else {
-		head_len = vqueue->max_cnt - vqueue->head;
-		tail_len = vqueue->head;
-		old_buf = vqueue->reqs;
-		vqueue->reqs = (struct rswap_request *)vmalloc(sizeof(struct rswap_request) * vqueue->max_cnt * 2);
-		memcpy(vqueue->reqs, old_buf + vqueue->head, sizeof(struct rswap_request) * head_len);
-		memcpy(vqueue->reqs + head_len, old_buf, sizeof(struct rswap_request) * tail_len);
-	}
-	vqueue->head = 0;
-	vqueue->tail = vqueue->max_cnt;
-	vqueue->max_cnt *= 2;
-	vfree(old_buf);
-	spin_unlock_irqrestore(&vqueue->lock, flags);
-	pr_info("Enlarge vqueue to %u\n", vqueue->max_cnt);
-}
-
-int rswap_vqueue_enqueue(struct rswap_vqueue *vqueue, struct rswap_request *request)
-{
-	int cnt;
-	if (!vqueue || !request) {
-		return -EINVAL;
-	}
-
-	cnt = atomic_read(&vqueue->cnt);
-	if (cnt == vqueue->max_cnt) {
-		rswap_vqueue_enlarge(vqueue);
-	}
-
-	rswap_request_copy(&vqueue->reqs[vqueue->tail], request);
-	vqueue->tail = (vqueue->tail + 1) % vqueue->max_cnt;
-	atomic_inc(&vqueue->cnt);
-
-	return 0;
-}
-EXPORT_SYMBOL(rswap_vqueue_enqueue);
-
-int rswap_vqueue_dequeue(struct rswap_vqueue *vqueue, struct rswap_request **request)
-{
-	int cnt;
-
-	cnt = atomic_read(&vqueue->cnt);
-	if (cnt == 0) {
-		return -1;
-	} else if (cnt < vqueue->max_cnt) {
-		*request = &vqueue->reqs[vqueue->head];
-		vqueue->head = (vqueue->head + 1) % vqueue->max_cnt;
-		return 0;
-	} else {
-		unsigned long flags;
-		spin_lock_irqsave(&vqueue->lock, flags);
-		*request = &vqueue->reqs[vqueue->head];
-		vqueue->head = (vqueue->head + 1) % vqueue->max_cnt;
-		spin_unlock_irqrestore(&vqueue->lock, flags);
-		return 0;
-	}
-
-	return -1;
-}
-EXPORT_SYMBOL(rswap_vqueue_dequeue);
-
 int rswap_vqueue_drain(int cpu, enum rdma_queue_type type)
 {
 	unsigned long flags;
@@ -632,7 +529,7 @@ static inline bool poll_all_vqueues(enum rdma_queue_type type, int i, int n)
 	struct rswap_vqtriple *vqtri;
 	struct rswap_proc *proc, *tmp;
 	struct rswap_vqueue *vqueue;
-	struct rswap_request *vrequest;
+	struct rswap_request vrequest;
 
 	int min_active_pkts = 1 << 30;
 	int min_weight = 1 << 30;
@@ -681,7 +578,7 @@ static inline bool poll_all_vqueues(enum rdma_queue_type type, int i, int n)
 			ret = rswap_vqueue_dequeue(vqueue, &vrequest);
 			if (ret == 0) {
 				rswap_proc_send_pkts_inc(baseline_proc, type);
-				rswap_rdma_send_note(cpu, vrequest->offset, vrequest->page, type, 0);
+				rswap_rdma_send_note(cpu, vrequest.offset, vrequest.page, type, 0);
 				atomic_dec(&vqueue->cnt);
 				find = true;
 			} else if (ret != -1) {
@@ -715,7 +612,7 @@ static inline bool poll_all_vqueues(enum rdma_queue_type type, int i, int n)
 				ret = rswap_vqueue_dequeue(vqueue, &vrequest);
 				if (ret == 0) {
 					rswap_proc_send_pkts_inc(proc, type);
-					rswap_rdma_send_note(cpu, vrequest->offset, vrequest->page, type, 0);
+					rswap_rdma_send_note(cpu, vrequest.offset, vrequest.page, type, 0);
 					atomic_dec(&vqueue->cnt);
 					budget--;
 					find = true;
@@ -746,7 +643,7 @@ static inline void poll_idle_cores(int i, int n)
 		int j;
 		struct rswap_vqtriple *vqtri;
 		struct rswap_vqueue *vqueue;
-		struct rswap_request *vrequest;
+		struct rswap_request vrequest;
 
 		vqtri = rswap_vqlist_get_triple(cpu);
 		for (j = 0; j < n; j++) {
@@ -760,7 +657,7 @@ static inline void poll_idle_cores(int i, int n)
 			vqueue = rswap_vqlist_get(cpu, type);
 			ret = rswap_vqueue_dequeue(vqueue, &vrequest);
 			if (ret == 0) {
-				rswap_rdma_send_note(cpu, vrequest->offset, vrequest->page, type, 0);
+				rswap_rdma_send_note(cpu, vrequest.offset, vrequest.page, type, 0);
 				atomic_dec(&vqueue->cnt);
 			} else if (ret != -1) {
 				print_err(ret);
@@ -839,7 +736,7 @@ static inline void wait_vqueue_clear(void)
 		int ret;
 		int type;
 		struct rswap_vqueue *vqueue;
-		struct rswap_request *vrequest;
+		struct rswap_request vrequest;
 
 		if (cpu == global_rswap_scheduler_cores[0])
 			continue;
@@ -849,7 +746,7 @@ static inline void wait_vqueue_clear(void)
 			ret = rswap_vqueue_dequeue(vqueue, &vrequest);
 			if (ret == 0) {
 				rswap_proc_send_pkts_inc(rswap_vqlist_get_triple(cpu)->proc, type);
-				rswap_rdma_send_note(cpu, vrequest->offset, vrequest->page, type, 0);
+				rswap_rdma_send_note(cpu, vrequest.offset, vrequest.page, type, 0);
 				atomic_dec(&vqueue->cnt);
 				cond_resched();
 				goto again;
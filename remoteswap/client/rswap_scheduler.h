@@ -37,8 +37,8 @@ static inline int rswap_request_copy(struct rswap_request *dst,
 struct rswap_vqueue {
 	atomic_t cnt;
 	atomic_t send_direct;
-	int max_cnt;
-	unsigned head;
+	int max_cnt; // a power of 2
+	unsigned head; // free running, see rswap_vqueue_enqueue()
 	unsigned tail;
 	struct rswap_request *reqs;
 	spinlock_t lock;
@@ -49,7 +49,7 @@ int rswap_vqueue_destroy(struct rswap_vqueue *queue);
 int rswap_vqueue_enqueue(struct rswap_vqueue *queue,
 			 struct rswap_request *request);
 int rswap_vqueue_dequeue(struct rswap_vqueue *queue,
-			 struct rswap_request **request);
+			 struct rswap_request *request);
 int rswap_vqueue_drain(int cpu, enum rdma_queue_type type);
 
 #define RSWAP_PROC_NAME_LEN 32
@@ -0,0 +1,431 @@
+#include "rswap_tcp.h"
+#include "rswap_heat.h"
+
+/*
+ * TCP transport to the memory server, for CPU servers without RNIC, see the
+ * TCP transport in constants.h. The cores are split into groups, and every
+ * group has its own connections: the stores of a group go to its first
+ * connection, its loads are spread over the others. Requests are pipelined,
+ * a tx thread per connection sends them in order, and its rx thread takes
+ * the answers in the same order. Stores go out with sendpage, without copy.
+ */
+
+static struct rswap_tcp_session tcp_session;
+
+static int conns_per_group = 2;
+static int cores_per_group = 4;
+MODULE_PARM_DESC(conns_per_group,
+		 "TCP connections of a group of cores, the first one for stores");
+MODULE_PARM_DESC(cores_per_group, "Cores sharing TCP connections");
+module_param(conns_per_group, int, 0444);
+module_param(cores_per_group, int, 0444);
+
+static struct rswap_tcp_conn *rswap_tcp_get_conn(int cpu, bool store)
+{
+	int base = cpu / cores_per_group * conns_per_group;
+
+	if (store || conns_per_group == 1)
+		return &tcp_session.conns[base];
+	return &tcp_session.conns[base + 1 + cpu % (conns_per_group - 1)];
+}
+
+static int rswap_tcp_send_buf(struct socket *sock, void *buf, size_t len,
+			      int flags)
+{
+	struct kvec vec;
+	struct msghdr msg = { .msg_flags = flags | MSG_NOSIGNAL };
+	int ret;
+
+	while (len) {
+		vec.iov_base = buf;
+		vec.iov_len = len;
+		ret = kernel_sendmsg(sock, &msg, &vec, 1, len);
+		if (ret <= 0)
+			return ret ? ret : -ECONNRESET;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int rswap_tcp_send_page(struct socket *sock, struct page *page)
+{
+	size_t off = 0;
+	int ret;
+
+	while (off < PAGE_SIZE) {
+		ret = kernel_sendpage(sock, page, off, PAGE_SIZE - off, 0);
+		if (ret <= 0)
+			return ret ? ret : -ECONNRESET;
+		off += ret;
+	}
+	return 0;
+}
+
+static int rswap_tcp_recv_buf(struct socket *sock, void *buf, size_t len)
+{
+	struct kvec vec;
+	struct msghdr msg = { .msg_flags = MSG_NOSIGNAL };
+	int ret;
+
+	while (len) {
+		vec.iov_base = buf;
+		vec.iov_len = len;
+		ret = kernel_recvmsg(sock, &msg, &vec, 1, len, MSG_WAITALL);
+		if (ret <= 0)
+			return ret ? ret : -ECONNRESET;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void rswap_tcp_end_req(struct rswap_tcp_req *req, int status)
+{
+	if (req->hdr.op == RSWAP_TCP_STORE) {
+		req->status = status;
+		complete(&req->done);
+		return;
+	}
+
+	if (likely(!status))
+		SetPageUptodate(req->page);
+	else
+		SetPageError(req->page);
+	unlock_page(req->page);
+	mempool_free(req, tcp_session.req_pool);
+}
+
+// Fail all the requests of a broken connection, and the later ones.
+static void rswap_tcp_fail_conn(struct rswap_tcp_conn *conn, int err)
+{
+	struct rswap_tcp_req *req, *tmp;
+	unsigned long flags;
+	LIST_HEAD(failed);
+
+	spin_lock_irqsave(&conn->lock, flags);
+	if (!conn->broken)
+		pr_err("%s, connection %d broken, %d\n", __func__, conn->idx,
+		       err);
+	conn->broken = true;
+	list_splice_tail_init(&conn->inflight, &failed);
+	list_splice_tail_init(&conn->tx_list, &failed);
+	spin_unlock_irqrestore(&conn->lock, flags);
+
+	list_for_each_entry_safe (req, tmp, &failed, list) {
+		list_del(&req->list);
+		rswap_tcp_end_req(req, -EIO);
+	}
+}
+
+static int rswap_tcp_tx(void *arg)
+{
+	struct rswap_tcp_conn *conn = arg;
+	struct rswap_tcp_req *req;
+	unsigned long flags;
+	bool store;
+	int ret;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(conn->tx_wait,
+					 !list_empty(&conn->tx_list) ||
+						 kthread_should_stop());
+
+		spin_lock_irqsave(&conn->lock, flags);
+		req = list_first_entry_or_null(&conn->tx_list,
+					       struct rswap_tcp_req, list);
+		// on the inflight list before the answer can come
+		if (req)
+			list_move_tail(&req->list, &conn->inflight);
+		spin_unlock_irqrestore(&conn->lock, flags);
+		if (!req)
+			continue;
+
+		store = req->hdr.op == RSWAP_TCP_STORE;
+		ret = rswap_tcp_send_buf(conn->sock, &req->hdr, sizeof(req->hdr),
+					 store ? MSG_MORE : 0);
+		if (!ret && store)
+			ret = rswap_tcp_send_page(conn->sock, req->page);
+		if (unlikely(ret))
+			rswap_tcp_fail_conn(conn, ret);
+	}
+	return 0;
+}
+
+static int rswap_tcp_rx(void *arg)
+{
+	struct rswap_tcp_conn *conn = arg;
+	struct rswap_tcp_hdr hdr;
+	struct rswap_tcp_req *req;
+	unsigned long flags;
+	void *vaddr;
+	int ret;
+
+	while (!kthread_should_stop()) {
+		ret = rswap_tcp_recv_buf(conn->sock, &hdr, sizeof(hdr));
+		if (ret)
+			break;
+
+		spin_lock_irqsave(&conn->lock, flags);
+		req = list_first_entry_or_null(&conn->inflight,
+					       struct rswap_tcp_req, list);
+		if (req)
+			list_del(&req->list);
+		spin_unlock_irqrestore(&conn->lock, flags);
+
+		if (unlikely(!req || hdr.magic != RSWAP_TCP_MAGIC ||
+			     hdr.id != req->hdr.id)) {
+			pr_err("%s, connection %d: unexpected answer %llu\n",
+			       __func__, conn->idx, hdr.id);
+			if (req)
+				rswap_tcp_end_req(req, -EIO);
+			ret = -EPROTO;
+			break;
+		}
+
+		if (req->hdr.op == RSWAP_TCP_LOAD) {
+			vaddr = kmap(req->page);
+			ret = rswap_tcp_recv_buf(conn->sock, vaddr, PAGE_SIZE);
+			kunmap(req->page);
+			if (ret) {
+				rswap_tcp_end_req(req, ret);
+				break;
+			}
+		}
+		if (unlikely(hdr.status))
+			pr_err("%s, memory server failed on 0x%llx, %d\n",
+			       __func__, hdr.addr, hdr.status);
+		rswap_tcp_end_req(req, -hdr.status);
+	}
+
+	rswap_tcp_fail_conn(conn, ret);
+	// wait for rswap_tcp_exit()
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ);
+	return 0;
+}
+
+static int rswap_tcp_submit(struct rswap_tcp_conn *conn,
+			    struct rswap_tcp_req *req)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&conn->lock, flags);
+	if (unlikely(conn->broken)) {
+		spin_unlock_irqrestore(&conn->lock, flags);
+		return -EIO;
+	}
+	req->hdr.id = conn->next_id++;
+	list_add_tail(&req->list, &conn->tx_list);
+	spin_unlock_irqrestore(&conn->lock, flags);
+
+	wake_up(&conn->tx_wait);
+	return 0;
+}
+
+static struct rswap_tcp_req *rswap_tcp_alloc_req(enum rswap_tcp_op op,
+						 pgoff_t offset,
+						 struct page *page)
+{
+	struct rswap_tcp_req *req;
+
+	req = mempool_alloc(tcp_session.req_pool, GFP_ATOMIC);
+	if (unlikely(!req))
+		return NULL;
+	req->hdr.magic = RSWAP_TCP_MAGIC;
+	req->hdr.op = op;
+	req->hdr.status = 0;
+	req->hdr.addr = (u64)offset << PAGE_SHIFT;
+	req->page = page;
+	return req;
+}
+
+int rswap_tcp_store(int cpu, pgoff_t offset, struct page *page)
+{
+	struct rswap_tcp_req *req;
+	int ret;
+
+	rswap_heat_add(offset << PAGE_SHIFT, true);
+	req = rswap_tcp_alloc_req(RSWAP_TCP_STORE, offset, page);
+	if (unlikely(!req))
+		return -ENOMEM;
+	init_completion(&req->done);
+
+	ret = rswap_tcp_submit(rswap_tcp_get_conn(cpu, true), req);
+	if (likely(!ret)) {
+		wait_for_completion(&req->done);
+		ret = req->status;
+	}
+	mempool_free(req, tcp_session.req_pool);
+	return ret;
+}
+
+// The page is unlocked once it is read, as the RDMA transport does.
+int rswap_tcp_load(int cpu, pgoff_t offset, struct page *page)
+{
+	struct rswap_tcp_req *req;
+	int ret;
+
+	rswap_heat_add(offset << PAGE_SHIFT, false);
+	req = rswap_tcp_alloc_req(RSWAP_TCP_LOAD, offset, page);
+	if (unlikely(!req)) {
+		pr_err("%s, out of requests.\n", __func__);
+		return -ENOMEM;
+	}
+
+	ret = rswap_tcp_submit(rswap_tcp_get_conn(cpu, false), req);
+	if (unlikely(ret))
+		mempool_free(req, tcp_session.req_pool);
+	return ret;
+}
+
+// Connect and ask for @wanted chunks, returns the chunks we hold.
+static int rswap_tcp_connect(struct rswap_tcp_conn *conn, uint32_t wanted)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = tcp_session.addr,
+		.sin_port = tcp_session.port,
+	};
+	struct rswap_tcp_hdr hdr = {
+		.magic = RSWAP_TCP_MAGIC,
+		.op = RSWAP_TCP_HELLO,
+		.id = RSWAP_TCP_CHUNK_SHIFT,
+		.addr = wanted,
+	};
+	int one = 1;
+	int ret;
+
+	ret = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP,
+			       &conn->sock);
+	if (ret)
+		return ret;
+	// the sockets work for the reclaim, as nbd does
+	sk_set_memalloc(conn->sock->sk);
+	conn->sock->sk->sk_allocation = GFP_NOIO;
+	kernel_setsockopt(conn->sock, SOL_TCP, TCP_NODELAY, (char *)&one,
+			  sizeof(one));
+
+	ret = kernel_connect(conn->sock, (struct sockaddr *)&sin, sizeof(sin),
+			     0);
+	if (ret) {
+		pr_err("%s, connect to %pI4:%u failed, %d\n", __func__,
+		       &tcp_session.addr, ntohs(tcp_session.port), ret);
+		return ret;
+	}
+
+	ret = rswap_tcp_send_buf(conn->sock, &hdr, sizeof(hdr), 0);
+	if (!ret)
+		ret = rswap_tcp_recv_buf(conn->sock, &hdr, sizeof(hdr));
+	if (ret)
+		return ret;
+	if (hdr.magic != RSWAP_TCP_MAGIC || hdr.status) {
+		pr_err("%s, rejected by the memory server, its chunks are 1 << %llu bytes.\n",
+		       __func__, hdr.id);
+		return -EINVAL;
+	}
+	return hdr.addr;
+}
+
+// chunks held on the memory server, after rswap_tcp_init()
+uint32_t rswap_tcp_granted(void)
+{
+	return tcp_session.chunk_num;
+}
+
+int rswap_tcp_init(char *server_ip, int server_port, int mem_size)
+{
+	uint32_t wanted = mem_size ? DIV_ROUND_UP(mem_size, REGION_SIZE_GB) : MAX_REGION_NUM;
+	int nr_groups, i, ret;
+
+	if (conns_per_group < 1 || cores_per_group < 1) {
+		pr_err("%s, bad conns_per_group or cores_per_group.\n",
+		       __func__);
+		return -EINVAL;
+	}
+	if (!in4_pton(server_ip, strlen(server_ip), (u8 *)&tcp_session.addr,
+		      -1, NULL)) {
+		pr_err("%s, bad memory server ip %s\n", __func__, server_ip);
+		return -EINVAL;
+	}
+	tcp_session.port = htons(server_port);
+
+	ret = -ENOMEM;
+	tcp_session.req_cache = KMEM_CACHE(rswap_tcp_req, 0);
+	if (!tcp_session.req_cache)
+		goto err;
+	tcp_session.req_pool = mempool_create_slab_pool(RSWAP_TCP_MIN_REQS,
+							tcp_session.req_cache);
+	if (!tcp_session.req_pool)
+		goto err;
+
+	nr_groups = DIV_ROUND_UP(num_possible_cpus(), cores_per_group);
+	tcp_session.nr_conns = nr_groups * conns_per_group;
+	tcp_session.conns = kcalloc(tcp_session.nr_conns,
+				    sizeof(struct rswap_tcp_conn), GFP_KERNEL);
+	if (!tcp_session.conns)
+		goto err;
+
+	tcp_session.chunk_num = wanted;
+	for (i = 0; i < tcp_session.nr_conns; i++) {
+		struct rswap_tcp_conn *conn = &tcp_session.conns[i];
+
+		conn->idx = i;
+		spin_lock_init(&conn->lock);
+		INIT_LIST_HEAD(&conn->tx_list);
+		INIT_LIST_HEAD(&conn->inflight);
+		init_waitqueue_head(&conn->tx_wait);
+
+		ret = rswap_tcp_connect(conn, wanted);
+		if (ret < 0)
+			goto err;
+		tcp_session.chunk_num = min_t(uint32_t, tcp_session.chunk_num,
+					      ret);
+
+		conn->tx_thread = kthread_run(rswap_tcp_tx, conn, "rswap_tx/%d",
+					      i);
+		conn->rx_thread = kthread_run(rswap_tcp_rx, conn, "rswap_rx/%d",
+					      i);
+		if (IS_ERR(conn->tx_thread) || IS_ERR(conn->rx_thread)) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	pr_info("%s, %d TCP connections to %s:%d, got %u chunks.\n", __func__,
+		tcp_session.nr_conns, server_ip, server_port,
+		tcp_session.chunk_num);
+	if (tcp_session.chunk_num < wanted)
+		pr_warn("%s, asked for %u chunks, the rest is out of the quota or the free memory of memory server.\n",
+			__func__, wanted);
+	return 0;
+
+err:
+	rswap_tcp_exit();
+	return ret;
+}
+
+void rswap_tcp_exit(void)
+{
+	int i;
+
+	for (i = 0; tcp_session.conns && i < tcp_session.nr_conns; i++) {
+		struct rswap_tcp_conn *conn = &tcp_session.conns[i];
+
+		if (!conn->sock)
+			continue;
+		// wakes up the rx thread, the server releases the chunks
+		kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+		if (!IS_ERR_OR_NULL(conn->tx_thread))
+			kthread_stop(conn->tx_thread);
+		if (!IS_ERR_OR_NULL(conn->rx_thread))
+			kthread_stop(conn->rx_thread);
+		rswap_tcp_fail_conn(conn, -ESHUTDOWN);
+		sock_release(conn->sock);
+	}
+	kfree(tcp_session.conns);
+	tcp_session.conns = NULL;
+	mempool_destroy(tcp_session.req_pool);
+	kmem_cache_destroy(tcp_session.req_cache);
+	pr_info("%s done.\n", __func__);
+}
@@ -0,0 +1,70 @@
+#ifndef __RSWAP_TCP_H
+#define __RSWAP_TCP_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/inet.h>
+#include <linux/net.h>
+#include <linux/tcp.h>
+#include <linux/kthread.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/mempool.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
+#include <net/sock.h>
+
+#include "constants.h"
+
+#define RSWAP_TCP_CHUNK_SHIFT (30 + ilog2(REGION_SIZE_GB))
+#define RSWAP_TCP_MIN_REQS 256 // reserved, a load must not fail for memory
+
+/*
+ * A page going to or coming from the memory server. Loads are answered in
+ * the rx thread of their connection, stores wait for their answer.
+ */
+struct rswap_tcp_req {
+	struct rswap_tcp_hdr hdr;
+	struct page *page;
+	struct list_head list;
+
+	struct completion done;
+	int status;
+};
+
+struct rswap_tcp_conn {
+	int idx;
+	struct socket *sock;
+
+	spinlock_t lock;
+	struct list_head tx_list; // to send
+	struct list_head inflight; // sent, answered in order
+	u64 next_id;
+	bool broken;
+
+	wait_queue_head_t tx_wait;
+	struct task_struct *tx_thread;
+	struct task_struct *rx_thread;
+};
+
+struct rswap_tcp_session {
+	__be32 addr;
+	__be16 port;
+
+	int nr_conns;
+	struct rswap_tcp_conn *conns;
+	uint32_t chunk_num; // held on the memory server
+
+	struct kmem_cache *req_cache;
+	mempool_t *req_pool;
+};
+
+int rswap_tcp_init(char *server_ip, int server_port, int mem_size);
+void rswap_tcp_exit(void);
+uint32_t rswap_tcp_granted(void);
+int rswap_tcp_store(int cpu, pgoff_t offset, struct page *page);
+int rswap_tcp_load(int cpu, pgoff_t offset, struct page *page);
+
+#endif // __RSWAP_TCP_H
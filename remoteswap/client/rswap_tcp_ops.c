@@ -0,0 +1,236 @@
+#include "rswap_tcp.h"
+#include "rswap_ops.h"
+
+#include <linux/frontswap.h>
+#include <linux/swap_stats.h>
+
+static inline pgoff_t local_to_remote_page_mapping(unsigned type,
+						   pgoff_t swap_entry_offset)
+{
+#ifndef RSWAP_KERNEL_SUPPORT
+	return swap_entry_offset;
+#else
+	if (!swap_isolated())
+		return swap_entry_offset;
+	else
+		return swap_partition_global_entry_offset(type) +
+		       swap_entry_offset;
+#endif
+}
+
+// of the remote memory, the swap device takes the pages past it
+static pgoff_t rswap_swap_pages;
+
+int rswap_granted_size(void)
+{
+	return rswap_tcp_granted() * REGION_SIZE_GB;
+}
+
+void rswap_swap_limit_init(int mem_size, int cc_size, int dev_size)
+{
+	u64 swap_size = max(mem_size - cc_size - dev_size, 0);
+	u64 granted = rswap_granted_size();
+
+	rswap_swap_pages = min(swap_size, granted) << (30 - PAGE_SHIFT);
+	pr_info("%s, %lu swap pages in the remote memory\n", __func__,
+		rswap_swap_pages);
+}
+
+int rswap_frontswap_store(unsigned type, pgoff_t swap_entry_offset,
+			  struct page *page)
+{
+	pgoff_t remote_page_offset =
+		local_to_remote_page_mapping(type, swap_entry_offset);
+	int ret;
+
+	// the store fails, the kernel writes the page to the swap device
+	if (unlikely(remote_page_offset >= rswap_swap_pages)) {
+		pr_warn_once("%s, the swap partition is larger than the remote memory, the pages past %lu go to the swap device\n",
+			     __func__, rswap_swap_pages);
+		return -ENOSPC;
+	}
+	// may sleep, the store waits for the memory server
+	ret = rswap_tcp_store(raw_smp_processor_id(), remote_page_offset,
+			      page);
+	if (unlikely(ret))
+		pr_err("%s, could not write page remotely, %d\n", __func__,
+		       ret);
+	return ret;
+}
+
+int rswap_frontswap_load(unsigned type, pgoff_t swap_entry_offset,
+			 struct page *page)
+{
+	pgoff_t remote_page_offset =
+		local_to_remote_page_mapping(type, swap_entry_offset);
+	int ret;
+
+	ret = rswap_tcp_load(raw_smp_processor_id(), remote_page_offset, page);
+	if (unlikely(ret))
+		pr_err("%s, enqueuing tcp frontswap read failed.\n", __func__);
+	return ret;
+}
+
+int rswap_frontswap_load_async(unsigned type, pgoff_t swap_entry_offset,
+			       struct page *page)
+{
+	pgoff_t remote_page_offset =
+		local_to_remote_page_mapping(type, swap_entry_offset);
+	int ret;
+
+	ret = rswap_tcp_load(raw_smp_processor_id(), remote_page_offset, page);
+	if (unlikely(ret))
+		pr_err("%s, enqueuing tcp frontswap read failed.\n", __func__);
+	return ret;
+}
+
+// The rx threads unlock the pages, the faulting thread waits on the lock.
+int rswap_frontswap_poll_load(int cpu)
+{
+	return 0;
+}
+
+static void rswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+#ifdef DEBUG_MODE_DETAIL
+	pr_info("%s, remove page_virt addr 0x%lx\n", __func__,
+		offset << PAGE_OFFSET);
+#endif
+	return;
+}
+
+static void rswap_invalidate_area(unsigned type)
+{
+#ifdef DEBUG_MODE_DETAIL
+	pr_warn("%s, remove the pages of area 0x%x ?\n", __func__, type);
+#endif
+	return;
+}
+
+static void rswap_frontswap_init(unsigned type)
+{
+}
+
+static struct frontswap_ops rswap_frontswap_ops = {
+	.init = rswap_frontswap_init,
+	.store = rswap_frontswap_store,
+	.load = rswap_frontswap_load,
+	.load_async = rswap_frontswap_load_async,
+	.poll_load = rswap_frontswap_poll_load,
+	.invalidate_page = rswap_invalidate_page,
+	.invalidate_area = rswap_invalidate_area,
+};
+
+int rswap_register_frontswap(void)
+{
+	frontswap_register_ops(&rswap_frontswap_ops);
+	pr_info("frontswap module loaded\n");
+	return 0;
+}
+
+int rswap_replace_frontswap(void)
+{
+#ifdef RSWAP_KERNEL_SUPPORT
+	frontswap_ops->init = rswap_frontswap_ops.init;
+	frontswap_ops->store = rswap_frontswap_ops.store;
+	frontswap_ops->load = rswap_frontswap_ops.load;
+	frontswap_ops->load_async = rswap_frontswap_ops.load_async;
+	frontswap_ops->poll_load = rswap_frontswap_ops.poll_load;
+#else
+	frontswap_ops->init = rswap_frontswap_ops.init;
+	frontswap_ops->store = rswap_frontswap_ops.store;
+	frontswap_ops->load = rswap_frontswap_ops.load;
+	frontswap_ops->poll_load = rswap_frontswap_ops.poll_load;
+#endif
+	pr_info("frontswap ops replaced\n");
+	return 0;
+}
+
+void *rswap_client_park(void)
+{
+	// the server drops the chunks of a closed connection
+	return NULL;
+}
+
+int rswap_unpark_frontswap(void)
+{
+	// the server dropped the chunks of the parked module
+	pr_err("%s, cannot take the pages of the parked module, frontswap stays parked.\n",
+	       __func__);
+	return -EOPNOTSUPP;
+}
+
+int rswap_client_init(char *server_ip, int server_port, int mem_size)
+{
+	return rswap_tcp_init(server_ip, server_port, mem_size);
+}
+
+void rswap_client_exit(void)
+{
+	rswap_tcp_exit();
+}
+
+// The tcp stores may sleep, and cleancache puts run with irqs off.
+int rswap_cleancache_init(int mem_size, int cc_size)
+{
+	if (!cc_size)
+		return 0;
+	pr_err("%s, no cleancache on the tcp backend\n", __func__);
+	return -EOPNOTSUPP;
+}
+
+void rswap_cleancache_exit(void)
+{
+}
+
+int rswap_dev_init(int mem_size, int cc_size, int dev_size)
+{
+	if (!dev_size)
+		return 0;
+	pr_err("%s, no /dev/rswap on the tcp backend\n", __func__);
+	return -EOPNOTSUPP;
+}
+
+void rswap_dev_exit(void)
+{
+}
+
+// log_store is a parameter of the rdma backend
+int rswap_log_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_log_exit(void)
+{
+}
+
+// ecip is a parameter of the rdma backend
+int rswap_ec_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_ec_exit(void)
+{
+}
+
+// mgip is a parameter of the rdma backend
+int rswap_migrate_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_migrate_exit(void)
+{
+}
+
+// farip is a parameter of the rdma backend
+int rswap_tier_init(int mem_size, int cc_size, int dev_size)
+{
+	return 0;
+}
+
+void rswap_tier_exit(void)
+{
+}
@@ -0,0 +1,295 @@
+#include <linux/delay.h>
+#include <linux/hash.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+
+#include "rswap_rdma.h"
+#include "rswap_ops.h"
+
+/*
+ * Placement of the swap pages over a near memory server, the primary one,
+ * and a slower far one (farip), e.g. in another rack. Each swap offset has
+ * a heat, the demand faults on it, halved every tier_decay_ms. A page
+ * stored with a heat of tier_hot or more goes to its place on the primary
+ * server, a colder one to a free slot of the farsize GB on the far server,
+ * so the faults that come back often are served by the near server. A page
+ * that gets hot is read once from the far server and placed near at its
+ * next swap-out, and the other way around.
+ *
+ * The primary server keeps the place of every swap offset, the far one
+ * only adds the capacity for the cold pages, and a page stays near when the
+ * far server is full. With tier_policy=0, the pages are placed by offset,
+ * as many on the far server as its share of the capacity, as if both were
+ * the same, to compare. far_delay_us adds a latency to each transfer with
+ * the far server, to emulate it with two servers of the same rack.
+ */
+
+static struct rdma_session_context rdma_session_far;
+
+static char far_ip[INET_ADDRSTRLEN];
+static int far_port;
+static int far_size;
+static int far_delay_us;
+static int tier_policy = 1;
+static int tier_hot = 2;
+static int tier_decay_ms = 1000;
+
+MODULE_PARM_DESC(farip, "Far memory server for the cold swap pages, none by default");
+MODULE_PARM_DESC(farport, "Port of the far memory server");
+MODULE_PARM_DESC(farsize, "Remote memory on the far server in GB");
+MODULE_PARM_DESC(far_delay_us, "Added latency of each transfer with the far server, in us");
+MODULE_PARM_DESC(tier_policy, "1 places the swap pages by their faults, 0 by offset");
+MODULE_PARM_DESC(tier_hot, "Faults within tier_decay_ms of a swap page to keep it on the near server");
+MODULE_PARM_DESC(tier_decay_ms, "The fault counts are halved that often");
+module_param_string(farip, far_ip, INET_ADDRSTRLEN, 0444);
+module_param_named(farport, far_port, int, 0444);
+module_param_named(farsize, far_size, int, 0444);
+module_param_named(far_delay_us, far_delay_us, int, 0644);
+module_param_named(tier_policy, tier_policy, int, 0644);
+module_param_named(tier_hot, tier_hot, int, 0644);
+module_param_named(tier_decay_ms, tier_decay_ms, int, 0644);
+
+static struct {
+	bool on;
+	u8 *heat; // per swap offset, saturated
+	unsigned long nr_pages; // of the swap part
+	struct delayed_work decay;
+
+	struct xarray map; // swap offset -> far slot
+	unsigned long *slots; // in use
+	unsigned long nr_slots;
+	unsigned long hint;
+	spinlock_t lock; // slots
+	unsigned int far_pct; // of the capacity, for tier_policy=0
+
+	atomic64_t near_stores, far_stores, near_loads, far_loads;
+} rswap_tier;
+
+bool rswap_tier_on(void)
+{
+	return rswap_tier.on;
+}
+
+static unsigned long rswap_tier_alloc_slot(void)
+{
+	unsigned long slot;
+
+	spin_lock(&rswap_tier.lock);
+	slot = find_next_zero_bit(rswap_tier.slots, rswap_tier.nr_slots, rswap_tier.hint);
+	if (slot >= rswap_tier.nr_slots)
+		slot = find_first_zero_bit(rswap_tier.slots, rswap_tier.nr_slots);
+	if (slot < rswap_tier.nr_slots) {
+		__set_bit(slot, rswap_tier.slots);
+		rswap_tier.hint = slot + 1;
+	}
+	spin_unlock(&rswap_tier.lock);
+	return slot;
+}
+
+static void rswap_tier_free_slot(unsigned long slot)
+{
+	spin_lock(&rswap_tier.lock);
+	__clear_bit(slot, rswap_tier.slots);
+	spin_unlock(&rswap_tier.lock);
+}
+
+void rswap_tier_invalidate(pgoff_t offset)
+{
+	void *entry;
+
+	if (!rswap_tier.on)
+		return;
+	entry = xa_erase(&rswap_tier.map, offset);
+	if (entry)
+		rswap_tier_free_slot(xa_to_value(entry));
+}
+
+// swapoff, the heat of the offsets is gone with their pages
+void rswap_tier_invalidate_all(void)
+{
+	unsigned long offset;
+	void *entry;
+
+	if (!rswap_tier.on)
+		return;
+	xa_for_each (&rswap_tier.map, offset, entry)
+		rswap_tier_invalidate(offset);
+	memset(rswap_tier.heat, 0, rswap_tier.nr_pages);
+}
+
+static void rswap_tier_decay(struct work_struct *work)
+{
+	u64 *heat = (u64 *)rswap_tier.heat;
+	unsigned long i;
+
+	// halves 8 counts at a time, racing faults may lose an increment
+	for (i = 0; i < rswap_tier.nr_pages / 8; i++) {
+		heat[i] = (heat[i] >> 1) & 0x7f7f7f7f7f7f7f7fULL;
+		if (!(i & 0xffff))
+			cond_resched();
+	}
+	queue_delayed_work(system_unbound_wq, &rswap_tier.decay, msecs_to_jiffies(max(tier_decay_ms, 10)));
+}
+
+static bool rswap_tier_near(pgoff_t offset)
+{
+	if (!tier_policy)
+		return hash_long(offset, 32) % 100 >= rswap_tier.far_pct;
+	return READ_ONCE(rswap_tier.heat[offset]) >= tier_hot;
+}
+
+static int rswap_tier_rw(unsigned long slot, struct page *page, enum rdma_queue_type type)
+{
+	int ret = rswap_rdma_rw_sync(&rdma_session_far, slot << PAGE_SHIFT, page, type);
+
+	if (far_delay_us)
+		udelay(far_delay_us);
+	return ret;
+}
+
+/*
+ * Stores a cold page on the far server. Returns 0 once stored, or 1 if the
+ * page is to be stored in its place on the primary server. No load of the
+ * same offset runs meanwhile.
+ */
+int rswap_tier_store(pgoff_t offset, struct page *page)
+{
+	unsigned long slot;
+	void *entry;
+
+	if (!rswap_tier.on || offset >= rswap_tier.nr_pages)
+		return 1;
+	entry = xa_load(&rswap_tier.map, offset);
+	if (rswap_tier_near(offset))
+		goto near;
+
+	slot = entry ? xa_to_value(entry) : rswap_tier_alloc_slot();
+	if (slot >= rswap_tier.nr_slots)
+		goto near; // full
+	if (rswap_tier_rw(slot, page, QP_STORE)) {
+		if (entry)
+			rswap_tier_invalidate(offset);
+		else
+			rswap_tier_free_slot(slot);
+		goto near;
+	}
+	if (!entry && xa_err(xa_store(&rswap_tier.map, offset, xa_mk_value(slot), GFP_NOWAIT))) {
+		rswap_tier_free_slot(slot);
+		goto near;
+	}
+	atomic64_inc(&rswap_tier.far_stores);
+	return 0;
+
+near:
+	// an older copy on the far server is stale now
+	if (entry)
+		rswap_tier_invalidate(offset);
+	atomic64_inc(&rswap_tier.near_stores);
+	return 1;
+}
+
+/*
+ * Counts a demand fault on the offset, and reads the page if it is on the
+ * far server. Returns 0 once the page is up to date and unlocked, an error,
+ * or 1 if the page is to be read from the primary server.
+ */
+int rswap_tier_load(pgoff_t offset, struct page *page, bool fault)
+{
+	void *entry;
+	u8 heat;
+
+	if (!rswap_tier.on || offset >= rswap_tier.nr_pages)
+		return 1;
+	if (fault) {
+		heat = READ_ONCE(rswap_tier.heat[offset]);
+		if (heat < U8_MAX)
+			WRITE_ONCE(rswap_tier.heat[offset], heat + 1);
+	}
+	entry = xa_load(&rswap_tier.map, offset);
+	if (!entry) {
+		atomic64_inc(&rswap_tier.near_loads);
+		return 1;
+	}
+
+	if (rswap_tier_rw(xa_to_value(entry), page, QP_LOAD_SYNC))
+		return -EIO;
+	atomic64_inc(&rswap_tier.far_loads);
+	SetPageUptodate(page);
+	unlock_page(page);
+	return 0;
+}
+
+int rswap_tier_init(int mem_size, int cc_size, int dev_size)
+{
+	int ret;
+
+	if (!far_ip[0])
+		return 0;
+	if (rswap_log_on() || rswap_ec_on() || rswap_migrate_on() || rdma_session_replica.replica) {
+		pr_err("%s, the swap pages have a fixed place with log_store, ecip, mgip or rsip\n", __func__);
+		return -EINVAL;
+	}
+	if (far_size < REGION_SIZE_GB) {
+		pr_err("%s, farsize %dGB, at least %dGB for the cold pages\n", __func__, far_size, REGION_SIZE_GB);
+		return -EINVAL;
+	}
+
+	rswap_tier.nr_pages = (unsigned long)(mem_size - cc_size - dev_size) << (30 - PAGE_SHIFT);
+	rswap_tier.nr_slots = (unsigned long)(far_size / REGION_SIZE_GB) << (CHUNK_SHIFT - PAGE_SHIFT);
+	rswap_tier.far_pct = rswap_tier.nr_slots * 100 / (rswap_tier.nr_slots + rswap_tier.nr_pages);
+	rswap_tier.heat = vzalloc(rswap_tier.nr_pages);
+	rswap_tier.slots = vzalloc(BITS_TO_LONGS(rswap_tier.nr_slots) * sizeof(unsigned long));
+	if (!rswap_tier.heat || !rswap_tier.slots) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	rdma_session_far.secondary = true;
+	rdma_session_far.remote_mem_pool.remote_mem_size = far_size;
+	rdma_session_far.remote_mem_pool.chunk_num = far_size / REGION_SIZE_GB;
+	ret = init_rdma_sessions(&rdma_session_far, far_ip, far_port);
+	if (ret != 1) {
+		ret = -EINVAL;
+		goto err;
+	}
+	ret = rdma_session_connect(&rdma_session_far);
+	if (ret) {
+		pr_err("%s, connect to %s:%d failed\n", __func__, far_ip, far_port);
+		goto err;
+	}
+
+	xa_init(&rswap_tier.map);
+	spin_lock_init(&rswap_tier.lock);
+	INIT_DELAYED_WORK(&rswap_tier.decay, rswap_tier_decay);
+	queue_delayed_work(system_unbound_wq, &rswap_tier.decay, msecs_to_jiffies(max(tier_decay_ms, 10)));
+	rswap_tier.on = true;
+	pr_info("%s, cold pages on %s:%d, %lu pages, %u%% of the capacity\n", __func__, far_ip, far_port,
+		rswap_tier.nr_slots, rswap_tier.far_pct);
+	return 0;
+
+err:
+	vfree(rswap_tier.heat);
+	rswap_tier.heat = NULL;
+	vfree(rswap_tier.slots);
+	rswap_tier.slots = NULL;
+	return ret;
+}
+
+// After the stores and loads.
+void rswap_tier_exit(void)
+{
+	if (!rswap_tier.on)
+		return;
+	rswap_tier.on = false;
+	cancel_delayed_work_sync(&rswap_tier.decay);
+
+	pr_info("%s, stores %lld near %lld far, loads %lld near %lld far\n", __func__,
+		atomic64_read(&rswap_tier.near_stores), atomic64_read(&rswap_tier.far_stores),
+		atomic64_read(&rswap_tier.near_loads), atomic64_read(&rswap_tier.far_loads));
+	xa_destroy(&rswap_tier.map);
+	vfree(rswap_tier.slots);
+	rswap_tier.slots = NULL;
+	vfree(rswap_tier.heat);
+	rswap_tier.heat = NULL;
+	rswap_disconnect_and_collect_resource(&rdma_session_far);
+}
@@ -0,0 +1,123 @@
+/*
+ * The per-core virtual queues of the swap scheduler, where the swap
+ * requests of a core wait for the scheduler threads to post them.
+ * Kept apart from the scheduler so that rswap-vqueue-test can build them
+ * without an RDMA session.
+ */
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "rswap_scheduler.h"
+
+int rswap_vqueue_init(struct rswap_vqueue *vqueue)
+{
+	BUILD_BUG_ON(!is_power_of_2(RSWAP_VQUEUE_MAX_SIZE));
+	if (!vqueue) {
+		return -EINVAL;
+	}
+
+	atomic_set(&vqueue->cnt, 0);
+	atomic_set(&vqueue->send_direct, 1);
+
+	vqueue->max_cnt = RSWAP_VQUEUE_MAX_SIZE;
+	vqueue->head = 0;
+	vqueue->tail = 0;
+
+	vqueue->reqs = kvmalloc_array(vqueue->max_cnt, sizeof(struct rswap_request), GFP_KERNEL);
+	if (!vqueue->reqs) {
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&vqueue->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(rswap_vqueue_init);
+
+int rswap_vqueue_destroy(struct rswap_vqueue *vqueue)
+{
+	if (!vqueue) {
+		return -EINVAL;
+	}
+	kvfree(vqueue->reqs);
+	memset(vqueue, 0, sizeof(struct rswap_vqueue));
+	return 0;
+}
+
+/*
+ * Double the ring. Called with the lock held by a producer that must not
+ * sleep, hence GFP_ATOMIC. Dequeue copies the requests out, so nothing
+ * points into the old ring once it is freed.
+ */
+static int rswap_vqueue_enlarge(struct rswap_vqueue *vqueue)
+{
+	unsigned len = vqueue->tail - vqueue->head;
+	unsigned mask = vqueue->max_cnt - 1;
+	struct rswap_request *reqs;
+	unsigned i;
+
+	reqs = kmalloc_array(vqueue->max_cnt * 2, sizeof(struct rswap_request), GFP_ATOMIC | __GFP_NOWARN);
+	if (!reqs) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < len; i++) {
+		reqs[i] = vqueue->reqs[(vqueue->head + i) & mask];
+	}
+	kvfree(vqueue->reqs);
+	vqueue->reqs = reqs;
+	vqueue->head = 0;
+	vqueue->tail = len;
+	vqueue->max_cnt *= 2;
+	pr_info("Enlarge vqueue to %u\n", vqueue->max_cnt);
+	return 0;
+}
+
+/*
+ * head and tail run freely and are masked by max_cnt - 1, so tail - head is
+ * the number of queued requests across the wrap-around of both. cnt also
+ * counts the dequeued requests until the consumer has sent them.
+ */
+int rswap_vqueue_enqueue(struct rswap_vqueue *vqueue, struct rswap_request *request)
+{
+	unsigned long flags;
+	int ret = 0;
+	if (!vqueue || !request) {
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&vqueue->lock, flags);
+	if (vqueue->tail - vqueue->head == vqueue->max_cnt) {
+		ret = rswap_vqueue_enlarge(vqueue);
+		if (ret) {
+			goto out;
+		}
+	}
+	rswap_request_copy(&vqueue->reqs[vqueue->tail & (vqueue->max_cnt - 1)], request);
+	vqueue->tail++;
+	atomic_inc(&vqueue->cnt);
+out:
+	spin_unlock_irqrestore(&vqueue->lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL(rswap_vqueue_enqueue);
+
+int rswap_vqueue_dequeue(struct rswap_vqueue *vqueue, struct rswap_request *request)
+{
+	unsigned long flags;
+
+	if (vqueue->tail == vqueue->head) {
+		return -1;
+	}
+	spin_lock_irqsave(&vqueue->lock, flags);
+	if (vqueue->tail == vqueue->head) {
+		spin_unlock_irqrestore(&vqueue->lock, flags);
+		return -1;
+	}
+	rswap_request_copy(request, &vqueue->reqs[vqueue->head & (vqueue->max_cnt - 1)]);
+	vqueue->head++;
+	spin_unlock_irqrestore(&vqueue->lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL(rswap_vqueue_dequeue);
@@ -0,0 +1,451 @@
+/*
+ * Self-tests and microbenchmarks of the rswap vqueue, built by make TEST=1.
+ *
+ * The vqueue is the ring between the swap path of a core (producer) and the
+ * scheduler threads (consumer). The tests check the FIFO order across the
+ * wrap-around of the ring and of its free running indices, the growth of a
+ * full ring, and the order under concurrent producers. The benchmarks print
+ * ns/op of an enqueue/dequeue pair, then of 1, 2, 4, ... cores enqueueing
+ * into their own vqueue while one consumer drains all of them, as the
+ * scheduler does.
+ *
+ * The module links its own copy of the vqueue, so load it while rswap-client
+ * is not loaded. Loading fails with -EINVAL if any test fails, the results
+ * are in dmesg.
+ */
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#include "rswap_scheduler.h"
+
+MODULE_AUTHOR("Chenxi Wang, Yifan Qiao, Yulong Zhang");
+MODULE_DESCRIPTION("RSWAP, vqueue self-tests and microbenchmarks");
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_VERSION("1.0");
+
+static int nr_reqs = 1 << 16;
+static int bench_iters = 1 << 20;
+static bool bench = true;
+
+MODULE_PARM_DESC(nr_reqs, "Requests per producer of the concurrency tests");
+MODULE_PARM_DESC(bench_iters, "Operations per core of the benchmarks");
+MODULE_PARM_DESC(bench, "Run the benchmarks after the tests");
+module_param(nr_reqs, int, 0444);
+module_param(bench_iters, int, 0444);
+module_param(bench, bool, 0444);
+
+#define VQ_TEST_TIMEOUT (10 * HZ)
+#define PRODUCER_SHIFT 40 // offset of a request: producer << 40 | seq
+
+static int nr_failed_checks;
+
+#define VQ_CHECK(cond)                                                         \
+	do {                                                                   \
+		if (!(cond)) {                                                 \
+			pr_err("%s:%d check failed: %s\n", __func__, __LINE__, \
+			       #cond);                                         \
+			nr_failed_checks++;                                    \
+		}                                                              \
+	} while (0)
+
+static int vq_enqueue(struct rswap_vqueue *vqueue, pgoff_t offset)
+{
+	struct rswap_request req = { offset, NULL };
+
+	return rswap_vqueue_enqueue(vqueue, &req);
+}
+
+// dequeue and send, as the scheduler does
+static int vq_dequeue(struct rswap_vqueue *vqueue, pgoff_t *offset)
+{
+	struct rswap_request req;
+	int ret;
+
+	ret = rswap_vqueue_dequeue(vqueue, &req);
+	if (ret == 0) {
+		*offset = req.offset;
+		atomic_dec(&vqueue->cnt);
+	}
+	return ret;
+}
+
+/* single thread tests */
+
+static void vq_test_fifo(void)
+{
+	struct rswap_vqueue vqueue;
+	pgoff_t i, offset;
+
+	VQ_CHECK(rswap_vqueue_init(&vqueue) == 0);
+	VQ_CHECK(vq_dequeue(&vqueue, &offset) == -1);
+	for (i = 0; i < 100; i++)
+		VQ_CHECK(vq_enqueue(&vqueue, i) == 0);
+	VQ_CHECK(atomic_read(&vqueue.cnt) == 100);
+	for (i = 0; i < 100; i++) {
+		VQ_CHECK(vq_dequeue(&vqueue, &offset) == 0);
+		VQ_CHECK(offset == i);
+	}
+	VQ_CHECK(vq_dequeue(&vqueue, &offset) == -1);
+	VQ_CHECK(atomic_read(&vqueue.cnt) == 0);
+	rswap_vqueue_destroy(&vqueue);
+}
+
+// the ring position wraps around many times, never more than 3 queued
+static void vq_test_ring_wrap(void)
+{
+	struct rswap_vqueue vqueue;
+	pgoff_t in = 0, out = 0, offset = 0;
+	int i, j;
+
+	VQ_CHECK(rswap_vqueue_init(&vqueue) == 0);
+	for (i = 0; i < 10 * RSWAP_VQUEUE_MAX_SIZE; i++) {
+		for (j = 0; j < 3; j++)
+			vq_enqueue(&vqueue, in++);
+		for (j = 0; j < 3; j++) {
+			VQ_CHECK(vq_dequeue(&vqueue, &offset) == 0);
+			VQ_CHECK(offset == out);
+			out++;
+		}
+	}
+	VQ_CHECK(vqueue.max_cnt == RSWAP_VQUEUE_MAX_SIZE);
+	rswap_vqueue_destroy(&vqueue);
+}
+
+// head and tail overflow their unsigned range
+static void vq_test_index_wrap(void)
+{
+	struct rswap_vqueue vqueue;
+	pgoff_t i, offset;
+
+	VQ_CHECK(rswap_vqueue_init(&vqueue) == 0);
+	vqueue.head = vqueue.tail = UINT_MAX - 5;
+	for (i = 0; i < 20; i++)
+		vq_enqueue(&vqueue, i);
+	VQ_CHECK(vqueue.tail - vqueue.head == 20);
+	for (i = 0; i < 20; i++) {
+		VQ_CHECK(vq_dequeue(&vqueue, &offset) == 0);
+		VQ_CHECK(offset == i);
+	}
+	VQ_CHECK(vq_dequeue(&vqueue, &offset) == -1);
+	rswap_vqueue_destroy(&vqueue);
+}
+
+/*
+ * A full ring grows while its requests wrap around the end of it, and while
+ * the consumer has one dequeued but not sent. The ring used to grow on
+ * cnt, which counts the request in flight, and copied one slot too many.
+ */
+static void vq_test_enlarge(void)
+{
+	struct rswap_vqueue vqueue;
+	struct rswap_request in_flight;
+	pgoff_t in = 0, out = 0, offset = 0;
+	int i;
+
+	VQ_CHECK(rswap_vqueue_init(&vqueue) == 0);
+	for (i = 0; i < RSWAP_VQUEUE_MAX_SIZE / 2; i++) {
+		vq_enqueue(&vqueue, in++);
+		vq_dequeue(&vqueue, &offset);
+		out++;
+	}
+	for (i = 0; i < RSWAP_VQUEUE_MAX_SIZE; i++)
+		vq_enqueue(&vqueue, in++);
+	VQ_CHECK(rswap_vqueue_dequeue(&vqueue, &in_flight) == 0);
+	VQ_CHECK(in_flight.offset == out);
+	out++;
+	for (i = 0; i < 2 * RSWAP_VQUEUE_MAX_SIZE; i++)
+		vq_enqueue(&vqueue, in++);
+	VQ_CHECK(vqueue.max_cnt == 4 * RSWAP_VQUEUE_MAX_SIZE);
+	VQ_CHECK(in_flight.offset == out - 1);
+	atomic_dec(&vqueue.cnt);
+
+	while (vq_dequeue(&vqueue, &offset) == 0) {
+		VQ_CHECK(offset == out);
+		out++;
+	}
+	VQ_CHECK(out == in);
+	VQ_CHECK(atomic_read(&vqueue.cnt) == 0);
+	rswap_vqueue_destroy(&vqueue);
+}
+
+/* concurrency */
+
+struct vq_thread {
+	struct task_struct *task;
+	struct completion done;
+	int id;
+	struct rswap_vqueue *vqueues;
+	int nr_vqueues;
+	int nr_producers;
+	int nr_ops;
+	atomic_t *start;
+	u64 ns;
+	int errors;
+};
+
+static void vq_wait_start(struct vq_thread *thd)
+{
+	atomic_dec(thd->start);
+	while (atomic_read(thd->start) > 0)
+		cond_resched();
+}
+
+// enqueues nr_ops requests into its vqueue, or the only one
+static int vq_producer(void *arg)
+{
+	struct vq_thread *thd = arg;
+	struct rswap_vqueue *vqueue =
+		&thd->vqueues[thd->nr_vqueues > 1 ? thd->id : 0];
+	pgoff_t base = (pgoff_t)thd->id << PRODUCER_SHIFT;
+	u64 start;
+	int i;
+
+	vq_wait_start(thd);
+	start = ktime_get_ns();
+	for (i = 0; i < thd->nr_ops; i++) {
+		while (vq_enqueue(vqueue, base + i) == -ENOMEM)
+			cond_resched();
+	}
+	thd->ns = ktime_get_ns() - start;
+	complete(&thd->done);
+	return 0;
+}
+
+/*
+ * Sweeps all the vqueues, as a scheduler thread, until it has nr_ops
+ * requests of every producer, each producer in order.
+ */
+static int vq_consumer(void *arg)
+{
+	struct vq_thread *thd = arg;
+	unsigned long deadline;
+	pgoff_t *next, offset;
+	long remaining = (long)thd->nr_ops * thd->nr_producers;
+	u64 start;
+	int q, p;
+
+	next = kcalloc(thd->nr_producers, sizeof(*next), GFP_KERNEL);
+	if (!next) {
+		thd->errors++;
+		vq_wait_start(thd);
+		complete(&thd->done);
+		return -ENOMEM;
+	}
+	vq_wait_start(thd);
+	start = ktime_get_ns();
+	deadline = jiffies + VQ_TEST_TIMEOUT;
+	while (remaining > 0) {
+		for (q = 0; q < thd->nr_vqueues; q++) {
+			if (vq_dequeue(&thd->vqueues[q], &offset))
+				continue;
+			p = offset >> PRODUCER_SHIFT;
+			if (p >= thd->nr_producers ||
+			    (offset & ((1UL << PRODUCER_SHIFT) - 1)) != next[p])
+				thd->errors++;
+			else
+				next[p]++;
+			remaining--;
+		}
+		if (time_after(jiffies, deadline)) {
+			pr_err("%s: timed out, %ld requests missing\n",
+			       __func__, remaining);
+			thd->errors++;
+			break;
+		}
+		if (need_resched())
+			cond_resched();
+	}
+	thd->ns = ktime_get_ns() - start;
+	kfree(next);
+	complete(&thd->done);
+	return 0;
+}
+
+/*
+ * Run nr_producers producers and one consumer, one core each if there are
+ * enough. With per_core, every producer has its own vqueue, otherwise all
+ * of them share one. Returns the ns of the consumer, or 0 on errors.
+ */
+static u64 vq_run(int nr_producers, bool per_core, int nr_ops)
+{
+	int nr_vqueues = per_core ? nr_producers : 1;
+	int nr_thds = nr_producers + 1;
+	struct rswap_vqueue *vqueues;
+	struct vq_thread *thds;
+	atomic_t start;
+	int i, cpu, errors = 0;
+	u64 ns = 0;
+
+	vqueues = kcalloc(nr_vqueues, sizeof(*vqueues), GFP_KERNEL);
+	thds = kcalloc(nr_thds, sizeof(*thds), GFP_KERNEL);
+	if (!vqueues || !thds)
+		goto out;
+	for (i = 0; i < nr_vqueues; i++)
+		rswap_vqueue_init(&vqueues[i]);
+	atomic_set(&start, nr_thds);
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nr_thds; i++) {
+		struct vq_thread *thd = &thds[i];
+
+		thd->id = i;
+		thd->vqueues = vqueues;
+		thd->nr_vqueues = nr_vqueues;
+		thd->nr_producers = nr_producers;
+		thd->nr_ops = nr_ops;
+		thd->start = &start;
+		init_completion(&thd->done);
+		// the last one is the consumer
+		thd->task = kthread_create(i < nr_producers ? vq_producer :
+							      vq_consumer,
+					   thd, "rswap_vq_test/%d", i);
+		if (IS_ERR(thd->task)) {
+			// none of them has started yet
+			pr_err("%s: kthread_create failed\n", __func__);
+			nr_thds = i;
+			errors++;
+			break;
+		}
+		kthread_bind(thd->task, cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+	if (errors) {
+		for (i = 0; i < nr_thds; i++)
+			kthread_stop(thds[i].task);
+		goto out_destroy;
+	}
+	for (i = 0; i < nr_thds; i++)
+		wake_up_process(thds[i].task);
+	for (i = 0; i < nr_thds; i++) {
+		wait_for_completion(&thds[i].done);
+		errors += thds[i].errors;
+	}
+	for (i = 0; i < nr_vqueues; i++) {
+		VQ_CHECK(atomic_read(&vqueues[i].cnt) == 0);
+		VQ_CHECK(vqueues[i].head == vqueues[i].tail);
+	}
+	VQ_CHECK(errors == 0);
+	if (!errors)
+		ns = thds[nr_producers].ns;
+
+out_destroy:
+	for (i = 0; i < nr_vqueues; i++)
+		rswap_vqueue_destroy(&vqueues[i]);
+out:
+	kfree(thds);
+	kfree(vqueues);
+	return ns;
+}
+
+// one producer and one consumer, the ring grows under them
+static void vq_test_spsc(void)
+{
+	VQ_CHECK(vq_run(1, true, nr_reqs) > 0);
+}
+
+// tasks preempted on one core enqueue into the same vqueue
+static void vq_test_shared(void)
+{
+	VQ_CHECK(vq_run(min(4U, num_online_cpus()), false, nr_reqs) > 0);
+}
+
+// the scheduler sweeping the vqueues of all the cores
+static void vq_test_per_core(void)
+{
+	VQ_CHECK(vq_run(max(1U, num_online_cpus() - 1), true, nr_reqs) > 0);
+}
+
+/* benchmarks */
+
+static void vq_bench_pair(void)
+{
+	struct rswap_vqueue vqueue;
+	pgoff_t offset;
+	u64 start, ns;
+	int i;
+
+	if (rswap_vqueue_init(&vqueue))
+		return;
+	start = ktime_get_ns();
+	for (i = 0; i < bench_iters; i++) {
+		vq_enqueue(&vqueue, i);
+		vq_dequeue(&vqueue, &offset);
+	}
+	ns = ktime_get_ns() - start;
+	pr_info("rswap_vqueue bench: enqueue+dequeue: %llu ns/op\n",
+		ns / bench_iters);
+	rswap_vqueue_destroy(&vqueue);
+}
+
+static void vq_bench_scaling(void)
+{
+	unsigned int cores = max(1U, num_online_cpus() - 1);
+	unsigned int n;
+	u64 ns;
+
+	for (n = 1;; n = min(n * 2, cores)) {
+		ns = vq_run(n, true, bench_iters);
+		if (!ns)
+			return;
+		pr_info("rswap_vqueue bench: %u producer cores: %llu ns/op, %llu Kops/s\n",
+			n, ns / ((u64)bench_iters * n),
+			(u64)bench_iters * n * 1000000 / ns);
+		if (n == cores)
+			break;
+	}
+}
+
+struct vq_test_case {
+	const char *name;
+	void (*run)(void);
+};
+
+static const struct vq_test_case vq_tests[] = {
+	{ "fifo", vq_test_fifo },
+	{ "ring_wrap", vq_test_ring_wrap },
+	{ "index_wrap", vq_test_index_wrap },
+	{ "enlarge", vq_test_enlarge },
+	{ "spsc", vq_test_spsc },
+	{ "shared", vq_test_shared },
+	{ "per_core", vq_test_per_core },
+};
+
+static int __init rswap_vqueue_test_init(void)
+{
+	int i, failed, nr_failed = 0;
+
+	// TAP, as KUnit prints it
+	pr_info("TAP version 14\n");
+	pr_info("1..%zu\n", ARRAY_SIZE(vq_tests));
+	for (i = 0; i < ARRAY_SIZE(vq_tests); i++) {
+		failed = nr_failed_checks;
+		vq_tests[i].run();
+		failed = nr_failed_checks != failed;
+		nr_failed += failed;
+		pr_info("%s %d - rswap_vqueue_%s\n", failed ? "not ok" : "ok",
+			i + 1, vq_tests[i].name);
+	}
+	if (nr_failed)
+		return -EINVAL;
+
+	if (bench) {
+		vq_bench_pair();
+		vq_bench_scaling();
+	}
+	return 0;
+}
+
+static void __exit rswap_vqueue_test_exit(void)
+{
+}
+
+module_init(rswap_vqueue_test_init);
+module_exit(rswap_vqueue_test_exit);
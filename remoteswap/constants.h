@@ -0,0 +1,151 @@
+#ifndef __RSWAP_CONSTANTS_H
+#define __RSWAP_CONSTANTS_H
+
+/*
+ * Shared by the rswap client (kernel module) and the rswap server (user
+ * space). Keep the layout of the structures below identical on both sides.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define ONE_MB ((uint64_t)1 << 20)
+#define ONE_GB ((uint64_t)1 << 30)
+
+// Remote memory is handed out to the client in chunks of REGION_SIZE_GB.
+#define REGION_SIZE_GB 4
+// Max #(chunks) carried by one message, i.e. max remote memory of a client.
+#define MAX_REGION_NUM 64
+// One page per rdma work request.
+#define MAX_REQUEST_SGL 1
+
+// message types start from 1, see rdma_message_print() of the client
+enum message_type {
+	DONE = 1,
+	GOT_CHUNKS,
+	GOT_SINGLE_CHUNK,
+	FREE_SIZE,
+	EVICT,
+	ACTIVITY,
+	STOP,
+	REQUEST_CHUNKS,
+	REQUEST_SINGLE_CHUNK,
+	QUERY,
+	AVAILABLE_TO_QUERY,
+	RELEASE_CHUNKS, // return the chunks at buf[0..mapped_chunk), DONE
+	QUERY_ALLOC_MAP,
+	ALLOC_MAP,
+	REATTACH_CHUNKS,
+};
+
+/*
+ * 2-sided message between client and server.
+ * QUERY -> FREE_SIZE: #(chunks) the client can still get, within its quota.
+ * REQUEST_CHUNKS/REQUEST_SINGLE_CHUNK -> GOT_CHUNKS/GOT_SINGLE_CHUNK: the
+ * granted chunks in buf/rkey/mapped_size, their number in mapped_chunk.
+ * QUERY_ALLOC_MAP -> ALLOC_MAP: the alloc map in buf[0]/rkey[0]/mapped_size[0]
+ * and the client slot in it in mapped_chunk, -1 if the server has none.
+ * REATTACH_CHUNKS -> GOT_CHUNKS: a reloaded client asks back the chunks at
+ * buf[0..mapped_chunk), still leased to it by the server. The answer keeps
+ * their order, with rkey 0 for a chunk the client does not hold anymore.
+ */
+struct message {
+	uint64_t buf[MAX_REGION_NUM];
+	uint64_t mapped_size[MAX_REGION_NUM];
+	uint32_t rkey[MAX_REGION_NUM];
+	int mapped_chunk;
+	enum message_type type;
+};
+
+// Each core of the client has one rdma queue of every type.
+enum rdma_queue_type {
+	QP_STORE,
+	QP_LOAD_SYNC,
+	QP_LOAD_ASYNC,
+	NUM_QP_TYPE
+};
+
+/*
+ * Private data of the rdma_cm connect request of every client queue, echoed
+ * back by the server in its accept (or reject, carrying the server's
+ * chunk_shift). A server also accepts a client sending no private data, with
+ * the default chunk size.
+ */
+#define RSWAP_CONN_MAGIC 0x52535750 // "RSWP"
+
+struct rswap_conn_param {
+	uint32_t magic;
+	uint16_t num_queues; // total #(queues) of the client
+	uint16_t q_index; // index of this queue
+	uint32_t chunk_shift; // log2(chunk size in bytes)
+} __attribute__((packed));
+
+/*
+ * One-sided chunk allocation. The memory server exports an alloc map in which
+ * clients claim and return chunks with RDMA atomics, without the server CPU:
+ *
+ *   struct rswap_alloc_header
+ *   uint64_t owner[nr_chunks]              0: free, else client slot + 1
+ *   struct rswap_extent extent[nr_chunks]  where the chunks are, read-only
+ *   struct rswap_alloc_client client[RSWAP_MAX_CLIENTS]
+ *
+ * A client claims chunk i with CAS(owner[i], 0, slot + 1) and returns it with
+ * CAS(owner[i], slot + 1, 0). It first adds 1 to client[slot].used with FAA
+ * and backs off when that exceeds its quota. header.cursor is a FAA hint of
+ * where to start looking for a free chunk, so that clients do not all race
+ * on the first free one.
+ */
+#define RSWAP_ALLOC_MAGIC 0x5253414c // "RSAL"
+#define RSWAP_MAX_CLIENTS 64
+
+struct rswap_alloc_header {
+	uint32_t magic;
+	uint32_t nr_chunks;
+	uint32_t chunk_shift;
+	uint32_t nr_clients;
+	uint64_t cursor;
+	// offsets in bytes from the start of the alloc map
+	uint64_t owner_off;
+	uint64_t extent_off;
+	uint64_t client_off;
+};
+
+struct rswap_extent {
+	uint64_t addr;
+	uint32_t rkey;
+	uint32_t node;
+};
+
+struct rswap_alloc_client {
+	uint64_t used; // chunks claimed, FAA by the client
+	uint64_t quota; // in chunks, 0: no limit, set by the server
+};
+
+/*
+ * TCP transport, for CPU servers without RNIC. Every request is a header,
+ * followed by a page for RSWAP_TCP_STORE. The server answers the requests of
+ * a connection in order with a header, followed by a page for
+ * RSWAP_TCP_LOAD. A connection starts with RSWAP_TCP_HELLO asking for
+ * addr chunks of 1 << id bytes, answered with the #(chunks) the client
+ * holds in addr.
+ */
+#define RSWAP_TCP_MAGIC 0x52535443 // "RSTC"
+
+enum rswap_tcp_op {
+	RSWAP_TCP_HELLO = 1,
+	RSWAP_TCP_STORE,
+	RSWAP_TCP_LOAD,
+};
+
+struct rswap_tcp_hdr {
+	uint32_t magic;
+	uint16_t op;
+	uint16_t status; // of the answer, 0 or an errno
+	uint64_t id; // echoed by the answer
+	uint64_t addr; // offset of the page in the remote memory of the client
+} __attribute__((packed));
+
+#endif // __RSWAP_CONSTANTS_H
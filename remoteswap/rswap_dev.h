@@ -0,0 +1,89 @@
+#ifndef __RSWAP_DEV_H
+#define __RSWAP_DEV_H
+
+/*
+ * /dev/rswap, object-granular access to remote memory from user space.
+ * Shared by the rswap client (kernel module) and its users.
+ *
+ * A process sets up a context on its open file, mmaps its rings at offset 0
+ * and its buffer at RSWAP_DEV_BUF_OFF, and allocates remote regions. It then
+ * fills submission entries, each a read or a write between a range of its
+ * buffer and a range of a region, and passes them to RSWAP_IOC_ENTER. The
+ * transfers complete asynchronously into the completion ring.
+ *
+ * The rings are single producer, single consumer: the process writes the
+ * sq entries then sq_tail, and reads the cq entries up to cq_tail then
+ * writes cq_head. The kernel does the rest, with the same ordering.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define RSWAP_DEV_NAME "rswap"
+
+// offsets and lengths of the transfers are multiples of it
+#define RSWAP_DEV_ALIGN 64
+#define RSWAP_DEV_MAX_LEN (64 * 1024)
+#define RSWAP_DEV_MAX_ENTRIES 4096
+#define RSWAP_DEV_BUF_OFF 0x10000000ULL
+
+enum rswap_dev_op {
+	RSWAP_DEV_READ = 1, // remote -> buffer
+	RSWAP_DEV_WRITE, // buffer -> remote
+};
+
+struct rswap_dev_sqe {
+	__u8 opcode;
+	__u8 pad[3];
+	__u32 region;
+	__u64 offset; // in the region
+	__u64 buf_offset; // in the buffer
+	__u32 len;
+	__u32 pad2;
+	__u64 user_data; // echoed in the completion
+};
+
+struct rswap_dev_cqe {
+	__u64 user_data;
+	__s32 res; // len, or -errno
+	__u32 pad;
+};
+
+struct rswap_dev_rings {
+	__u32 sq_head; // kernel
+	__u32 sq_tail; // user
+	__u32 sq_entries;
+	__u32 cq_head; // user
+	__u32 cq_tail; // kernel
+	__u32 cq_entries;
+	__u64 sq_off; // of the sq entries in the ring mapping
+	__u64 cq_off;
+};
+
+struct rswap_dev_setup {
+	__u32 sq_entries; // in, rounded up to a power of 2
+	__u32 cq_entries; // out, twice sq_entries
+	__u64 buf_size; // in, rounded up to pages
+	__u64 rings_size; // out, to mmap at offset 0
+};
+
+struct rswap_dev_alloc {
+	__u64 size; // in, rounded up to pages
+	__u32 region; // out
+	__u32 pad;
+};
+
+struct rswap_dev_enter {
+	__u32 to_submit;
+	__u32 min_complete; // waits for the cq to hold that many entries
+	__u32 submitted; // out
+	__u32 pad;
+};
+
+#define RSWAP_IOC_MAGIC 'r'
+#define RSWAP_IOC_SETUP _IOWR(RSWAP_IOC_MAGIC, 1, struct rswap_dev_setup)
+#define RSWAP_IOC_ALLOC _IOWR(RSWAP_IOC_MAGIC, 2, struct rswap_dev_alloc)
+#define RSWAP_IOC_FREE _IOW(RSWAP_IOC_MAGIC, 3, __u32)
+#define RSWAP_IOC_ENTER _IOWR(RSWAP_IOC_MAGIC, 4, struct rswap_dev_enter)
+
+#endif // __RSWAP_DEV_H
@@ -0,0 +1,179 @@
+#ifndef __RSWAP_EC_H
+#define __RSWAP_EC_H
+
+/*
+ * Erasure coding of the swap pages across memory servers, RS(4,2): a stripe
+ * of RSWAP_EC_K consecutive swap offsets, plus two parity pages P and Q,
+ * one fragment per server. Any RSWAP_EC_M fragments of a stripe can be
+ * lost. Shared by the rswap client (kernel module) and its user-space
+ * tests.
+ *
+ * The code is the one of RAID-6, over GF(2^8) with the polynomial 0x11d:
+ * P is the xor of the data pages, Q the sum of g^i * D_i with g = 2.
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#define RSWAP_EC_K 4
+#define RSWAP_EC_M 2
+#define RSWAP_EC_N (RSWAP_EC_K + RSWAP_EC_M)
+// fragments 0..K-1 are the data, then
+#define RSWAP_EC_P RSWAP_EC_K
+#define RSWAP_EC_Q (RSWAP_EC_K + 1)
+#define RSWAP_EC_DATA ((1U << RSWAP_EC_K) - 1)
+#define RSWAP_EC_ALL ((1U << RSWAP_EC_N) - 1)
+
+static inline uint64_t rswap_ec_stripe(uint64_t offset)
+{
+	return offset / RSWAP_EC_K;
+}
+
+static inline unsigned int rswap_ec_member(uint64_t offset)
+{
+	return offset % RSWAP_EC_K;
+}
+
+// The server of a fragment, rotated so the parity is spread. A server
+// holds the fragment of stripe s at its page s.
+static inline unsigned int rswap_ec_server(uint64_t stripe, unsigned int frag)
+{
+	return (stripe + frag) % RSWAP_EC_N;
+}
+
+static uint8_t rswap_ec_exp[510];
+static uint8_t rswap_ec_log[256];
+
+static inline void rswap_ec_gf_init(void)
+{
+	unsigned int i, x = 1;
+
+	for (i = 0; i < 255; i++) {
+		rswap_ec_exp[i] = rswap_ec_exp[i + 255] = x;
+		rswap_ec_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= 0x11d;
+	}
+}
+
+static inline uint8_t rswap_ec_mul(uint8_t a, uint8_t b)
+{
+	if (!a || !b)
+		return 0;
+	return rswap_ec_exp[rswap_ec_log[a] + rswap_ec_log[b]];
+}
+
+static inline uint8_t rswap_ec_div(uint8_t a, uint8_t b)
+{
+	if (!a)
+		return 0;
+	return rswap_ec_exp[rswap_ec_log[a] + 255 - rswap_ec_log[b]];
+}
+
+// 2 * x on each byte
+static inline uint64_t rswap_ec_mul2(uint64_t x)
+{
+	uint64_t high = (x >> 7) & 0x0101010101010101ULL;
+
+	return ((x << 1) & 0xfefefefefefefefeULL) ^ (high * 0x1d);
+}
+
+// P and Q of the data fragments, len a multiple of 8.
+static inline void rswap_ec_encode(uint8_t *frag[RSWAP_EC_N], size_t len)
+{
+	uint64_t *p = (uint64_t *)frag[RSWAP_EC_P];
+	uint64_t *q = (uint64_t *)frag[RSWAP_EC_Q];
+	size_t w;
+	int i;
+
+	for (w = 0; w < len / 8; w++) {
+		uint64_t d = ((uint64_t *)frag[RSWAP_EC_K - 1])[w];
+		uint64_t pw = d, qw = d;
+
+		// Horner, from the highest power of g
+		for (i = RSWAP_EC_K - 2; i >= 0; i--) {
+			d = ((uint64_t *)frag[i])[w];
+			pw ^= d;
+			qw = rswap_ec_mul2(qw) ^ d;
+		}
+		p[w] = pw;
+		q[w] = qw;
+	}
+}
+
+/*
+ * Rebuilds the fragments in the lost mask from the others, in place.
+ * Returns -1 if more than RSWAP_EC_M are lost.
+ */
+static inline int rswap_ec_decode(uint8_t *frag[RSWAP_EC_N], size_t len, unsigned int lost)
+{
+	unsigned int data_lost = lost & RSWAP_EC_DATA;
+	int a = -1, b = -1, i;
+	size_t n;
+
+	if (__builtin_popcount(lost) > RSWAP_EC_M)
+		return -1;
+	for (i = 0; i < RSWAP_EC_K; i++) {
+		if (!(data_lost & (1U << i)))
+			continue;
+		if (a < 0)
+			a = i;
+		else
+			b = i;
+	}
+
+	if (b >= 0) {
+		// two data fragments, from P and Q:
+		// Da ^ Db = Pab, g^a Da ^ g^b Db = Qab
+		uint8_t ga = rswap_ec_exp[a], gb = rswap_ec_exp[b];
+		uint8_t denom = ga ^ gb;
+
+		for (n = 0; n < len; n++) {
+			uint8_t pab = frag[RSWAP_EC_P][n], qab = frag[RSWAP_EC_Q][n];
+
+			for (i = 0; i < RSWAP_EC_K; i++) {
+				if (i == a || i == b)
+					continue;
+				pab ^= frag[i][n];
+				qab ^= rswap_ec_mul(rswap_ec_exp[i], frag[i][n]);
+			}
+			frag[a][n] = rswap_ec_div(qab ^ rswap_ec_mul(gb, pab), denom);
+			frag[b][n] = pab ^ frag[a][n];
+		}
+		return 0;
+	}
+
+	if (a >= 0 && !(lost & (1U << RSWAP_EC_P))) {
+		// one data fragment, from P
+		memcpy(frag[a], frag[RSWAP_EC_P], len);
+		for (i = 0; i < RSWAP_EC_K; i++) {
+			if (i == a)
+				continue;
+			for (n = 0; n < len; n++)
+				frag[a][n] ^= frag[i][n];
+		}
+	} else if (a >= 0) {
+		// one data fragment and P, from Q
+		for (n = 0; n < len; n++) {
+			uint8_t qa = frag[RSWAP_EC_Q][n];
+
+			for (i = 0; i < RSWAP_EC_K; i++) {
+				if (i != a)
+					qa ^= rswap_ec_mul(rswap_ec_exp[i], frag[i][n]);
+			}
+			frag[a][n] = rswap_ec_div(qa, rswap_ec_exp[a]);
+		}
+	}
+	// the data is whole, the parity is computed again
+	if (lost & ~RSWAP_EC_DATA)
+		rswap_ec_encode(frag, len);
+	return 0;
+}
+
+#endif // __RSWAP_EC_H
@@ -0,0 +1,1638 @@
+/*
+ * rswap-server: the memory server of Canvas.
+ *
+ * The server exports its memory pool to the rswap client in chunks. The pool
+ * is split over the NUMA nodes of the server, backed by hugepages and
+ * registered to the RNIC once at start-up, so a client only gets the rkey
+ * and address of its chunks.
+ *
+ * Connections are handled by a multi-threaded CM event loop: the listener
+ * thread only takes connect requests and migrates every new rdma_cm_id to the
+ * event channel of a worker thread. A worker owns all the events of its
+ * connections, CM and completion events alike, so a connection is never
+ * touched by two threads and the server accepts any number of queues.
+ *
+ * One server serves many clients (CPU servers), told apart by their ip. Each
+ * client gets and returns chunks one by one or in batches, within its quota.
+ * A part of the pool can be left to the one-sided allocator, in which the
+ * clients claim chunks with RDMA atomics on the alloc map of the server.
+ * The chunks of a gone client can be kept for a lease, so that a reloaded
+ * client reattaches to them without moving its data.
+ *
+ * With -T, the server talks to clients without RNIC over TCP instead, see
+ * the TCP transport in constants.h. The pool and the quotas are the same.
+ *
+ * Usage: ./rswap-server [-t workers] [-c chunk size in GB] [-q quota in GB]
+ *                       [-Q client ip=quota in GB]... [-r report period in s]
+ *                       [-o one-sided part of the pool in GB]
+ *                       [-l lease in s] [-T]
+ *                       <ip> <port> <pool size in GB>
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "constants.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define RSWAP_RECV_DEPTH 4 // outstanding 2-sided messages per queue
+#define RSWAP_CQ_DEPTH (2 * RSWAP_RECV_DEPTH)
+#define RSWAP_MAX_EVENTS 64
+#define RSWAP_DEFAULT_WORKERS 4
+#define RSWAP_DEFAULT_REPORT_SEC 60
+#define RSWAP_PAGE_SIZE 4096 // of the client, the unit of the TCP transport
+
+#define rswap_log(fmt, ...) fprintf(stderr, "%s, " fmt, __func__, ##__VA_ARGS__)
+
+/*
+ * Memory pool
+ */
+
+struct node_region {
+	int node;
+	char *addr;
+	size_t size;
+	const char *backing;
+	struct ibv_mr *mr;
+};
+
+struct client_session;
+
+struct mem_chunk {
+	char *addr;
+	uint32_t rkey;
+	int node;
+	struct client_session *owner;
+};
+
+struct mem_pool {
+	uint64_t chunk_size;
+	uint32_t chunk_shift;
+	std::vector<struct node_region> regions;
+	std::vector<struct mem_chunk> chunks;
+
+	std::mutex lock;
+	size_t nr_free;
+};
+
+/*
+ * Connections and clients
+ */
+
+// All the queues connected from one client address.
+struct client_session {
+	std::string addr;
+	int nr_queues; // connected queues
+	int expected_queues; // announced by the client, 0 if unknown
+	size_t quota; // max #(chunks) held at a time
+	std::vector<int> chunks; // held, protected by mem_pool.lock
+
+	// accounting, in chunks
+	unsigned long nr_allocated;
+	unsigned long nr_released;
+	unsigned long nr_denied; // asked for but over quota or pool
+
+	int alloc_slot; // client slot in the alloc map, -1 if none
+	time_t lease_end; // chunks kept until then, 0 while connected
+};
+
+/*
+ * The one-sided alloc map, see constants.h. Its chunks are the last ones of
+ * the pool and are never handed out by messages. The server CPU only writes
+ * the map to set up a client slot and to take back the chunks of a gone
+ * client: storing 0 to an owner word can't race with a successful remote
+ * CAS, which needs the word to be 0 already.
+ */
+struct alloc_map {
+	char *addr;
+	size_t size;
+	struct ibv_mr *mr;
+	struct rswap_alloc_header *header;
+	volatile uint64_t *owner;
+	struct rswap_extent *extents;
+	volatile struct rswap_alloc_client *clients;
+
+	size_t first_chunk; // its chunk 0 in mem_pool.chunks
+	bool slot_used[RSWAP_MAX_CLIENTS]; // protected by session_lock
+};
+
+struct rswap_worker;
+
+struct rswap_conn {
+	struct rdma_cm_id *cm_id;
+	struct rswap_worker *worker;
+	struct client_session *session;
+
+	struct ibv_cq *cq;
+	unsigned int cq_events; // completion events to ack before destroying cq
+
+	struct message *recv_msgs; // RSWAP_RECV_DEPTH recv slots
+	struct message *send_msgs; // the reply of every recv slot
+	struct ibv_mr *recv_mr;
+	struct ibv_mr *send_mr;
+
+	uint8_t responder_resources;
+	uint8_t initiator_depth;
+	struct rswap_conn_param param;
+	bool has_param;
+};
+
+struct rswap_worker {
+	int id;
+	std::thread thread;
+
+	int epfd;
+	int evfd; // signals new connections in setup_queue
+	struct rdma_event_channel *cm_channel;
+	struct ibv_comp_channel *comp_channel;
+
+	std::mutex lock;
+	std::deque<struct rswap_conn *> setup_queue;
+
+	std::atomic<unsigned long> nr_conns;
+	std::atomic<unsigned long> nr_messages;
+};
+
+struct rswap_server {
+	struct sockaddr_in addr;
+	struct rdma_event_channel *listen_channel;
+	struct rdma_cm_id *listen_id;
+	struct ibv_context *ctx;
+	struct ibv_pd *pd;
+
+	struct mem_pool pool;
+	std::vector<struct rswap_worker *> workers;
+	unsigned int next_worker;
+
+	std::mutex session_lock;
+	std::map<std::string, struct client_session *> sessions;
+
+	size_t default_quota; // in chunks, 0: no limit
+	std::map<std::string, size_t> quotas; // per-client, in chunks
+	unsigned int report_sec;
+	unsigned int lease_sec; // keep the chunks of a gone client, 0: don't
+
+	struct alloc_map alloc_map;
+};
+
+static struct rswap_server server;
+
+// owner of the chunks of the alloc map in mem_pool.chunks
+static struct client_session one_sided_owner;
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0)
+		return -errno;
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -errno;
+	return 0;
+}
+
+static const char *message_name(int type)
+{
+	static const char *const names[] = {
+		"DONE",		 "GOT_CHUNKS",	 "GOT_SINGLE_CHUNK",
+		"FREE_SIZE",	 "EVICT",	 "ACTIVITY",
+		"STOP",		 "REQUEST_CHUNKS", "REQUEST_SINGLE_CHUNK",
+		"QUERY",	 "AVAILABLE_TO_QUERY", "RELEASE_CHUNKS",
+		"QUERY_ALLOC_MAP", "ALLOC_MAP", "REATTACH_CHUNKS",
+	};
+
+	if (type < DONE || type > REATTACH_CHUNKS)
+		return "ERROR Message Type";
+	return names[type - DONE];
+}
+
+/*
+ * mmap @size bytes of hugepages bound to @node. Prefer 1GB hugetlb pages,
+ * then the default hugetlb size, then transparent hugepages.
+ */
+static char *alloc_node_memory(int node, size_t size, const char **backing)
+{
+	static const struct {
+		int flags;
+		const char *name;
+	} backings[] = {
+		// without MAP_NORESERVE, hugetlb mmap fails if no page is reserved
+		{ MAP_HUGETLB | MAP_HUGE_1GB, "hugetlb 1GB" },
+		{ MAP_HUGETLB, "hugetlb" },
+		{ MAP_NORESERVE, "thp" },
+	};
+	unsigned long nodemask;
+	char *addr = (char *)MAP_FAILED;
+	size_t i;
+
+	for (i = 0; i < sizeof(backings) / sizeof(backings[0]); i++) {
+		addr = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+				    MAP_PRIVATE | MAP_ANONYMOUS | backings[i].flags,
+				    -1, 0);
+		if (addr != MAP_FAILED)
+			break;
+	}
+	if (addr == MAP_FAILED) {
+		rswap_log("mmap %zu bytes failed, %s\n", size, strerror(errno));
+		return NULL;
+	}
+	*backing = backings[i].name;
+
+	if (!(backings[i].flags & MAP_HUGETLB) &&
+	    madvise(addr, size, MADV_HUGEPAGE))
+		rswap_log("madvise(MADV_HUGEPAGE) failed, %s\n",
+			  strerror(errno));
+
+	if (node >= 0) {
+		nodemask = 1UL << node;
+		if (mbind(addr, size, MPOL_BIND, &nodemask,
+			  sizeof(nodemask) * 8, MPOL_MF_STRICT)) {
+			rswap_log("mbind to node %d failed, %s\n", node,
+				  strerror(errno));
+			munmap(addr, size);
+			return NULL;
+		}
+	}
+	return addr;
+}
+
+/*
+ * Chunk i of the pool lives on node (i % nr_nodes), so that the memory of a
+ * client is interleaved over all the nodes.
+ */
+static int init_memory_pool(struct mem_pool *pool, uint64_t pool_size)
+{
+	int nr_nodes = 1, use_numa = numa_available() >= 0;
+	size_t nr_chunks = pool_size >> pool->chunk_shift;
+	size_t i;
+	int n;
+
+	if (!nr_chunks) {
+		rswap_log("pool size %lu is smaller than a chunk %lu\n",
+			  (unsigned long)pool_size,
+			  (unsigned long)pool->chunk_size);
+		return -EINVAL;
+	}
+	if (use_numa)
+		nr_nodes = numa_num_configured_nodes();
+	if ((size_t)nr_nodes > nr_chunks)
+		nr_nodes = nr_chunks;
+
+	for (n = 0; n < nr_nodes; n++) {
+		struct node_region region;
+		size_t node_chunks = nr_chunks / nr_nodes +
+				     ((size_t)n < nr_chunks % nr_nodes);
+
+		region.node = use_numa ? n : -1;
+		region.size = node_chunks * pool->chunk_size;
+		region.addr = alloc_node_memory(region.node, region.size,
+						&region.backing);
+		if (!region.addr)
+			return -ENOMEM;
+
+		// pins and faults in the memory, on the bound node
+		region.mr = NULL;
+		if (server.pd)
+			region.mr = ibv_reg_mr(server.pd, region.addr,
+					       region.size,
+					       IBV_ACCESS_LOCAL_WRITE |
+						       IBV_ACCESS_REMOTE_WRITE |
+						       IBV_ACCESS_REMOTE_READ);
+		else if (mlock(region.addr, region.size))
+			rswap_log("mlock %zu bytes on node %d failed, %s\n",
+				  region.size, region.node, strerror(errno));
+		if (server.pd && !region.mr) {
+			rswap_log("register %zu bytes on node %d failed, %s\n",
+				  region.size, region.node, strerror(errno));
+			munmap(region.addr, region.size);
+			return -ENOMEM;
+		}
+
+		rswap_log("node %d: %zu chunks, %zu GB, %s, rkey 0x%x\n",
+			  region.node, node_chunks, region.size / ONE_GB,
+			  region.backing, region.mr ? region.mr->rkey : 0);
+		pool->regions.push_back(region);
+	}
+
+	for (i = 0; i < nr_chunks; i++) {
+		struct node_region *region = &pool->regions[i % nr_nodes];
+		struct mem_chunk chunk;
+
+		chunk.addr = region->addr + (i / nr_nodes) * pool->chunk_size;
+		chunk.rkey = region->mr ? region->mr->rkey : 0;
+		chunk.node = region->node;
+		chunk.owner = NULL;
+		pool->chunks.push_back(chunk);
+	}
+	pool->nr_free = nr_chunks;
+	return 0;
+}
+
+/*
+ * Hand the last @nr chunks of the pool over to the one-sided allocator and
+ * export the alloc map describing them.
+ */
+static int init_alloc_map(struct mem_pool *pool, size_t nr)
+{
+	struct alloc_map *map = &server.alloc_map;
+	size_t owner_off, extent_off, client_off, i;
+
+	if (nr > pool->chunks.size())
+		nr = pool->chunks.size();
+
+	owner_off = sizeof(struct rswap_alloc_header);
+	extent_off = owner_off + nr * sizeof(uint64_t);
+	client_off = extent_off + nr * sizeof(struct rswap_extent);
+	map->size = client_off +
+		    RSWAP_MAX_CLIENTS * sizeof(struct rswap_alloc_client);
+
+	map->addr = (char *)mmap(NULL, map->size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map->addr == MAP_FAILED)
+		return -ENOMEM;
+	map->header = (struct rswap_alloc_header *)map->addr;
+	map->owner = (volatile uint64_t *)(map->addr + owner_off);
+	map->extents = (struct rswap_extent *)(map->addr + extent_off);
+	map->clients =
+		(volatile struct rswap_alloc_client *)(map->addr + client_off);
+
+	map->header->magic = RSWAP_ALLOC_MAGIC;
+	map->header->nr_chunks = nr;
+	map->header->chunk_shift = pool->chunk_shift;
+	map->header->nr_clients = RSWAP_MAX_CLIENTS;
+	map->header->cursor = 0;
+	map->header->owner_off = owner_off;
+	map->header->extent_off = extent_off;
+	map->header->client_off = client_off;
+
+	map->first_chunk = pool->chunks.size() - nr;
+	for (i = 0; i < nr; i++) {
+		struct mem_chunk *chunk = &pool->chunks[map->first_chunk + i];
+
+		chunk->owner = &one_sided_owner;
+		map->extents[i].addr = (uint64_t)chunk->addr;
+		map->extents[i].rkey = chunk->rkey;
+		map->extents[i].node = chunk->node;
+	}
+	pool->nr_free -= nr;
+
+	map->mr = ibv_reg_mr(server.pd, map->addr, map->size,
+			     IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+				     IBV_ACCESS_REMOTE_ATOMIC);
+	if (!map->mr) {
+		rswap_log("register alloc map failed, %s\n", strerror(errno));
+		return -ENOMEM;
+	}
+	rswap_log("%zu chunks for the one-sided allocator, alloc map %zu bytes, rkey 0x%x\n",
+		  nr, map->size, map->mr->rkey);
+	return 0;
+}
+
+// Caller holds session_lock.
+static int get_alloc_slot(struct client_session *session)
+{
+	struct alloc_map *map = &server.alloc_map;
+	int slot;
+
+	if (!map->mr)
+		return -1;
+	if (session->alloc_slot >= 0)
+		return session->alloc_slot;
+
+	for (slot = 0; slot < RSWAP_MAX_CLIENTS; slot++) {
+		if (map->slot_used[slot])
+			continue;
+		map->slot_used[slot] = true;
+		map->clients[slot].used = 0;
+		map->clients[slot].quota = session->quota;
+		session->alloc_slot = slot;
+		return slot;
+	}
+	rswap_log("no free slot in the alloc map for client %s\n",
+		  session->addr.c_str());
+	return -1;
+}
+
+// #(chunks) claimed by @slot in the alloc map.
+static size_t alloc_slot_chunks(int slot)
+{
+	struct alloc_map *map = &server.alloc_map;
+	size_t nr = 0, i;
+
+	for (i = 0; map->mr && i < map->header->nr_chunks; i++)
+		nr += map->owner[i] == (uint64_t)slot + 1;
+	return nr;
+}
+
+// Take back what a gone client claimed. Caller holds session_lock.
+static void put_alloc_slot(struct client_session *session)
+{
+	struct alloc_map *map = &server.alloc_map;
+	int slot = session->alloc_slot;
+	size_t nr = 0, i;
+
+	if (slot < 0)
+		return;
+
+	for (i = 0; i < map->header->nr_chunks; i++) {
+		if (map->owner[i] != (uint64_t)slot + 1)
+			continue;
+		map->owner[i] = 0;
+		nr++;
+	}
+	map->clients[slot].used = 0;
+	map->slot_used[slot] = false;
+	session->alloc_slot = -1;
+	if (nr)
+		rswap_log("client %s left %zu one-sided chunks, take them back\n",
+			  session->addr.c_str(), nr);
+}
+
+// #(chunks) @session can still get. Caller holds pool->lock.
+static size_t grantable_chunks(struct mem_pool *pool,
+			       struct client_session *session)
+{
+	size_t nr = pool->nr_free;
+	size_t held = session->chunks.size();
+
+	if (session->quota)
+		nr = std::min(nr, session->quota > held ? session->quota - held :
+							  0);
+	// a message carries at most MAX_REGION_NUM chunks in total
+	return std::min(nr, MAX_REGION_NUM > held ? MAX_REGION_NUM - held : 0);
+}
+
+static int free_chunk_num(struct mem_pool *pool,
+			  struct client_session *session)
+{
+	std::lock_guard<std::mutex> guard(pool->lock);
+
+	return grantable_chunks(pool, session);
+}
+
+// Hand out up to @nr free chunks to @session, fill them in @msg.
+static int alloc_chunks(struct mem_pool *pool, struct client_session *session,
+			struct message *msg, int nr)
+{
+	std::lock_guard<std::mutex> guard(pool->lock);
+	size_t max = grantable_chunks(pool, session);
+	int got = 0;
+	size_t i;
+
+	if (nr < 0)
+		nr = 0;
+	if ((size_t)nr > max) {
+		session->nr_denied += nr - max;
+		nr = max;
+	}
+
+	for (i = 0; i < pool->chunks.size() && got < nr; i++) {
+		struct mem_chunk *chunk = &pool->chunks[i];
+
+		if (chunk->owner)
+			continue;
+		chunk->owner = session;
+		session->chunks.push_back(i);
+		pool->nr_free--;
+
+		msg->buf[got] = (uint64_t)chunk->addr;
+		msg->rkey[got] = chunk->rkey;
+		msg->mapped_size[got] = pool->chunk_size;
+		got++;
+	}
+	session->nr_allocated += got;
+	return got;
+}
+
+// Return the chunks of @session at @addrs, the ones it does not hold are
+// skipped.
+static int release_chunks_at(struct mem_pool *pool,
+			     struct client_session *session,
+			     const uint64_t *addrs, int nr)
+{
+	std::lock_guard<std::mutex> guard(pool->lock);
+	int released = 0;
+
+	for (int n = 0; n < nr && n < MAX_REGION_NUM; n++) {
+		auto it = std::find_if(session->chunks.begin(),
+				       session->chunks.end(), [&](int i) {
+					       return (uint64_t)pool->chunks[i]
+							      .addr == addrs[n];
+				       });
+
+		if (it == session->chunks.end()) {
+			rswap_log("client %s does not hold chunk 0x%lx\n",
+				  session->addr.c_str(),
+				  (unsigned long)addrs[n]);
+			continue;
+		}
+		pool->chunks[*it].owner = NULL;
+		pool->nr_free++;
+		session->chunks.erase(it);
+		released++;
+	}
+	session->nr_released += released;
+	return released;
+}
+
+static void release_chunks(struct mem_pool *pool,
+			   struct client_session *session)
+{
+	std::lock_guard<std::mutex> guard(pool->lock);
+
+	for (int i : session->chunks) {
+		pool->chunks[i].owner = NULL;
+		pool->nr_free++;
+	}
+	session->nr_released += session->chunks.size();
+	session->chunks.clear();
+}
+
+/*
+ * Give back the chunks at @req->buf that @session still holds, in the same
+ * order, the ones it lost get rkey 0.
+ */
+static int reattach_chunks(struct mem_pool *pool,
+			   struct client_session *session,
+			   const struct message *req, struct message *resp)
+{
+	struct alloc_map *map = &server.alloc_map;
+	std::lock_guard<std::mutex> guard(pool->lock);
+	int found = 0;
+
+	for (int n = 0; n < req->mapped_chunk && n < MAX_REGION_NUM; n++) {
+		for (size_t i = 0; i < pool->chunks.size(); i++) {
+			struct mem_chunk *chunk = &pool->chunks[i];
+			bool held;
+
+			if ((uint64_t)chunk->addr != req->buf[n])
+				continue;
+			if (chunk->owner == &one_sided_owner)
+				held = session->alloc_slot >= 0 &&
+				       map->owner[i - map->first_chunk] ==
+					       (uint64_t)session->alloc_slot + 1;
+			else
+				held = chunk->owner == session;
+			if (held) {
+				resp->buf[n] = req->buf[n];
+				resp->rkey[n] = chunk->rkey;
+				resp->mapped_size[n] = pool->chunk_size;
+				found++;
+			}
+			break;
+		}
+	}
+	return found;
+}
+
+/*
+ * Client sessions
+ */
+
+// A new queue of the client at @peer, which has @nr_queues, 0 if unknown.
+static struct client_session *get_session_at(struct sockaddr_in *peer,
+					     int nr_queues)
+{
+	char ip[INET_ADDRSTRLEN] = "unknown";
+	struct client_session *session;
+
+	inet_ntop(AF_INET, &peer->sin_addr, ip, sizeof(ip));
+
+	std::lock_guard<std::mutex> guard(server.session_lock);
+	auto it = server.sessions.find(ip);
+	if (it == server.sessions.end()) {
+		auto quota = server.quotas.find(ip);
+
+		session = new client_session();
+		session->addr = ip;
+		session->nr_queues = 0;
+		session->expected_queues = 0;
+		session->quota = quota != server.quotas.end() ?
+					 quota->second :
+					 server.default_quota;
+		session->nr_allocated = 0;
+		session->nr_released = 0;
+		session->nr_denied = 0;
+		session->alloc_slot = -1;
+		session->lease_end = 0;
+		server.sessions[ip] = session;
+		rswap_log("new client %s, quota %zu chunks\n", ip,
+			  session->quota);
+	} else {
+		session = it->second;
+		if (session->lease_end) {
+			rswap_log("client %s is back, %zu chunks kept for it\n",
+				  ip, session->chunks.size());
+			session->lease_end = 0;
+		}
+	}
+	session->nr_queues++;
+	if (nr_queues)
+		session->expected_queues = nr_queues;
+	return session;
+}
+
+static struct client_session *get_session(struct rswap_conn *conn)
+{
+	return get_session_at(
+		(struct sockaddr_in *)rdma_get_peer_addr(conn->cm_id),
+		conn->has_param ? conn->param.num_queues : 0);
+}
+
+// Caller holds session_lock.
+static void drop_session(struct client_session *session)
+{
+	rswap_log("client %s gone, release %zu chunks\n",
+		  session->addr.c_str(), session->chunks.size());
+	release_chunks(&server.pool, session);
+	put_alloc_slot(session);
+	server.sessions.erase(session->addr);
+	delete session;
+}
+
+/*
+ * The chunks of a client go back to the pool with its last queue, or when
+ * its lease ends if it may come back for them.
+ */
+static void put_session(struct client_session *session)
+{
+	std::lock_guard<std::mutex> guard(server.session_lock);
+
+	if (--session->nr_queues)
+		return;
+
+	if (server.lease_sec &&
+	    (session->chunks.size() || session->alloc_slot >= 0)) {
+		session->lease_end = time(NULL) + server.lease_sec;
+		rswap_log("client %s disconnected, keep %zu chunks for %u s\n",
+			  session->addr.c_str(), session->chunks.size(),
+			  server.lease_sec);
+		return;
+	}
+	drop_session(session);
+}
+
+static void lease_loop(void)
+{
+	for (;;) {
+		sleep(1);
+
+		std::lock_guard<std::mutex> guard(server.session_lock);
+		time_t now = time(NULL);
+
+		for (auto it = server.sessions.begin();
+		     it != server.sessions.end();) {
+			struct client_session *session = (it++)->second;
+
+			if (session->lease_end && now >= session->lease_end)
+				drop_session(session);
+		}
+	}
+}
+
+/*
+ * 2-sided messages
+ */
+
+static int post_recv(struct rswap_conn *conn, int slot)
+{
+	struct ibv_recv_wr wr = {}, *bad_wr;
+	struct ibv_sge sge;
+
+	sge.addr = (uint64_t)&conn->recv_msgs[slot];
+	sge.length = sizeof(struct message);
+	sge.lkey = conn->recv_mr->lkey;
+
+	wr.wr_id = slot;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	return ibv_post_recv(conn->cm_id->qp, &wr, &bad_wr);
+}
+
+static int send_message(struct rswap_conn *conn, int slot)
+{
+	struct ibv_send_wr wr = {}, *bad_wr;
+	struct ibv_sge sge;
+	int ret;
+
+	sge.addr = (uint64_t)&conn->send_msgs[slot];
+	sge.length = sizeof(struct message);
+	sge.lkey = conn->send_mr->lkey;
+
+	wr.wr_id = slot;
+	wr.opcode = IBV_WR_SEND;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	ret = ibv_post_send(conn->cm_id->qp, &wr, &bad_wr);
+	if (ret)
+		rswap_log("send %s failed, %d\n",
+			  message_name(conn->send_msgs[slot].type), ret);
+	return ret;
+}
+
+static void handle_message(struct rswap_conn *conn, int slot)
+{
+	struct message *req = &conn->recv_msgs[slot];
+	struct message *resp = &conn->send_msgs[slot];
+	int found;
+
+	memset(resp, 0, sizeof(*resp));
+	switch (req->type) {
+	case QUERY:
+		resp->type = FREE_SIZE;
+		resp->mapped_chunk = free_chunk_num(&server.pool, conn->session);
+		break;
+	case REQUEST_CHUNKS:
+		resp->type = GOT_CHUNKS;
+		resp->mapped_chunk = alloc_chunks(&server.pool, conn->session,
+						  resp, req->mapped_chunk);
+		rswap_log("client %s asked for %d chunks, got %d\n",
+			  conn->session->addr.c_str(), req->mapped_chunk,
+			  resp->mapped_chunk);
+		break;
+	case REQUEST_SINGLE_CHUNK:
+		resp->type = GOT_SINGLE_CHUNK;
+		resp->mapped_chunk = alloc_chunks(&server.pool, conn->session,
+						  resp, 1);
+		break;
+	case QUERY_ALLOC_MAP:
+		resp->type = ALLOC_MAP;
+		{
+			std::lock_guard<std::mutex> guard(server.session_lock);
+
+			resp->mapped_chunk = get_alloc_slot(conn->session);
+		}
+		if (resp->mapped_chunk >= 0) {
+			resp->buf[0] = (uint64_t)server.alloc_map.addr;
+			resp->rkey[0] = server.alloc_map.mr->rkey;
+			resp->mapped_size[0] = server.alloc_map.size;
+		}
+		break;
+	case REATTACH_CHUNKS:
+		resp->type = GOT_CHUNKS;
+		resp->mapped_chunk = req->mapped_chunk;
+		found = reattach_chunks(&server.pool, conn->session, req, resp);
+		rswap_log("client %s reattached %d of %d chunks\n",
+			  conn->session->addr.c_str(), found,
+			  req->mapped_chunk);
+		break;
+	case RELEASE_CHUNKS:
+		resp->type = DONE;
+		resp->mapped_chunk = release_chunks_at(&server.pool,
+						       conn->session, req->buf,
+						       req->mapped_chunk);
+		rswap_log("client %s released %d chunks\n",
+			  conn->session->addr.c_str(), resp->mapped_chunk);
+		break;
+	default:
+		rswap_log("unexpected message %d, %s\n", req->type,
+			  message_name(req->type));
+		post_recv(conn, slot);
+		return;
+	}
+
+	conn->worker->nr_messages++;
+	// the client posts its recv before sending the request
+	if (post_recv(conn, slot))
+		rswap_log("repost recv failed\n");
+	send_message(conn, slot);
+}
+
+static void poll_conn_cq(struct rswap_conn *conn)
+{
+	struct ibv_wc wc[RSWAP_CQ_DEPTH];
+	int nr, i;
+
+	while ((nr = ibv_poll_cq(conn->cq, RSWAP_CQ_DEPTH, wc)) > 0) {
+		for (i = 0; i < nr; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				// flushed at disconnection
+				if (wc[i].status != IBV_WC_WR_FLUSH_ERR)
+					rswap_log("wc error %s, opcode %d\n",
+						  ibv_wc_status_str(wc[i].status),
+						  wc[i].opcode);
+				continue;
+			}
+			if (wc[i].opcode == IBV_WC_RECV) {
+				if (wc[i].byte_len != sizeof(struct message)) {
+					rswap_log("bogus message, size %u\n",
+						  wc[i].byte_len);
+					post_recv(conn, wc[i].wr_id);
+					continue;
+				}
+				handle_message(conn, wc[i].wr_id);
+			}
+		}
+	}
+	if (nr < 0)
+		rswap_log("poll cq failed\n");
+}
+
+/*
+ * Connection life cycle, run by the worker owning the connection
+ */
+
+static void destroy_conn(struct rswap_conn *conn)
+{
+	if (conn->cm_id->qp)
+		rdma_destroy_qp(conn->cm_id);
+	if (conn->cq) {
+		ibv_ack_cq_events(conn->cq, conn->cq_events);
+		ibv_destroy_cq(conn->cq);
+	}
+	if (conn->recv_mr)
+		ibv_dereg_mr(conn->recv_mr);
+	if (conn->send_mr)
+		ibv_dereg_mr(conn->send_mr);
+	free(conn->recv_msgs);
+	free(conn->send_msgs);
+	if (conn->session) {
+		put_session(conn->session);
+		conn->worker->nr_conns--;
+	}
+	rdma_destroy_id(conn->cm_id);
+	delete conn;
+}
+
+static int create_conn_resources(struct rswap_conn *conn)
+{
+	struct ibv_qp_init_attr attr = {};
+	size_t size = sizeof(struct message) * RSWAP_RECV_DEPTH;
+	int i, ret;
+
+	conn->recv_msgs = (struct message *)calloc(1, size);
+	conn->send_msgs = (struct message *)calloc(1, size);
+	if (!conn->recv_msgs || !conn->send_msgs)
+		return -ENOMEM;
+	conn->recv_mr = ibv_reg_mr(server.pd, conn->recv_msgs, size,
+				   IBV_ACCESS_LOCAL_WRITE);
+	conn->send_mr = ibv_reg_mr(server.pd, conn->send_msgs, size, 0);
+	if (!conn->recv_mr || !conn->send_mr)
+		return -ENOMEM;
+
+	conn->cq = ibv_create_cq(conn->cm_id->verbs, RSWAP_CQ_DEPTH, conn,
+				 conn->worker->comp_channel, 0);
+	if (!conn->cq)
+		return -ENOMEM;
+	ret = ibv_req_notify_cq(conn->cq, 0);
+	if (ret)
+		return -ret;
+
+	// data is moved by one-sided rdma, only messages use the queues
+	attr.cap.max_send_wr = RSWAP_RECV_DEPTH;
+	attr.cap.max_recv_wr = RSWAP_RECV_DEPTH;
+	attr.cap.max_send_sge = 1;
+	attr.cap.max_recv_sge = 1;
+	attr.qp_type = IBV_QPT_RC;
+	attr.send_cq = conn->cq;
+	attr.recv_cq = conn->cq;
+	if (rdma_create_qp(conn->cm_id, server.pd, &attr))
+		return -errno;
+
+	for (i = 0; i < RSWAP_RECV_DEPTH; i++) {
+		ret = post_recv(conn, i);
+		if (ret)
+			return -ret;
+	}
+	return 0;
+}
+
+static void setup_conn(struct rswap_conn *conn)
+{
+	struct rdma_conn_param conn_param = {};
+	struct rswap_conn_param param = {};
+	int ret;
+
+	param.magic = RSWAP_CONN_MAGIC;
+	param.chunk_shift = server.pool.chunk_shift;
+	if (conn->has_param) {
+		param.num_queues = conn->param.num_queues;
+		param.q_index = conn->param.q_index;
+	}
+
+	if (conn->has_param &&
+	    conn->param.chunk_shift != server.pool.chunk_shift) {
+		rswap_log("client chunk size 2^%u != server chunk size 2^%u, reject\n",
+			  conn->param.chunk_shift, server.pool.chunk_shift);
+		rdma_reject(conn->cm_id, &param, sizeof(param));
+		goto err;
+	}
+
+	ret = create_conn_resources(conn);
+	if (ret) {
+		rswap_log("create queue resources failed, %s\n",
+			  strerror(-ret));
+		rdma_reject(conn->cm_id, NULL, 0);
+		goto err;
+	}
+
+	conn_param.responder_resources = conn->initiator_depth;
+	conn_param.initiator_depth = conn->responder_resources;
+	conn_param.rnr_retry_count = 7;
+	conn_param.private_data = &param;
+	conn_param.private_data_len = sizeof(param);
+	if (rdma_accept(conn->cm_id, &conn_param)) {
+		rswap_log("accept failed, %s\n", strerror(errno));
+		goto err;
+	}
+
+	conn->session = get_session(conn);
+	conn->worker->nr_conns++;
+	return;
+
+err:
+	destroy_conn(conn);
+}
+
+static void conn_established(struct rswap_conn *conn)
+{
+	struct client_session *session = conn->session;
+	struct message *msg = &conn->send_msgs[0];
+
+	if (conn->has_param &&
+	    conn->param.q_index + 1 == session->expected_queues)
+		rswap_log("client %s connected all its %d queues\n",
+			  session->addr.c_str(), session->expected_queues);
+
+	// every queue of the client waits for this before querying memory
+	memset(msg, 0, sizeof(*msg));
+	msg->type = AVAILABLE_TO_QUERY;
+	send_message(conn, 0);
+}
+
+static void handle_conn_event(struct rdma_cm_event *event)
+{
+	struct rswap_conn *conn = (struct rswap_conn *)event->id->context;
+	enum rdma_cm_event_type type = event->event;
+
+	rdma_ack_cm_event(event);
+
+	switch (type) {
+	case RDMA_CM_EVENT_ESTABLISHED:
+		conn_established(conn);
+		break;
+	case RDMA_CM_EVENT_DISCONNECTED:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+	case RDMA_CM_EVENT_UNREACHABLE:
+	case RDMA_CM_EVENT_REJECTED:
+	case RDMA_CM_EVENT_DEVICE_REMOVAL:
+		destroy_conn(conn);
+		break;
+	default:
+		rswap_log("ignore cm event %s\n", rdma_event_str(type));
+		break;
+	}
+}
+
+static void worker_handle_cm_events(struct rswap_worker *worker)
+{
+	struct rdma_cm_event *event;
+
+	while (!rdma_get_cm_event(worker->cm_channel, &event))
+		handle_conn_event(event);
+	if (errno != EAGAIN)
+		rswap_log("get cm event failed, %s\n", strerror(errno));
+}
+
+static void worker_handle_cq_events(struct rswap_worker *worker)
+{
+	struct ibv_cq *cq;
+	void *ctx;
+
+	while (!ibv_get_cq_event(worker->comp_channel, &cq, &ctx)) {
+		struct rswap_conn *conn = (struct rswap_conn *)ctx;
+
+		conn->cq_events++;
+		ibv_req_notify_cq(cq, 0);
+		poll_conn_cq(conn);
+	}
+}
+
+static void worker_handle_setup(struct rswap_worker *worker)
+{
+	std::deque<struct rswap_conn *> queue;
+	uint64_t cnt;
+
+	if (read(worker->evfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		rswap_log("read eventfd failed, %s\n", strerror(errno));
+
+	{
+		std::lock_guard<std::mutex> guard(worker->lock);
+		queue.swap(worker->setup_queue);
+	}
+	for (struct rswap_conn *conn : queue)
+		setup_conn(conn);
+}
+
+static void worker_loop(struct rswap_worker *worker)
+{
+	struct epoll_event events[RSWAP_MAX_EVENTS];
+	int nr, i;
+
+	for (;;) {
+		nr = epoll_wait(worker->epfd, events, RSWAP_MAX_EVENTS, -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			rswap_log("worker %d epoll failed, %s\n", worker->id,
+				  strerror(errno));
+			return;
+		}
+
+		for (i = 0; i < nr; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == worker->evfd)
+				worker_handle_setup(worker);
+			else if (fd == worker->cm_channel->fd)
+				worker_handle_cm_events(worker);
+			else if (fd == worker->comp_channel->fd)
+				worker_handle_cq_events(worker);
+		}
+	}
+}
+
+static int epoll_add(int epfd, int fd)
+{
+	struct epoll_event ev = {};
+
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (set_nonblock(fd) || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		return -errno;
+	return 0;
+}
+
+static struct rswap_worker *create_worker(int id)
+{
+	struct rswap_worker *worker = new rswap_worker();
+
+	worker->id = id;
+	worker->nr_conns = 0;
+	worker->nr_messages = 0;
+	worker->epfd = epoll_create1(0);
+	worker->evfd = eventfd(0, EFD_NONBLOCK);
+	worker->cm_channel = rdma_create_event_channel();
+	worker->comp_channel = ibv_create_comp_channel(server.ctx);
+	if (worker->epfd < 0 || worker->evfd < 0 || !worker->cm_channel ||
+	    !worker->comp_channel) {
+		rswap_log("worker %d: create channels failed, %s\n", id,
+			  strerror(errno));
+		return NULL;
+	}
+
+	if (epoll_add(worker->epfd, worker->evfd) ||
+	    epoll_add(worker->epfd, worker->cm_channel->fd) ||
+	    epoll_add(worker->epfd, worker->comp_channel->fd)) {
+		rswap_log("worker %d: epoll_ctl failed, %s\n", id,
+			  strerror(errno));
+		return NULL;
+	}
+
+	worker->thread = std::thread(worker_loop, worker);
+	return worker;
+}
+
+/*
+ * Accounting report of the remote memory of every client
+ */
+
+static void report_clients(void)
+{
+	struct mem_pool *pool = &server.pool;
+	unsigned long chunk_gb = pool->chunk_size / ONE_GB;
+
+	std::lock_guard<std::mutex> session_guard(server.session_lock);
+	std::lock_guard<std::mutex> pool_guard(pool->lock);
+
+	fprintf(stderr, "pool: %zu/%zu chunks free, %lu GB each, %zu clients\n",
+		pool->nr_free, pool->chunks.size(), chunk_gb,
+		server.sessions.size());
+	for (auto &it : server.sessions) {
+		struct client_session *session = it.second;
+
+		fprintf(stderr,
+			"  client %s: %d queues, %zu GB held, quota %zu GB, allocated %lu released %lu denied %lu chunks\n",
+			session->addr.c_str(), session->nr_queues,
+			session->chunks.size() * chunk_gb,
+			session->quota * chunk_gb, session->nr_allocated,
+			session->nr_released, session->nr_denied);
+		if (session->lease_end)
+			fprintf(stderr, "  client %s: gone, lease ends in %ld s\n",
+				session->addr.c_str(),
+				(long)(session->lease_end - time(NULL)));
+		if (session->alloc_slot >= 0)
+			fprintf(stderr,
+				"  client %s: %zu GB claimed one-sided, slot %d\n",
+				session->addr.c_str(),
+				alloc_slot_chunks(session->alloc_slot) *
+					chunk_gb,
+				session->alloc_slot);
+	}
+	if (server.alloc_map.mr)
+		fprintf(stderr, "one-sided: %zu/%u chunks free\n",
+			alloc_slot_chunks(-1), server.alloc_map.header->nr_chunks);
+	for (struct rswap_worker *worker : server.workers)
+		fprintf(stderr, "  worker %d: %lu queues, %lu messages\n",
+			worker->id, worker->nr_conns.load(),
+			worker->nr_messages.load());
+}
+
+static void report_loop(void)
+{
+	for (;;) {
+		sleep(server.report_sec);
+		report_clients();
+	}
+}
+
+/*
+ * TCP transport, see constants.h. A thread per connection serves its
+ * requests in order, copying the pages from and to the chunks of the client.
+ */
+
+static int tcp_recv(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+
+	while (len) {
+		ssize_t n = recv(fd, p, len, MSG_WAITALL);
+
+		if (n <= 0)
+			return n ? -errno : -ECONNRESET;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int tcp_send(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg = {};
+	struct iovec vec[2];
+	size_t left = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		vec[i] = iov[i];
+		left += iov[i].iov_len;
+	}
+	msg.msg_iov = vec;
+	msg.msg_iovlen = iovcnt;
+	while (left) {
+		ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+		if (n <= 0)
+			return n ? -errno : -ECONNRESET;
+		left -= n;
+		while (n && msg.msg_iovlen) {
+			size_t done = std::min((size_t)n, msg.msg_iov->iov_len);
+
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + done;
+			msg.msg_iov->iov_len -= done;
+			n -= done;
+			if (!msg.msg_iov->iov_len) {
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			}
+		}
+	}
+	return 0;
+}
+
+// Get @session up to @nr chunks in total, returns the chunks it holds.
+static size_t tcp_hello(struct client_session *session, size_t nr)
+{
+	struct message *msg = new message();
+	size_t held;
+
+	{
+		std::lock_guard<std::mutex> guard(server.pool.lock);
+
+		held = session->chunks.size();
+	}
+	if (held < nr)
+		alloc_chunks(&server.pool, session, msg, nr - held);
+	delete msg;
+
+	std::lock_guard<std::mutex> guard(server.pool.lock);
+	return session->chunks.size();
+}
+
+// Where the page at @addr of @session is, NULL if it holds no chunk there.
+static char *tcp_page_addr(struct client_session *session,
+			   std::vector<char *> *bases, uint64_t addr)
+{
+	size_t idx = addr >> server.pool.chunk_shift;
+
+	if (idx >= bases->size()) {
+		// the chunks got by another connection of the client
+		std::lock_guard<std::mutex> guard(server.pool.lock);
+
+		bases->clear();
+		for (int i : session->chunks)
+			bases->push_back(server.pool.chunks[i].addr);
+	}
+	if (idx >= bases->size() ||
+	    (addr & (server.pool.chunk_size - 1)) + RSWAP_PAGE_SIZE >
+		    server.pool.chunk_size)
+		return NULL;
+	return (*bases)[idx] + (addr & (server.pool.chunk_size - 1));
+}
+
+static void tcp_serve(int fd, struct sockaddr_in peer)
+{
+	struct client_session *session = get_session_at(&peer, 0);
+	static char discard[RSWAP_PAGE_SIZE];
+	std::vector<char *> bases;
+	struct rswap_tcp_hdr hdr;
+	struct iovec iov[2];
+	char *page;
+	int one = 1;
+	int ret;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	while (!(ret = tcp_recv(fd, &hdr, sizeof(hdr)))) {
+		if (hdr.magic != RSWAP_TCP_MAGIC) {
+			rswap_log("client %s sent a bad header\n",
+				  session->addr.c_str());
+			break;
+		}
+
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = sizeof(hdr);
+		hdr.status = 0;
+		switch (hdr.op) {
+		case RSWAP_TCP_HELLO:
+			if (hdr.id != server.pool.chunk_shift) {
+				rswap_log("client %s uses chunks of 1 << %lu bytes, not 1 << %u\n",
+					  session->addr.c_str(),
+					  (unsigned long)hdr.id,
+					  server.pool.chunk_shift);
+				hdr.status = EINVAL;
+				hdr.id = server.pool.chunk_shift;
+				hdr.addr = 0;
+			} else {
+				hdr.addr = tcp_hello(session, hdr.addr);
+			}
+			ret = tcp_send(fd, iov, 1);
+			break;
+		case RSWAP_TCP_STORE:
+			page = tcp_page_addr(session, &bases, hdr.addr);
+			if (!page) {
+				hdr.status = EFAULT;
+				page = discard;
+			}
+			ret = tcp_recv(fd, page, RSWAP_PAGE_SIZE);
+			if (!ret)
+				ret = tcp_send(fd, iov, 1);
+			break;
+		case RSWAP_TCP_LOAD:
+			page = tcp_page_addr(session, &bases, hdr.addr);
+			if (!page) {
+				hdr.status = EFAULT;
+				page = discard;
+			}
+			iov[1].iov_base = page;
+			iov[1].iov_len = RSWAP_PAGE_SIZE;
+			ret = tcp_send(fd, iov, 2);
+			break;
+		default:
+			rswap_log("client %s sent unknown op %u\n",
+				  session->addr.c_str(), hdr.op);
+			ret = -EINVAL;
+		}
+		if (ret)
+			break;
+	}
+	if (ret && ret != -ECONNRESET)
+		rswap_log("client %s connection error, %s\n",
+			  session->addr.c_str(), strerror(-ret));
+	close(fd);
+	put_session(session);
+}
+
+static int tcp_listen(const char *ip, int port)
+{
+	int one = 1;
+	int fd;
+
+	server.addr.sin_family = AF_INET;
+	server.addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &server.addr.sin_addr) != 1) {
+		rswap_log("bad ip %s\n", ip);
+		return -EINVAL;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&server.addr, sizeof(server.addr)) ||
+	    listen(fd, 128)) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static void tcp_listen_loop(int listen_fd)
+{
+	for (;;) {
+		struct sockaddr_in peer;
+		socklen_t len = sizeof(peer);
+		int fd = accept(listen_fd, (struct sockaddr *)&peer, &len);
+
+		if (fd < 0) {
+			rswap_log("accept failed, %s\n", strerror(errno));
+			continue;
+		}
+		std::thread(tcp_serve, fd, peer).detach();
+	}
+}
+
+/*
+ * Listener: hand every connect request over to a worker
+ */
+
+static void handle_connect_request(struct rdma_cm_event *event)
+{
+	struct rswap_worker *worker =
+		server.workers[server.next_worker++ % server.workers.size()];
+	struct rswap_conn *conn = new rswap_conn();
+	const struct rdma_conn_param *param = &event->param.conn;
+	struct rdma_cm_id *cm_id = event->id;
+	uint64_t one = 1;
+
+	conn->cm_id = cm_id;
+	conn->worker = worker;
+	conn->responder_resources = param->responder_resources;
+	conn->initiator_depth = param->initiator_depth;
+	if (param->private_data_len >= sizeof(conn->param)) {
+		memcpy(&conn->param, param->private_data, sizeof(conn->param));
+		conn->has_param = conn->param.magic == RSWAP_CONN_MAGIC;
+	}
+	cm_id->context = conn;
+
+	// all the later events of the connection go to the worker
+	rdma_ack_cm_event(event);
+	if (rdma_migrate_id(cm_id, worker->cm_channel)) {
+		rswap_log("migrate cm_id to worker %d failed, %s\n",
+			  worker->id, strerror(errno));
+		rdma_reject(cm_id, NULL, 0);
+		rdma_destroy_id(cm_id);
+		delete conn;
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(worker->lock);
+		worker->setup_queue.push_back(conn);
+	}
+	if (write(worker->evfd, &one, sizeof(one)) < 0)
+		rswap_log("wake up worker %d failed, %s\n", worker->id,
+			  strerror(errno));
+}
+
+static void listen_loop(void)
+{
+	struct rdma_cm_event *event;
+
+	while (!rdma_get_cm_event(server.listen_channel, &event)) {
+		if (event->event == RDMA_CM_EVENT_CONNECT_REQUEST) {
+			handle_connect_request(event);
+		} else {
+			rswap_log("ignore listener event %s\n",
+				  rdma_event_str(event->event));
+			rdma_ack_cm_event(event);
+		}
+	}
+	rswap_log("get cm event failed, %s\n", strerror(errno));
+}
+
+static int start_listen(const char *ip, int port)
+{
+	server.addr.sin_family = AF_INET;
+	server.addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &server.addr.sin_addr) != 1) {
+		rswap_log("bad ip %s\n", ip);
+		return -EINVAL;
+	}
+
+	server.listen_channel = rdma_create_event_channel();
+	if (!server.listen_channel)
+		return -errno;
+	if (rdma_create_id(server.listen_channel, &server.listen_id, NULL,
+			   RDMA_PS_TCP))
+		return -errno;
+	if (rdma_bind_addr(server.listen_id, (struct sockaddr *)&server.addr))
+		return -errno;
+
+	// the ip of the RNIC binds the listener to its device
+	server.ctx = server.listen_id->verbs;
+	if (!server.ctx) {
+		rswap_log("%s is not the ip of an RDMA device\n", ip);
+		return -ENODEV;
+	}
+	server.pd = ibv_alloc_pd(server.ctx);
+	if (!server.pd)
+		return -ENOMEM;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t workers] [-c chunk size in GB] [-q quota in GB]\n"
+		"          [-Q client ip=quota in GB]... [-r report period in s]\n"
+		"          [-o one-sided part of the pool in GB] [-l lease in s] [-T]\n"
+		"          <ip> <port> <pool size in GB>\n"
+		"  -t  #(threads) handling connections, default %d\n"
+		"  -c  chunk size, must match the client, default %d\n"
+		"  -q  remote memory quota of a client, default 0, no limit\n"
+		"  -Q  quota of the client at ip, overrides -q\n"
+		"  -r  period of the accounting report, 0 disables it, default %d\n"
+		"  -o  part of the pool claimed by the clients with RDMA atomics, default 0\n"
+		"  -l  keep the chunks of a gone client for a reload, default 0, release at once\n"
+		"  -T  serve the clients over TCP instead of RDMA\n",
+		prog, RSWAP_DEFAULT_WORKERS, REGION_SIZE_GB,
+		RSWAP_DEFAULT_REPORT_SEC);
+}
+
+// "ip=GB"
+static int parse_client_quota(const char *arg, uint64_t *gb, std::string *ip)
+{
+	const char *eq = strchr(arg, '=');
+
+	if (!eq || eq == arg)
+		return -EINVAL;
+	ip->assign(arg, eq - arg);
+	*gb = strtoull(eq + 1, NULL, 0);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_workers = RSWAP_DEFAULT_WORKERS;
+	uint64_t chunk_gb = REGION_SIZE_GB;
+	uint64_t quota_gb = 0, one_sided_gb = 0;
+	std::map<std::string, uint64_t> quotas_gb;
+	uint64_t pool_gb;
+	bool tcp = false;
+	int tcp_fd = -1;
+	int opt, i, ret;
+
+	server.report_sec = RSWAP_DEFAULT_REPORT_SEC;
+	while ((opt = getopt(argc, argv, "t:c:q:Q:r:o:l:Th")) != -1) {
+		std::string ip;
+		uint64_t gb;
+
+		switch (opt) {
+		case 't':
+			nr_workers = atoi(optarg);
+			break;
+		case 'c':
+			chunk_gb = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			quota_gb = strtoull(optarg, NULL, 0);
+			break;
+		case 'Q':
+			if (parse_client_quota(optarg, &gb, &ip)) {
+				usage(argv[0]);
+				return 1;
+			}
+			quotas_gb[ip] = gb;
+			break;
+		case 'r':
+			server.report_sec = atoi(optarg);
+			break;
+		case 'o':
+			one_sided_gb = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			server.lease_sec = atoi(optarg);
+			break;
+		case 'T':
+			tcp = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind < 3 || nr_workers <= 0 || !chunk_gb ||
+	    (chunk_gb & (chunk_gb - 1))) {
+		usage(argv[0]);
+		return 1;
+	}
+	// the client core count was needed by the old server
+	if (argc - optind > 3)
+		rswap_log("ignore the client core count %s, not needed anymore\n",
+			  argv[optind + 3]);
+
+	pool_gb = strtoull(argv[optind + 2], NULL, 0);
+	server.pool.chunk_size = chunk_gb * ONE_GB;
+	server.pool.chunk_shift = __builtin_ctzll(server.pool.chunk_size);
+	// a quota below one chunk is rounded up, 0 stays no limit
+	server.default_quota = (quota_gb + chunk_gb - 1) / chunk_gb;
+	for (auto &it : quotas_gb)
+		server.quotas[it.first] = (it.second + chunk_gb - 1) / chunk_gb;
+
+	if (tcp && one_sided_gb) {
+		rswap_log("the one-sided allocator needs RDMA\n");
+		return 1;
+	}
+	if (tcp) {
+		tcp_fd = tcp_listen(argv[optind], atoi(argv[optind + 1]));
+		ret = tcp_fd < 0 ? tcp_fd : 0;
+	} else {
+		ret = start_listen(argv[optind], atoi(argv[optind + 1]));
+	}
+	if (ret) {
+		rswap_log("bind %s:%s failed, %s\n", argv[optind],
+			  argv[optind + 1], strerror(-ret));
+		return 1;
+	}
+
+	ret = init_memory_pool(&server.pool, pool_gb * ONE_GB);
+	if (ret) {
+		rswap_log("init memory pool failed, %s\n", strerror(-ret));
+		return 1;
+	}
+	if (one_sided_gb) {
+		ret = init_alloc_map(&server.pool, one_sided_gb / chunk_gb);
+		if (ret) {
+			rswap_log("init alloc map failed, %s\n",
+				  strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (server.report_sec)
+		std::thread(report_loop).detach();
+	if (server.lease_sec)
+		std::thread(lease_loop).detach();
+
+	if (tcp) {
+		rswap_log("listening on %s:%s over TCP, %lu GB in %zu chunks of %lu GB\n",
+			  argv[optind], argv[optind + 1],
+			  (unsigned long)pool_gb, server.pool.chunks.size(),
+			  (unsigned long)chunk_gb);
+		tcp_listen_loop(tcp_fd);
+		return 1;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		struct rswap_worker *worker = create_worker(i);
+
+		if (!worker)
+			return 1;
+		server.workers.push_back(worker);
+	}
+
+	if (rdma_listen(server.listen_id, 128)) {
+		rswap_log("listen failed, %s\n", strerror(errno));
+		return 1;
+	}
+	rswap_log("listening on %s:%s, %lu GB in %zu chunks of %lu GB, %d workers\n",
+		  argv[optind], argv[optind + 1], (unsigned long)pool_gb,
+		  server.pool.chunks.size(), (unsigned long)chunk_gb,
+		  nr_workers);
+
+	listen_loop();
+	return 1;
+}
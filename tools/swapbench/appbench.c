@@ -0,0 +1,766 @@
+/*
+ * appbench - application workloads on remote memory.
+ *
+ * Tenants modelled on the ones Canvas is evaluated with, generated in memory
+ * with no external service:
+ *   kv      a hash table KV store serving Zipfian gets (and puts),
+ *   graph   PageRank over a CSR graph with skewed in-neighbours,
+ *   kmeans  k-means over a dense matrix of clustered points,
+ *   logreg  logistic regression over the same kind of matrix.
+ *
+ * The data set is built in the cgroup without a limit, which gives the
+ * memory it takes. Then the workload runs for -d seconds at every local
+ * memory ratio of -r, the cgroup limit being that ratio of the footprint,
+ * from the largest ratio down so that every step swaps more of it out.
+ */
+#include "bench.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define MAX_RATIOS 16
+#define KV_BATCH 64
+
+static struct {
+	uint64_t bytes;
+	int threads;
+	int duration;
+	double ratios[MAX_RATIOS];
+	int nr_ratios;
+	const char *cgroup;
+
+	int value_size; // kv
+	double theta; // kv gets, graph in-neighbours
+	int put_pct; // kv
+	int degree; // graph
+	int dims; // kmeans, logreg
+	int clusters; // kmeans
+} conf = {
+	.bytes = 1ULL << 30,
+	.threads = 1,
+	.duration = 10,
+	.cgroup = "appbench",
+	.value_size = 1024,
+	.theta = 0.99,
+	.degree = 16,
+	.dims = 32,
+	.clusters = 16,
+};
+
+struct app_thread {
+	pthread_t thread;
+	int id;
+	uint64_t lo, hi; // its share of the items of a round
+	uint64_t seed;
+	uint64_t units;
+	uint64_t sink; // keeps the reads
+	uint64_t errors;
+	struct bench_hist hist; // kv ops
+};
+
+struct app {
+	const char *name;
+	const char *unit; // of the throughput
+	// the threads finish a round over all the data together, then
+	// round_end() runs on one of them
+	bool rounds;
+	int (*build)(void);
+	uint64_t (*run)(struct app_thread *t);
+	void (*round_end)(void);
+	void (*report)(const char *prefix);
+};
+
+static const struct app *app;
+static struct app_thread *threads;
+static pthread_barrier_t barrier;
+static volatile int stop;
+static uint64_t deadline;
+static uint64_t nr_rounds;
+
+static void split(struct app_thread *t, uint64_t n)
+{
+	t->lo = n * t->id / conf.threads;
+	t->hi = n * (t->id + 1) / conf.threads;
+}
+
+// Run fn on all the threads, to build the data set in parallel.
+static void run_parallel(void *(*fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < conf.threads; i++)
+		pthread_create(&threads[i].thread, NULL, fn, &threads[i]);
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(threads[i].thread, NULL);
+}
+
+/*
+ * kv: open addressing over 64-bit keys, the values in a slab of their own.
+ * The first word of a value is its id, which every get checks.
+ */
+struct kv_slot {
+	uint64_t key; // 0: empty
+	uint64_t id;
+};
+
+static struct {
+	struct kv_slot *table;
+	uint64_t mask;
+	char *values;
+	uint64_t nr_keys;
+	struct bench_zipf zipf;
+} kv;
+
+static inline uint64_t kv_key(uint64_t id)
+{
+	return bench_scramble(id) | 1;
+}
+
+static inline uint64_t *kv_value(uint64_t id)
+{
+	return (uint64_t *)(kv.values + id * conf.value_size);
+}
+
+static void *kv_fill(void *arg)
+{
+	struct app_thread *t = arg;
+	uint64_t id, *v;
+	int i;
+
+	split(t, kv.nr_keys);
+	for (id = t->lo; id < t->hi; id++) {
+		v = kv_value(id);
+		v[0] = id;
+		for (i = 1; i < conf.value_size / 8; i++)
+			v[i] = id ^ i;
+	}
+	return NULL;
+}
+
+static int kv_build(void)
+{
+	uint64_t id, h, slots;
+
+	kv.nr_keys = conf.bytes / (conf.value_size + 2 * sizeof(struct kv_slot));
+	for (slots = 1; slots < 2 * kv.nr_keys; slots <<= 1)
+		;
+	kv.mask = slots - 1;
+	kv.table = bench_map(slots * sizeof(struct kv_slot));
+	kv.values = bench_map(kv.nr_keys * conf.value_size);
+	if (!kv.table || !kv.values)
+		return -1;
+	run_parallel(kv_fill);
+	for (id = 0; id < kv.nr_keys; id++) {
+		for (h = kv_key(id) & kv.mask; kv.table[h].key;
+		     h = (h + 1) & kv.mask)
+			;
+		kv.table[h].key = kv_key(id);
+		kv.table[h].id = id;
+	}
+	bench_zipf_init(&kv.zipf, kv.nr_keys, conf.theta);
+	printf("kv_keys: %" PRIu64 "\n", kv.nr_keys);
+	printf("kv_value_bytes: %d\n", conf.value_size);
+	return 0;
+}
+
+static uint64_t *kv_lookup(uint64_t id)
+{
+	uint64_t key = kv_key(id), h;
+
+	for (h = key & kv.mask; kv.table[h].key != key; h = (h + 1) & kv.mask)
+		if (!kv.table[h].key)
+			return NULL;
+	return kv_value(kv.table[h].id);
+}
+
+static uint64_t kv_run(struct app_thread *t)
+{
+	uint64_t id, start, *v, sum;
+	int i, j;
+
+	for (i = 0; i < KV_BATCH; i++) {
+		// the popular keys are spread over the table and the values
+		id = bench_scramble(bench_zipf_next(&kv.zipf, &t->seed)) %
+		     kv.nr_keys;
+		start = bench_now_ns();
+		v = kv_lookup(id);
+		if (!v || v[0] != id) {
+			t->errors++;
+		} else if (bench_rand(&t->seed) % 100 < conf.put_pct) {
+			for (j = 1; j < conf.value_size / 8; j++)
+				v[j] = id ^ j ^ t->seed;
+		} else {
+			for (j = 0, sum = 0; j < conf.value_size / 8; j++)
+				sum += v[j];
+			t->sink += sum;
+		}
+		bench_hist_add(&t->hist, bench_now_ns() - start);
+	}
+	return KV_BATCH;
+}
+
+static void kv_report(const char *prefix)
+{
+	struct bench_hist *h = calloc(1, sizeof(*h));
+	char name[64];
+	int i;
+
+	if (!h)
+		return;
+	for (i = 0; i < conf.threads; i++)
+		bench_hist_merge(h, &threads[i].hist);
+	snprintf(name, sizeof(name), "%sop", prefix);
+	bench_report_hist(name, h);
+	free(h);
+}
+
+/*
+ * graph: pull-based PageRank over the in-edges in CSR. The in-degrees are
+ * uniform around the average, the sources Zipfian, so a few hubs are read
+ * by many. Each vertex has its contribution, rank / out-degree, of this
+ * round and of the next.
+ */
+#define DAMPING 0.85
+
+static struct {
+	uint64_t nr_vertices;
+	uint64_t nr_edges;
+	uint64_t *offsets;
+	uint32_t *sources;
+	uint32_t *out_degree;
+	double *rank;
+	double *contrib[2];
+	struct bench_zipf zipf;
+} g;
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void *graph_fill(void *arg)
+{
+	struct app_thread *t = arg;
+	uint64_t v, e, src;
+
+	split(t, g.nr_vertices);
+	for (v = t->lo; v < t->hi; v++) {
+		for (e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+			src = bench_scramble(bench_zipf_next(&g.zipf, &t->seed)) %
+			      g.nr_vertices;
+			g.sources[e] = src;
+			__atomic_fetch_add(&g.out_degree[src], 1,
+					   __ATOMIC_RELAXED);
+		}
+		// sorted, as graph loaders store them
+		qsort(&g.sources[g.offsets[v]], g.offsets[v + 1] - g.offsets[v],
+		      sizeof(*g.sources), cmp_u32);
+	}
+	return NULL;
+}
+
+static void *graph_init_rank(void *arg)
+{
+	struct app_thread *t = arg;
+	uint64_t v;
+
+	split(t, g.nr_vertices);
+	for (v = t->lo; v < t->hi; v++) {
+		g.rank[v] = 1.0 / g.nr_vertices;
+		g.contrib[0][v] =
+			g.out_degree[v] ? g.rank[v] / g.out_degree[v] : 0;
+	}
+	return NULL;
+}
+
+static int graph_build(void)
+{
+	uint64_t v, seed = 42;
+	uint64_t per_vertex = 3 * sizeof(uint64_t) + sizeof(uint32_t) +
+			      sizeof(double) + conf.degree * sizeof(uint32_t);
+
+	g.nr_vertices = conf.bytes / per_vertex;
+	if (g.nr_vertices < 2 || g.nr_vertices > UINT32_MAX)
+		return -1;
+	g.offsets = bench_map((g.nr_vertices + 1) * sizeof(*g.offsets));
+	g.out_degree = bench_map(g.nr_vertices * sizeof(*g.out_degree));
+	g.rank = bench_map(g.nr_vertices * sizeof(*g.rank));
+	g.contrib[0] = bench_map(g.nr_vertices * sizeof(double));
+	g.contrib[1] = bench_map(g.nr_vertices * sizeof(double));
+	if (!g.offsets || !g.out_degree || !g.rank || !g.contrib[0] ||
+	    !g.contrib[1])
+		return -1;
+	// in-degrees in [1, 2 * degree - 1]
+	for (v = 0; v < g.nr_vertices; v++)
+		g.offsets[v + 1] = g.offsets[v] + 1 +
+				   bench_rand(&seed) % (2 * conf.degree - 1);
+	g.nr_edges = g.offsets[g.nr_vertices];
+	g.sources = bench_map(g.nr_edges * sizeof(*g.sources));
+	if (!g.sources)
+		return -1;
+	bench_zipf_init(&g.zipf, g.nr_vertices, conf.theta);
+	run_parallel(graph_fill);
+	run_parallel(graph_init_rank);
+	printf("graph_vertices: %" PRIu64 "\n", g.nr_vertices);
+	printf("graph_edges: %" PRIu64 "\n", g.nr_edges);
+	return 0;
+}
+
+static uint64_t graph_run(struct app_thread *t)
+{
+	const double *contrib = g.contrib[nr_rounds & 1];
+	double *next = g.contrib[(nr_rounds + 1) & 1];
+	double base = (1 - DAMPING) / g.nr_vertices, sum;
+	uint64_t v, e;
+
+	for (v = t->lo; v < t->hi; v++) {
+		for (e = g.offsets[v], sum = 0; e < g.offsets[v + 1]; e++)
+			sum += contrib[g.sources[e]];
+		g.rank[v] = base + DAMPING * sum;
+		next[v] = g.out_degree[v] ? g.rank[v] / g.out_degree[v] : 0;
+	}
+	return g.offsets[t->hi] - g.offsets[t->lo];
+}
+
+static void graph_report(const char *prefix)
+{
+	double sum = 0;
+	uint64_t v;
+
+	// less than 1, the dangling vertices leak rank
+	for (v = 0; v < g.nr_vertices; v++)
+		sum += g.rank[v];
+	printf("%srank_sum: %.6f\n", prefix, sum);
+}
+
+/*
+ * kmeans, logreg: rows of dims floats around clusters random centers, the
+ * label of a row is its side of a random hyperplane. Each thread sums into
+ * its own accumulators, merged by round_end().
+ */
+static struct {
+	uint64_t nr_rows;
+	float *x;
+	float *y;
+	double *model; // the centroids, or the weights
+	double *acc; // per thread, clusters * (dims + 1), or dims + 1
+	size_t acc_len;
+	double *partial; // per thread inertia or loss
+	double objective;
+} ml;
+
+static void *ml_fill(void *arg)
+{
+	struct app_thread *t = arg;
+	const double *center;
+	double z;
+	uint64_t r;
+	float *x;
+	int d;
+
+	split(t, ml.nr_rows);
+	for (r = t->lo; r < t->hi; r++) {
+		x = &ml.x[r * conf.dims];
+		center = &ml.model[(bench_rand(&t->seed) % conf.clusters) *
+				   conf.dims];
+		for (d = 0, z = 0; d < conf.dims; d++) {
+			// the sum of two uniforms in [-1, 1)
+			x[d] = center[d] +
+			       (bench_rand(&t->seed) >> 40) * 0x1.0p-23 +
+			       (bench_rand(&t->seed) >> 40) * 0x1.0p-23 - 2;
+			z += x[d] * ((d % 3) - 1.0);
+		}
+		ml.y[r] = z > 0;
+	}
+	return NULL;
+}
+
+static int ml_build(void)
+{
+	uint64_t seed = 42;
+	int i, nr_model;
+
+	ml.nr_rows = conf.bytes / ((conf.dims + 1) * sizeof(float));
+	nr_model = conf.clusters * conf.dims;
+	ml.acc_len = conf.clusters * (conf.dims + 1);
+	ml.x = bench_map(ml.nr_rows * conf.dims * sizeof(float));
+	ml.y = bench_map(ml.nr_rows * sizeof(float));
+	ml.model = calloc(nr_model, sizeof(double));
+	ml.acc = calloc(conf.threads * ml.acc_len, sizeof(double));
+	ml.partial = calloc(conf.threads, sizeof(double));
+	if (!ml.x || !ml.y || !ml.model || !ml.acc || !ml.partial)
+		return -1;
+	// the true centers first, which fill uses
+	for (i = 0; i < nr_model; i++)
+		ml.model[i] = (bench_rand(&seed) % 2000) / 100.0 - 10;
+	run_parallel(ml_fill);
+	printf("ml_rows: %" PRIu64 "\n", ml.nr_rows);
+	printf("ml_dims: %d\n", conf.dims);
+	return 0;
+}
+
+static int kmeans_build(void)
+{
+	int i;
+
+	if (ml_build())
+		return -1;
+	// start from rows as the centroids
+	for (i = 0; i < conf.clusters * conf.dims; i++)
+		ml.model[i] = ml.x[(i / conf.dims) * (ml.nr_rows / conf.clusters) *
+				   conf.dims + i % conf.dims];
+	return 0;
+}
+
+static uint64_t kmeans_run(struct app_thread *t)
+{
+	double *acc = &ml.acc[t->id * ml.acc_len];
+	double dist, best_dist, diff, inertia = 0;
+	const double *c;
+	const float *x;
+	int k, d, best;
+	uint64_t r;
+
+	for (r = t->lo; r < t->hi; r++) {
+		x = &ml.x[r * conf.dims];
+		best = 0;
+		best_dist = INFINITY;
+		for (k = 0; k < conf.clusters; k++) {
+			c = &ml.model[k * conf.dims];
+			for (d = 0, dist = 0; d < conf.dims; d++) {
+				diff = x[d] - c[d];
+				dist += diff * diff;
+			}
+			if (dist < best_dist) {
+				best_dist = dist;
+				best = k;
+			}
+		}
+		for (d = 0; d < conf.dims; d++)
+			acc[best * (conf.dims + 1) + d] += x[d];
+		acc[best * (conf.dims + 1) + conf.dims] += 1;
+		inertia += best_dist;
+	}
+	ml.partial[t->id] = inertia;
+	return t->hi - t->lo;
+}
+
+static void kmeans_round_end(void)
+{
+	double *sum, count;
+	int i, k, d;
+
+	ml.objective = 0;
+	for (i = 0; i < conf.threads; i++) {
+		ml.objective += ml.partial[i];
+		if (i)
+			for (k = 0; k < ml.acc_len; k++)
+				ml.acc[k] += ml.acc[i * ml.acc_len + k];
+	}
+	for (k = 0; k < conf.clusters; k++) {
+		sum = &ml.acc[k * (conf.dims + 1)];
+		count = sum[conf.dims];
+		if (count)
+			for (d = 0; d < conf.dims; d++)
+				ml.model[k * conf.dims + d] = sum[d] / count;
+	}
+	memset(ml.acc, 0, conf.threads * ml.acc_len * sizeof(double));
+}
+
+static int logreg_build(void)
+{
+	if (ml_build())
+		return -1;
+	memset(ml.model, 0, conf.dims * sizeof(double));
+	return 0;
+}
+
+static uint64_t logreg_run(struct app_thread *t)
+{
+	double *grad = &ml.acc[t->id * ml.acc_len];
+	double z, p, loss = 0;
+	const float *x;
+	uint64_t r;
+	int d;
+
+	for (r = t->lo; r < t->hi; r++) {
+		x = &ml.x[r * conf.dims];
+		for (d = 0, z = 0; d < conf.dims; d++)
+			z += ml.model[d] * x[d];
+		p = 1 / (1 + exp(-z));
+		for (d = 0; d < conf.dims; d++)
+			grad[d] += (p - ml.y[r]) * x[d];
+		loss -= ml.y[r] ? log(p + 1e-12) : log(1 - p + 1e-12);
+	}
+	ml.partial[t->id] = loss;
+	return t->hi - t->lo;
+}
+
+static void logreg_round_end(void)
+{
+	double grad;
+	int i, d;
+
+	ml.objective = 0;
+	for (i = 0; i < conf.threads; i++)
+		ml.objective += ml.partial[i];
+	ml.objective /= ml.nr_rows;
+	for (d = 0; d < conf.dims; d++) {
+		for (i = 0, grad = 0; i < conf.threads; i++)
+			grad += ml.acc[i * ml.acc_len + d];
+		ml.model[d] -= 0.1 * grad / ml.nr_rows;
+	}
+	memset(ml.acc, 0, conf.threads * ml.acc_len * sizeof(double));
+}
+
+static void ml_report(const char *prefix)
+{
+	printf("%s%s: %.6f\n", prefix,
+	       app->run == kmeans_run ? "inertia" : "loss", ml.objective);
+}
+
+static struct app apps[] = {
+	{ "kv", "ops", false, kv_build, kv_run, NULL, kv_report },
+	{ "graph", "edges", true, graph_build, graph_run, NULL,
+	  graph_report },
+	{ "kmeans", "rows", true, kmeans_build, kmeans_run,
+	  kmeans_round_end, ml_report },
+	{ "logreg", "rows", true, logreg_build, logreg_run,
+	  logreg_round_end, ml_report },
+};
+
+static uint64_t app_items(void)
+{
+	if (app->build == graph_build)
+		return g.nr_vertices;
+	return ml.nr_rows;
+}
+
+static void *app_thread_fn(void *arg)
+{
+	struct app_thread *t = arg;
+
+	if (app->rounds)
+		split(t, app_items());
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		t->units += app->run(t);
+		if (!app->rounds) {
+			if (bench_now_ns() >= deadline)
+				break;
+			continue;
+		}
+		pthread_barrier_wait(&barrier);
+		if (t->id == 0) {
+			if (app->round_end)
+				app->round_end();
+			nr_rounds++;
+			// whole rounds only, at least one
+			if (bench_now_ns() >= deadline)
+				stop = 1;
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+/* Run for the duration under limit, and print the results after prefix. */
+static void run_ratio(struct bench_cgroup *cg, const char *prefix,
+		      uint64_t limit)
+{
+	struct bench_counters before, after, c;
+	uint64_t start, elapsed, units = 0, errors = 0, rounds;
+	struct rusage ru;
+	long majflt;
+	double sec;
+	int i;
+
+	for (i = 0; i < conf.threads; i++) {
+		threads[i].units = 0;
+		memset(&threads[i].hist, 0, sizeof(threads[i].hist));
+	}
+	stop = 0;
+	rounds = nr_rounds;
+	pthread_barrier_init(&barrier, NULL, conf.threads);
+
+	bench_read_counters(cg, &before);
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt;
+	start = bench_now_ns();
+	deadline = start + conf.duration * 1000000000ULL;
+	run_parallel(app_thread_fn);
+	elapsed = bench_now_ns() - start;
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt - majflt;
+	bench_read_counters(cg, &after);
+	bench_counters_sub(&c, &after, &before);
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < conf.threads; i++) {
+		units += threads[i].units;
+		errors += threads[i].errors;
+	}
+	sec = elapsed / 1e9;
+	printf("%slocal_limit_bytes: %" PRIu64 "\n", prefix, limit);
+	printf("%selapsed_sec: %.3f\n", prefix, sec);
+	if (app->rounds)
+		printf("%srounds: %" PRIu64 "\n", prefix, nr_rounds - rounds);
+	printf("%s%s_per_sec: %.0f\n", prefix, app->unit, units / sec);
+	printf("%smajor_faults: %ld\n", prefix, majflt);
+	printf("%sondemand_swapin: %" PRIu64 "\n", prefix, c.ondemand_swapin);
+	printf("%sprefetch_swapin: %" PRIu64 "\n", prefix, c.prefetch_swapin);
+	printf("%sswapin_bytes: %" PRIu64 "\n", prefix,
+	       c.pswpin * BENCH_PAGE_SIZE);
+	printf("%sswapout_bytes: %" PRIu64 "\n", prefix,
+	       c.pswpout * BENCH_PAGE_SIZE);
+	if (errors)
+		printf("%serrors: %" PRIu64 "\n", prefix, errors);
+	app->report(prefix);
+}
+
+static int cmp_desc(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int parse_ratios(char *str)
+{
+	char *tok, *save;
+
+	conf.nr_ratios = 0;
+	for (tok = strtok_r(str, ",", &save); tok && conf.nr_ratios < MAX_RATIOS;
+	     tok = strtok_r(NULL, ",", &save)) {
+		conf.ratios[conf.nr_ratios] = atof(tok);
+		if (conf.ratios[conf.nr_ratios] <= 0)
+			return -1;
+		conf.nr_ratios++;
+	}
+	qsort(conf.ratios, conf.nr_ratios, sizeof(double), cmp_desc);
+	return conf.nr_ratios ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -a kv|graph|kmeans|logreg [-s <data set size>] [-r <local memory ratios, e.g. 1,0.5,0.25>]\n"
+		"\t[-t <#threads>] [-d <seconds per ratio>] [-c <cgroup name>]\n"
+		"\tkv: [-v <value size>] [-z <zipf theta>] [-w <%% of puts>]\n"
+		"\tgraph: [-e <average in-degree>] [-z <zipf theta of the sources>]\n"
+		"\tkmeans, logreg: [-D <dims>] [-k <#clusters>]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_cgroup cg;
+	char ratios[] = "1,0.75,0.5,0.25", prefix[32];
+	uint64_t start, footprint, limit;
+	int i, opt, ret = 1;
+
+	parse_ratios(ratios);
+	while ((opt = getopt(argc, argv, "a:s:r:t:d:c:v:z:w:e:D:k:h")) != -1) {
+		switch (opt) {
+		case 'a':
+			for (i = 0; i < sizeof(apps) / sizeof(apps[0]); i++)
+				if (!strcmp(optarg, apps[i].name))
+					app = &apps[i];
+			break;
+		case 's':
+			conf.bytes = bench_parse_size(optarg);
+			break;
+		case 'r':
+			if (parse_ratios(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't':
+			conf.threads = atoi(optarg);
+			break;
+		case 'd':
+			conf.duration = atoi(optarg);
+			break;
+		case 'c':
+			conf.cgroup = optarg;
+			break;
+		case 'v':
+			conf.value_size = atoi(optarg);
+			break;
+		case 'z':
+			conf.theta = atof(optarg);
+			break;
+		case 'w':
+			conf.put_pct = atoi(optarg);
+			break;
+		case 'e':
+			conf.degree = atoi(optarg);
+			break;
+		case 'D':
+			conf.dims = atoi(optarg);
+			break;
+		case 'k':
+			conf.clusters = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!app || conf.threads < 1 || conf.duration < 1 ||
+	    conf.value_size < 8 || conf.value_size % 8 || conf.theta <= 0 ||
+	    conf.theta >= 1 || conf.degree < 1 || conf.dims < 1 ||
+	    conf.clusters < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	threads = calloc(conf.threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+	for (i = 0; i < conf.threads; i++) {
+		threads[i].id = i;
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+
+	// the data set is built without a limit, in the cgroup
+	if (bench_cgroup_create(&cg, conf.cgroup, 0) ||
+	    bench_cgroup_attach(&cg, getpid()))
+		goto out_cgroup;
+	printf("app: %s\n", app->name);
+	printf("threads: %d\n", conf.threads);
+	start = bench_now_ns();
+	if (app->build()) {
+		fprintf(stderr, "cannot build the %s data set\n", app->name);
+		goto out_cgroup;
+	}
+	footprint = bench_cgroup_usage(&cg);
+	printf("build_sec: %.3f\n", (bench_now_ns() - start) / 1e9);
+	printf("footprint_bytes: %" PRIu64 "\n", footprint);
+
+	for (i = 0; i < conf.nr_ratios; i++) {
+		limit = (uint64_t)(footprint * conf.ratios[i]) &
+			~(BENCH_PAGE_SIZE - 1);
+		snprintf(prefix, sizeof(prefix), "r%.2f.", conf.ratios[i]);
+		printf("%sratio: %.2f\n", prefix, conf.ratios[i]);
+		// fails if it cannot swap down to the limit
+		if (bench_cgroup_set_limit(&cg, limit))
+			continue;
+		run_ratio(&cg, prefix, limit);
+		fflush(stdout);
+	}
+	ret = 0;
+
+out_cgroup:
+	bench_cgroup_destroy(&cg);
+	return ret;
+}
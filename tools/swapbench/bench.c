@@ -0,0 +1,415 @@
+#include "bench.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_V1_MEMORY CGROUP_ROOT "/memory"
+
+static int write_file(const char *dir, const char *file, const char *val)
+{
+	char path[512];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+int bench_cgroup_create(struct bench_cgroup *cg, const char *name,
+			uint64_t limit_bytes)
+{
+	cg->v2 = access(CGROUP_ROOT "/cgroup.controllers", F_OK) == 0;
+	if (cg->v2) {
+		// the memory controller of the children, may be on already
+		write_file(CGROUP_ROOT, "cgroup.subtree_control", "+memory");
+		snprintf(cg->path, sizeof(cg->path), CGROUP_ROOT "/%s", name);
+	} else {
+		snprintf(cg->path, sizeof(cg->path), CGROUP_V1_MEMORY "/%s",
+			 name);
+	}
+
+	cg->created = mkdir(cg->path, 0755) == 0;
+	if (!cg->created && errno != EEXIST) {
+		fprintf(stderr, "cannot create cgroup %s: %s\n", cg->path,
+			strerror(errno));
+		return -errno;
+	}
+
+	return bench_cgroup_set_limit(cg, limit_bytes);
+}
+
+int bench_cgroup_set_limit(struct bench_cgroup *cg, uint64_t limit_bytes)
+{
+	char val[32];
+	int ret;
+
+	if (limit_bytes)
+		snprintf(val, sizeof(val), "%" PRIu64, limit_bytes);
+	else
+		strcpy(val, cg->v2 ? "max" : "-1");
+	// v1 reclaims down to a lower limit, and fails if it cannot
+	ret = write_file(cg->path,
+			 cg->v2 ? "memory.max" : "memory.limit_in_bytes", val);
+	if (ret)
+		fprintf(stderr, "cannot limit cgroup %s to %s bytes: %s\n",
+			cg->path, val, strerror(-ret));
+	return ret;
+}
+
+uint64_t bench_cgroup_usage(struct bench_cgroup *cg)
+{
+	char path[512];
+	unsigned long long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", cg->path,
+		 cg->v2 ? "memory.current" : "memory.usage_in_bytes");
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+int bench_cgroup_set_remote(struct bench_cgroup *cg, uint64_t max_bytes,
+			    int policy)
+{
+	char val[32];
+	int ret;
+
+	if (max_bytes)
+		snprintf(val, sizeof(val), "%" PRIu64, max_bytes);
+	else
+		strcpy(val, cg->v2 ? "max" : "-1");
+	ret = write_file(cg->path,
+			 cg->v2 ? "memory.remote.max" :
+				  "memory.remote.limit_in_bytes", val);
+	if (!ret) {
+		snprintf(val, sizeof(val), "%d", policy);
+		ret = write_file(cg->path, "memory.remote.policy", val);
+	}
+	if (ret)
+		fprintf(stderr, "cannot set the remote memory quota of cgroup %s: %s, is it a Canvas kernel?\n",
+			cg->path, strerror(-ret));
+	return ret;
+}
+
+uint64_t bench_cgroup_remote(struct bench_cgroup *cg, uint64_t *refused)
+{
+	char path[512];
+	unsigned long long val = 0;
+	FILE *f;
+
+	*refused = 0;
+	snprintf(path, sizeof(path), "%s/%s", cg->path,
+		 cg->v2 ? "memory.remote.events" : "memory.remote.failcnt");
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, cg->v2 ? "max %llu" : "%llu", &val) == 1)
+			*refused = val;
+		fclose(f);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", cg->path,
+		 cg->v2 ? "memory.remote.current" :
+			  "memory.remote.usage_in_bytes");
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+int bench_cgroup_attach(struct bench_cgroup *cg, int pid)
+{
+	char val[16];
+	int ret;
+
+	snprintf(val, sizeof(val), "%d", pid);
+	ret = write_file(cg->path, "cgroup.procs", val);
+	if (ret)
+		fprintf(stderr, "cannot move %d into cgroup %s: %s\n", pid,
+			cg->path, strerror(-ret));
+	return ret;
+}
+
+// Move the caller out of the cgroup, and remove it if we created it.
+void bench_cgroup_destroy(struct bench_cgroup *cg)
+{
+	char val[16];
+
+	snprintf(val, sizeof(val), "%d", getpid());
+	write_file(cg->v2 ? CGROUP_ROOT : CGROUP_V1_MEMORY, "cgroup.procs",
+		   val);
+	if (cg->created && rmdir(cg->path))
+		fprintf(stderr, "cannot remove cgroup %s: %s\n", cg->path,
+			strerror(errno));
+}
+
+void *bench_map(uint64_t bytes)
+{
+	void *addr;
+
+	addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	madvise(addr, bytes, MADV_NOHUGEPAGE);
+	return addr;
+}
+
+void bench_unmap(void *addr, uint64_t bytes)
+{
+	if (addr)
+		munmap(addr, bytes);
+}
+
+struct counter_field {
+	const char *name;
+	size_t off;
+};
+
+#define COUNTER(f) { #f, offsetof(struct bench_counters, f) }
+
+static const struct counter_field vmstat_fields[] = {
+	COUNTER(pswpin),	  COUNTER(pswpout),
+	COUNTER(ondemand_swapin), COUNTER(prefetch_swapin),
+	COUNTER(hiton_swap_cache), COUNTER(swap_ra),
+	COUNTER(swap_ra_hit),
+};
+
+static const struct counter_field memcg_fields[] = {
+	COUNTER(ondemand_swapin),
+	COUNTER(prefetch_swapin),
+	COUNTER(hiton_swap_cache),
+};
+
+// Read the fields of a "name value" file, returns how many were found.
+static int read_fields(const char *path, const struct counter_field *fields,
+		       int nr, struct bench_counters *c)
+{
+	char name[64];
+	unsigned long long val;
+	int i, found = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %llu", name, &val) == 2) {
+		for (i = 0; i < nr; i++) {
+			if (strcmp(name, fields[i].name))
+				continue;
+			*(uint64_t *)((char *)c + fields[i].off) = val;
+			found++;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+// A file of one value, 0 if it can't be read.
+static uint64_t read_value(const char *path)
+{
+	unsigned long long val = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+void bench_read_counters(struct bench_cgroup *cg, struct bench_counters *c)
+{
+	char path[512];
+	int nr = sizeof(memcg_fields) / sizeof(memcg_fields[0]);
+
+	memset(c, 0, sizeof(*c));
+	read_fields("/proc/vmstat", vmstat_fields,
+		    sizeof(vmstat_fields) / sizeof(vmstat_fields[0]), c);
+	c->frontswap_loads = read_value("/sys/kernel/debug/frontswap/loads");
+	c->frontswap_stores =
+		read_value("/sys/kernel/debug/frontswap/succ_stores");
+	c->frontswap_failed_stores =
+		read_value("/sys/kernel/debug/frontswap/failed_stores");
+	if (!cg)
+		return;
+	snprintf(path, sizeof(path), "%s/memory.stat", cg->path);
+	read_fields(path, memcg_fields, nr, c);
+}
+
+void bench_counters_sub(struct bench_counters *res,
+			const struct bench_counters *after,
+			const struct bench_counters *before)
+{
+	const uint64_t *a = (const uint64_t *)after;
+	const uint64_t *b = (const uint64_t *)before;
+	uint64_t *r = (uint64_t *)res;
+	size_t i;
+
+	// the Canvas counters are reset by writes to memory.stat
+	for (i = 0; i < sizeof(*res) / sizeof(uint64_t); i++)
+		r[i] = a[i] >= b[i] ? a[i] - b[i] : a[i];
+}
+
+static inline int hist_bucket(uint64_t ns)
+{
+	int shift;
+
+	if (ns < BENCH_HIST_SUB)
+		return ns;
+	shift = 63 - __builtin_clzll(ns) - BENCH_HIST_SUB_SHIFT;
+	return (shift + 1) * BENCH_HIST_SUB + (ns >> shift) - BENCH_HIST_SUB;
+}
+
+// the middle of the bucket
+static inline uint64_t hist_value(int bucket)
+{
+	int shift = bucket / BENCH_HIST_SUB - 1;
+
+	if (shift < 0)
+		return bucket;
+	return ((uint64_t)(BENCH_HIST_SUB + bucket % BENCH_HIST_SUB) << shift) +
+	       ((1ULL << shift) >> 1);
+}
+
+void bench_hist_add(struct bench_hist *h, uint64_t ns)
+{
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->buckets[hist_bucket(ns)]++;
+}
+
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t bench_hist_percentile(const struct bench_hist *h, double pct)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+	rank = (uint64_t)(h->count * pct / 100.0);
+	if (rank >= h->count)
+		rank = h->count - 1;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank)
+			break;
+	}
+	return hist_value(i) < h->max ? hist_value(i) : h->max;
+}
+
+void bench_report_hist(const char *prefix, const struct bench_hist *h)
+{
+	printf("%s_count: %" PRIu64 "\n", prefix, h->count);
+	printf("%s_avg_ns: %" PRIu64 "\n", prefix,
+	       h->count ? h->sum / h->count : 0);
+	printf("%s_p50_ns: %" PRIu64 "\n", prefix,
+	       bench_hist_percentile(h, 50));
+	printf("%s_p90_ns: %" PRIu64 "\n", prefix,
+	       bench_hist_percentile(h, 90));
+	printf("%s_p99_ns: %" PRIu64 "\n", prefix,
+	       bench_hist_percentile(h, 99));
+	printf("%s_p999_ns: %" PRIu64 "\n", prefix,
+	       bench_hist_percentile(h, 99.9));
+	printf("%s_max_ns: %" PRIu64 "\n", prefix, h->max);
+}
+
+// 512, 64k, 100m, 2g, ...
+#define ZETA_EXACT (1 << 20)
+
+// the sum of 1/i^theta up to n, the tail after ZETA_EXACT from its integral
+static double zeta(uint64_t n, double theta)
+{
+	uint64_t i, exact = n < ZETA_EXACT ? n : ZETA_EXACT;
+	double sum = 0;
+
+	for (i = 1; i <= exact; i++)
+		sum += 1 / pow(i, theta);
+	if (n > exact)
+		sum += (pow(n + 0.5, 1 - theta) - pow(exact + 0.5, 1 - theta)) /
+		       (1 - theta);
+	return sum;
+}
+
+void bench_zipf_init(struct bench_zipf *z, uint64_t n, double theta)
+{
+	z->n = n;
+	z->theta = theta;
+	z->alpha = 1 / (1 - theta);
+	z->zetan = zeta(n, theta);
+	z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / z->zetan);
+}
+
+uint64_t bench_zipf_next(const struct bench_zipf *z, uint64_t *seed)
+{
+	double u = (bench_rand(seed) >> 11) * 0x1.0p-53;
+	double uz = u * z->zetan;
+	uint64_t rank;
+
+	if (uz < 1)
+		return 0;
+	if (uz < 1 + pow(0.5, z->theta))
+		return 1;
+	rank = z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+	return rank < z->n ? rank : z->n - 1;
+}
+
+uint64_t bench_parse_size(const char *str)
+{
+	char *end;
+	uint64_t val = strtoull(str, &end, 0);
+
+	switch (*end) {
+	case 'g':
+	case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		val <<= 10;
+	}
+	return val;
+}
@@ -0,0 +1,139 @@
+/*
+ * Helpers shared by the swap benchmarks: the memory cgroup the workload runs
+ * in, the swap counters of the kernel and the latency histograms.
+ */
+#ifndef __SWAPBENCH_BENCH_H
+#define __SWAPBENCH_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define BENCH_PAGE_SIZE 4096UL
+#define BENCH_PAGE_SHIFT 12
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, good enough to pick pages
+static inline uint64_t bench_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * The memory cgroup of a workload. Both cgroup versions are supported, the
+ * local memory limit is memory.limit_in_bytes on v1 and memory.max on v2.
+ */
+struct bench_cgroup {
+	char path[256];
+	bool v2;
+	bool created;
+};
+
+int bench_cgroup_create(struct bench_cgroup *cg, const char *name,
+			uint64_t limit_bytes);
+int bench_cgroup_attach(struct bench_cgroup *cg, int pid);
+void bench_cgroup_destroy(struct bench_cgroup *cg);
+// 0 lifts the limit
+int bench_cgroup_set_limit(struct bench_cgroup *cg, uint64_t limit_bytes);
+uint64_t bench_cgroup_usage(struct bench_cgroup *cg);
+/*
+ * The remote memory quota of the Canvas kernel, memory.remote.*: 0 lifts it,
+ * @policy 1 also gives back the remote memory of the pages faulted in.
+ */
+int bench_cgroup_set_remote(struct bench_cgroup *cg, uint64_t max_bytes,
+			    int policy);
+// the remote memory of the cgroup, and the stores its quota refused
+uint64_t bench_cgroup_remote(struct bench_cgroup *cg, uint64_t *refused);
+
+// Anonymous memory of base pages, as the swap path is measured on them.
+void *bench_map(uint64_t bytes);
+void bench_unmap(void *addr, uint64_t bytes);
+
+/*
+ * Swap counters, the system-wide ones of /proc/vmstat and the Canvas swap-in
+ * counters of the cgroup (memory.stat), which fall back to /proc/vmstat.
+ * pswpin and pswpout are the pages read from and written to the swap device,
+ * the frontswap ones (debugfs, 0 if not mounted) the pages of the remote
+ * memory.
+ */
+struct bench_counters {
+	uint64_t pswpin;
+	uint64_t pswpout;
+	uint64_t frontswap_loads;
+	uint64_t frontswap_stores;
+	uint64_t frontswap_failed_stores;
+	uint64_t ondemand_swapin;
+	uint64_t prefetch_swapin;
+	uint64_t hiton_swap_cache;
+	uint64_t swap_ra;
+	uint64_t swap_ra_hit;
+};
+
+void bench_read_counters(struct bench_cgroup *cg, struct bench_counters *c);
+void bench_counters_sub(struct bench_counters *res,
+			const struct bench_counters *after,
+			const struct bench_counters *before);
+
+/*
+ * Log-linear latency histogram in ns: 32 sub-buckets per power of two, so a
+ * percentile is within 3% of the exact value. Each thread fills its own and
+ * they are merged at the end.
+ */
+#define BENCH_HIST_SUB_SHIFT 5
+#define BENCH_HIST_SUB (1 << BENCH_HIST_SUB_SHIFT)
+#define BENCH_HIST_BUCKETS (64 * BENCH_HIST_SUB)
+
+struct bench_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[BENCH_HIST_BUCKETS];
+};
+
+void bench_hist_add(struct bench_hist *h, uint64_t ns);
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src);
+uint64_t bench_hist_percentile(const struct bench_hist *h, double pct);
+
+/*
+ * Zipfian ranks in [0, n), rank 0 the most popular, with the generator of
+ * YCSB (Gray et al., Quickly Generating Billion-Record Synthetic Databases).
+ * theta < 1 is the skew, YCSB uses 0.99. Scramble the ranks to spread the
+ * popular items over the data set.
+ */
+struct bench_zipf {
+	uint64_t n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+void bench_zipf_init(struct bench_zipf *z, uint64_t n, double theta);
+uint64_t bench_zipf_next(const struct bench_zipf *z, uint64_t *seed);
+
+// a bijection of the 64-bit integers, the finalizer of splitmix64
+static inline uint64_t bench_scramble(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+uint64_t bench_parse_size(const char *str);
+void bench_report_hist(const char *prefix, const struct bench_hist *h);
+
+#endif // __SWAPBENCH_BENCH_H
@@ -0,0 +1,31 @@
+/*
+ * The extended syscalls of the Canvas kernel, see
+ * linux-5.5/extended_syscalls/extended_syscalls.c. They follow clone3 (435)
+ * in the x86_64 table, in the order of that file. Pass e.g.
+ * -DSYS_CANVAS_BASE=<n> if your kernel numbers them elsewhere.
+ */
+#ifndef __SWAPBENCH_CANVAS_SYSCALLS_H
+#define __SWAPBENCH_CANVAS_SYSCALLS_H
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SYS_CANVAS_BASE
+#define SYS_CANVAS_BASE 436
+#endif
+
+#define SYS_reset_swap_stats (SYS_CANVAS_BASE + 0)
+#define SYS_get_swap_stats (SYS_CANVAS_BASE + 1)
+#define SYS_set_async_prefetch (SYS_CANVAS_BASE + 2)
+#define SYS_set_bypass_swap_cache (SYS_CANVAS_BASE + 3)
+#define SYS_set_readahead_win (SYS_CANVAS_BASE + 4)
+#define SYS_set_customized_prefetch (SYS_CANVAS_BASE + 5)
+#define SYS_set_swapcache_mode (SYS_CANVAS_BASE + 6)
+#define SYS_set_swap_bw_control (SYS_CANVAS_BASE + 7)
+#define SYS_get_all_procs_swap_pkts (SYS_CANVAS_BASE + 8)
+#define SYS_syscall_scheduler_set_policy (SYS_CANVAS_BASE + 9)
+#define SYS_syscall_rswap_set_proc (SYS_CANVAS_BASE + 10)
+#define SYS_set_slotcache_cpumask (SYS_CANVAS_BASE + 11)
+#define SYS_set_swap_isolated (SYS_CANVAS_BASE + 12)
+
+#endif // __SWAPBENCH_CANVAS_SYSCALLS_H
@@ -0,0 +1,602 @@
+/*
+ * ectest - tests of the erasure coding of rswap-client (ecip), in user space.
+ *
+ * The codec test encodes random stripes and decodes every single and double
+ * erasure of their fragments, checked against the originals, and checks the
+ * word-wise Q against a byte-wise one.
+ *
+ * The emulated test runs the placement of rswap_ec.c against RSWAP_EC_N
+ * servers in memory: threads store and load the pages of a swap area, a
+ * page per thread at a time as the kernel does, through per-thread pending
+ * stripes written in full with their parity, and the main thread writes the
+ * partial stripes out as the delayed work does. Each thread owns whole
+ * stripes: it fills them in order, which must write full stripes, then
+ * stores whole stripes, as a swap-out of consecutive slots, or single
+ * pages, which write partial ones. A server is killed after a
+ * third of the run, another after two thirds: its memory is overwritten and
+ * its transfers fail, also those in flight, so a load from it only succeeds
+ * by decoding. Every load, and every page at the end, is checked against
+ * the generation last stored.
+ */
+#include "bench.h"
+#include "rswap_ec.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PAGE_WORDS (BENCH_PAGE_SIZE / sizeof(uint64_t))
+#define EC_NONE UINT64_MAX
+#define EC_LOCKS 64
+
+static struct {
+	uint64_t bytes;
+	int threads;
+	int duration;
+	int write_pct;
+	int stripes; // of the codec test
+	int kills;
+} conf = {
+	.bytes = 64ULL << 20,
+	.threads = 4,
+	.duration = 6,
+	.write_pct = 50,
+	.stripes = 64,
+	.kills = RSWAP_EC_M,
+};
+
+static uint64_t nr_errors;
+
+#define EC_CHECK(cond)                                                          \
+	do {                                                                    \
+		if (!(cond)) {                                                  \
+			fprintf(stderr, "%s:%d check failed: %s\n", __func__, \
+				__LINE__, #cond);                               \
+			nr_errors++;                                            \
+		}                                                               \
+	} while (0)
+
+static uint8_t *alloc_pages(int n)
+{
+	void *p;
+
+	if (posix_memalign(&p, BENCH_PAGE_SIZE, n * BENCH_PAGE_SIZE)) {
+		fprintf(stderr, "cannot allocate %d pages\n", n);
+		exit(1);
+	}
+	return p;
+}
+
+static void fill_random(uint8_t *p, size_t len, uint64_t *seed)
+{
+	size_t i;
+
+	for (i = 0; i < len / sizeof(uint64_t); i++)
+		((uint64_t *)p)[i] = bench_rand(seed);
+}
+
+/* codec */
+
+static void codec_test(void)
+{
+	uint8_t *orig = alloc_pages(RSWAP_EC_N), *work = alloc_pages(RSWAP_EC_N);
+	uint8_t *frag[RSWAP_EC_N], *ofrag[RSWAP_EC_N];
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	unsigned int lost, f;
+	uint64_t decodes = 0;
+	size_t n;
+	int s, i;
+
+	for (f = 0; f < RSWAP_EC_N; f++) {
+		ofrag[f] = orig + f * BENCH_PAGE_SIZE;
+		frag[f] = work + f * BENCH_PAGE_SIZE;
+	}
+	for (s = 0; s < conf.stripes; s++) {
+		fill_random(orig, RSWAP_EC_K * BENCH_PAGE_SIZE, &seed);
+		// also the corner cases of the field
+		if (s == 1)
+			memset(orig, 0xff, RSWAP_EC_K * BENCH_PAGE_SIZE);
+		rswap_ec_encode(ofrag, BENCH_PAGE_SIZE);
+
+		for (n = 0; n < BENCH_PAGE_SIZE; n++) {
+			uint8_t p = 0, q = 0;
+
+			for (i = 0; i < RSWAP_EC_K; i++) {
+				p ^= ofrag[i][n];
+				q ^= rswap_ec_mul(rswap_ec_exp[i], ofrag[i][n]);
+			}
+			EC_CHECK(ofrag[RSWAP_EC_P][n] == p);
+			EC_CHECK(ofrag[RSWAP_EC_Q][n] == q);
+		}
+
+		for (lost = 1; lost <= RSWAP_EC_ALL; lost++) {
+			memcpy(work, orig, RSWAP_EC_N * BENCH_PAGE_SIZE);
+			for (f = 0; f < RSWAP_EC_N; f++) {
+				if (lost & (1U << f))
+					fill_random(frag[f], BENCH_PAGE_SIZE, &seed);
+			}
+			if (__builtin_popcount(lost) > RSWAP_EC_M) {
+				EC_CHECK(rswap_ec_decode(frag, BENCH_PAGE_SIZE, lost) < 0);
+				continue;
+			}
+			EC_CHECK(rswap_ec_decode(frag, BENCH_PAGE_SIZE, lost) == 0);
+			EC_CHECK(!memcmp(work, orig, RSWAP_EC_N * BENCH_PAGE_SIZE));
+			decodes++;
+		}
+	}
+	printf("codec_stripes: %d\n", conf.stripes);
+	printf("codec_decodes: %" PRIu64 "\n", decodes);
+	free(orig);
+	free(work);
+}
+
+/* emulated servers */
+
+static uint64_t nr_pages, nr_stripes;
+static uint8_t *servers[RSWAP_EC_N]; // a page per stripe
+static unsigned int dead; // servers
+
+static bool server_dead(unsigned int srv)
+{
+	return __atomic_load_n(&dead, __ATOMIC_ACQUIRE) & (1U << srv);
+}
+
+// a transfer fails if the server dies before it is done
+static int server_rw(uint64_t stripe, unsigned int frag, uint8_t *page, bool write)
+{
+	unsigned int srv = rswap_ec_server(stripe, frag);
+	uint8_t *remote = servers[srv] + stripe * BENCH_PAGE_SIZE;
+
+	if (server_dead(srv))
+		return -1;
+	if (write)
+		memcpy(remote, page, BENCH_PAGE_SIZE);
+	else
+		memcpy(page, remote, BENCH_PAGE_SIZE);
+	return server_dead(srv) ? -1 : 0;
+}
+
+static void kill_server(unsigned int srv)
+{
+	uint64_t seed = srv + 1;
+
+	__atomic_fetch_or(&dead, 1U << srv, __ATOMIC_RELEASE);
+	fill_random(servers[srv], nr_stripes * BENCH_PAGE_SIZE, &seed);
+}
+
+/* the client, as rswap_ec.c */
+
+struct pend {
+	pthread_mutex_t lock;
+	uint64_t stripe;
+	unsigned int members;
+	uint64_t stamp;
+	uint8_t *pages[RSWAP_EC_N];
+	uint8_t *scratch[RSWAP_EC_N];
+};
+
+static struct pend *pends; // of each thread
+static struct pend **pending; // of each stripe
+static pthread_mutex_t locks[EC_LOCKS];
+static uint64_t full_writes, partial_writes, decoded;
+
+static unsigned int ec_rw(uint64_t stripe, uint8_t **frags, unsigned int mask, bool write)
+{
+	unsigned int frag, done = 0;
+
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if ((mask & (1U << frag)) && !server_rw(stripe, frag, frags[frag], write))
+			done |= 1U << frag;
+	}
+	return done;
+}
+
+static unsigned int ec_lost(uint64_t stripe)
+{
+	unsigned int frag, lost = 0;
+
+	for (frag = 0; frag < RSWAP_EC_N; frag++) {
+		if (server_dead(rswap_ec_server(stripe, frag)))
+			lost |= 1U << frag;
+	}
+	return lost;
+}
+
+static int ec_read_stripe(uint64_t stripe, uint8_t **frags, unsigned int want)
+{
+	unsigned int done = 0, lost;
+
+	if (want & ec_lost(stripe))
+		want = RSWAP_EC_ALL;
+	for (;;) {
+		done |= ec_rw(stripe, frags, want & ~done, false);
+		if (!(want & ~done) || want == RSWAP_EC_ALL)
+			break;
+		want = RSWAP_EC_ALL;
+	}
+	lost = want & ~done;
+	if (!lost)
+		return 0;
+	__atomic_fetch_add(&decoded, 1, __ATOMIC_RELAXED);
+	return rswap_ec_decode(frags, BENCH_PAGE_SIZE, lost);
+}
+
+static int ec_flush(struct pend *pend)
+{
+	uint64_t stripe = pend->stripe;
+	unsigned int missing = RSWAP_EC_DATA & ~pend->members, frag;
+	pthread_mutex_t *lock = &locks[stripe % EC_LOCKS];
+	int ret = 0;
+
+	pthread_mutex_lock(lock);
+	if (missing) {
+		ret = ec_read_stripe(stripe, pend->scratch, missing);
+		if (ret)
+			goto out;
+		for (frag = 0; frag < RSWAP_EC_K; frag++) {
+			if (missing & (1U << frag))
+				memcpy(pend->pages[frag], pend->scratch[frag], BENCH_PAGE_SIZE);
+		}
+	}
+	rswap_ec_encode(pend->pages, BENCH_PAGE_SIZE);
+	ec_rw(stripe, pend->pages, pend->members | 1U << RSWAP_EC_P | 1U << RSWAP_EC_Q, true);
+	if (__builtin_popcount(__atomic_load_n(&dead, __ATOMIC_ACQUIRE)) > RSWAP_EC_M)
+		ret = -1;
+	__atomic_fetch_add(missing ? &partial_writes : &full_writes, 1, __ATOMIC_RELAXED);
+out:
+	pthread_mutex_unlock(lock);
+	__atomic_store_n(&pending[stripe], NULL, __ATOMIC_RELEASE);
+	pend->stripe = EC_NONE;
+	pend->members = 0;
+	return ret;
+}
+
+static int ec_add(struct pend *pend, unsigned int member, const uint8_t *page)
+{
+	memcpy(pend->pages[member], page, BENCH_PAGE_SIZE);
+	pend->members |= 1U << member;
+	if (pend->members == RSWAP_EC_DATA)
+		return ec_flush(pend);
+	return 0;
+}
+
+static int ec_store(int thread, uint64_t offset, const uint8_t *page)
+{
+	uint64_t stripe = rswap_ec_stripe(offset);
+	unsigned int member = rswap_ec_member(offset);
+	struct pend *pend, *none;
+	int ret;
+
+retry:
+	pend = __atomic_load_n(&pending[stripe], __ATOMIC_ACQUIRE);
+	if (pend) {
+		pthread_mutex_lock(&pend->lock);
+		if (pend->stripe != stripe) {
+			pthread_mutex_unlock(&pend->lock);
+			goto retry;
+		}
+		ret = ec_add(pend, member, page);
+		pthread_mutex_unlock(&pend->lock);
+		return ret;
+	}
+
+	pend = &pends[thread];
+	pthread_mutex_lock(&pend->lock);
+	if (pend->stripe != EC_NONE && ec_flush(pend))
+		fprintf(stderr, "pending stripe lost\n");
+	pend->stripe = stripe;
+	pend->stamp = bench_now_ns();
+	none = NULL;
+	if (!__atomic_compare_exchange_n(&pending[stripe], &none, pend, false, __ATOMIC_ACQ_REL,
+					 __ATOMIC_ACQUIRE)) {
+		pend->stripe = EC_NONE;
+		pthread_mutex_unlock(&pend->lock);
+		goto retry;
+	}
+	ret = ec_add(pend, member, page);
+	pthread_mutex_unlock(&pend->lock);
+	return ret;
+}
+
+static int ec_load(uint64_t offset, uint8_t *page, uint8_t **scratch)
+{
+	uint64_t stripe = rswap_ec_stripe(offset);
+	unsigned int member = rswap_ec_member(offset);
+	pthread_mutex_t *lock = &locks[stripe % EC_LOCKS];
+	struct pend *pend;
+	int ret;
+
+	pend = __atomic_load_n(&pending[stripe], __ATOMIC_ACQUIRE);
+	if (pend) {
+		pthread_mutex_lock(&pend->lock);
+		if (pend->stripe == stripe && (pend->members & (1U << member))) {
+			memcpy(page, pend->pages[member], BENCH_PAGE_SIZE);
+			pthread_mutex_unlock(&pend->lock);
+			return 0;
+		}
+		pthread_mutex_unlock(&pend->lock);
+	}
+
+	if (!server_rw(stripe, member, page, false))
+		return 0;
+	// degraded
+	pthread_mutex_lock(lock);
+	ret = ec_read_stripe(stripe, scratch, 1U << member);
+	pthread_mutex_unlock(lock);
+	if (!ret)
+		memcpy(page, scratch[member], BENCH_PAGE_SIZE);
+	return ret;
+}
+
+static void ec_flush_idle(uint64_t age_ns)
+{
+	int i;
+
+	for (i = 0; i < conf.threads; i++) {
+		pthread_mutex_lock(&pends[i].lock);
+		if (pends[i].stripe != EC_NONE && bench_now_ns() - pends[i].stamp >= age_ns && ec_flush(&pends[i]))
+			fprintf(stderr, "pending stripe lost\n");
+		pthread_mutex_unlock(&pends[i].lock);
+	}
+}
+
+/* the emulated swap */
+
+struct ec_thread {
+	pthread_t thread;
+	int id;
+	uint64_t seed;
+	uint8_t *page;
+	uint8_t *scratch[RSWAP_EC_N];
+	volatile uint64_t loads, stores, failed;
+};
+
+static struct ec_thread *threads;
+static uint32_t *gens;
+static volatile int stop;
+
+static void make_page(uint8_t *page, uint64_t idx, uint32_t gen)
+{
+	uint64_t *p = (uint64_t *)page;
+	int i;
+
+	p[0] = idx;
+	p[1] = gen;
+	for (i = 2; i < PAGE_WORDS; i++)
+		p[i] = bench_scramble(idx ^ ((uint64_t)gen << 40) ^ i);
+}
+
+static void check_page(struct ec_thread *t, uint64_t idx)
+{
+	uint64_t *p = (uint64_t *)t->page;
+	uint8_t *expected = t->scratch[0]; // not used by the load after
+	int ret;
+
+	ret = ec_load(idx, t->page, t->scratch);
+	if (ret) {
+		t->failed++;
+		__atomic_fetch_add(&nr_errors, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "page %" PRIu64 " could not be read\n", idx);
+		return;
+	}
+	make_page(expected, idx, gens[idx]);
+	if (memcmp(t->page, expected, BENCH_PAGE_SIZE)) {
+		__atomic_fetch_add(&nr_errors, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "page %" PRIu64 ": expected gen %u, found page %" PRIu64 " gen %" PRIu64 "\n", idx,
+			gens[idx], p[0], p[1]);
+	}
+	t->loads++;
+}
+
+static void store_page(struct ec_thread *t, uint64_t idx, uint32_t gen)
+{
+	make_page(t->page, idx, gen);
+	if (ec_store(t->id, idx, t->page)) {
+		t->failed++;
+		__atomic_fetch_add(&nr_errors, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "page %" PRIu64 " could not be stored\n", idx);
+		return;
+	}
+	gens[idx] = gen;
+	t->stores++;
+}
+
+// stripe s belongs to thread s % threads
+static void *fill_fn(void *arg)
+{
+	struct ec_thread *t = arg;
+	uint64_t stripe, idx;
+
+	for (stripe = t->id; stripe < nr_stripes; stripe += conf.threads) {
+		for (idx = stripe * RSWAP_EC_K; idx < (stripe + 1) * RSWAP_EC_K; idx++)
+			store_page(t, idx, 1);
+	}
+	return NULL;
+}
+
+static void *swap_fn(void *arg)
+{
+	struct ec_thread *t = arg;
+	uint64_t owned = (nr_stripes - t->id + conf.threads - 1) / conf.threads;
+	uint64_t stripe, idx;
+
+	while (!stop) {
+		stripe = bench_rand(&t->seed) % owned * conf.threads + t->id;
+		idx = stripe * RSWAP_EC_K + bench_rand(&t->seed) % RSWAP_EC_K;
+		if (bench_rand(&t->seed) % 100 >= conf.write_pct)
+			check_page(t, idx);
+		else if (bench_rand(&t->seed) % 2)
+			store_page(t, idx, gens[idx] + 1);
+		else
+			for (idx = stripe * RSWAP_EC_K; idx < (stripe + 1) * RSWAP_EC_K; idx++)
+				store_page(t, idx, gens[idx] + 1);
+	}
+	return NULL;
+}
+
+static void *final_fn(void *arg)
+{
+	struct ec_thread *t = arg;
+	uint64_t idx;
+
+	for (idx = t->id; idx < nr_pages; idx += conf.threads)
+		check_page(t, idx);
+	return NULL;
+}
+
+static void run_threads(void *(*fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < conf.threads; i++)
+		pthread_create(&threads[i].thread, NULL, fn, &threads[i]);
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(threads[i].thread, NULL);
+}
+
+static void emulated_test(void)
+{
+	uint64_t start, end, loads = 0, stores = 0, failed = 0, kill_ns;
+	uint64_t seed = 0x2545F4914F6CDD1DULL;
+	uint64_t fill_full, fill_partial;
+	unsigned int srv, kills = 0;
+	int i, f;
+
+	nr_pages = conf.bytes >> BENCH_PAGE_SHIFT;
+	nr_stripes = nr_pages / RSWAP_EC_K;
+	nr_pages = nr_stripes * RSWAP_EC_K;
+	for (srv = 0; srv < RSWAP_EC_N; srv++) {
+		servers[srv] = alloc_pages(nr_stripes);
+		memset(servers[srv], 0, nr_stripes * BENCH_PAGE_SIZE);
+	}
+	pending = calloc(nr_stripes, sizeof(*pending));
+	gens = calloc(nr_pages, sizeof(*gens));
+	pends = calloc(conf.threads, sizeof(*pends));
+	threads = calloc(conf.threads, sizeof(*threads));
+	if (!pending || !gens || !pends || !threads) {
+		fprintf(stderr, "cannot allocate the swap area\n");
+		exit(1);
+	}
+	for (i = 0; i < EC_LOCKS; i++)
+		pthread_mutex_init(&locks[i], NULL);
+	for (i = 0; i < conf.threads; i++) {
+		pthread_mutex_init(&pends[i].lock, NULL);
+		pends[i].stripe = EC_NONE;
+		threads[i].id = i;
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		threads[i].page = alloc_pages(1);
+		for (f = 0; f < RSWAP_EC_N; f++) {
+			pends[i].pages[f] = alloc_pages(1);
+			pends[i].scratch[f] = alloc_pages(1);
+			threads[i].scratch[f] = alloc_pages(1);
+		}
+	}
+
+	printf("threads: %d\n", conf.threads);
+	printf("swap_bytes: %" PRIu64 "\n", nr_pages << BENCH_PAGE_SHIFT);
+	run_threads(fill_fn);
+	ec_flush_idle(0);
+	// the stripes stored in order are written with their parity at once
+	fill_full = full_writes;
+	fill_partial = partial_writes;
+	printf("fill.full_stripe_writes: %" PRIu64 "\n", fill_full);
+	printf("fill.partial_stripe_writes: %" PRIu64 "\n", fill_partial);
+	EC_CHECK(fill_full > fill_partial);
+	full_writes = partial_writes = 0;
+
+	for (i = 0; i < conf.threads; i++)
+		pthread_create(&threads[i].thread, NULL, swap_fn, &threads[i]);
+	start = bench_now_ns();
+	end = start + conf.duration * 1000000000ULL;
+	kill_ns = (end - start) / (conf.kills + 1);
+	while (bench_now_ns() < end) {
+		usleep(10000);
+		ec_flush_idle(10000000);
+		if (kills < conf.kills && bench_now_ns() - start >= (kills + 1) * kill_ns) {
+			do
+				srv = bench_rand(&seed) % RSWAP_EC_N;
+			while (server_dead(srv));
+			kill_server(srv);
+			printf("t%.1f.killed_server: %u\n", (bench_now_ns() - start) / 1e9, srv);
+			fflush(stdout);
+			kills++;
+		}
+	}
+	stop = 1;
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	ec_flush_idle(0);
+
+	stop = 0;
+	run_threads(final_fn);
+	for (i = 0; i < conf.threads; i++) {
+		loads += threads[i].loads;
+		stores += threads[i].stores;
+		failed += threads[i].failed;
+	}
+	printf("elapsed_sec: %.3f\n", (bench_now_ns() - start) / 1e9);
+	printf("loaded_pages: %" PRIu64 "\n", loads);
+	printf("stored_pages: %" PRIu64 "\n", stores);
+	printf("failed_pages: %" PRIu64 "\n", failed);
+	printf("full_stripe_writes: %" PRIu64 "\n", full_writes);
+	printf("partial_stripe_writes: %" PRIu64 "\n", partial_writes);
+	printf("decoded_stripes: %" PRIu64 "\n", decoded);
+	printf("dead_servers: 0x%x\n", dead);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-s <swap area size>] [-t <#threads>] [-d <seconds>] [-w <%% of stores>]\n"
+		"\t[-n <stripes of the codec test>] [-k <servers killed, up to %d>]\n"
+		"Sizes take k/m/g suffixes. The exit status is 1 if any page was lost or corrupt.\n",
+		prog, RSWAP_EC_M);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:t:d:w:n:k:h")) != -1) {
+		switch (opt) {
+		case 's':
+			conf.bytes = bench_parse_size(optarg);
+			break;
+		case 't':
+			conf.threads = atoi(optarg);
+			break;
+		case 'd':
+			conf.duration = atoi(optarg);
+			break;
+		case 'w':
+			conf.write_pct = atoi(optarg);
+			break;
+		case 'n':
+			conf.stripes = atoi(optarg);
+			break;
+		case 'k':
+			conf.kills = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (conf.threads < 1 || conf.duration < 1 || conf.write_pct < 0 || conf.write_pct > 100 ||
+	    conf.stripes < 1 || conf.kills < 0 || conf.kills > RSWAP_EC_M ||
+	    conf.bytes < (uint64_t)conf.threads * RSWAP_EC_K * BENCH_PAGE_SIZE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	rswap_ec_gf_init();
+	codec_test();
+	printf("codec_errors: %" PRIu64 "\n", nr_errors);
+	emulated_test();
+	printf("errors: %" PRIu64 "\n", nr_errors);
+	return nr_errors ? 1 : 0;
+}
@@ -0,0 +1,460 @@
+/*
+ * isobench - measure the isolation of co-running tenants on the swap path.
+ *
+ * Every tenant runs a workload of its own in its own memory cgroup, with its
+ * threads pinned to its own cores, which is how the rswap scheduler tells
+ * the tenants apart. The weights and the latency-critical flags go to the
+ * scheduler with syscall_rswap_set_proc, and its policy with
+ * syscall_scheduler_set_policy. All the tenants run for the same time, then
+ * their throughput, swap-in latency and the fairness among them are printed
+ * as "name: value" lines.
+ */
+#define _GNU_SOURCE
+#include "workload.h"
+#include "canvas_syscalls.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_TENANTS 16
+#define MAX_TENANT_THREADS 64
+#define PROC_NAME_LEN 100 // MAX_PROC_NAME_LENGTH of rswap_scheduler.h
+#define SCHEDULER_NUM 4 // RSWAP_SCHEDULER_NUM of rswap_scheduler.h
+
+struct tenant {
+	char name[32];
+	uint64_t limit;
+	int threads;
+	int weight;
+	int lat_critical;
+	int cores[MAX_TENANT_THREADS];
+	uint64_t remote; // quota of the remote memory, 0: none
+	int remote_policy;
+	struct workload wl;
+
+	// filled by the tenant
+	uint64_t accesses;
+	uint64_t elapsed_ns;
+	struct bench_counters counters;
+	struct bench_hist all;
+	struct bench_hist slow;
+	uint64_t remote_bytes;
+	uint64_t remote_refused;
+};
+
+static struct tenant *tenants; // shared with the tenant processes
+static int nr_tenants;
+static int duration = 30;
+
+static struct {
+	bool set_policy;
+	int cores[SCHEDULER_NUM];
+	int boundary[SCHEDULER_NUM];
+	int threshold;
+	int maintain_time;
+	int check_duration;
+	int poll_times;
+	bool no_proc;
+} policy = {
+	.boundary = { 0, 10, 20, 30 },
+	.threshold = -1000,
+	.maintain_time = 10,
+	.check_duration = 100,
+	.poll_times = 10,
+};
+
+static int parse_ints(const char *str, int *vals, int max)
+{
+	int n = 0, lo, hi;
+	const char *p = str;
+	char *end;
+
+	while (*p && n < max) {
+		lo = strtol(p, &end, 0);
+		hi = lo;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 0);
+		for (; lo <= hi && n < max; lo++)
+			vals[n++] = lo;
+		if (*end != ',' && *end != ':')
+			break;
+		p = end + 1;
+	}
+	return n;
+}
+
+/*
+ * name=kv,wss=4g,limit=1g,threads=4,weight=2,lc=1,pattern=random,cores=0-3,
+ * the cores are separated by ':' in a list, e.g., cores=0:2:4:6. remote=2g
+ * caps the remote memory of the tenant, reclaim=1 sets its quota policy.
+ */
+static int parse_tenant(char *spec, int *next_core)
+{
+	struct tenant *t = &tenants[nr_tenants];
+	char *tok, *val, *save;
+	int nr_cores = 0, i;
+
+	snprintf(t->name, sizeof(t->name), "tenant%d", nr_tenants);
+	t->wl.bytes = 1ULL << 30;
+	t->wl.pattern = PAT_RANDOM;
+	t->wl.stride = 8;
+	t->wl.streams = 4;
+	t->wl.phase_len = 16384;
+	t->wl.hot_pct = 20;
+	t->wl.fault_ns = 1000;
+	t->threads = 1;
+	t->weight = 1;
+
+	for (tok = strtok_r(spec, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (!strcmp(tok, "name"))
+			snprintf(t->name, sizeof(t->name), "%s", val);
+		else if (!strcmp(tok, "wss"))
+			t->wl.bytes = bench_parse_size(val);
+		else if (!strcmp(tok, "limit"))
+			t->limit = bench_parse_size(val);
+		else if (!strcmp(tok, "threads"))
+			t->threads = atoi(val);
+		else if (!strcmp(tok, "weight"))
+			t->weight = atoi(val);
+		else if (!strcmp(tok, "lc"))
+			t->lat_critical = atoi(val);
+		else if (!strcmp(tok, "pattern"))
+			t->wl.pattern = parse_pattern(val);
+		else if (!strcmp(tok, "write"))
+			t->wl.write = atoi(val);
+		else if (!strcmp(tok, "remote"))
+			t->remote = bench_parse_size(val);
+		else if (!strcmp(tok, "reclaim"))
+			t->remote_policy = atoi(val);
+		else if (!strcmp(tok, "cores"))
+			nr_cores = parse_ints(val, t->cores,
+					      MAX_TENANT_THREADS);
+		else
+			return -1;
+	}
+	if (t->threads < 1 || t->threads > MAX_TENANT_THREADS ||
+	    (int)t->wl.pattern < 0 ||
+	    (nr_cores && nr_cores != t->threads))
+		return -1;
+	if (!t->limit)
+		t->limit = t->wl.bytes / 4;
+	// by default the tenants get the next free cores
+	if (!nr_cores)
+		for (i = 0; i < t->threads; i++)
+			t->cores[i] = (*next_core)++;
+	nr_tenants++;
+	return 0;
+}
+
+static int apply_policy(void)
+{
+	char names[MAX_TENANTS * PROC_NAME_LEN] = { 0 };
+	int cores[MAX_TENANTS * MAX_TENANT_THREADS];
+	int threads[MAX_TENANTS], weights[MAX_TENANTS], lc[MAX_TENANTS];
+	int info[2] = { nr_tenants, PROC_NAME_LEN };
+	int threshold[2] = { policy.threshold, policy.maintain_time };
+	int i, j, n = 0;
+
+	if (policy.set_policy &&
+	    syscall(SYS_syscall_scheduler_set_policy, policy.cores, threshold,
+		    policy.boundary, policy.check_duration,
+		    policy.poll_times)) {
+		fprintf(stderr, "syscall_scheduler_set_policy failed, is rswap-client loaded?\n");
+		return -1;
+	}
+	if (policy.no_proc)
+		return 0;
+
+	for (i = 0; i < nr_tenants; i++) {
+		snprintf(names + i * PROC_NAME_LEN, PROC_NAME_LEN, "%s",
+			 tenants[i].name);
+		threads[i] = tenants[i].threads;
+		weights[i] = tenants[i].weight;
+		lc[i] = tenants[i].lat_critical;
+		for (j = 0; j < tenants[i].threads; j++)
+			cores[n++] = tenants[i].cores[j];
+	}
+	if (syscall(SYS_syscall_rswap_set_proc, info, names, cores, threads,
+		    weights, lc)) {
+		fprintf(stderr, "syscall_rswap_set_proc failed, is rswap-client loaded?\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void *tenant_worker(void *arg)
+{
+	struct worker *w = arg;
+
+	while (!w->wl->stop)
+		worker_run_pass(w);
+	return NULL;
+}
+
+/*
+ * The process of a tenant: fill its working set, tell the parent it is
+ * ready on @ready, run from the byte on @go for the duration.
+ */
+static int run_tenant(struct tenant *t, int ready, int go)
+{
+	struct bench_cgroup cg;
+	struct worker *workers;
+	struct bench_counters before, after;
+	char cgname[64], c = 0;
+	uint64_t start;
+	cpu_set_t set;
+	int i, ret = 1;
+
+	snprintf(cgname, sizeof(cgname), "isobench-%s", t->name);
+	if (bench_cgroup_create(&cg, cgname, t->limit) ||
+	    (t->remote &&
+	     bench_cgroup_set_remote(&cg, t->remote, t->remote_policy)) ||
+	    bench_cgroup_attach(&cg, getpid()))
+		goto out_cgroup;
+	if (workload_map(&t->wl))
+		goto out_cgroup;
+	workers = calloc(t->threads, sizeof(*workers));
+	if (!workers)
+		goto out_unmap;
+
+	// the parent sees EOF on ready once every tenant is ready or gone
+	if (write(ready, &c, 1) != 1 || close(ready) || read(go, &c, 1) != 1)
+		goto out_free;
+
+	bench_read_counters(&cg, &before);
+	start = bench_now_ns();
+	for (i = 0; i < t->threads; i++) {
+		worker_init(&workers[i], &t->wl, i, t->threads);
+		pthread_create(&workers[i].thread, NULL, tenant_worker,
+			       &workers[i]);
+		CPU_ZERO(&set);
+		CPU_SET(t->cores[i], &set);
+		pthread_setaffinity_np(workers[i].thread, sizeof(set), &set);
+	}
+	sleep(duration);
+	t->wl.stop = 1;
+	for (i = 0; i < t->threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		t->accesses += workers[i].accesses;
+		bench_hist_merge(&t->all, &workers[i].all);
+		bench_hist_merge(&t->slow, &workers[i].slow);
+	}
+	t->elapsed_ns = bench_now_ns() - start;
+	bench_read_counters(&cg, &after);
+	bench_counters_sub(&t->counters, &after, &before);
+	t->remote_bytes = bench_cgroup_remote(&cg, &t->remote_refused);
+	ret = 0;
+
+out_free:
+	free(workers);
+out_unmap:
+	workload_unmap(&t->wl);
+out_cgroup:
+	bench_cgroup_destroy(&cg);
+	return ret;
+}
+
+// (sum x)^2 / (n * sum x^2), 1 when all the x are equal
+static double jain_index(const double *x, int n)
+{
+	double sum = 0, sq = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sum += x[i];
+		sq += x[i] * x[i];
+	}
+	return sq > 0 ? sum * sum / (n * sq) : 0;
+}
+
+static void report(void)
+{
+	double tput[MAX_TENANTS], weighted[MAX_TENANTS];
+	int i;
+
+	printf("tenants: %d\n", nr_tenants);
+	printf("duration_sec: %d\n", duration);
+	for (i = 0; i < nr_tenants; i++) {
+		struct tenant *t = &tenants[i];
+		double sec = t->elapsed_ns / 1e9;
+		char prefix[64];
+
+		tput[i] = sec > 0 ? t->accesses / sec : 0;
+		weighted[i] = tput[i] / t->weight;
+
+		printf("%s.pattern: %s\n", t->name,
+		       pattern_names[t->wl.pattern]);
+		printf("%s.weight: %d\n", t->name, t->weight);
+		printf("%s.lat_critical: %d\n", t->name, t->lat_critical);
+		printf("%s.access_per_sec: %.0f\n", t->name, tput[i]);
+		printf("%s.swapin_per_sec: %.0f\n", t->name,
+		       sec > 0 ? t->slow.count / sec : 0);
+		printf("%s.ondemand_swapin: %" PRIu64 "\n", t->name,
+		       t->counters.ondemand_swapin);
+		printf("%s.prefetch_swapin: %" PRIu64 "\n", t->name,
+		       t->counters.prefetch_swapin);
+		printf("%s.remote_bytes: %" PRIu64 "\n", t->name,
+		       t->remote_bytes);
+		printf("%s.remote_refused: %" PRIu64 "\n", t->name,
+		       t->remote_refused);
+		snprintf(prefix, sizeof(prefix), "%s.swapin", t->name);
+		bench_report_hist(prefix, &t->slow);
+	}
+	printf("jain_index: %.4f\n", jain_index(tput, nr_tenants));
+	// the throughput of a tenant over its weight, 1 if they get their share
+	printf("jain_index_weighted: %.4f\n",
+	       jain_index(weighted, nr_tenants));
+}
+
+// A tenant failed to start, the others may wait on go forever.
+static void kill_tenants(const pid_t *pids, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		kill(pids[i], SIGKILL);
+	for (i = 0; i < n; i++)
+		waitpid(pids[i], NULL, 0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -a <tenant> [-a <tenant>]... [-d <seconds>] [-N]\n"
+		"\t[-s <4 scheduler cores, c0,c1,c2,c3>] [-B <4 policy boundaries>] [-H <scheduler threshold>]\n"
+		"\t[-M <auto maintain time>] [-C <check duration>] [-Q <poll times>]\n"
+		"A tenant is name=<name>,wss=<size>,limit=<size>,threads=<n>,weight=<n>,lc=0|1,\n"
+		"\tpattern=" PATTERN_USAGE ",write=0|1,cores=<c0:c1:...|c0-cn>,remote=<size>,reclaim=0|1\n"
+		"-s applies the scheduler policy, -N skips syscall_rswap_set_proc.\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	int ready[2], go[2], next_core = 0;
+	pid_t pids[MAX_TENANTS];
+	int i, opt, status, failed = 0;
+	char c;
+
+	tenants = mmap(NULL, MAX_TENANTS * sizeof(*tenants),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+		       0);
+	if (tenants == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(tenants, 0, MAX_TENANTS * sizeof(*tenants));
+
+	while ((opt = getopt(argc, argv, "a:d:s:B:H:M:C:Q:Nh")) != -1) {
+		switch (opt) {
+		case 'a':
+			if (nr_tenants == MAX_TENANTS ||
+			    parse_tenant(optarg, &next_core)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			if (parse_ints(optarg, policy.cores, SCHEDULER_NUM) !=
+			    SCHEDULER_NUM) {
+				usage(argv[0]);
+				return 1;
+			}
+			policy.set_policy = true;
+			break;
+		case 'B':
+			if (parse_ints(optarg, policy.boundary,
+				       SCHEDULER_NUM) != SCHEDULER_NUM) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'H':
+			policy.threshold = atoi(optarg);
+			break;
+		case 'M':
+			policy.maintain_time = atoi(optarg);
+			break;
+		case 'C':
+			policy.check_duration = atoi(optarg);
+			break;
+		case 'Q':
+			policy.poll_times = atoi(optarg);
+			break;
+		case 'N':
+			policy.no_proc = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_tenants || duration < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (apply_policy())
+		return 1;
+
+	if (pipe(ready) || pipe(go)) {
+		perror("pipe");
+		return 1;
+	}
+	for (i = 0; i < nr_tenants; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			close(ready[0]);
+			close(go[1]);
+			exit(run_tenant(&tenants[i], ready[1], go[0]));
+		}
+		if (pids[i] < 0) {
+			perror("fork");
+			close(go[1]);
+			kill_tenants(pids, i);
+			return 1;
+		}
+	}
+	close(ready[1]);
+	close(go[0]);
+	// start together once all of them are swapped out
+	for (i = 0; i < nr_tenants; i++) {
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "a tenant exited before it was ready\n");
+			close(go[1]);
+			kill_tenants(pids, nr_tenants);
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_tenants; i++)
+		if (write(go[1], &c, 1) != 1)
+			break;
+	close(go[1]);
+
+	for (i = 0; i < nr_tenants; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "tenant %s failed\n", tenants[i].name);
+			failed = 1;
+		}
+	}
+	if (failed)
+		return 1;
+	report();
+	return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * swapbench - drive the swap path with synthetic access patterns.
+ *
+ * The working set is allocated in a memory cgroup whose limit is the local
+ * memory, so the rest of it lives in swap, i.e., on the memory server or in
+ * the DRAM backend. Every page access is timed, and the swap counters of the
+ * kernel are read around the measured passes.
+ */
+#include "workload.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static struct {
+	int threads;
+	int passes;
+	uint64_t limit;
+	const char *cgroup;
+} conf = {
+	.threads = 1,
+	.passes = 3,
+	.cgroup = "swapbench",
+};
+
+static struct workload wl = {
+	.bytes = 1ULL << 30,
+	.pattern = PAT_SEQ,
+	.stride = 8,
+	.streams = 4,
+	.phase_len = 16384,
+	.hot_pct = 20,
+	.fault_ns = 1000,
+};
+static pthread_barrier_t barrier;
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	int pass;
+
+	pthread_barrier_wait(&barrier);
+	for (pass = 0; pass < conf.passes; pass++)
+		worker_run_pass(w);
+	pthread_barrier_wait(&barrier);
+	return NULL;
+}
+
+static long major_faults(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_majflt;
+}
+
+static void report(struct worker *workers, uint64_t elapsed_ns,
+		   long majflt, struct bench_counters *c)
+{
+	struct bench_hist *all = calloc(1, sizeof(*all));
+	struct bench_hist *slow = calloc(1, sizeof(*slow));
+	double sec = elapsed_ns / 1e9;
+	uint64_t accesses = 0;
+	int i;
+
+	for (i = 0; i < conf.threads; i++) {
+		bench_hist_merge(all, &workers[i].all);
+		bench_hist_merge(slow, &workers[i].slow);
+		accesses += workers[i].accesses;
+	}
+
+	printf("pattern: %s\n", pattern_names[wl.pattern]);
+	printf("threads: %d\n", conf.threads);
+	printf("working_set_bytes: %" PRIu64 "\n", wl.bytes);
+	printf("local_limit_bytes: %" PRIu64 "\n", conf.limit);
+	printf("elapsed_sec: %.3f\n", sec);
+	printf("accesses: %" PRIu64 "\n", accesses);
+	printf("access_per_sec: %.0f\n", accesses / sec);
+	printf("major_faults: %ld\n", majflt);
+	printf("fault_per_sec: %.0f\n", majflt / sec);
+	bench_report_hist("access", all);
+	bench_report_hist("slow_access", slow);
+
+	printf("ondemand_swapin: %" PRIu64 "\n", c->ondemand_swapin);
+	printf("prefetch_swapin: %" PRIu64 "\n", c->prefetch_swapin);
+	printf("hiton_swap_cache: %" PRIu64 "\n", c->hiton_swap_cache);
+	// hiton_swap_cache only counts the first hit on a prefetched page
+	printf("prefetch_accuracy: %.4f\n",
+	       c->prefetch_swapin ?
+		       (double)c->hiton_swap_cache / c->prefetch_swapin :
+		       0.0);
+	printf("swap_ra_accuracy: %.4f\n",
+	       c->swap_ra ? (double)c->swap_ra_hit / c->swap_ra : 0.0);
+	printf("swapin_bytes: %" PRIu64 "\n", c->pswpin * BENCH_PAGE_SIZE);
+	printf("swapout_bytes: %" PRIu64 "\n", c->pswpout * BENCH_PAGE_SIZE);
+	printf("swap_bytes_per_sec: %.0f\n",
+	       (c->pswpin + c->pswpout) * BENCH_PAGE_SIZE / sec);
+
+	free(all);
+	free(slow);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-s <working set size>] [-l <local memory limit>] [-p " PATTERN_USAGE "]\n"
+		"\t[-t <#threads>] [-n <#passes>] [-S <stride in pages>] [-k <#streams of interleave>]\n"
+		"\t[-P <phase length in pages>] [-H <hot percent of the pages of hotcold>] [-w]\n"
+		"\t[-f <slow access threshold in ns>] [-c <cgroup name>]\n"
+		"Sizes take k/m/g suffixes. The local limit defaults to a quarter of the working set.\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_counters before, after, delta;
+	struct bench_cgroup cg;
+	struct worker *workers;
+	uint64_t start, elapsed;
+	long majflt;
+	int i, opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:l:p:t:n:S:k:P:H:wf:c:h")) != -1) {
+		switch (opt) {
+		case 's':
+			wl.bytes = bench_parse_size(optarg);
+			break;
+		case 'l':
+			conf.limit = bench_parse_size(optarg);
+			break;
+		case 'p':
+			i = parse_pattern(optarg);
+			if (i < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			wl.pattern = i;
+			break;
+		case 't':
+			conf.threads = atoi(optarg);
+			break;
+		case 'n':
+			conf.passes = atoi(optarg);
+			break;
+		case 'S':
+			wl.stride = strtoull(optarg, NULL, 0);
+			break;
+		case 'k':
+			wl.streams = atoi(optarg);
+			break;
+		case 'P':
+			wl.phase_len = strtoull(optarg, NULL, 0);
+			break;
+		case 'H':
+			wl.hot_pct = atoi(optarg);
+			break;
+		case 'w':
+			wl.write = true;
+			break;
+		case 'f':
+			wl.fault_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			conf.cgroup = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!conf.limit)
+		conf.limit = wl.bytes / 4;
+	if (conf.threads < 1 || conf.passes < 1 || wl.stride < 1 ||
+	    wl.streams < 1 || wl.phase_len < 1 || wl.hot_pct < 1 ||
+	    wl.hot_pct > 100 ||
+	    (wl.bytes >> BENCH_PAGE_SHIFT) <
+		    (uint64_t)conf.threads * wl.streams) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (bench_cgroup_create(&cg, conf.cgroup, conf.limit) ||
+	    bench_cgroup_attach(&cg, getpid()))
+		goto out_cgroup;
+
+	if (workload_map(&wl))
+		goto out_cgroup;
+
+	workers = calloc(conf.threads, sizeof(*workers));
+	if (!workers)
+		goto out_unmap;
+	pthread_barrier_init(&barrier, NULL, conf.threads + 1);
+	for (i = 0; i < conf.threads; i++) {
+		worker_init(&workers[i], &wl, i, conf.threads);
+		pthread_create(&workers[i].thread, NULL, worker_fn,
+			       &workers[i]);
+	}
+
+	bench_read_counters(&cg, &before);
+	majflt = major_faults();
+	start = bench_now_ns();
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	elapsed = bench_now_ns() - start;
+	majflt = major_faults() - majflt;
+	bench_read_counters(&cg, &after);
+
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	bench_counters_sub(&delta, &after, &before);
+	report(workers, elapsed, majflt, &delta);
+	ret = 0;
+
+	free(workers);
+out_unmap:
+	workload_unmap(&wl);
+out_cgroup:
+	bench_cgroup_destroy(&cg);
+	return ret;
+}
@@ -0,0 +1,418 @@
+/*
+ * swapreplay - play back a trace of swaptrace.
+ *
+ * The pages the tenant faulted on are laid out by process, in the order of
+ * their addresses, in a region of their own, so the spatial locality the
+ * prefetchers see is kept. The pages swapped out before the trace started
+ * are swapped out first. Then the faults are touched and the swap-outs are
+ * paged out with MADV_PAGEOUT in the recorded order, so the refaults happen
+ * where the tenant had them, under the chosen prefetch policy. The local
+ * memory limit should leave room for the pages in memory, or reclaim adds
+ * swap-outs of its own. Replaying a trace twice gives the same sequence of
+ * faults.
+ */
+#include "bench.h"
+#include "canvas_syscalls.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+struct fault {
+	uint64_t ns; // when the tenant faulted, or swapped the page out
+	uint64_t page; // index in the region
+	uint64_t think_ns; // since the previous fault was done
+	int out; // a swap-out, not a fault
+};
+
+// a page of the tenant
+struct page_key {
+	uint64_t pid;
+	uint64_t vpn;
+};
+
+// the swap entry of a fault, to find the page of a swap-out
+struct entry_use {
+	uint64_t entry;
+	uint64_t idx; // in faults
+};
+
+static struct {
+	uint64_t limit;
+	const char *cgroup;
+	int readahead_win; // -1: unchanged
+	int prefetch; // -1: unchanged, 0: VMA based, 1: Leap
+	double think; // scale of the recorded think time, 0: none
+	int passes;
+	uint64_t fault_ns;
+} conf = {
+	.limit = 1ULL << 30,
+	.cgroup = "swapreplay",
+	.readahead_win = -1,
+	.prefetch = -1,
+	.passes = 1,
+	.fault_ns = 1000,
+};
+
+static struct fault *faults; // and swap-outs
+static uint64_t nr_faults, nr_swapouts;
+static uint64_t nr_pages;
+static uint64_t *swapped_out; // pages out when the trace started
+static uint64_t nr_swapped_out;
+static uint64_t nr_prefetched, nr_prefetch_hits;
+static struct bench_hist recorded; // fault latency of the tenant
+
+static int cmp_key(const void *a, const void *b)
+{
+	const struct page_key *x = a, *y = b;
+
+	if (x->pid != y->pid)
+		return x->pid < y->pid ? -1 : 1;
+	return x->vpn < y->vpn ? -1 : x->vpn > y->vpn;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct entry_use *x = a, *y = b;
+
+	if (x->entry != y->entry)
+		return x->entry < y->entry ? -1 : 1;
+	return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+static uint64_t page_index(struct page_key *pages, struct page_key *key)
+{
+	uint64_t lo = 0, hi = nr_pages;
+
+	while (lo < hi) {
+		uint64_t mid = (lo + hi) / 2;
+
+		if (cmp_key(&pages[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// the first fault on @entry after event @idx, nr if none
+static uint64_t next_use(struct entry_use *uses, uint64_t nr, uint64_t entry,
+			 uint64_t idx)
+{
+	struct entry_use key = { entry, idx };
+	uint64_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		uint64_t mid = (lo + hi) / 2;
+
+		if (cmp_entry(&uses[mid], &key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < nr && uses[lo].entry == entry ? lo : nr;
+}
+
+/*
+ * Read the faults (I events) of the trace, with the time since the previous
+ * fault was done (F events), and the swap-outs (O events). A swap-out is of
+ * the page of the next fault on its swap entry, the ones never faulted back
+ * are not replayed. The prefetches (P events) are only counted. The pages
+ * are keyed by process and address, and get their index in the region.
+ */
+static int load_trace(const char *path)
+{
+	char line[256], type;
+	unsigned long long ns, pid, a, b, c;
+	uint64_t cap = 0, prev_done = 0, nr = 0, nr_uses = 0, i, n;
+	struct page_key *keys = NULL, *pages;
+	struct entry_use *uses;
+	uint8_t *seen;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llu %llu %c %llx %llx %llu", &ns, &pid, &type,
+			   &a, &b, &c) < 4)
+			continue;
+		if (type == 'F') {
+			// "F <address> <latency ns> <major>", the latency in decimal
+			sscanf(line, "%llu %llu %c %llx %llu", &ns, &pid, &type,
+			       &a, &b);
+			bench_hist_add(&recorded, b);
+			prev_done = ns; // traced once the fault is done
+			continue;
+		}
+		if (type == 'P') {
+			nr_prefetched++;
+			continue;
+		}
+		if (type != 'I' && type != 'O')
+			continue;
+		if (nr == cap) {
+			cap = cap ? cap * 2 : 1 << 16;
+			faults = realloc(faults, cap * sizeof(*faults));
+			keys = realloc(keys, cap * sizeof(*keys));
+			if (!faults || !keys) {
+				fclose(f);
+				return -1;
+			}
+		}
+		faults[nr].ns = ns;
+		faults[nr].out = type == 'O';
+		if (type == 'O') {
+			// "O <swap entry> <frontswap>", the page is found below
+			faults[nr].page = a;
+			faults[nr].think_ns = 0;
+		} else {
+			keys[nr].pid = pid;
+			keys[nr].vpn = a >> BENCH_PAGE_SHIFT;
+			faults[nr].page = b;
+			faults[nr].think_ns =
+				prev_done && ns > prev_done ? ns - prev_done : 0;
+			nr_prefetch_hits += c == 2;
+			nr_uses++;
+		}
+		nr++;
+	}
+	fclose(f);
+	if (!nr_uses) {
+		fprintf(stderr, "no faults in %s\n", path);
+		return -1;
+	}
+
+	// the swap entries of the faults, to find the page of a swap-out
+	uses = malloc(nr_uses * sizeof(*uses));
+	pages = malloc(nr_uses * sizeof(*pages));
+	if (!uses || !pages)
+		return -1;
+	for (i = 0, n = 0; i < nr; i++) {
+		if (faults[i].out)
+			continue;
+		uses[n].entry = faults[i].page;
+		uses[n].idx = i;
+		pages[n++] = keys[i];
+	}
+	qsort(uses, nr_uses, sizeof(*uses), cmp_entry);
+	for (i = 0; i < nr; i++) {
+		if (!faults[i].out)
+			continue;
+		n = next_use(uses, nr_uses, faults[i].page, i);
+		if (n == nr_uses) {
+			faults[i].page = UINT64_MAX;
+			continue;
+		}
+		keys[i] = keys[uses[n].idx];
+	}
+	free(uses);
+
+	// the distinct pages, by process and in the order of their addresses
+	qsort(pages, nr_uses, sizeof(*pages), cmp_key);
+	for (i = 0, n = 0; i < nr_uses; i++)
+		if (!n || cmp_key(&pages[i], &pages[n - 1]))
+			pages[n++] = pages[i];
+	nr_pages = n;
+
+	// drop the swap-outs never faulted back
+	for (i = 0, n = 0; i < nr; i++) {
+		if (faults[i].out && faults[i].page == UINT64_MAX)
+			continue;
+		faults[n] = faults[i];
+		faults[n].page = page_index(pages, &keys[i]);
+		nr_swapouts += faults[n].out;
+		nr_faults += !faults[n].out;
+		n++;
+	}
+	nr = n;
+	free(keys);
+	free(pages);
+
+	// out when the trace started: faulted on before any swap-out
+	seen = calloc(nr_pages, 1);
+	swapped_out = malloc(nr_pages * sizeof(*swapped_out));
+	if (!seen || !swapped_out)
+		return -1;
+	for (i = 0; i < nr; i++) {
+		if (seen[faults[i].page])
+			continue;
+		seen[faults[i].page] = 1;
+		if (!faults[i].out)
+			swapped_out[nr_swapped_out++] = faults[i].page;
+	}
+	free(seen);
+	return 0;
+}
+
+static void page_out(char *region, uint64_t page)
+{
+	if (madvise(region + (page << BENCH_PAGE_SHIFT), BENCH_PAGE_SIZE,
+		    MADV_PAGEOUT))
+		fprintf(stderr, "MADV_PAGEOUT: %s\n", strerror(errno));
+}
+
+static void set_prefetch_policy(void)
+{
+	if (conf.readahead_win >= 0 &&
+	    syscall(SYS_set_readahead_win, conf.readahead_win))
+		fprintf(stderr, "set_readahead_win: %s\n", strerror(errno));
+	if (conf.prefetch >= 0 &&
+	    syscall(SYS_set_customized_prefetch, conf.prefetch))
+		fprintf(stderr, "set_customized_prefetch: %s\n",
+			strerror(errno));
+}
+
+static void spin_until(uint64_t ns)
+{
+	while (bench_now_ns() < ns)
+		;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-l <local memory limit>] [-c <cgroup name>] [-w <readahead window, 0: kernel default, 1: off>]\n"
+		"\t[-L 0|1 <VMA based|Leap prefetch>] [-T <scale of the recorded think time>] [-n <#passes>]\n"
+		"\t[-f <slow access threshold in ns>] <trace file>\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_counters before, after, delta;
+	struct bench_hist *all, *slow;
+	struct bench_cgroup cg;
+	struct rusage ru;
+	uint64_t start, elapsed, t, lat, i;
+	long majflt;
+	char *region;
+	int opt, pass, ret = 1;
+
+	while ((opt = getopt(argc, argv, "l:c:w:L:T:n:f:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			conf.limit = bench_parse_size(optarg);
+			break;
+		case 'c':
+			conf.cgroup = optarg;
+			break;
+		case 'w':
+			conf.readahead_win = atoi(optarg);
+			break;
+		case 'L':
+			conf.prefetch = atoi(optarg);
+			break;
+		case 'T':
+			conf.think = atof(optarg);
+			break;
+		case 'n':
+			conf.passes = atoi(optarg);
+			break;
+		case 'f':
+			conf.fault_ns = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || conf.passes < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (load_trace(argv[optind]))
+		return 1;
+
+	all = calloc(1, sizeof(*all));
+	slow = calloc(1, sizeof(*slow));
+	if (!all || !slow)
+		return 1;
+
+	set_prefetch_policy();
+	if (bench_cgroup_create(&cg, conf.cgroup, conf.limit) ||
+	    bench_cgroup_attach(&cg, getpid()))
+		goto out_cgroup;
+
+	region = bench_map(nr_pages << BENCH_PAGE_SHIFT);
+	if (!region)
+		goto out_cgroup;
+
+	bench_read_counters(&cg, &before);
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt;
+	start = bench_now_ns();
+	for (pass = 0; pass < conf.passes; pass++) {
+		for (i = 0; i < nr_pages; i++)
+			*(uint64_t *)(region + (i << BENCH_PAGE_SHIFT)) = i;
+		// swapped out as the tenant found them
+		for (i = 0; i < nr_swapped_out; i++)
+			page_out(region, swapped_out[i]);
+
+		for (i = 0, t = bench_now_ns(); i < nr_faults + nr_swapouts; i++) {
+			char *p = region + (faults[i].page << BENCH_PAGE_SHIFT);
+
+			if (faults[i].out) {
+				page_out(region, faults[i].page);
+				continue;
+			}
+
+			if (conf.think > 0)
+				spin_until(t + faults[i].think_ns * conf.think);
+			t = bench_now_ns();
+			(void)*(volatile uint64_t *)p;
+			lat = bench_now_ns() - t;
+			t += lat;
+			bench_hist_add(all, lat);
+			if (lat >= conf.fault_ns)
+				bench_hist_add(slow, lat);
+		}
+	}
+	elapsed = bench_now_ns() - start;
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt - majflt;
+	bench_read_counters(&cg, &after);
+	bench_counters_sub(&delta, &after, &before);
+
+	printf("trace_faults: %" PRIu64 "\n", nr_faults);
+	printf("trace_swapouts: %" PRIu64 "\n", nr_swapouts);
+	printf("trace_pages: %" PRIu64 "\n", nr_pages);
+	printf("trace_prefetch_accuracy: %.4f\n",
+	       nr_prefetched ? (double)nr_prefetch_hits / nr_prefetched : 0.0);
+	printf("local_limit_bytes: %" PRIu64 "\n", conf.limit);
+	printf("elapsed_sec: %.3f\n", elapsed / 1e9);
+	printf("major_faults: %ld\n", majflt);
+	bench_report_hist("trace_fault", &recorded);
+	bench_report_hist("access", all);
+	bench_report_hist("slow_access", slow);
+	printf("ondemand_swapin: %" PRIu64 "\n", delta.ondemand_swapin);
+	printf("prefetch_swapin: %" PRIu64 "\n", delta.prefetch_swapin);
+	printf("hiton_swap_cache: %" PRIu64 "\n", delta.hiton_swap_cache);
+	printf("prefetch_accuracy: %.4f\n",
+	       delta.prefetch_swapin ?
+		       (double)delta.hiton_swap_cache / delta.prefetch_swapin :
+		       0.0);
+	printf("swapin_bytes: %" PRIu64 "\n", delta.pswpin * BENCH_PAGE_SIZE);
+	printf("swapout_bytes: %" PRIu64 "\n", delta.pswpout * BENCH_PAGE_SIZE);
+	ret = 0;
+
+	bench_unmap(region, nr_pages << BENCH_PAGE_SHIFT);
+out_cgroup:
+	bench_cgroup_destroy(&cg);
+	free(all);
+	free(slow);
+	free(faults);
+	free(swapped_out);
+	return ret;
+}
@@ -0,0 +1,396 @@
+/*
+ * swapstress - swap stress test that verifies every page it touches.
+ *
+ * Every page of the working set holds a pattern computed from its address
+ * and its generation, which is bumped on each rewrite, with both also in the
+ * header of the page. The working set is several times the memory cgroup
+ * limit, so the threads keep swapping pages out and in, and each access
+ * checks the whole page against the generation last written to it. A page
+ * that comes back from swap with an old generation is a lost or stale
+ * write, one with another address was swapped in from the wrong slot.
+ *
+ * It only goes through the swap path of the kernel, so it runs the same
+ * against any backend of rswap-client.
+ */
+#include "bench.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define PAGE_WORDS (BENCH_PAGE_SIZE / sizeof(uint64_t))
+#define PAGEOUT_PAGES 64
+
+static struct {
+	uint64_t bytes;
+	uint64_t limit;
+	int threads;
+	int duration;
+	int write_pct;
+	int pageout_pct;
+	int run; // pages accessed in a row
+	int interval;
+	bool keep_going;
+	const char *cgroup;
+} conf = {
+	.bytes = 1ULL << 30,
+	.threads = 4,
+	.duration = 30,
+	.write_pct = 50,
+	.run = 8,
+	.cgroup = "swapstress",
+};
+
+struct page_header {
+	uint64_t addr;
+	uint64_t gen;
+};
+
+struct stress_thread {
+	pthread_t thread;
+	int id;
+	uint64_t seed;
+	// updated while it runs, for the interval reports
+	volatile uint64_t verified;
+	volatile uint64_t written;
+	volatile uint64_t pageouts;
+};
+
+static char *region;
+static uint64_t nr_pages;
+static uint32_t *gens; // the generation last written to every page
+static struct stress_thread *threads;
+static pthread_barrier_t barrier;
+static volatile int stop;
+static uint64_t nr_errors;
+
+static inline uint64_t pattern_word(uint64_t addr, uint64_t gen, int i)
+{
+	return bench_scramble(addr ^ (gen << 44) ^ i);
+}
+
+static void write_page(uint64_t idx, uint32_t gen)
+{
+	uint64_t *p = (uint64_t *)(region + (idx << BENCH_PAGE_SHIFT));
+	struct page_header *h = (struct page_header *)p;
+	int i;
+
+	for (i = sizeof(*h) / sizeof(uint64_t); i < PAGE_WORDS; i++)
+		p[i] = pattern_word((uint64_t)p, gen, i);
+	h->addr = (uint64_t)p;
+	h->gen = gen;
+	gens[idx] = gen;
+}
+
+/* Check a page against the generation last written to it, 0 if it matches. */
+static int verify_page(uint64_t idx)
+{
+	uint64_t *p = (uint64_t *)(region + (idx << BENCH_PAGE_SHIFT));
+	struct page_header *h = (struct page_header *)p;
+	uint32_t gen = gens[idx];
+	int i, bad = 0, first = -1;
+	const char *what;
+
+	for (i = sizeof(*h) / sizeof(uint64_t); i < PAGE_WORDS; i++) {
+		if (p[i] != pattern_word((uint64_t)p, gen, i)) {
+			if (first < 0)
+				first = i;
+			bad++;
+		}
+	}
+	if (!bad && h->addr == (uint64_t)p && h->gen == gen)
+		return 0;
+
+	if (!h->addr && !h->gen)
+		what = "lost"; // came back as a zero page
+	else if (h->addr != (uint64_t)p)
+		what = "misplaced";
+	else if (h->gen < gen)
+		what = "stale";
+	else
+		what = "corrupt";
+	fprintf(stderr,
+		"%s page %" PRIu64 " at %p: expected gen %u, found addr 0x%" PRIx64
+		" gen %" PRIu64 ", %d bad words from word %d\n",
+		what, idx, p, gen, h->addr, h->gen, bad, first);
+	__atomic_fetch_add(&nr_errors, 1, __ATOMIC_RELAXED);
+	if (!conf.keep_going)
+		stop = 1;
+	return -1;
+}
+
+/*
+ * Page p belongs to thread p % threads, so that neighbouring pages, which
+ * are swapped out and prefetched together, are used by different threads.
+ */
+static uint64_t nr_owned(struct stress_thread *t)
+{
+	return (nr_pages - t->id + conf.threads - 1) / conf.threads;
+}
+
+static void *fill_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	uint64_t idx;
+
+	for (idx = t->id; idx < nr_pages; idx += conf.threads)
+		write_page(idx, 1);
+	return NULL;
+}
+
+static void *stress_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	uint64_t owned = nr_owned(t), n, idx, start;
+	int i;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		n = bench_rand(&t->seed) % owned;
+		if (bench_rand(&t->seed) % 100 < conf.pageout_pct) {
+			// push a range out, with the pages of the others in it
+			start = (n * conf.threads) & ~(uint64_t)(PAGEOUT_PAGES - 1);
+			if (start + PAGEOUT_PAGES <= nr_pages)
+				madvise(region + (start << BENCH_PAGE_SHIFT),
+					PAGEOUT_PAGES << BENCH_PAGE_SHIFT,
+					MADV_PAGEOUT);
+			t->pageouts++;
+		}
+		for (i = 0; i < conf.run && n < owned && !stop; i++, n++) {
+			idx = n * conf.threads + t->id;
+			verify_page(idx);
+			t->verified++;
+			if (bench_rand(&t->seed) % 100 < conf.write_pct) {
+				write_page(idx, gens[idx] + 1);
+				t->written++;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *final_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	uint64_t idx;
+
+	for (idx = t->id; idx < nr_pages; idx += conf.threads)
+		verify_page(idx);
+	return NULL;
+}
+
+static void run_threads(void *(*fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < conf.threads; i++)
+		pthread_create(&threads[i].thread, NULL, fn, &threads[i]);
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(threads[i].thread, NULL);
+}
+
+static void sum_threads(uint64_t *verified, uint64_t *written,
+			uint64_t *pageouts)
+{
+	int i;
+
+	*verified = *written = *pageouts = 0;
+	for (i = 0; i < conf.threads; i++) {
+		*verified += threads[i].verified;
+		*written += threads[i].written;
+		*pageouts += threads[i].pageouts;
+	}
+}
+
+static void report(const char *prefix, uint64_t ns, uint64_t verified,
+		   uint64_t written, struct bench_counters *c)
+{
+	double sec = ns / 1e9;
+
+	printf("%sverified_per_sec: %.0f\n", prefix, verified / sec);
+	printf("%swritten_per_sec: %.0f\n", prefix, written / sec);
+	printf("%sswapin_bytes_per_sec: %.0f\n", prefix,
+	       c->pswpin * BENCH_PAGE_SIZE / sec);
+	printf("%sswapout_bytes_per_sec: %.0f\n", prefix,
+	       c->pswpout * BENCH_PAGE_SIZE / sec);
+	// the part of the swap that went to the remote memory
+	printf("%sfrontswap_load_bytes_per_sec: %.0f\n", prefix,
+	       c->frontswap_loads * BENCH_PAGE_SIZE / sec);
+	printf("%sfrontswap_store_bytes_per_sec: %.0f\n", prefix,
+	       c->frontswap_stores * BENCH_PAGE_SIZE / sec);
+	printf("%serrors: %" PRIu64 "\n", prefix, nr_errors);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-s <working set size>] [-l <local memory limit>] [-t <#threads>] [-d <seconds>]\n"
+		"\t[-w <%% of writes>] [-p <%% of runs starting with MADV_PAGEOUT>] [-r <pages in a run>]\n"
+		"\t[-i <report interval in seconds>] [-k] [-c <cgroup name>]\n"
+		"Sizes take k/m/g suffixes. The local limit defaults to a quarter of the working set.\n"
+		"-k keeps going after a bad page; the exit status is 1 if any was found.\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_counters before, last, now, delta;
+	uint64_t start, last_ns, now_ns, end;
+	uint64_t verified, written, pageouts;
+	uint64_t last_verified = 0, last_written = 0;
+	struct bench_cgroup cg;
+	char prefix[32];
+	int i, opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:l:t:d:w:p:r:i:kc:h")) != -1) {
+		switch (opt) {
+		case 's':
+			conf.bytes = bench_parse_size(optarg);
+			break;
+		case 'l':
+			conf.limit = bench_parse_size(optarg);
+			break;
+		case 't':
+			conf.threads = atoi(optarg);
+			break;
+		case 'd':
+			conf.duration = atoi(optarg);
+			break;
+		case 'w':
+			conf.write_pct = atoi(optarg);
+			break;
+		case 'p':
+			conf.pageout_pct = atoi(optarg);
+			break;
+		case 'r':
+			conf.run = atoi(optarg);
+			break;
+		case 'i':
+			conf.interval = atoi(optarg);
+			break;
+		case 'k':
+			conf.keep_going = true;
+			break;
+		case 'c':
+			conf.cgroup = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	nr_pages = conf.bytes >> BENCH_PAGE_SHIFT;
+	if (!conf.limit)
+		conf.limit = conf.bytes / 4;
+	if (conf.threads < 1 || conf.duration < 1 || conf.write_pct < 0 ||
+	    conf.write_pct > 100 || conf.pageout_pct < 0 ||
+	    conf.pageout_pct > 100 || conf.run < 1 || conf.interval < 0 ||
+	    nr_pages < conf.threads) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (bench_cgroup_create(&cg, conf.cgroup, conf.limit) ||
+	    bench_cgroup_attach(&cg, getpid()))
+		goto out_cgroup;
+	region = bench_map(nr_pages << BENCH_PAGE_SHIFT);
+	gens = calloc(nr_pages, sizeof(*gens));
+	threads = calloc(conf.threads, sizeof(*threads));
+	if (!region || !gens || !threads) {
+		fprintf(stderr, "cannot allocate the working set\n");
+		goto out_free;
+	}
+	for (i = 0; i < conf.threads; i++) {
+		threads[i].id = i;
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+
+	printf("threads: %d\n", conf.threads);
+	printf("working_set_bytes: %" PRIu64 "\n", nr_pages << BENCH_PAGE_SHIFT);
+	printf("local_limit_bytes: %" PRIu64 "\n", conf.limit);
+	start = bench_now_ns();
+	run_threads(fill_fn);
+	printf("fill_sec: %.3f\n", (bench_now_ns() - start) / 1e9);
+	fflush(stdout);
+
+	pthread_barrier_init(&barrier, NULL, conf.threads + 1);
+	for (i = 0; i < conf.threads; i++)
+		pthread_create(&threads[i].thread, NULL, stress_fn,
+			       &threads[i]);
+	bench_read_counters(&cg, &before);
+	last = before;
+	start = last_ns = bench_now_ns();
+	end = start + conf.duration * 1000000000ULL;
+	pthread_barrier_wait(&barrier);
+	while (!stop && (now_ns = bench_now_ns()) < end) {
+		usleep(100000);
+		if (!conf.interval ||
+		    bench_now_ns() - last_ns < conf.interval * 1000000000ULL)
+			continue;
+		now_ns = bench_now_ns();
+		bench_read_counters(&cg, &now);
+		bench_counters_sub(&delta, &now, &last);
+		sum_threads(&verified, &written, &pageouts);
+		snprintf(prefix, sizeof(prefix), "t%.0f.",
+			 (now_ns - start) / 1e9);
+		report(prefix, now_ns - last_ns, verified - last_verified,
+		       written - last_written, &delta);
+		fflush(stdout);
+		last = now;
+		last_ns = now_ns;
+		last_verified = verified;
+		last_written = written;
+	}
+	stop = 1;
+	for (i = 0; i < conf.threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	now_ns = bench_now_ns();
+	bench_read_counters(&cg, &now);
+	bench_counters_sub(&delta, &now, &before);
+	pthread_barrier_destroy(&barrier);
+
+	sum_threads(&verified, &written, &pageouts);
+	printf("elapsed_sec: %.3f\n", (now_ns - start) / 1e9);
+	printf("verified_pages: %" PRIu64 "\n", verified);
+	printf("written_pages: %" PRIu64 "\n", written);
+	printf("pageout_calls: %" PRIu64 "\n", pageouts);
+	printf("swapin_bytes: %" PRIu64 "\n", delta.pswpin * BENCH_PAGE_SIZE);
+	printf("swapout_bytes: %" PRIu64 "\n", delta.pswpout * BENCH_PAGE_SIZE);
+	printf("frontswap_load_bytes: %" PRIu64 "\n",
+	       delta.frontswap_loads * BENCH_PAGE_SIZE);
+	printf("frontswap_store_bytes: %" PRIu64 "\n",
+	       delta.frontswap_stores * BENCH_PAGE_SIZE);
+	printf("frontswap_failed_stores: %" PRIu64 "\n",
+	       delta.frontswap_failed_stores);
+	report("", now_ns - start, verified, written, &delta);
+
+	// the pages written last and not read since are checked here
+	if (!nr_errors || conf.keep_going) {
+		stop = 0;
+		start = bench_now_ns();
+		run_threads(final_fn);
+		printf("final_verify_sec: %.3f\n", (bench_now_ns() - start) / 1e9);
+		printf("final_errors: %" PRIu64 "\n", nr_errors);
+	}
+	ret = nr_errors ? 1 : 0;
+
+out_free:
+	free(threads);
+	free(gens);
+	if (region)
+		bench_unmap(region, nr_pages << BENCH_PAGE_SHIFT);
+out_cgroup:
+	bench_cgroup_destroy(&cg);
+	return ret;
+}
@@ -0,0 +1,260 @@
+/*
+ * swaptrace - record the swap events of a tenant.
+ *
+ * Enables the canvas trace events (include/trace/events/canvas.h) for the
+ * memory cgroup of the tenant and writes them to a trace file, one event per
+ * line, which swapreplay plays back:
+ *
+ *	<ns> <pid> I <address> <swap entry> <hit>	fault on a swapped out page
+ *	<ns> <pid> F <address> <latency ns> <major>	that fault done
+ *	<ns> <pid> P <swap entry>			page prefetched
+ *	<ns> <pid> O <swap entry> <frontswap>		page swapped out
+ *
+ * <pid> is the process of the task, its tid if the kernel did not record it.
+ * <hit> is 0 for a miss, 1 for a hit on the swap cache, 2 for the first hit
+ * on a prefetched page.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static const char *tracefs;
+static volatile sig_atomic_t stop;
+
+static const char *const events[] = {
+	"canvas_swapin",
+	"canvas_swap_fault",
+	"canvas_swap_prefetch",
+	"canvas_swapout",
+};
+#define NR_EVENTS (sizeof(events) / sizeof(events[0]))
+
+static int trace_write(const char *file, const char *val)
+{
+	char path[512];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", tracefs, file);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0 || write(fd, val, strlen(val)) < 0) {
+		fprintf(stderr, "cannot write %s to %s: %s\n", val, path,
+			strerror(errno));
+		ret = -1;
+	}
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+static const char *find_tracefs(void)
+{
+	if (!access("/sys/kernel/tracing/events/canvas", F_OK))
+		return "/sys/kernel/tracing";
+	if (!access("/sys/kernel/debug/tracing/events/canvas", F_OK))
+		return "/sys/kernel/debug/tracing";
+	return NULL;
+}
+
+static int setup_events(unsigned long ino, int enable, const char *buf_kb)
+{
+	char file[128], filter[64];
+	size_t i;
+
+	if (trace_write("tracing_on", "0"))
+		return -1;
+	if (enable) {
+		trace_write("trace", "");
+		trace_write("trace_clock", "mono");
+		trace_write("buffer_size_kb", buf_kb);
+	}
+	// the addresses are per process, not per thread
+	trace_write("options/record-tgid", enable ? "1" : "0");
+	if (enable)
+		snprintf(filter, sizeof(filter), "ino == %lu", ino);
+	else
+		strcpy(filter, "0");
+	for (i = 0; i < NR_EVENTS; i++) {
+		snprintf(file, sizeof(file), "events/canvas/%s/filter",
+			 events[i]);
+		if (trace_write(file, filter))
+			return -1;
+		snprintf(file, sizeof(file), "events/canvas/%s/enable",
+			 events[i]);
+		if (trace_write(file, enable ? "1" : "0"))
+			return -1;
+	}
+	return enable ? trace_write("tracing_on", "1") : 0;
+}
+
+/*
+ * "  comm-tid  (tgid) [cpu] flags  sec.usec: canvas_swapin: addr=0x..
+ * entry=0x..", comm may have spaces and dashes, tgid is "-----" if unknown.
+ */
+static void convert_line(char *line, FILE *out, uint64_t *nr)
+{
+	char *ev, *p, *ts;
+	unsigned long tid, pid = 0, sec, usec;
+	unsigned long long a, b, c;
+	uint64_t ns;
+
+	ev = strstr(line, ": canvas_");
+	if (!ev)
+		return;
+	*ev = '\0';
+	ev += 2;
+
+	ts = strrchr(line, ' ');
+	if (!ts || sscanf(ts, " %lu.%lu", &sec, &usec) != 2)
+		return;
+	ns = (uint64_t)sec * 1000000000ULL + (uint64_t)usec * 1000;
+
+	p = strstr(line, " [");
+	if (!p)
+		return;
+	*p = '\0';
+	while (p > line && p[-1] == ' ')
+		*--p = '\0';
+	if (p > line && p[-1] == ')' && (p = strrchr(line, '('))) {
+		pid = strtoul(p + 1, NULL, 10);
+		*p = '\0';
+	}
+	p = strrchr(line, '-');
+	if (!p)
+		return;
+	tid = strtoul(p + 1, NULL, 10);
+	if (!pid)
+		pid = tid;
+
+	if (sscanf(ev, "canvas_swapin: addr=%llx entry=%llx hit=%llu", &a,
+		   &b, &c) == 3)
+		fprintf(out, "%" PRIu64 " %lu I 0x%llx 0x%llx %llu\n", ns, pid,
+			a, b, c);
+	else if (sscanf(ev, "canvas_swap_fault: addr=%llx major=%llu lat_ns=%llu",
+			&a, &b, &c) == 3)
+		fprintf(out, "%" PRIu64 " %lu F 0x%llx %llu %llu\n", ns, pid, a,
+			c, b);
+	else if (sscanf(ev, "canvas_swap_prefetch: entry=%llx", &a) == 1)
+		fprintf(out, "%" PRIu64 " %lu P 0x%llx\n", ns, pid, a);
+	else if (sscanf(ev, "canvas_swapout: entry=%llx ino=%llu frontswap=%llu",
+			&a, &b, &c) == 3)
+		fprintf(out, "%" PRIu64 " %lu O 0x%llx %llu\n", ns, pid, a, c);
+	else
+		return;
+	(*nr)++;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -c <cgroup dir of the tenant> [-o <trace file>] [-d <seconds>] [-b <trace buffer per cpu in KB>]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *cgroup = NULL, *out_path = "swap.trace";
+	const char *buf_kb = "65536";
+	char buf[65536], path[512];
+	size_t len = 0;
+	uint64_t nr = 0, deadline = 0;
+	struct pollfd pfd;
+	struct stat st;
+	FILE *out;
+	int opt, fd;
+	ssize_t n;
+
+	while ((opt = getopt(argc, argv, "c:o:d:b:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			cgroup = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'd':
+			deadline = bench_now_ns() +
+				   strtoull(optarg, NULL, 0) * 1000000000ULL;
+			break;
+		case 'b':
+			buf_kb = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!cgroup) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (stat(cgroup, &st)) {
+		fprintf(stderr, "cannot stat cgroup %s: %s\n", cgroup,
+			strerror(errno));
+		return 1;
+	}
+	tracefs = find_tracefs();
+	if (!tracefs) {
+		fprintf(stderr, "no canvas trace events, is tracefs mounted?\n");
+		return 1;
+	}
+	out = fopen(out_path, "w");
+	if (!out) {
+		perror(out_path);
+		return 1;
+	}
+	fprintf(out, "# swaptrace cgroup=%s\n", cgroup);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (setup_events(st.st_ino, 1, buf_kb))
+		goto out;
+
+	snprintf(path, sizeof(path), "%s/trace_pipe", tracefs);
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(path);
+		goto out;
+	}
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	fprintf(stderr, "recording %s to %s, ^C to stop\n", cgroup, out_path);
+	while (!stop && (!deadline || bench_now_ns() < deadline)) {
+		char *nl, *line;
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		n = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (n <= 0)
+			continue;
+		len += n;
+		buf[len] = '\0';
+		for (line = buf; (nl = strchr(line, '\n')); line = nl + 1) {
+			*nl = '\0';
+			convert_line(line, out, &nr);
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+	}
+	close(fd);
+
+out:
+	setup_events(0, 0, NULL);
+	fclose(out);
+	fprintf(stderr, "%" PRIu64 " events recorded\n", nr);
+	return 0;
+}
@@ -0,0 +1,227 @@
+#include "workload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *pattern_names[NR_PATTERNS] = {
+	"seq", "stride", "random", "chase", "interleave", "phase", "hotcold",
+};
+
+int parse_pattern(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NR_PATTERNS; i++)
+		if (!strcmp(name, pattern_names[i]))
+			return i;
+	return -1;
+}
+
+static inline uint64_t *page_words(struct workload *wl, uint64_t idx)
+{
+	return (uint64_t *)(wl->region + (idx << BENCH_PAGE_SHIFT));
+}
+
+// Returns the first word of the page, the next page of the chase.
+static inline uint64_t touch(struct worker *w, uint64_t idx)
+{
+	struct workload *wl = w->wl;
+	uint64_t start, lat, next;
+	uint64_t *p;
+
+	if (wl->stop)
+		return idx;
+	p = page_words(wl, idx);
+	start = bench_now_ns();
+	next = *(volatile uint64_t *)p;
+	if (wl->write)
+		*(volatile uint64_t *)(p + 1) = next;
+	lat = bench_now_ns() - start;
+
+	bench_hist_add(&w->all, lat);
+	if (lat >= wl->fault_ns)
+		bench_hist_add(&w->slow, lat);
+	w->accesses++;
+	return next;
+}
+
+static void run_seq(struct worker *w)
+{
+	uint64_t i;
+
+	for (i = w->lo; i < w->hi; i++)
+		touch(w, i);
+}
+
+static void run_stride(struct worker *w)
+{
+	uint64_t stride = w->wl->stride;
+	uint64_t off, i;
+
+	for (off = 0; off < stride; off++)
+		for (i = w->lo + off; i < w->hi; i += stride)
+			touch(w, i);
+}
+
+static void run_random(struct worker *w)
+{
+	uint64_t n = w->hi - w->lo;
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		touch(w, w->lo + bench_rand(&w->seed) % n);
+}
+
+static void run_chase(struct worker *w)
+{
+	uint64_t i, idx = w->lo;
+
+	for (i = w->lo; i < w->hi; i++)
+		idx = touch(w, idx);
+}
+
+// Sequential streams over slices of the pages, one page of each in turn.
+static void run_interleave(struct worker *w)
+{
+	int streams = w->wl->streams;
+	uint64_t len = (w->hi - w->lo) / streams;
+	uint64_t i;
+	int s;
+
+	for (i = 0; i < len; i++)
+		for (s = 0; s < streams; s++)
+			touch(w, w->lo + s * len + i);
+}
+
+// Sequential, strided and random phases in turn.
+static void run_phase(struct worker *w)
+{
+	struct workload *wl = w->wl;
+	uint64_t n = w->hi - w->lo;
+	uint64_t i, done, len;
+	int phase = 0;
+
+	for (done = 0; done < n; done += len, phase = (phase + 1) % 3) {
+		len = wl->phase_len < n - done ? wl->phase_len : n - done;
+		for (i = 0; i < len; i++) {
+			uint64_t off = done + i;
+
+			if (phase == 0)
+				touch(w, w->lo + off);
+			else if (phase == 1)
+				touch(w, w->lo + (off * wl->stride) % n);
+			else
+				touch(w, w->lo + bench_rand(&w->seed) % n);
+		}
+	}
+}
+
+// Random, 90% of the accesses on the first hot_pct% of the pages.
+static void run_hotcold(struct worker *w)
+{
+	uint64_t n = w->hi - w->lo;
+	uint64_t hot = n * w->wl->hot_pct / 100;
+	uint64_t i, r;
+
+	if (!hot)
+		hot = 1;
+	for (i = 0; i < n; i++) {
+		r = bench_rand(&w->seed);
+		if (r % 10 || hot == n)
+			touch(w, w->lo + (r / 10) % hot);
+		else
+			touch(w, w->lo + hot + (r / 10) % (n - hot));
+	}
+}
+
+void worker_run_pass(struct worker *w)
+{
+	switch (w->wl->pattern) {
+	case PAT_SEQ:
+		run_seq(w);
+		break;
+	case PAT_STRIDE:
+		run_stride(w);
+		break;
+	case PAT_RANDOM:
+		run_random(w);
+		break;
+	case PAT_CHASE:
+		run_chase(w);
+		break;
+	case PAT_INTERLEAVE:
+		run_interleave(w);
+		break;
+	case PAT_PHASE:
+		run_phase(w);
+		break;
+	case PAT_HOTCOLD:
+		run_hotcold(w);
+		break;
+	default:
+		break;
+	}
+}
+
+void worker_init(struct worker *w, struct workload *wl, int id,
+		 int nr_workers)
+{
+	w->id = id;
+	w->wl = wl;
+	w->seed = 0x9E3779B97F4A7C15ULL * (id + 1);
+	w->lo = wl->nr_pages * id / nr_workers;
+	w->hi = wl->nr_pages * (id + 1) / nr_workers;
+	// the chase follows one cycle over all the pages
+	if (wl->pattern == PAT_CHASE)
+		w->hi = w->lo + wl->nr_pages / nr_workers;
+}
+
+/*
+ * Write every page once, which pushes all but the local memory to swap. The
+ * first word of a page is its index, or the next page of one random cycle
+ * over all the pages for the pointer chase.
+ */
+static int fill_region(struct workload *wl)
+{
+	uint64_t *next = NULL;
+	uint64_t i, j, tmp, seed = 42;
+
+	if (wl->pattern == PAT_CHASE) {
+		next = malloc(wl->nr_pages * sizeof(*next));
+		if (!next)
+			return -1;
+		for (i = 0; i < wl->nr_pages; i++)
+			next[i] = i;
+		// Sattolo's algorithm, a single cycle
+		for (i = wl->nr_pages - 1; i > 0; i--) {
+			j = bench_rand(&seed) % i;
+			tmp = next[i];
+			next[i] = next[j];
+			next[j] = tmp;
+		}
+	}
+	for (i = 0; i < wl->nr_pages; i++)
+		*page_words(wl, i) = next ? next[i] : i;
+	free(next);
+	return 0;
+}
+
+int workload_map(struct workload *wl)
+{
+	wl->nr_pages = wl->bytes >> BENCH_PAGE_SHIFT;
+	wl->region = bench_map(wl->bytes);
+	if (!wl->region)
+		return -1;
+	if (fill_region(wl)) {
+		perror("fill");
+		workload_unmap(wl);
+		return -1;
+	}
+	return 0;
+}
+
+void workload_unmap(struct workload *wl)
+{
+	bench_unmap(wl->region, wl->bytes);
+}
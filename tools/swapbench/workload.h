@@ -0,0 +1,62 @@
+/*
+ * The synthetic access patterns of swapbench and isobench. A workload is a
+ * region of pages, its workers walk their share of it with the pattern and
+ * time every access.
+ */
+#ifndef __SWAPBENCH_WORKLOAD_H
+#define __SWAPBENCH_WORKLOAD_H
+
+#include "bench.h"
+
+#include <pthread.h>
+
+enum pattern {
+	PAT_SEQ,
+	PAT_STRIDE,
+	PAT_RANDOM,
+	PAT_CHASE,
+	PAT_INTERLEAVE,
+	PAT_PHASE,
+	PAT_HOTCOLD,
+	NR_PATTERNS,
+};
+
+extern const char *pattern_names[NR_PATTERNS];
+#define PATTERN_USAGE "seq|stride|random|chase|interleave|phase|hotcold"
+
+struct workload {
+	char *region;
+	uint64_t bytes;
+	uint64_t nr_pages;
+
+	enum pattern pattern;
+	uint64_t stride; // in pages
+	int streams; // of interleave, per worker
+	uint64_t phase_len; // in pages
+	int hot_pct; // of the pages, take 90% of the accesses of hotcold
+	bool write;
+	uint64_t fault_ns; // accesses slower than it are counted as slow
+
+	volatile int stop; // ends the passes early
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	struct workload *wl;
+	uint64_t lo, hi; // its pages
+	uint64_t seed;
+
+	uint64_t accesses;
+	struct bench_hist all; // every access
+	struct bench_hist slow; // the ones above fault_ns, mostly faults
+};
+
+int parse_pattern(const char *name);
+int workload_map(struct workload *wl);
+void workload_unmap(struct workload *wl);
+void worker_init(struct worker *w, struct workload *wl, int id,
+		 int nr_workers);
+void worker_run_pass(struct worker *w);
+
+#endif // __SWAPBENCH_WORKLOAD_H